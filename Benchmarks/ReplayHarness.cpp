@@ -0,0 +1,651 @@
+// Kernel stand-ins for replaying traces: ES client, messages and process lookups
+#include "ReplayHarness.h"
+#include "LatencyHistogram.h"
+#include <Block.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <libproc.h>
+#include <mach/mach.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysctl.h>
+#include <time.h>
+#include <atomic>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+// Allocation accounting
+
+static thread_local bool inHarness = false;
+static std::atomic<uint64_t> cxxAllocations(0);
+static std::atomic<uint64_t> sqliteAllocations(0);
+static sqlite3_mem_methods sqliteDefault;
+static bool sqliteCounted = false;
+
+HarnessScope::HarnessScope() : outer(!inHarness) {
+    inHarness = true;
+}
+
+HarnessScope::~HarnessScope() {
+    if (outer) {
+        inHarness = false;
+    }
+}
+
+void* operator new(size_t size) {
+    if (!inHarness) {
+        cxxAllocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    void* block = malloc(size ? size : 1);
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    return block;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    if (!inHarness) {
+        cxxAllocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+    return operator new(size, tag);
+}
+
+void operator delete(void* block) noexcept { free(block); }
+void operator delete[](void* block) noexcept { free(block); }
+void operator delete(void* block, size_t) noexcept { free(block); }
+void operator delete[](void* block, size_t) noexcept { free(block); }
+void operator delete(void* block, const std::nothrow_t&) noexcept { free(block); }
+void operator delete[](void* block, const std::nothrow_t&) noexcept { free(block); }
+
+static void* countedMalloc(int size) {
+    if (!inHarness) {
+        sqliteAllocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    return sqliteDefault.xMalloc(size);
+}
+
+static void* countedRealloc(void* block, int size) {
+    if (!inHarness) {
+        sqliteAllocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    return sqliteDefault.xRealloc(block, size);
+}
+
+bool replayCountSqliteAllocations() {
+    if (sqliteCounted) {
+        return true;
+    }
+    if (sqlite3_config(SQLITE_CONFIG_GETMALLOC, &sqliteDefault) != SQLITE_OK) {
+        return false;
+    }
+    sqlite3_mem_methods counted = sqliteDefault;
+    counted.xMalloc = countedMalloc;
+    counted.xRealloc = countedRealloc;
+    // Fails once SQLite has initialized; allocations just go uncounted then
+    sqliteCounted = sqlite3_config(SQLITE_CONFIG_MALLOC, &counted) == SQLITE_OK;
+    return sqliteCounted;
+}
+
+AllocationCounts replayAllocations() {
+    AllocationCounts counts;
+    counts.cxx = cxxAllocations.load(std::memory_order_relaxed);
+    counts.sqlite = sqliteAllocations.load(std::memory_order_relaxed);
+    return counts;
+}
+
+// Messages
+
+struct ReplayMessage {
+    es_message_t message;           // first, so the controller's pointer is ours
+    es_process_t process;
+    es_process_t target;
+    es_file_t processExecutable;
+    es_file_t targetExecutable;
+    es_file_t file;
+    std::vector<es_string_token_t> args;
+    std::atomic<int> references;
+    ReplayMessage* nextFree;
+};
+
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static ReplayMessage* freeMessages = nullptr;
+static std::atomic<uint64_t> messagesInFlight(0);
+
+static ReplayMessage* replayMessageFor(const es_message_t* message) {
+    return (ReplayMessage*)message;
+}
+
+static void fillFile(const TraceFile& in, es_file_t* out) {
+    memset(out, 0, sizeof(*out));
+    out->path.length = in.path.length;
+    out->path.data = in.path.data;
+    out->path_truncated = in.truncated;
+    out->stat.st_dev = (dev_t)in.device;
+    out->stat.st_ino = (ino_t)in.inode;
+}
+
+// Audit token fields in libbsm's order: auid, euid, egid, ruid, rgid, pid, asid, pidversion
+static void fillProcess(const TraceProcess& in, es_process_t* out, es_file_t* executable) {
+    memset(out, 0, sizeof(*out));
+    out->audit_token.val[1] = in.euid;
+    out->audit_token.val[2] = in.rgid;
+    out->audit_token.val[3] = in.euid;
+    out->audit_token.val[4] = in.rgid;
+    out->audit_token.val[5] = (unsigned int)in.pid;
+    out->audit_token.val[7] = in.pidVersion;
+    out->ppid = in.ppid;
+    out->original_ppid = in.ppid;
+    out->is_platform_binary = in.platformBinary;
+    out->signing_id.length = in.signingId.length;
+    out->signing_id.data = in.signingId.data;
+    out->start_time.tv_sec = (time_t)(in.startUsec / 1000000);
+    out->start_time.tv_usec = (suseconds_t)(in.startUsec % 1000000);
+    
+    // Distinct images get distinct cdhashes, so image caches key as they would live
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < in.executable.path.length; i++) {
+        hash = (hash ^ (uint8_t)in.executable.path.data[i]) * 0x100000001b3ull;
+    }
+    memcpy(out->cdhash, &hash, sizeof(hash));
+    
+    fillFile(in.executable, executable);
+    out->executable = executable;
+}
+
+es_message_t* replayMessage(const TraceEvent& event) {
+    HarnessScope scope;
+    
+    pthread_mutex_lock(&poolMutex);
+    ReplayMessage* replay = freeMessages;
+    if (replay) {
+        freeMessages = replay->nextFree;
+    }
+    pthread_mutex_unlock(&poolMutex);
+    if (!replay) {
+        replay = new ReplayMessage();
+    }
+    
+    es_message_t& message = replay->message;
+    memset(&message, 0, sizeof(message));
+    message.version = event.version;
+    clock_gettime(CLOCK_REALTIME, &message.time);
+    message.mach_time = mach_absolute_time();
+    message.deadline = message.mach_time + nanosecondsToMach(60ull * 1000000000);
+    message.action_type = (es_action_type_t)event.actionType;
+    message.event_type = (es_event_type_t)event.eventType;
+    fillProcess(event.process, &replay->process, &replay->processExecutable);
+    message.process = &replay->process;
+    
+    if (event.fields & TRACE_HAS_TARGET) {
+        fillProcess(event.target, &replay->target, &replay->targetExecutable);
+    }
+    if (event.fields & TRACE_HAS_FILE) {
+        fillFile(event.file, &replay->file);
+    }
+    replay->args.clear();
+    for (const TraceString& arg : event.args) {
+        replay->args.push_back({arg.length, arg.data});
+    }
+    
+    switch (message.event_type) {
+        case ES_EVENT_TYPE_AUTH_EXEC:
+        case ES_EVENT_TYPE_NOTIFY_EXEC:
+            message.event.exec.target = &replay->target;
+            break;
+        case ES_EVENT_TYPE_NOTIFY_FORK:
+            message.event.fork.child = &replay->target;
+            break;
+        case ES_EVENT_TYPE_NOTIFY_EXIT:
+            message.event.exit.stat = (int)event.value;
+            break;
+        case ES_EVENT_TYPE_AUTH_OPEN:
+        case ES_EVENT_TYPE_NOTIFY_OPEN:
+            message.event.open.file = &replay->file;
+            message.event.open.fflag = (int32_t)event.value;
+            break;
+        case ES_EVENT_TYPE_NOTIFY_WRITE:
+            message.event.write.target = &replay->file;
+            break;
+        case ES_EVENT_TYPE_AUTH_UNLINK:
+        case ES_EVENT_TYPE_NOTIFY_UNLINK:
+            message.event.unlink.target = &replay->file;
+            message.event.unlink.parent_dir = &replay->file;
+            break;
+        case ES_EVENT_TYPE_NOTIFY_MMAP:
+            message.event.mmap.source = &replay->file;
+            break;
+        case ES_EVENT_TYPE_NOTIFY_SIGNAL:
+            message.event.signal.sig = (int)event.value;
+            message.event.signal.target = &replay->target;
+            break;
+        case ES_EVENT_TYPE_NOTIFY_SETUID:
+            message.event.setuid.uid = (uid_t)event.value;
+            break;
+        default:
+            break;
+    }
+    
+    replay->references.store(1, std::memory_order_relaxed);
+    messagesInFlight.fetch_add(1, std::memory_order_relaxed);
+    return &message;
+}
+
+uint64_t replayMessagesInFlight() {
+    return messagesInFlight.load(std::memory_order_relaxed);
+}
+
+// ES client
+
+// The controller runs one client per role; a message goes to the client
+// subscribed to its type, on the caller's thread
+#define REPLAY_MAX_CLIENTS 4
+
+struct ReplayClient {
+    es_handler_block_t handler;
+    bool subscribed[ES_EVENT_TYPE_LAST];
+};
+static ReplayClient replayClients[REPLAY_MAX_CLIENTS];
+static std::atomic<uint64_t> authResponses(0);
+static std::atomic<uint64_t> authDenied(0);
+static std::atomic<uint64_t> subscribedTypes(0);
+static std::atomic<uint64_t> procCalls(0);
+
+static ReplayClient* replayClient(es_client_t* client) {
+    return (ReplayClient*)client;
+}
+
+bool replayClientReady() {
+    return replayClients[0].handler != nullptr;
+}
+
+void replayDeliver(es_message_t* message) {
+    ReplayClient* target = &replayClients[0];
+    for (ReplayClient& client : replayClients) {
+        if (client.handler && message->event_type < ES_EVENT_TYPE_LAST && client.subscribed[message->event_type]) {
+            target = &client;
+            break;
+        }
+    }
+    target->handler((es_client_t*)target, message);
+    es_release_message(message);
+}
+
+ReplayCounters replayCounters() {
+    ReplayCounters counters;
+    counters.authResponses = authResponses.load(std::memory_order_relaxed);
+    counters.authDenied = authDenied.load(std::memory_order_relaxed);
+    counters.subscribedTypes = subscribedTypes.load(std::memory_order_relaxed);
+    counters.procCalls = procCalls.load(std::memory_order_relaxed);
+    return counters;
+}
+
+extern "C" {
+
+es_new_client_result_t es_new_client(es_client_t** client, es_handler_block_t handler) {
+    for (ReplayClient& slot : replayClients) {
+        if (!slot.handler) {
+            memset(slot.subscribed, 0, sizeof(slot.subscribed));
+            slot.handler = Block_copy(handler);
+            *client = (es_client_t*)&slot;
+            return ES_NEW_CLIENT_RESULT_SUCCESS;
+        }
+    }
+    return ES_NEW_CLIENT_RESULT_ERR_TOO_MANY_CLIENTS;
+}
+
+es_return_t es_delete_client(es_client_t* client) {
+    ReplayClient* slot = replayClient(client);
+    if (slot->handler) {
+        Block_release(slot->handler);
+        slot->handler = nullptr;
+    }
+    return ES_RETURN_SUCCESS;
+}
+
+es_return_t es_subscribe(es_client_t* client, const es_event_type_t* events, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (events[i] < ES_EVENT_TYPE_LAST) {
+            replayClient(client)->subscribed[events[i]] = true;
+        }
+    }
+    subscribedTypes.fetch_add(count, std::memory_order_relaxed);
+    return ES_RETURN_SUCCESS;
+}
+
+es_return_t es_unsubscribe(es_client_t* client, const es_event_type_t* events, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (events[i] < ES_EVENT_TYPE_LAST) {
+            replayClient(client)->subscribed[events[i]] = false;
+        }
+    }
+    subscribedTypes.fetch_sub(count, std::memory_order_relaxed);
+    return ES_RETURN_SUCCESS;
+}
+
+es_return_t es_mute_process(es_client_t* client, const audit_token_t* token) {
+    return ES_RETURN_SUCCESS;
+}
+
+es_return_t es_mute_path(es_client_t* client, const char* path, es_mute_path_type_t type) {
+    return ES_RETURN_SUCCESS;
+}
+
+es_return_t es_unmute_path(es_client_t* client, const char* path, es_mute_path_type_t type) {
+    return ES_RETURN_SUCCESS;
+}
+
+es_return_t es_mute_path_events(es_client_t* client, const char* path, es_mute_path_type_t type,
+                                const es_event_type_t* events, size_t count) {
+    return ES_RETURN_SUCCESS;
+}
+
+es_return_t es_unmute_path_events(es_client_t* client, const char* path, es_mute_path_type_t type,
+                                  const es_event_type_t* events, size_t count) {
+    return ES_RETURN_SUCCESS;
+}
+
+es_clear_cache_result_t es_clear_cache(es_client_t* client) {
+    return ES_CLEAR_CACHE_RESULT_SUCCESS;
+}
+
+es_respond_result_t es_respond_auth_result(es_client_t* client, const es_message_t* message,
+                                           es_auth_result_t result, bool cache) {
+    authResponses.fetch_add(1, std::memory_order_relaxed);
+    if (result != ES_AUTH_RESULT_ALLOW) {
+        authDenied.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ES_RESPOND_RESULT_SUCCESS;
+}
+
+es_respond_result_t es_respond_flags_result(es_client_t* client, const es_message_t* message,
+                                            uint32_t authorizedFlags, bool cache) {
+    authResponses.fetch_add(1, std::memory_order_relaxed);
+    if (authorizedFlags == 0) {
+        authDenied.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ES_RESPOND_RESULT_SUCCESS;
+}
+
+void es_retain_message(const es_message_t* message) {
+    replayMessageFor(message)->references.fetch_add(1, std::memory_order_relaxed);
+}
+
+void es_release_message(const es_message_t* message) {
+    ReplayMessage* replay = replayMessageFor(message);
+    if (replay->references.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    messagesInFlight.fetch_sub(1, std::memory_order_relaxed);
+    pthread_mutex_lock(&poolMutex);
+    replay->nextFree = freeMessages;
+    freeMessages = replay;
+    pthread_mutex_unlock(&poolMutex);
+}
+
+// Replayed messages never change, so a copy can share the original
+es_message_t* es_copy_message(const es_message_t* message) {
+    es_retain_message(message);
+    return (es_message_t*)message;
+}
+
+void es_free_message(es_message_t* message) {
+    es_release_message(message);
+}
+
+uint32_t es_exec_arg_count(const es_event_exec_t* exec) {
+    const es_message_t* message = (const es_message_t*)((const char*)exec - offsetof(es_message_t, event));
+    return (uint32_t)replayMessageFor(message)->args.size();
+}
+
+es_string_token_t es_exec_arg(const es_event_exec_t* exec, uint32_t index) {
+    const es_message_t* message = (const es_message_t*)((const char*)exec - offsetof(es_message_t, event));
+    const std::vector<es_string_token_t>& args = replayMessageFor(message)->args;
+    return index < args.size() ? args[index] : es_string_token_t{0, ""};
+}
+
+}
+
+// Process model behind the stubbed lookups
+
+struct ModelProcess {
+    pid_t ppid;
+    uid_t uid;
+    gid_t gid;
+    uint64_t startUsec;
+    std::string path;
+    std::vector<std::string> args;
+};
+
+static pthread_rwlock_t modelLock = PTHREAD_RWLOCK_INITIALIZER;
+static std::map<pid_t, ModelProcess> model;
+
+static void learnProcess(const TraceProcess& process, bool replace) {
+    auto found = model.find(process.pid);
+    if (found != model.end() && !replace) {
+        return;
+    }
+    ModelProcess& entry = model[process.pid];
+    entry.ppid = process.ppid;
+    entry.uid = process.euid;
+    entry.gid = process.rgid;
+    entry.startUsec = process.startUsec;
+    entry.path.assign(process.executable.path.data, process.executable.path.length);
+    entry.args.assign(1, entry.path);
+}
+
+void replayTrackProcess(const TraceEvent& event) {
+    HarnessScope scope;
+    pthread_rwlock_wrlock(&modelLock);
+    learnProcess(event.process, false);
+    
+    switch (event.eventType) {
+        case ES_EVENT_TYPE_NOTIFY_EXEC:
+            learnProcess(event.target, true);
+            model[event.target.pid].args.clear();
+            for (const TraceString& arg : event.args) {
+                model[event.target.pid].args.push_back(std::string(arg.data, arg.length));
+            }
+            break;
+        case ES_EVENT_TYPE_NOTIFY_FORK: {
+            ModelProcess child = model[event.process.pid];
+            child.ppid = event.process.pid;
+            child.startUsec = event.target.startUsec;
+            model[event.target.pid] = child;
+            break;
+        }
+        case ES_EVENT_TYPE_NOTIFY_EXIT:
+            model.erase(event.process.pid);
+            break;
+        default:
+            break;
+    }
+    pthread_rwlock_unlock(&modelLock);
+}
+
+size_t replayProcessCount() {
+    pthread_rwlock_rdlock(&modelLock);
+    size_t count = model.size();
+    pthread_rwlock_unlock(&modelLock);
+    return count;
+}
+
+static void fillBsdInfo(pid_t pid, const ModelProcess& process, struct proc_bsdinfo* info) {
+    memset(info, 0, sizeof(*info));
+    info->pbi_pid = (uint32_t)pid;
+    info->pbi_ppid = (uint32_t)process.ppid;
+    info->pbi_uid = process.uid;
+    info->pbi_gid = process.gid;
+    info->pbi_ruid = process.uid;
+    info->pbi_rgid = process.gid;
+    info->pbi_start_tvsec = process.startUsec / 1000000;
+    info->pbi_start_tvusec = process.startUsec % 1000000;
+    const char* name = strrchr(process.path.c_str(), '/');
+    name = name ? name + 1 : process.path.c_str();
+    strlcpy(info->pbi_comm, name, sizeof(info->pbi_comm));
+    strlcpy(info->pbi_name, name, sizeof(info->pbi_name));
+}
+
+// A plausible, fixed footprint; nothing reads these for more than display
+static void fillTaskInfo(struct proc_taskinfo* info) {
+    memset(info, 0, sizeof(*info));
+    info->pti_virtual_size = 4ull << 30;
+    info->pti_resident_size = 32ull << 20;
+    info->pti_threadnum = 4;
+}
+
+extern "C" {
+
+int proc_pidinfo(int pid, int flavor, uint64_t arg, void* buffer, int bufferSize) {
+    procCalls.fetch_add(1, std::memory_order_relaxed);
+    pthread_rwlock_rdlock(&modelLock);
+    auto found = model.find(pid);
+    int result = 0;
+    if (found == model.end()) {
+        errno = ESRCH;
+    } else if (flavor == PROC_PIDLISTFDS) {
+        result = 0;                 // descriptors aren't traced
+    } else if (flavor == PROC_PIDTASKALLINFO && buffer && bufferSize >= (int)sizeof(struct proc_taskallinfo)) {
+        struct proc_taskallinfo* info = (struct proc_taskallinfo*)buffer;
+        fillBsdInfo(pid, found->second, &info->pbsd);
+        fillTaskInfo(&info->ptinfo);
+        result = (int)sizeof(*info);
+    } else if (flavor == PROC_PIDTASKINFO && buffer && bufferSize >= (int)sizeof(struct proc_taskinfo)) {
+        fillTaskInfo((struct proc_taskinfo*)buffer);
+        result = (int)sizeof(struct proc_taskinfo);
+    } else if (flavor == PROC_PIDTBSDINFO && buffer && bufferSize >= (int)sizeof(struct proc_bsdinfo)) {
+        fillBsdInfo(pid, found->second, (struct proc_bsdinfo*)buffer);
+        result = (int)sizeof(struct proc_bsdinfo);
+    } else {
+        errno = EINVAL;
+    }
+    pthread_rwlock_unlock(&modelLock);
+    return result;
+}
+
+int proc_pidfdinfo(int pid, int fd, int flavor, void* buffer, int bufferSize) {
+    procCalls.fetch_add(1, std::memory_order_relaxed);
+    errno = EBADF;
+    return 0;
+}
+
+int proc_pidpath(int pid, void* buffer, uint32_t bufferSize) {
+    procCalls.fetch_add(1, std::memory_order_relaxed);
+    pthread_rwlock_rdlock(&modelLock);
+    auto found = model.find(pid);
+    int length = 0;
+    if (found == model.end() || bufferSize == 0) {
+        errno = ESRCH;
+    } else {
+        length = (int)strlcpy((char*)buffer, found->second.path.c_str(), bufferSize);
+        length = length < (int)bufferSize ? length : (int)bufferSize - 1;
+    }
+    pthread_rwlock_unlock(&modelLock);
+    return length;
+}
+
+int proc_listallpids(void* buffer, int bufferSize) {
+    procCalls.fetch_add(1, std::memory_order_relaxed);
+    pthread_rwlock_rdlock(&modelLock);
+    int count = (int)model.size();
+    if (buffer) {
+        int capacity = bufferSize / (int)sizeof(pid_t);
+        count = 0;
+        for (auto it = model.begin(); it != model.end() && count < capacity; ++it) {
+            ((pid_t*)buffer)[count++] = it->first;
+        }
+    }
+    pthread_rwlock_unlock(&modelLock);
+    return count;
+}
+
+// Remote task ports are out of reach, as they are for an unentitled process
+kern_return_t task_for_pid(mach_port_name_t targetTask, int pid, mach_port_name_t* task) {
+    procCalls.fetch_add(1, std::memory_order_relaxed);
+    return KERN_FAILURE;
+}
+
+// Sizes, then copies, the way the kernel answers: a short buffer is ENOMEM
+static int copyOut(const void* data, size_t size, void* oldp, size_t* oldlenp) {
+    if (!oldp) {
+        *oldlenp = size;
+        return 0;
+    }
+    if (*oldlenp < size) {
+        *oldlenp = size;
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(oldp, data, size);
+    *oldlenp = size;
+    return 0;
+}
+
+// KERN_PROC_ALL and KERN_PROCARGS2 come from the model; anything else is real
+int sysctl(int* name, u_int nameLength, void* oldp, size_t* oldlenp, void* newp, size_t newLength) {
+    if (nameLength >= 3 && name[0] == CTL_KERN && name[1] == KERN_PROC && name[2] == KERN_PROC_ALL) {
+        procCalls.fetch_add(1, std::memory_order_relaxed);
+        HarnessScope scope;
+        pthread_rwlock_rdlock(&modelLock);
+        std::vector<struct kinfo_proc> procs(model.size());
+        size_t i = 0;
+        for (const auto& entry : model) {
+            struct kinfo_proc& proc = procs[i++];
+            memset(&proc, 0, sizeof(proc));
+            proc.kp_proc.p_pid = entry.first;
+            proc.kp_proc.p_starttime.tv_sec = (time_t)(entry.second.startUsec / 1000000);
+            proc.kp_proc.p_starttime.tv_usec = (suseconds_t)(entry.second.startUsec % 1000000);
+            proc.kp_eproc.e_ppid = entry.second.ppid;
+            proc.kp_eproc.e_ucred.cr_uid = entry.second.uid;
+            proc.kp_eproc.e_pcred.p_ruid = entry.second.uid;
+            proc.kp_eproc.e_pcred.p_rgid = entry.second.gid;
+            const char* name = strrchr(entry.second.path.c_str(), '/');
+            strlcpy(proc.kp_proc.p_comm, name ? name + 1 : entry.second.path.c_str(), sizeof(proc.kp_proc.p_comm));
+        }
+        pthread_rwlock_unlock(&modelLock);
+        return copyOut(procs.data(), procs.size() * sizeof(struct kinfo_proc), oldp, oldlenp);
+    }
+    
+    if (nameLength == 3 && name[0] == CTL_KERN && name[1] == KERN_PROCARGS2) {
+        procCalls.fetch_add(1, std::memory_order_relaxed);
+        HarnessScope scope;
+        std::string args;
+        pthread_rwlock_rdlock(&modelLock);
+        auto found = model.find(name[2]);
+        bool known = found != model.end();
+        if (known) {
+            // argc, the exec path, then each argument; no environment is traced
+            int argc = (int)found->second.args.size();
+            args.append((const char*)&argc, sizeof(argc));
+            args.append(found->second.path).push_back('\0');
+            for (const auto& arg : found->second.args) {
+                args.append(arg).push_back('\0');
+            }
+            args.push_back('\0');
+        }
+        pthread_rwlock_unlock(&modelLock);
+        if (!known) {
+            errno = EINVAL;
+            return -1;
+        }
+        return copyOut(args.data(), args.size(), oldp, oldlenp);
+    }
+    
+    typedef int (*SysctlFunction)(int*, u_int, void*, size_t*, void*, size_t);
+    static SysctlFunction real = (SysctlFunction)dlsym(RTLD_NEXT, "sysctl");
+    return real ? real(name, nameLength, oldp, oldlenp, newp, newLength) : -1;
+}
+
+}
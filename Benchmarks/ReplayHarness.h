@@ -0,0 +1,57 @@
+#ifndef ReplayHarness_h
+#define ReplayHarness_h
+
+#include <EndpointSecurity/EndpointSecurity.h>
+#include <stdint.h>
+#include "EventTrace.h"
+
+// Stand-ins for the kernel while a trace is replayed. ReplayHarness.cpp
+// defines the EndpointSecurity calls the controller makes, and the libproc,
+// KERN_PROC and task_for_pid calls it uses to look processes up, so avbench
+// runs the extension's own code unchanged and unprivileged. The stubbed APIs
+// answer from a process model built from the replayed events themselves;
+// task_for_pid always fails, so remote memory reads are skipped.
+
+// True once the controller has created its ES clients
+bool replayClientReady();
+
+// Hands a message to the handler of the client subscribed to its type, as
+// the kernel would, and drops the kernel's reference once the handler returns
+void replayDeliver(es_message_t* message);
+
+// A message built from a trace event, stamped with the current mach time.
+// Messages are pooled; the last es_release_message returns one to the pool.
+es_message_t* replayMessage(const TraceEvent& event);
+uint64_t replayMessagesInFlight();
+
+// Keeps the process model in step with an event, before it is delivered
+void replayTrackProcess(const TraceEvent& event);
+size_t replayProcessCount();
+
+struct ReplayCounters {
+    uint64_t authResponses;
+    uint64_t authDenied;
+    uint64_t subscribedTypes;
+    uint64_t procCalls;             // stubbed libproc and sysctl lookups
+};
+ReplayCounters replayCounters();
+
+// Allocations by the code under test; the harness's own are excluded
+struct AllocationCounts {
+    uint64_t cxx;                   // operator new
+    uint64_t sqlite;                // SQLite's allocator; only if installed in time
+};
+// Must run before anything opens a database
+bool replayCountSqliteAllocations();
+AllocationCounts replayAllocations();
+
+// Allocations made while one of these is alive on a thread are the harness's
+struct HarnessScope {
+    HarnessScope();
+    ~HarnessScope();
+
+private:
+    bool outer;
+};
+
+#endif
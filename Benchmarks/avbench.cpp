@@ -0,0 +1,967 @@
+// avbench: replays ES traces through the extension's controller and
+// benchmarks its hot paths, so changes can be measured without deploying
+#include "ReplayHarness.h"
+#include "AudioVideoController.h"
+#include "EventTrace.h"
+#include "PathClassifier.h"
+#include "StringTable.h"
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+// The controller must never write into the installed extension's database
+#if !defined(DATABASE_PATH) || !defined(EVENT_JOURNAL_DIR) || !defined(WARM_START_PATH)
+#error "Build avbench with scratch -DDATABASE_PATH, -DEVENT_JOURNAL_DIR and -DWARM_START_PATH (see build.sh)"
+#endif
+
+// Relative change past which a metric counts as a regression
+#ifndef AVBENCH_DEFAULT_TOLERANCE
+#define AVBENCH_DEFAULT_TOLERANCE 10.0
+#endif
+
+struct Result {
+    std::string name;
+    double value;
+};
+typedef std::vector<Result> Results;
+
+struct Options {
+    const char* trace;
+    double rate;                    // events per second; 0 is as fast as possible
+    double speed;                   // multiple of the recorded pace; overrides rate
+    int loops;
+    uint64_t events;                // synth: events to generate
+    uint32_t processes;             // synth: processes alive at once
+    uint32_t seed;
+    double scale;                   // micro: multiplier on iteration counts
+    const char* workDir;
+    bool keep;
+    const char* savePath;
+    const char* baselinePath;
+    double tolerance;
+};
+
+static void printUsage() {
+    printf("avbench - replay ES traces and benchmark the AudioVideoMonitor extension\n"
+           "\n"
+           "USAGE:\n"
+           "    avbench synth <trace> [--events N] [--processes N] [--seed N]\n"
+           "    avbench replay <trace> [--rate N | --speed X] [--loops N] [options]\n"
+           "    avbench micro [--scale X] [options]\n"
+           "    avbench compare <results> <baseline> [--tolerance PCT]\n"
+           "\n"
+           "OPTIONS:\n"
+           "    --rate N          deliver N events per second (default: as fast as possible)\n"
+           "    --speed X         deliver at X times the recorded pace\n"
+           "    --save FILE       write the results, e.g. as the next release's baseline\n"
+           "    --baseline FILE   compare against saved results; exits 1 on a regression\n"
+           "    --tolerance PCT   change allowed before a metric regresses (default %.0f)\n"
+           "    --work DIR        scratch directory for the database (default: a new one in /tmp)\n"
+           "    --keep            leave the scratch directory behind\n"
+           "\n"
+           "Record a trace from the running extension with: systemmonitor trace start <path>\n",
+           AVBENCH_DEFAULT_TOLERANCE);
+}
+
+static uint64_t elapsedNs(uint64_t since) {
+    return machToNanoseconds(mach_absolute_time() - since);
+}
+
+// Sleeps most of the way, then spins, so pacing holds at high rates
+static void waitUntil(uint64_t deadline) {
+    for (;;) {
+        uint64_t now = mach_absolute_time();
+        if (now >= deadline) {
+            return;
+        }
+        uint64_t remaining = machToNanoseconds(deadline - now);
+        if (remaining > 200 * 1000) {
+            struct timespec pause = {0, (long)(remaining - 100 * 1000)};
+            nanosleep(&pause, nullptr);
+        }
+    }
+}
+
+static void addResult(Results* results, const char* name, double value) {
+    results->push_back({name, value});
+}
+
+// Synthetic load
+
+// Deterministic, so two runs of the same seed generate the same trace
+struct Random {
+    uint64_t state;
+    explicit Random(uint32_t seed) : state(seed * 0x9e3779b97f4a7c15ull + 1) {}
+    uint64_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+    double unit() { return (double)(next() >> 11) / (double)(1ull << 53); }
+    size_t below(size_t n) { return (size_t)(next() % n); }
+    // Skewed towards low indexes, the way a few hot files take most accesses
+    size_t skewed(size_t n) { double u = unit(); return (size_t)(u * u * u * (double)n); }
+};
+
+static TraceString traceString(const std::string& value) {
+    return {value.size(), value.data()};
+}
+
+// A process and event mix shaped like a busy developer machine: short-lived
+// tools forking and execing, repeated opens of a hot set of files, dylib maps
+class SyntheticLoad {
+public:
+    SyntheticLoad(uint32_t processes, uint32_t seed)
+        : random(seed), targetProcesses(processes ? processes : 1), nextPid(400), timeNs(0) {
+        static const char* executables[] = {
+            "/bin/zsh", "/bin/ls", "/usr/bin/git", "/usr/bin/make", "/usr/bin/grep", "/usr/bin/find",
+            "/usr/bin/ssh", "/usr/bin/python3", "/usr/sbin/mDNSResponder", "/usr/libexec/xpcproxy",
+            "/usr/libexec/trustd", "/System/Library/CoreServices/Finder.app/Contents/MacOS/Finder",
+            "/System/Library/CoreServices/Spotlight.app/Contents/MacOS/Spotlight",
+            "/Applications/Safari.app/Contents/MacOS/Safari",
+            "/Applications/Xcode.app/Contents/Developer/usr/bin/clang",
+            "/Applications/Google Chrome.app/Contents/MacOS/Google Chrome",
+            "/Applications/zoom.us.app/Contents/MacOS/zoom.us", "/opt/homebrew/bin/node",
+            "/opt/homebrew/bin/rg", "/usr/local/bin/docker"
+        };
+        for (const char* path : executables) {
+            executablePaths.push_back(path);
+            const char* name = strrchr(path, '/') + 1;
+            signingIds.push_back(std::string(strncmp(path, "/Applications", 13) == 0 ? "com.example." : "com.apple.") +
+                                 name);
+        }
+        
+        static const char* libraries[] = {
+            "libSystem.B", "libc++.1", "libobjc.A", "libz.1", "libsqlite3", "libxml2.2", "libcurl.4",
+            "libssl.48", "libiconv.2", "libresolv.9", "libbsm.0", "libpcap.A"
+        };
+        for (const char* library : libraries) {
+            libraryPaths.push_back(std::string("/usr/lib/") + library + ".dylib");
+        }
+        static const char* frameworks[] = {
+            "Foundation", "CoreFoundation", "AppKit", "Security", "IOKit", "CoreAudio", "AVFoundation",
+            "Metal", "CoreGraphics", "SystemConfiguration"
+        };
+        for (const char* framework : frameworks) {
+            libraryPaths.push_back(std::string("/System/Library/Frameworks/") + framework + ".framework/Versions/A/" +
+                                   framework);
+        }
+        
+        static const char* directories[] = {
+            "/Users/dev/project/src", "/Users/dev/project/build", "/Users/dev/Library/Caches/com.apple.Safari",
+            "/Users/dev/Library/Preferences", "/private/var/folders/zz/T", "/usr/share/zoneinfo",
+            "/private/etc", "/Library/Preferences", "/System/Library/Fonts", "/Users/dev/.git/objects"
+        };
+        static const char* extensions[] = {".c", ".h", ".o", ".plist", ".db", ".json", ".log", ".tmp"};
+        char name[64];
+        for (int i = 0; i < 4000; i++) {
+            snprintf(name, sizeof(name), "/file%04d%s", i, extensions[i % 8]);
+            filePaths.push_back(std::string(directories[i % 10]) + name);
+        }
+        devicePaths.push_back("/dev/null");
+        devicePaths.push_back("/dev/urandom");
+        devicePaths.push_back("/dev/ttys001");
+        
+        // launchd, the parent of everything that isn't forked from a live process
+        SyntheticProcess launchd = SyntheticProcess();
+        launchd.info.pid = 1;
+        launchd.info.pidVersion = 1;
+        launchd.info.platformBinary = true;
+        launchd.info.executable.path = {13, "/sbin/launchd"};
+        launchd.info.executable.device = 1;
+        launchd.info.executable.inode = 2;
+        launchd.info.signingId = {16, "com.apple.xpc.la"};
+        live.push_back(launchd);
+    }
+    
+    void next(TraceEvent* event) {
+        // Nominally 20000 events a second, evenly jittered
+        timeNs += (uint64_t)(50000.0 * (0.5 + random.unit()));
+        
+        if (!pending.empty()) {
+            emit(pending.front(), event);
+            pending.pop_front();
+            return;
+        }
+        
+        double choice = random.unit();
+        if (live.size() < targetProcesses + 1 && choice < 0.08) {
+            spawn(event);
+        } else if (live.size() > 1 && choice < 0.10) {
+            size_t index = 1 + random.below(live.size() - 1);
+            begin(live[index], ES_EVENT_TYPE_NOTIFY_EXIT, ES_ACTION_TYPE_NOTIFY, event);
+            event->fields = TRACE_HAS_VALUE;
+            live.erase(live.begin() + (long)index);
+        } else {
+            const SyntheticProcess& process = live[random.below(live.size())];
+            fileEvent(process, event);
+        }
+    }
+
+private:
+    struct SyntheticProcess {
+        TraceProcess info;
+        std::vector<TraceString> args;
+    };
+    
+    Random random;
+    uint32_t targetProcesses;
+    pid_t nextPid;
+    uint64_t timeNs;
+    std::vector<std::string> executablePaths;
+    std::vector<std::string> signingIds;
+    std::vector<std::string> libraryPaths;
+    std::vector<std::string> filePaths;
+    std::vector<std::string> devicePaths;
+    std::deque<std::string> argumentStore;  // stable addresses for TraceStrings
+    std::vector<SyntheticProcess> live;
+    std::deque<TraceEvent> pending;         // an EXEC waits behind its FORK
+    
+    void emit(const TraceEvent& queued, TraceEvent* event) {
+        *event = queued;
+        event->timeNs = timeNs;
+    }
+    
+    void begin(const SyntheticProcess& process, es_event_type_t type, es_action_type_t action, TraceEvent* event) {
+        event->timeNs = timeNs;
+        event->eventType = type;
+        event->actionType = action;
+        event->version = 6;
+        event->fields = 0;
+        event->process = process.info;
+        event->target = TraceProcess();
+        event->file = TraceFile();
+        event->value = 0;
+        event->args.clear();
+    }
+    
+    void spawn(TraceEvent* event) {
+        const SyntheticProcess parent = live[random.below(live.size())];
+        SyntheticProcess child = parent;
+        child.info.pid = nextPid;
+        child.info.ppid = parent.info.pid;
+        child.info.pidVersion = (uint32_t)nextPid * 7 + 1;
+        child.info.startUsec = 1700000000ull * 1000000 + timeNs / 1000;
+        nextPid = nextPid >= 99000 ? 400 : nextPid + 1;
+        
+        begin(parent, ES_EVENT_TYPE_NOTIFY_FORK, ES_ACTION_TYPE_NOTIFY, event);
+        event->target = child.info;
+        event->fields = TRACE_HAS_TARGET;
+        
+        // Exec of an image picked with a skew, so a few tools dominate
+        size_t image = random.skewed(executablePaths.size());
+        SyntheticProcess exec = child;
+        exec.info.executable.path = traceString(executablePaths[image]);
+        exec.info.executable.device = 1;
+        exec.info.executable.inode = 1000 + image;
+        exec.info.signingId = traceString(signingIds[image]);
+        exec.info.platformBinary = executablePaths[image].compare(0, 13, "/Applications") != 0 &&
+                                   executablePaths[image].compare(0, 5, "/opt/") != 0;
+        exec.info.euid = random.unit() < 0.3 ? 0 : 501;
+        exec.info.rgid = exec.info.euid ? 20 : 0;
+        exec.args.push_back(exec.info.executable.path);
+        size_t argCount = random.below(4);
+        for (size_t i = 0; i < argCount; i++) {
+            if (random.unit() < 0.5) {
+                exec.args.push_back(traceString(filePaths[random.skewed(filePaths.size())]));
+            } else {
+                argumentStore.push_back("--option=" + std::to_string(random.below(16)));
+                exec.args.push_back(traceString(argumentStore.back()));
+            }
+        }
+        
+        TraceEvent execEvent;
+        begin(child, ES_EVENT_TYPE_NOTIFY_EXEC, ES_ACTION_TYPE_NOTIFY, &execEvent);
+        execEvent.target = exec.info;
+        execEvent.args = exec.args;
+        execEvent.fields = TRACE_HAS_TARGET | TRACE_HAS_ARGS;
+        pending.push_back(execEvent);
+        live.push_back(exec);
+    }
+    
+    void fileEvent(const SyntheticProcess& process, TraceEvent* event) {
+        double kind = random.unit();
+        const std::string* path = &filePaths[random.skewed(filePaths.size())];
+        if (kind < 0.40) {
+            begin(process, ES_EVENT_TYPE_NOTIFY_OPEN, ES_ACTION_TYPE_NOTIFY, event);
+            event->value = 1;           // FREAD
+            event->fields = TRACE_HAS_FILE | TRACE_HAS_VALUE;
+        } else if (kind < 0.50) {
+            // Device opens are the AUTH events the extension answers
+            begin(process, ES_EVENT_TYPE_AUTH_OPEN, ES_ACTION_TYPE_AUTH, event);
+            if (random.unit() < 0.3) {
+                path = &devicePaths[random.below(devicePaths.size())];
+            }
+            event->value = 3;           // FREAD | FWRITE
+            event->fields = TRACE_HAS_FILE | TRACE_HAS_VALUE;
+        } else if (kind < 0.65) {
+            begin(process, ES_EVENT_TYPE_NOTIFY_WRITE, ES_ACTION_TYPE_NOTIFY, event);
+            event->fields = TRACE_HAS_FILE;
+        } else if (kind < 0.85) {
+            begin(process, ES_EVENT_TYPE_NOTIFY_MMAP, ES_ACTION_TYPE_NOTIFY, event);
+            path = &libraryPaths[random.below(libraryPaths.size())];
+            event->fields = TRACE_HAS_FILE;
+        } else if (kind < 0.97) {
+            begin(process, ES_EVENT_TYPE_NOTIFY_UNLINK, ES_ACTION_TYPE_NOTIFY, event);
+            event->fields = TRACE_HAS_FILE;
+        } else if (kind < 0.995 && live.size() > 1) {
+            begin(process, ES_EVENT_TYPE_NOTIFY_SIGNAL, ES_ACTION_TYPE_NOTIFY, event);
+            event->target = live[1 + random.below(live.size() - 1)].info;
+            event->value = random.unit() < 0.5 ? 15 : 9;
+            event->fields = TRACE_HAS_TARGET | TRACE_HAS_VALUE;
+            return;
+        } else {
+            begin(process, ES_EVENT_TYPE_NOTIFY_SETUID, ES_ACTION_TYPE_NOTIFY, event);
+            event->value = 501;
+            event->fields = TRACE_HAS_VALUE;
+            return;
+        }
+        event->file.path = traceString(*path);
+        event->file.device = 1;
+        event->file.inode = 100000 + (uint64_t)(path - &filePaths[0]) % 1000000;
+    }
+};
+
+static int runSynth(const Options& options) {
+    EventTraceWriter writer;
+    std::string error;
+    if (!writer.start(options.trace, &error)) {
+        fprintf(stderr, "avbench: %s\n", error.c_str());
+        return 1;
+    }
+    
+    SyntheticLoad load(options.processes, options.seed);
+    TraceEvent event;
+    for (uint64_t i = 0; i < options.events; i++) {
+        load.next(&event);
+        writer.append(event);
+    }
+    
+    EventTraceStats stats;
+    writer.stop(&stats);
+    printf("✅ %llu events, %llu strings, %llu bytes (%.1f bytes/event) written to %s\n",
+           stats.events, stats.strings, stats.bytes,
+           stats.events ? (double)stats.bytes / (double)stats.events : 0.0, options.trace);
+    return 0;
+}
+
+// Scratch directory
+
+static std::string workDirectory;
+static bool workDirectoryCreated = false;
+static uint64_t storageTotal = 0;
+
+static int addFileSize(const char* path, const struct stat* info, int type, struct FTW* ftw) {
+    if (type == FTW_F) {
+        storageTotal += (uint64_t)info->st_size;
+    }
+    return 0;
+}
+
+static int removeEntry(const char* path, const struct stat* info, int type, struct FTW* ftw) {
+    return remove(path);
+}
+
+// Database, WAL and journal, in bytes
+static uint64_t storageBytes() {
+    storageTotal = 0;
+    struct stat info;
+    if (stat(DATABASE_PATH, &info) == 0) {
+        storageTotal += (uint64_t)info.st_size;
+    }
+    if (stat(DATABASE_PATH "-wal", &info) == 0) {
+        storageTotal += (uint64_t)info.st_size;
+    }
+    nftw(EVENT_JOURNAL_DIR, addFileSize, 16, FTW_PHYS);
+    return storageTotal;
+}
+
+static bool enterWorkDirectory(const Options& options, std::string* previous) {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        return false;
+    }
+    *previous = cwd;
+    
+    if (options.workDir) {
+        workDirectory = options.workDir;
+        if (mkdir(options.workDir, 0700) != 0 && errno != EEXIST) {
+            fprintf(stderr, "avbench: cannot create %s: %s\n", options.workDir, strerror(errno));
+            return false;
+        }
+    } else {
+        char path[] = "/tmp/avbench.XXXXXX";
+        if (!mkdtemp(path)) {
+            fprintf(stderr, "avbench: cannot create a scratch directory: %s\n", strerror(errno));
+            return false;
+        }
+        workDirectory = path;
+        workDirectoryCreated = true;
+    }
+    if (chdir(workDirectory.c_str()) != 0) {
+        fprintf(stderr, "avbench: cannot enter %s: %s\n", workDirectory.c_str(), strerror(errno));
+        return false;
+    }
+    
+    // Every run starts from an empty database and a cold process table
+    unlink(DATABASE_PATH);
+    unlink(DATABASE_PATH "-wal");
+    unlink(DATABASE_PATH "-shm");
+    nftw(EVENT_JOURNAL_DIR, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    unlink(WARM_START_PATH);
+    return true;
+}
+
+static void leaveWorkDirectory(const Options& options, const std::string& previous) {
+    if (chdir(previous.c_str()) != 0) {
+        return;
+    }
+    if (workDirectoryCreated && !options.keep) {
+        nftw(workDirectory.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    } else {
+        printf("📁 Scratch files kept in %s\n", workDirectory.c_str());
+    }
+}
+
+static AudioVideoController* startController() {
+    // SQLite counts only if its allocator is swapped before the first connection
+    if (!replayCountSqliteAllocations()) {
+        fprintf(stderr, "avbench: SQLite allocations will not be counted\n");
+    }
+    
+    AudioVideoController* controller = AudioVideoController::getInstance();
+    if (!controller->initialize() || !replayClientReady()) {
+        fprintf(stderr, "avbench: the controller did not start; see the system log\n");
+        return nullptr;
+    }
+    return controller;
+}
+
+// Waits until every delivered event has been handled or dropped
+static void drainPipeline(AudioVideoController* controller, uint64_t delivered) {
+    for (;;) {
+        EventPipelineStats stats = controller->getEventPipelineStats();
+        if (stats.processed + stats.dropped >= delivered) {
+            return;
+        }
+        usleep(1000);
+    }
+}
+
+static void addLatency(Results* results, const char* name, const LatencySummary& summary) {
+    std::string prefix = name;
+    addResult(results, (prefix + "_p50_ns").c_str(), (double)summary.p50Ns);
+    addResult(results, (prefix + "_p99_ns").c_str(), (double)summary.p99Ns);
+    addResult(results, (prefix + "_p999_ns").c_str(), (double)summary.p999Ns);
+}
+
+// Macro benchmark: the whole trace through the ES callback, the pipeline
+// and the database, paced like the recording or at a fixed rate
+
+static int runReplay(const Options& options, Results* results) {
+    EventTraceReader reader;
+    std::string error;
+    if (!reader.open(options.trace, &error)) {
+        fprintf(stderr, "avbench: %s\n", error.c_str());
+        return 1;
+    }
+    
+    std::string previousDirectory;
+    if (!enterWorkDirectory(options, &previousDirectory)) {
+        return 1;
+    }
+    AudioVideoController* controller = startController();
+    if (!controller) {
+        leaveWorkDirectory(options, previousDirectory);
+        return 1;
+    }
+    
+    uint64_t storageBefore = storageBytes();
+    AllocationCounts allocationsBefore = replayAllocations();
+    ReplayCounters countersBefore = replayCounters();
+    static LatencyHistogram callbackLatency;
+    
+    uint64_t delivered = 0;
+    uint64_t authEvents = 0;
+    uint64_t loopStartNs = 0;
+    uint64_t lastNs = 0;
+    uint64_t started = mach_absolute_time();
+    TraceEvent event;
+    for (int loop = 0; loop < options.loops; loop++) {
+        reader.rewind();
+        while (reader.next(&event)) {
+            if (options.speed > 0) {
+                lastNs = loopStartNs + event.timeNs;
+                waitUntil(started + nanosecondsToMach((uint64_t)((double)lastNs / options.speed)));
+            } else if (options.rate > 0) {
+                waitUntil(started + nanosecondsToMach((uint64_t)((double)delivered * 1e9 / options.rate)));
+            }
+            
+            replayTrackProcess(event);
+            es_message_t* message = replayMessage(event);
+            uint64_t before = mach_absolute_time();
+            replayDeliver(message);
+            callbackLatency.record(machToNanoseconds(mach_absolute_time() - before));
+            delivered++;
+            authEvents += event.actionType == ES_ACTION_TYPE_AUTH;
+        }
+        if (reader.damaged()) {
+            fprintf(stderr, "avbench: %s ends in a damaged record; replayed what came before it\n", options.trace);
+        }
+        loopStartNs = lastNs + 1000000;
+    }
+    drainPipeline(controller, delivered);
+    uint64_t elapsed = elapsedNs(started);
+    
+    AllocationCounts allocations = replayAllocations();
+    ReplayCounters counters = replayCounters();
+    EventPipelineStats pipeline = controller->getEventPipelineStats();
+    EsClientStats authClient = controller->getEsClientStats()[ES_CLIENT_AUTH];
+    
+    // Everything queued for the database is committed before it closes
+    controller->cleanup();
+    uint64_t storageAfter = storageBytes();
+    DatabaseWriterStats writer = controller->getDatabaseWriterStats();
+    leaveWorkDirectory(options, previousDirectory);
+    
+    if (delivered == 0) {
+        fprintf(stderr, "avbench: %s has no events\n", options.trace);
+        return 1;
+    }
+    double events = (double)delivered;
+    addResult(results, "events", events);
+    addResult(results, "dropped", (double)pipeline.dropped);
+    addResult(results, "seconds", (double)elapsed / 1e9);
+    addResult(results, "events_per_sec", events * 1e9 / (double)elapsed);
+    addLatency(results, "callback", callbackLatency.summarize());
+    addLatency(results, "handler", pipeline.handlerLatency);
+    addLatency(results, "queue", pipeline.queueLatency);
+    addResult(results, "cxx_allocations_per_event", (double)(allocations.cxx - allocationsBefore.cxx) / events);
+    addResult(results, "sqlite_allocations_per_event",
+              (double)(allocations.sqlite - allocationsBefore.sqlite) / events);
+    addResult(results, "allocations_per_event",
+              (double)(allocations.cxx - allocationsBefore.cxx + allocations.sqlite - allocationsBefore.sqlite) / events);
+    addResult(results, "db_bytes_per_event",
+              storageAfter > storageBefore ? (double)(storageAfter - storageBefore) / events : 0.0);
+    addResult(results, "db_rows_written", (double)writer.rowsWritten);
+    addResult(results, "proc_calls_per_event", (double)(counters.procCalls - countersBefore.procCalls) / events);
+    addResult(results, "auth_unanswered",
+              (double)authEvents - (double)(counters.authResponses - countersBefore.authResponses));
+    addResult(results, "auth_missed_deadlines", (double)authClient.missedDeadlines);
+    return 0;
+}
+
+// Micro benchmarks: one operation in a loop, reported per operation
+
+// Times a batch that performs `iterations` operations
+template <typename Batch>
+static void measureBatch(Results* results, const char* name, uint64_t iterations, Batch batch) {
+    AllocationCounts before = replayAllocations();
+    uint64_t started = mach_absolute_time();
+    batch();
+    uint64_t elapsed = elapsedNs(started);
+    AllocationCounts after = replayAllocations();
+    
+    std::string prefix = name;
+    addResult(results, (prefix + "_ns").c_str(), (double)elapsed / (double)iterations);
+    addResult(results, (prefix + "_allocations_per_op").c_str(),
+              (double)(after.cxx - before.cxx + after.sqlite - before.sqlite) / (double)iterations);
+    printf("   %-22s %10.1f ns/op\n", name, (double)elapsed / (double)iterations);
+}
+
+template <typename Body>
+static void measure(Results* results, const char* name, uint64_t iterations, Body body) {
+    measureBatch(results, name, iterations, [&]() {
+        for (uint64_t i = 0; i < iterations; i++) {
+            body(i);
+        }
+    });
+}
+
+// The events of one type from the synthetic mix, sharing its strings
+static std::vector<TraceEvent> syntheticEvents(SyntheticLoad* load, uint32_t type, size_t count) {
+    HarnessScope scope;
+    std::vector<TraceEvent> events;
+    TraceEvent event;
+    while (events.size() < count) {
+        load->next(&event);
+        if (event.eventType == type) {
+            events.push_back(event);
+        }
+    }
+    return events;
+}
+
+// Delivers through the ES callback, pausing whenever the rings run half full
+// so the figure is throughput rather than drops
+static void deliverAll(AudioVideoController* controller, const std::vector<TraceEvent>& events,
+                       uint64_t iterations, uint64_t* delivered) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        const TraceEvent& event = events[i % events.size()];
+        if (event.eventType == ES_EVENT_TYPE_NOTIFY_EXEC || event.eventType == ES_EVENT_TYPE_NOTIFY_FORK) {
+            replayTrackProcess(event);
+        }
+        replayDeliver(replayMessage(event));
+        (*delivered)++;
+        if ((i & 1023) == 1023 &&
+            controller->getEventPipelineStats().queueDepth * 2 >
+                (uint64_t)EVENT_PIPELINE_CAPACITY * EVENT_PIPELINE_WORKERS) {
+            drainPipeline(controller, *delivered);
+        }
+    }
+    drainPipeline(controller, *delivered);
+}
+
+static int runMicro(const Options& options, Results* results) {
+    auto iterations = [&](uint64_t base) {
+        uint64_t scaled = (uint64_t)((double)base * options.scale);
+        return scaled ? scaled : 1;
+    };
+    SyntheticLoad load(64, options.seed);
+    
+    printf("⏱️  Components\n");
+    // Setup runs in a HarnessScope, so only the measured operations' allocations count
+    static StringTable strings;
+    std::vector<std::string> paths;
+    {
+        HarnessScope scope;
+        for (int i = 0; i < 4096; i++) {
+            paths.push_back("/Users/dev/project/src/module" + std::to_string(i % 64) + "/file" + std::to_string(i) + ".c");
+            strings.intern(paths.back());
+        }
+    }
+    measure(results, "string_intern_hit", iterations(1000000), [&](uint64_t i) {
+        strings.intern(paths[i & 4095]);
+    });
+    char miss[64];
+    measure(results, "string_intern_miss", iterations(200000), [&](uint64_t i) {
+        int length = snprintf(miss, sizeof(miss), "/private/var/folders/zz/T/miss%llu", (unsigned long long)i);
+        strings.intern(miss, (size_t)length);
+    });
+    
+    PathClassifier classifier;
+    std::string error;
+    {
+        HarnessScope scope;
+        classifier.load(PathClassifier::defaultRules(), &error);
+    }
+    measure(results, "path_classify", iterations(1000000), [&](uint64_t i) {
+        classifier.classify(paths[i & 4095].data(), paths[i & 4095].size());
+    });
+    
+    std::string previousDirectory;
+    if (!enterWorkDirectory(options, &previousDirectory)) {
+        return 1;
+    }
+    
+    std::vector<TraceEvent> mixed;
+    {
+        HarnessScope scope;
+        TraceEvent event;
+        for (int i = 0; i < 8192; i++) {
+            load.next(&event);
+            mixed.push_back(event);
+        }
+    }
+    EventTraceWriter writer;
+    writer.start("micro.trace", &error);
+    measure(results, "trace_encode", iterations(500000), [&](uint64_t i) {
+        writer.append(mixed[i % mixed.size()]);
+    });
+    writer.stop(nullptr);
+    EventTraceReader reader;
+    reader.open("micro.trace", &error);
+    TraceEvent decoded;
+    measure(results, "trace_decode", iterations(500000), [&](uint64_t i) {
+        if (!reader.next(&decoded)) {
+            reader.rewind();
+            reader.next(&decoded);
+        }
+    });
+    reader.close();
+    
+    printf("⏱️  Controller\n");
+    AudioVideoController* controller = startController();
+    if (!controller) {
+        leaveWorkDirectory(options, previousDirectory);
+        return 1;
+    }
+    
+    // Per event until handled: the ES callback, a worker's handler and the writer's share
+    uint64_t delivered = 0;
+    std::vector<TraceEvent> execs = syntheticEvents(&load, ES_EVENT_TYPE_NOTIFY_EXEC, 1024);
+    measureBatch(results, "callback_exec", iterations(20000), [&]() {
+        deliverAll(controller, execs, iterations(20000), &delivered);
+    });
+    std::vector<TraceEvent> opens = syntheticEvents(&load, ES_EVENT_TYPE_NOTIFY_OPEN, 1024);
+    measureBatch(results, "callback_open", iterations(100000), [&]() {
+        deliverAll(controller, opens, iterations(100000), &delivered);
+    });
+    std::vector<TraceEvent> writes = syntheticEvents(&load, ES_EVENT_TYPE_NOTIFY_WRITE, 1024);
+    measureBatch(results, "callback_write", iterations(100000), [&]() {
+        deliverAll(controller, writes, iterations(100000), &delivered);
+    });
+    std::vector<TraceEvent> authOpens = syntheticEvents(&load, ES_EVENT_TYPE_AUTH_OPEN, 1024);
+    measureBatch(results, "callback_auth_open", iterations(100000), [&]() {
+        deliverAll(controller, authOpens, iterations(100000), &delivered);
+    });
+    
+    // Processes the controller has never seen, so each lookup is a full analysis
+    uint64_t analyses = iterations(2000);
+    {
+        HarnessScope scope;
+        TraceEvent event = opens[0];
+        for (uint64_t i = 0; i < analyses; i++) {
+            event.process.pid = (pid_t)(200000 + i);
+            replayTrackProcess(event);
+        }
+    }
+    measure(results, "analyze_process", analyses, [&](uint64_t i) {
+        controller->getProcessInfo((pid_t)(200000 + i));
+    });
+    
+    ProcessInfo info = ProcessInfo();
+    {
+        HarnessScope scope;
+        info.pid = 4242;
+        info.ppid = 1;
+        info.executablePath = "/usr/bin/git";
+        info.commandLine = "/usr/bin/git status --short";
+        info.uid = 501;
+        info.gid = 20;
+    }
+    measure(results, "log_process_event", iterations(50000), [&](uint64_t i) {
+        controller->logProcessEvent(info, "EXEC");
+    });
+    
+    controller->cleanup();
+    leaveWorkDirectory(options, previousDirectory);
+    return 0;
+}
+
+// Results files: "name value" per line, # comments
+
+static bool saveResults(const char* path, const Results& results, const std::string& header) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "avbench: cannot write %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    fprintf(file, "# %s\n", header.c_str());
+    for (const Result& result : results) {
+        fprintf(file, "%s %.6g\n", result.name.c_str(), result.value);
+    }
+    fclose(file);
+    return true;
+}
+
+static bool loadResults(const char* path, Results* results) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "avbench: cannot read %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        char name[256];
+        double value;
+        if (line[0] != '#' && sscanf(line, "%255s %lf", name, &value) == 2) {
+            results->push_back({name, value});
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+// +1 if higher is better, -1 if lower is, 0 if the metric only describes the run
+static int direction(const std::string& name) {
+    auto endsWith = [&](const char* suffix) {
+        size_t length = strlen(suffix);
+        return name.size() >= length && name.compare(name.size() - length, length, suffix) == 0;
+    };
+    if (endsWith("_per_sec")) {
+        return 1;
+    }
+    if (endsWith("_ns") || endsWith("_per_event") || endsWith("_per_op")) {
+        return -1;
+    }
+    return 0;
+}
+
+static bool compareResults(const Results& current, const Results& baseline, double tolerance) {
+    printf("\n%-32s %14s %14s %9s\n", "METRIC", "BASELINE", "CURRENT", "CHANGE");
+    int regressions = 0;
+    for (const Result& base : baseline) {
+        const Result* now = nullptr;
+        for (const Result& result : current) {
+            if (result.name == base.name) {
+                now = &result;
+                break;
+            }
+        }
+        if (!now) {
+            continue;
+        }
+        
+        double change = base.value != 0 ? (now->value - base.value) / fabs(base.value) * 100.0 : 0.0;
+        int better = direction(base.name);
+        // Tiny absolute moves on near-zero metrics aren't regressions
+        double floor = base.name.size() > 3 && base.name.compare(base.name.size() - 3, 3, "_ns") == 0 ? 1.0 : 0.05;
+        const char* verdict = "";
+        if (better != 0 && fabs(now->value - base.value) > floor) {
+            if (better * change < -tolerance || (base.value == 0 && better < 0 && now->value > floor)) {
+                verdict = "❌ regressed";
+                regressions++;
+            } else if (better * change > tolerance) {
+                verdict = "✅ improved";
+            }
+        }
+        printf("%-32s %14.6g %14.6g %8.1f%% %s\n", base.name.c_str(), base.value, now->value, change, verdict);
+    }
+    
+    if (regressions) {
+        printf("\n❌ %d metric%s regressed by more than %.0f%%\n", regressions, regressions == 1 ? "" : "s", tolerance);
+        return false;
+    }
+    printf("\n✅ No regressions beyond %.0f%%\n", tolerance);
+    return true;
+}
+
+static void printResults(const Results& results) {
+    printf("\n");
+    for (const Result& result : results) {
+        printf("%-32s %.6g\n", result.name.c_str(), result.value);
+    }
+}
+
+static bool parseOptions(int argc, const char* argv[], int first, Options* options) {
+    for (int i = first; i < argc; i++) {
+        const char* option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (strcmp(option, "--keep") == 0) {
+            options->keep = true;
+            continue;
+        }
+        if (!value) {
+            fprintf(stderr, "avbench: %s needs a value\n", option);
+            return false;
+        }
+        i++;
+        if (strcmp(option, "--rate") == 0) {
+            options->rate = atof(value);
+        } else if (strcmp(option, "--speed") == 0) {
+            options->speed = atof(value);
+        } else if (strcmp(option, "--loops") == 0) {
+            options->loops = atoi(value) > 0 ? atoi(value) : 1;
+        } else if (strcmp(option, "--events") == 0) {
+            options->events = strtoull(value, nullptr, 10);
+        } else if (strcmp(option, "--processes") == 0) {
+            options->processes = (uint32_t)strtoul(value, nullptr, 10);
+        } else if (strcmp(option, "--seed") == 0) {
+            options->seed = (uint32_t)strtoul(value, nullptr, 10);
+        } else if (strcmp(option, "--scale") == 0) {
+            options->scale = atof(value) > 0 ? atof(value) : 1.0;
+        } else if (strcmp(option, "--work") == 0) {
+            options->workDir = value;
+        } else if (strcmp(option, "--save") == 0) {
+            options->savePath = value;
+        } else if (strcmp(option, "--baseline") == 0) {
+            options->baselinePath = value;
+        } else if (strcmp(option, "--tolerance") == 0) {
+            options->tolerance = atof(value);
+        } else {
+            fprintf(stderr, "avbench: unknown option %s\n", option);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 2 || strcmp(argv[1], "help") == 0 || strcmp(argv[1], "--help") == 0) {
+        printUsage();
+        return argc < 2 ? 2 : 0;
+    }
+    
+    Options options = Options();
+    options.loops = 1;
+    options.events = 200000;
+    options.processes = 200;
+    options.seed = 1;
+    options.scale = 1.0;
+    options.tolerance = AVBENCH_DEFAULT_TOLERANCE;
+    
+    const char* command = argv[1];
+    bool needsTrace = strcmp(command, "synth") == 0 || strcmp(command, "replay") == 0;
+    int first = needsTrace ? 3 : 2;
+    if (strcmp(command, "compare") == 0) {
+        first = 4;
+    }
+    if (argc < first || !parseOptions(argc, argv, first, &options)) {
+        printUsage();
+        return 2;
+    }
+    
+    if (strcmp(command, "compare") == 0) {
+        Results current, baseline;
+        if (!loadResults(argv[2], &current) || !loadResults(argv[3], &baseline)) {
+            return 1;
+        }
+        return compareResults(current, baseline, options.tolerance) ? 0 : 1;
+    }
+    if (strcmp(command, "synth") == 0) {
+        options.trace = argv[2];
+        return runSynth(options);
+    }
+    
+    // Read before the scratch directory is entered, so relative paths work
+    Results baseline;
+    if (options.baselinePath && !loadResults(options.baselinePath, &baseline)) {
+        return 1;
+    }
+    
+    Results results;
+    std::string header;
+    int status;
+    if (strcmp(command, "replay") == 0) {
+        options.trace = argv[2];
+        char description[512];
+        snprintf(description, sizeof(description), "avbench replay %s rate=%g speed=%g loops=%d",
+                 options.trace, options.rate, options.speed, options.loops);
+        header = description;
+        printf("▶️  Replaying %s\n", options.trace);
+        status = runReplay(options, &results);
+    } else if (strcmp(command, "micro") == 0) {
+        char description[128];
+        snprintf(description, sizeof(description), "avbench micro scale=%g", options.scale);
+        header = description;
+        status = runMicro(options, &results);
+    } else {
+        fprintf(stderr, "avbench: unknown command %s\n", command);
+        printUsage();
+        return 2;
+    }
+    if (status != 0) {
+        return status;
+    }
+    
+    printResults(results);
+    if (options.savePath && !saveResults(options.savePath, results, header)) {
+        return 1;
+    }
+    if (options.baselinePath) {
+        return compareResults(results, baseline, options.tolerance) ? 0 : 1;
+    }
+    return 0;
+}
@@ -9,6 +9,9 @@ class SystemCleanupCLI {
     private let communicator = SystemExtensionCommunicator()
     private let dbPath = "/var/log/AudioVideoMonitor.db"
     private var database: OpaquePointer?
+    // Outside every tree we size, so saving it doesn't invalidate itself
+    private let sizeCachePath = NSString(string: "~/Library/Application Support/AudioVideoMonitor/sizes.cache").expandingTildeInPath
+    private var directoryScanner: OpaquePointer?
     
     // Known safe-to-kill background services and processes
     private let safeToKillServices = [
@@ -52,6 +55,9 @@ class SystemCleanupCLI {
         if let db = database {
             sqlite3_close(db)
         }
+        if let scanner = directoryScanner {
+            systemDirectoryScannerDestroy(scanner)
+        }
     }
     
     func run() {
@@ -576,6 +582,9 @@ class SystemCleanupCLI {
             print("🔄 Cleaning \(cacheDir)...")
             
             if cleanDirectory(expandedPath) {
+                if let scanner = directoryScanner {
+                    systemDirectoryScannerInvalidate(scanner, expandedPath)
+                }
                 let afterSize = getFolderSize(expandedPath) ?? 0
                 let freed = beforeSize - afterSize
                 totalFreed += freed
@@ -754,28 +763,13 @@ class SystemCleanupCLI {
     private func getRunningProcesses() -> [(pid: Int32, name: String)] {
         var processes: [(pid: Int32, name: String)] = []
         
-        let task = Process()
-        task.launchPath = "/bin/ps"
-        task.arguments = ["-axo", "pid,comm"]
-        
-        let pipe = Pipe()
-        task.standardOutput = pipe
-        task.launch()
-        task.waitUntilExit()
-        
-        let data = pipe.fileHandleForReading.readDataToEndOfFile()
-        let output = String(data: data, encoding: .utf8) ?? ""
+        guard let list = systemProcessListCopy() else { return processes }
+        defer { systemProcessListFree(list) }
         
-        for line in output.components(separatedBy: .newlines).dropFirst() {
-            let components = line.trimmingCharacters(in: .whitespaces)
-                .components(separatedBy: .whitespaces)
-                .filter { !$0.isEmpty }
-            
-            if components.count >= 2,
-               let pid = Int32(components[0]) {
-                let name = components[1]
-                processes.append((pid: pid, name: name))
-            }
+        let entries = systemProcessListEntries(list)!
+        for index in 0..<systemProcessListCount(list) {
+            let entry = entries[index]
+            processes.append((pid: entry.pid, name: String(cString: entry.name)))
         }
         
         return processes
@@ -787,21 +781,16 @@ class SystemCleanupCLI {
     }
     
     private func getFolderSize(_ path: String) -> Int64? {
-        let fileManager = FileManager.default
-        guard let enumerator = fileManager.enumerator(atPath: path) else { return nil }
-        
-        var totalSize: Int64 = 0
-        
-        while let fileName = enumerator.nextObject() as? String {
-            let filePath = "\(path)/\(fileName)"
-            if let attributes = try? fileManager.attributesOfItem(atPath: filePath) {
-                if let size = attributes[.size] as? Int64 {
-                    totalSize += size
-                }
-            }
+        if directoryScanner == nil {
+            try? FileManager.default.createDirectory(atPath: (sizeCachePath as NSString).deletingLastPathComponent,
+                                                     withIntermediateDirectories: true)
+            directoryScanner = systemDirectoryScannerCreate(sizeCachePath, 0)
         }
+        guard let scanner = directoryScanner else { return nil }
         
-        return totalSize
+        var totals = SystemDirectoryTotals()
+        guard systemDirectoryScannerScan(scanner, path, &totals) else { return nil }
+        return Int64(totals.bytes)
     }
     
     private func cleanDirectory(_ path: String) -> Bool {
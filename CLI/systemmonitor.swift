@@ -32,11 +32,17 @@ class SystemMonitorCLI {
         
         switch command {
         case "monitor":
-            startRealTimeMonitoring()
+            startRealTimeMonitoring(Array(arguments.dropFirst(2)))
         case "processes":
             showProcessHistory()
+        case "ps":
+            showRunningProcesses()
         case "files":
-            showFileAccessHistory()
+            if arguments.count > 2 && arguments[2] == "--live" {
+                showRecentFileAccess()
+            } else {
+                showFileAccessHistory()
+            }
         case "network":
             showNetworkActivity()
         case "search":
@@ -64,6 +70,33 @@ class SystemMonitorCLI {
             exportData()
         case "stats":
             showSystemStats()
+        case "retention":
+            if arguments.count > 3 {
+                guard let days = Int64(arguments[3]) else {
+                    print("❌ Retention days must be a number")
+                    exit(1)
+                }
+                setRetention(arguments[2], days: days)
+            } else {
+                showRetention()
+            }
+        case "metrics":
+            showMetrics()
+        case "trace":
+            controlTrace(arguments.count > 2 ? arguments[2] : "status")
+        case "tree":
+            if arguments.count > 2, let pid = Int64(arguments[2]) {
+                showProcessTree(pid)
+            } else {
+                print("❌ Tree command requires a PID")
+                exit(1)
+            }
+        case "log":
+            if arguments.count > 3 {
+                setLogLevel(arguments[2], level: arguments[3])
+            } else {
+                showLogLevels()
+            }
         case "help", "--help", "-h":
             printUsage()
             exit(0)
@@ -82,15 +115,24 @@ class SystemMonitorCLI {
             systemmonitor <command> [options]
         
         COMMANDS:
-            monitor             🔴 Start real-time monitoring (live output)
+            monitor [filters]   🔴 Start real-time monitoring (live output)
+                --type <t>      only process, file, network or syscall events (repeatable)
+                --pid <pid>     only events of one process
+                --path <prefix> only files/executables under a path
             processes           📋 Show process execution history
-            files               📁 Show file access history  
+            ps                  🧾 List running processes (live, from the extension)
+            files [--live]      📁 Show file access history (--live: newest in memory)
             network             🌐 Show network activity
-            search <term>       🔍 Search all events for specific term
+            search <term>       🔍 Search paths and command lines, newest first
             dump <pid>          🧠 Dump process memory to file
             analyze <pid>       🔬 Comprehensive process analysis
+            tree <pid>          🌳 Who started a process and everything it started
             export              📤 Export all data to CSV files
             stats               📊 Show system monitoring statistics
+            retention [<table> <days>]  🗓️  Show or set how many days each table keeps (0 = forever)
+            metrics             ⏱️  Per-event and per-call latencies, drops and queue depth
+            trace start | stop | status  🎞️  Record ES messages for replay with avbench
+            log [<category> <level>]  📝 Show or set the extension's log levels (off, error, default, info, debug)
             help                ❓ Show this help message
         
         MONITORING FEATURES:
@@ -105,11 +147,17 @@ class SystemMonitorCLI {
         
         EXAMPLES:
             systemmonitor monitor                    # Live monitoring
+            systemmonitor monitor --type file --path /etc   # Live /etc access
             systemmonitor processes | head -20       # Recent processes
             systemmonitor files | grep "/etc"        # System file access
             systemmonitor search "chrome"            # Find Chrome-related events
             systemmonitor analyze 1234               # Deep dive into PID 1234
+            systemmonitor tree 1234                  # Ancestry and descendants of PID 1234
             systemmonitor dump 1234                  # Memory dump of PID 1234
+            systemmonitor retention file_access 3    # Keep 3 days of raw file accesses
+            systemmonitor metrics                    # Where the extension spends its time
+            systemmonitor trace start                # Capture a workload to benchmark
+            systemmonitor log file debug             # Log file opens and writes too
         
         DATA LOCATION:
             Database: /var/log/AudioVideoMonitor.db
@@ -124,10 +172,34 @@ class SystemMonitorCLI {
             print("❌ Cannot open database: \(String(cString: sqlite3_errmsg(database)))")
             return false
         }
+        // The extension writes in WAL mode; wait briefly on checkpoints instead of failing
+        sqlite3_busy_timeout(database, 1000)
         return true
     }
     
-    private func startRealTimeMonitoring() {
+    private func startRealTimeMonitoring(_ options: [String]) {
+        var types: [String] = []
+        var pid: Int32 = 0
+        var pathPrefix: String?
+        
+        var index = 0
+        while index < options.count {
+            let option = options[index]
+            let value = index + 1 < options.count ? options[index + 1] : nil
+            switch (option, value) {
+            case ("--type", let value?):
+                types.append(value)
+            case ("--pid", let value?):
+                pid = Int32(value) ?? 0
+            case ("--path", let value?):
+                pathPrefix = value
+            default:
+                print("❌ Unknown monitor option: \(option)")
+                exit(1)
+            }
+            index += 2
+        }
+        
         print("🔴 Starting Real-Time System Monitoring...")
         print("   Press Ctrl+C to stop")
         print("=" + String(repeating: "=", count: 79))
@@ -138,78 +210,139 @@ class SystemMonitorCLI {
             exit(0)
         }
         
-        var lastTimestamp: Int64 = 0
+        let formatter = DateFormatter()
+        formatter.dateFormat = "HH:mm:ss"
         
-        while true {
-            // Query recent events
-            showRecentEvents(since: lastTimestamp)
-            lastTimestamp = Int64(Date().timeIntervalSince1970)
+        // The extension pushes batches as events happen; nothing is polled
+        communicator.onEvent = { message in
+            guard let stream = xpc_dictionary_get_string(message, "stream"),
+                  String(cString: stream) == "events" else {
+                return
+            }
             
-            // Sleep for 1 second
-            usleep(1000000)
+            let dropped = xpc_dictionary_get_uint64(message, "dropped")
+            if dropped > 0 {
+                print("⚠️  \(dropped) events dropped (monitor fell behind)")
+            }
+            
+            guard let events = xpc_dictionary_get_value(message, "events") else {
+                return
+            }
+            for i in 0..<xpc_array_get_count(events) {
+                let event = xpc_array_get_value(events, i)
+                self.printStreamEvent(event, formatter: formatter)
+            }
+        }
+        
+        var arguments: [String: Any] = ["pid": Int64(pid)]
+        if !types.isEmpty {
+            arguments["types"] = types
+        }
+        if let pathPrefix = pathPrefix {
+            arguments["path_prefix"] = pathPrefix
+        }
+        
+        communicator.sendCommand("subscribe_events", arguments: arguments) { success, data in
+            if !success {
+                let error = data?["error"] as? String ?? "cannot reach system extension"
+                print("❌ Subscription failed: \(error)")
+                exit(1)
+            }
         }
+        
+        dispatchMain()
     }
     
-    private func showRecentEvents(since timestamp: Int64) {
-        guard let db = database else { return }
+    private func printStreamEvent(_ event: xpc_object_t, formatter: DateFormatter) {
+        func string(_ key: String) -> String {
+            guard let value = xpc_dictionary_get_string(event, key) else { return "" }
+            return String(cString: value)
+        }
         
-        // Process events
-        let processSQL = """
-            SELECT timestamp, pid, executable_path, event_type, uid 
-            FROM process_events 
-            WHERE timestamp > ? 
-            ORDER BY timestamp DESC 
-            LIMIT 10
-        """
+        let timeUs = xpc_dictionary_get_uint64(event, "time_us")
+        let date = Date(timeIntervalSince1970: TimeInterval(timeUs) / 1_000_000)
+        let time = formatter.string(from: date)
+        let pid = xpc_dictionary_get_int64(event, "pid")
+        let subject = string("subject")
+        let action = string("action")
         
-        var stmt: OpaquePointer?
-        if sqlite3_prepare_v2(db, processSQL, -1, &stmt, nil) == SQLITE_OK {
-            sqlite3_bind_int64(stmt, 1, timestamp)
+        switch string("type") {
+        case "process":
+            print("🔄 [\(time)] \(action) PID:\(pid) \(subject)")
+        case "file":
+            let blockStatus = xpc_dictionary_get_bool(event, "blocked") ? "🔒" : "✅"
+            let count = xpc_dictionary_get_uint64(event, "count")
+            let repeats = count > 1 ? " (x\(count))" : ""
+            print("📁 [\(time)] \(action) \(blockStatus) PID:\(pid) \(subject)\(repeats)")
+        case "network":
+            print("🌐 [\(time)] \(action) PID:\(pid) \(subject)")
+        case "syscall":
+            print("⚙️  [\(time)] \(subject) PID:\(pid) \(action)")
+        default:
+            break
+        }
+    }
+    
+    // Bulk listings come from a snapshot the extension shares with us; the
+    // rows are read straight out of the mapping
+    private func showRunningProcesses() {
+        guard let snapshot = communicator.fetchSnapshot(.processes) else {
+            print("❌ Could not get the process list from the system extension")
+            exit(1)
+        }
+        
+        print("🧾 Running Processes (\(snapshot.count))")
+        print("=" + String(repeating: "=", count: 79))
+        print(String(format: "%-8s %-8s %-8s %-10s %-5s %s", "PID", "PPID", "UID", "MEMORY", "TIER", "EXECUTABLE"))
+        print(String(repeating: "-", count: 120))
+        
+        typealias Field = SnapshotReader.ProcessField
+        for i in 0..<snapshot.count {
+            let flags = snapshot.field(i, Field.flags, as: UInt8.self)
+            let memMB = Double(snapshot.field(i, Field.memoryUsage, as: UInt64.self)) / (1024 * 1024)
+            let systemIcon = flags & SnapshotReader.systemProcess != 0 ? "⚙️ " : ""
+            let audio = flags & SnapshotReader.audioAccess != 0 ? " 🎤" : ""
+            let video = flags & SnapshotReader.videoAccess != 0 ? " 📹" : ""
             
-            while sqlite3_step(stmt) == SQLITE_ROW {
-                let timestamp = sqlite3_column_int64(stmt, 0)
-                let pid = sqlite3_column_int(stmt, 1)
-                let path = String(cString: sqlite3_column_text(stmt, 2))
-                let event = String(cString: sqlite3_column_text(stmt, 3))
-                let uid = sqlite3_column_int(stmt, 4)
-                
-                let date = Date(timeIntervalSince1970: TimeInterval(timestamp))
-                let formatter = DateFormatter()
-                formatter.dateFormat = "HH:mm:ss"
-                
-                print("🔄 [\(formatter.string(from: date))] \(event) PID:\(pid) UID:\(uid) \(path)")
-            }
+            print(String(format: "%-8d %-8d %-8u %-10s %-5u ",
+                         snapshot.field(i, Field.pid, as: Int32.self),
+                         snapshot.field(i, Field.ppid, as: Int32.self),
+                         snapshot.field(i, Field.uid, as: UInt32.self),
+                         String(format: "%.1f MB", memMB),
+                         UInt32(snapshot.field(i, Field.enrichmentTier, as: UInt8.self))) +
+                  "\(systemIcon)\(snapshot.string(i, Field.executablePath))\(audio)\(video)")
+        }
+    }
+    
+    private func showRecentFileAccess() {
+        guard let snapshot = communicator.fetchSnapshot(.fileAccess) else {
+            print("❌ Could not get recent file access from the system extension")
+            exit(1)
         }
-        sqlite3_finalize(stmt)
         
-        // File access events
-        let fileSQL = """
-            SELECT timestamp, pid, file_path, access_type, was_blocked
-            FROM file_access 
-            WHERE timestamp > ? 
-            ORDER BY timestamp DESC 
-            LIMIT 5
-        """
+        print("📁 Recent File Access (\(snapshot.count), newest first)")
+        print("=" + String(repeating: "=", count: 79))
         
-        if sqlite3_prepare_v2(db, fileSQL, -1, &stmt, nil) == SQLITE_OK {
-            sqlite3_bind_int64(stmt, 1, timestamp)
+        let formatter = DateFormatter()
+        formatter.dateFormat = "MM/dd HH:mm:ss"
+        
+        typealias Field = SnapshotReader.FileAccessField
+        for i in 0..<snapshot.count {
+            let timestamp = snapshot.field(i, Field.timestamp, as: UInt64.self)
+            let count = snapshot.field(i, Field.count, as: UInt32.self)
+            let blocked = snapshot.field(i, Field.blocked, as: UInt8.self) != 0
+            let date = Date(timeIntervalSince1970: TimeInterval(timestamp))
+            let repeats = count > 1 ? " (x\(count))" : ""
             
-            while sqlite3_step(stmt) == SQLITE_ROW {
-                let timestamp = sqlite3_column_int64(stmt, 0)
-                let pid = sqlite3_column_int(stmt, 1)
-                let path = String(cString: sqlite3_column_text(stmt, 2))
-                let accessType = String(cString: sqlite3_column_text(stmt, 3))
-                let blocked = sqlite3_column_int(stmt, 4) != 0
-                
-                let date = Date(timeIntervalSince1970: TimeInterval(timestamp))
-                let formatter = DateFormatter()
-                formatter.dateFormat = "HH:mm:ss"
-                
-                let blockStatus = blocked ? "🔒" : "✅"
-                print("📁 [\(formatter.string(from: date))] \(accessType) \(blockStatus) PID:\(pid) \(path)")
+            print("[\(formatter.string(from: date))] \(snapshot.string(i, Field.accessType)) " +
+                  "\(blocked ? "🔒" : "✅") PID:\(snapshot.field(i, Field.pid, as: Int32.self)) " +
+                  "\(snapshot.string(i, Field.path))\(repeats)")
+            
+            let reason = snapshot.string(i, Field.reason)
+            if blocked && !reason.isEmpty {
+                print("   ⚠️  Blocked: \(reason)")
             }
         }
-        sqlite3_finalize(stmt)
     }
     
     private func showProcessHistory() {
@@ -373,10 +506,48 @@ class SystemMonitorCLI {
         sqlite3_finalize(stmt)
     }
     
+    // Served from the extension's search index; scans the event tables only
+    // when the extension can't be reached
     private func searchEvents(_ searchTerm: String) {
         print("🔍 Searching for: '\(searchTerm)'")
         print("=" + String(repeating: "=", count: 79))
         
+        guard let reply = communicator.sendCommandSync("search", arguments: ["term": searchTerm, "limit": Int64(60)]),
+              xpc_dictionary_get_bool(reply, "success"),
+              let matches = xpc_dictionary_get_value(reply, "matches") else {
+            print("⚠️  Search index unavailable, scanning the event tables (slow)\n")
+            scanEvents(searchTerm)
+            return
+        }
+        
+        let formatter = DateFormatter()
+        formatter.dateFormat = "MM/dd HH:mm:ss"
+        
+        // Newest first within each kind; a path run as a program and opened as a file shows in both
+        let sections: [(UInt64, String)] = [(0x01, "📋 Executables:"), (0x02, "📝 Command Lines:"), (0x04, "📁 File Paths:")]
+        for (kind, title) in sections {
+            print(title)
+            var found = false
+            for i in 0..<xpc_array_get_count(matches) {
+                let match = xpc_array_get_value(matches, i)
+                guard xpc_dictionary_get_uint64(match, "kinds") & kind != 0 else {
+                    continue
+                }
+                found = true
+                let date = Date(timeIntervalSince1970: TimeInterval(xpc_dictionary_get_uint64(match, "last_seen")))
+                let pid = xpc_dictionary_get_int64(match, "last_pid")
+                let value = String(cString: xpc_dictionary_get_string(match, "value"))
+                let uses = xpc_dictionary_get_uint64(match, "uses")
+                print("  [\(formatter.string(from: date))] \(pid > 0 ? "PID:\(pid) " : "")\(value) (\(uses) events)")
+            }
+            if !found {
+                print("  (none)")
+            }
+            print("")
+        }
+    }
+    
+    private func scanEvents(_ searchTerm: String) {
         guard let db = database else { return }
         
         // Search in process events
@@ -507,8 +678,8 @@ class SystemMonitorCLI {
         }
         sqlite3_finalize(stmt)
         
-        // File access count
-        let fileSQL = "SELECT COUNT(*) FROM file_access WHERE pid = ?"
+        // File access count; coalesced rows stand for `count` accesses each
+        let fileSQL = "SELECT COALESCE(SUM(count), 0) FROM file_access WHERE pid = ?"
         if sqlite3_prepare_v2(db, fileSQL, -1, &stmt, nil) == SQLITE_OK {
             sqlite3_bind_int(stmt, 1, pid)
             if sqlite3_step(stmt) == SQLITE_ROW {
@@ -580,41 +751,67 @@ class SystemMonitorCLI {
         
         guard let db = database else { return }
         
-        var stmt: OpaquePointer?
-        
-        // Total events
-        let tables = ["process_events", "file_access", "network_connections", "system_calls"]
-        
-        for table in tables {
-            let sql = "SELECT COUNT(*) FROM \(table)"
-            if sqlite3_prepare_v2(db, sql, -1, &stmt, nil) == SQLITE_OK {
-                if sqlite3_step(stmt) == SQLITE_ROW {
-                    let count = sqlite3_column_int(stmt, 0)
-                    print("📈 \(table.capitalized.replacingOccurrences(of: "_", with: " ")): \(count) events")
-                }
+        // Read from the rollups the extension keeps, so this costs the same on any
+        // size of history. Each query is a range of one resolution's primary key.
+        func rollups(_ sql: String, _ row: (OpaquePointer?) -> Void) -> Bool {
+            var stmt: OpaquePointer?
+            guard sqlite3_prepare_v2(db, sql, -1, &stmt, nil) == SQLITE_OK else {
+                sqlite3_finalize(stmt)
+                return false
+            }
+            while sqlite3_step(stmt) == SQLITE_ROW {
+                row(stmt)
             }
             sqlite3_finalize(stmt)
+            return true
+        }
+        
+        // Keys of the per-table rollups (RollupTable in EventRollups.h)
+        let tables = [1: "process_events", 2: "file_access", 3: "network_connections",
+                      4: "system_calls", 5: "loaded_libraries", 6: "environment_vars"]
+        
+        // Total events
+        let totalsSQL = """
+            SELECT key, events, blocked FROM rollup_counts
+            WHERE resolution = 0 AND bucket = 0 AND dimension = 1
+            ORDER BY key
+        """
+        let haveRollups = rollups(totalsSQL) { stmt in
+            let table = tables[Int(sqlite3_column_int(stmt, 0))] ?? "unknown"
+            let blocked = sqlite3_column_int64(stmt, 2)
+            print("📈 \(table.capitalized.replacingOccurrences(of: "_", with: " ")): \(sqlite3_column_int64(stmt, 1)) events" +
+                  (blocked > 0 ? " (\(blocked) blocked)" : ""))
+        }
+        guard haveRollups else {
+            print("❌ No event rollups in this database; start the system extension to create them")
+            return
+        }
+        
+        // Last hour, from the per-minute buckets
+        print("\n⏱️  Last Hour:")
+        let lastHourSQL = """
+            SELECT key, SUM(events), SUM(blocked) FROM rollup_counts
+            WHERE resolution = 60 AND bucket >= CAST(strftime('%s', 'now') AS INTEGER) - 3600 AND dimension = 1
+            GROUP BY key ORDER BY key
+        """
+        _ = rollups(lastHourSQL) { stmt in
+            let table = tables[Int(sqlite3_column_int(stmt, 0))] ?? "unknown"
+            print("  \(table): \(sqlite3_column_int64(stmt, 1)) events, \(sqlite3_column_int64(stmt, 2)) blocked")
         }
         
         // Most active processes
         print("\n🔥 Most Active Processes:")
         let activeSQL = """
-            SELECT executable_path, COUNT(*) as event_count
-            FROM process_events 
-            GROUP BY executable_path 
-            ORDER BY event_count DESC 
+            SELECT s.value, r.events FROM rollup_counts r JOIN strings s ON s.id = r.key
+            WHERE r.resolution = 0 AND r.bucket = 0 AND r.dimension = 3
+            ORDER BY r.events DESC
             LIMIT 10
         """
-        
-        if sqlite3_prepare_v2(db, activeSQL, -1, &stmt, nil) == SQLITE_OK {
-            while sqlite3_step(stmt) == SQLITE_ROW {
-                let path = String(cString: sqlite3_column_text(stmt, 0))
-                let count = sqlite3_column_int(stmt, 1)
-                let processName = URL(fileURLWithPath: path).lastPathComponent
-                print("  \(processName): \(count) events")
-            }
+        _ = rollups(activeSQL) { stmt in
+            let path = String(cString: sqlite3_column_text(stmt, 0))
+            let processName = URL(fileURLWithPath: path).lastPathComponent
+            print("  \(processName): \(sqlite3_column_int64(stmt, 1)) events")
         }
-        sqlite3_finalize(stmt)
         
         // Database size
         if let attributes = try? FileManager.default.attributesOfItem(atPath: dbPath) {
@@ -625,6 +822,289 @@ class SystemMonitorCLI {
         }
     }
     
+    // Retention lives in the database, but changes go through the extension so
+    // the writer applies them between batches
+    private func showRetention() {
+        guard let reply = communicator.sendCommandSync("get_retention"),
+              let entries = xpc_dictionary_get_value(reply, "retention") else {
+            print("❌ Could not get retention settings from the system extension")
+            exit(1)
+        }
+        
+        print("🗓️  Retention")
+        print("=" + String(repeating: "=", count: 59))
+        func column(_ text: String, _ width: Int) -> String {
+            return text.padding(toLength: max(width, text.count), withPad: " ", startingAt: 0)
+        }
+        
+        print(column("TABLE", 21) + column("DAYS", 9) + column("PARTITIONS", 13) + "OLDEST DAY")
+        for i in 0..<xpc_array_get_count(entries) {
+            let entry = xpc_array_get_value(entries, i)
+            let table = String(cString: xpc_dictionary_get_string(entry, "table"))
+            let days = xpc_dictionary_get_int64(entry, "days")
+            let oldest = xpc_dictionary_get_uint64(entry, "oldest_day")
+            print(column(table, 21) + column(days > 0 ? "\(days)" : "forever", 9) +
+                  column("\(xpc_dictionary_get_uint64(entry, "partitions"))", 13) +
+                  (oldest > 0 ? "\(oldest)" : "-"))
+        }
+    }
+    
+    private func setRetention(_ table: String, days: Int64) {
+        guard let reply = communicator.sendCommandSync("set_retention", arguments: ["table": table, "days": days]) else {
+            print("❌ Could not reach the system extension")
+            exit(1)
+        }
+        
+        if xpc_dictionary_get_bool(reply, "success") {
+            print("✅ \(table) now keeps \(days > 0 ? "\(days) days" : "everything")")
+        } else {
+            let error = xpc_dictionary_get_string(reply, "error").map { String(cString: $0) } ?? "unknown error"
+            print("❌ Failed to set retention: \(error)")
+            exit(1)
+        }
+    }
+    
+    // Traces are written by the extension, since only it sees the messages
+    // Counters and histograms the extension keeps on its hot paths
+    private func showMetrics() {
+        guard let reply = communicator.sendCommandSync("get_metrics"),
+              let events = xpc_dictionary_get_value(reply, "events"),
+              let calls = xpc_dictionary_get_value(reply, "calls") else {
+            print("❌ Could not get metrics from the system extension")
+            exit(1)
+        }
+        
+        func column(_ text: String, _ width: Int) -> String {
+            return text.padding(toLength: max(width, text.count), withPad: " ", startingAt: 0)
+        }
+        func duration(_ ns: UInt64) -> String {
+            if ns >= 1_000_000 {
+                return String(format: "%.1fms", Double(ns) / 1_000_000)
+            }
+            return ns >= 1_000 ? String(format: "%.1fµs", Double(ns) / 1_000) : "\(ns)ns"
+        }
+        func latencies(_ entry: xpc_object_t) -> String {
+            return column(duration(xpc_dictionary_get_uint64(entry, "p50_ns")), 10) +
+                   column(duration(xpc_dictionary_get_uint64(entry, "p99_ns")), 10) +
+                   column(duration(xpc_dictionary_get_uint64(entry, "p999_ns")), 10) +
+                   duration(xpc_dictionary_get_uint64(entry, "max_ns"))
+        }
+        
+        print("⏱️  ES events (handler time on the pipeline workers)")
+        print("=" + String(repeating: "=", count: 89))
+        print(column("EVENT", 14) + column("RECEIVED", 12) + column("HANDLED", 12) + column("KERNEL DROPS", 14) +
+              column("P50", 10) + column("P99", 10) + column("P99.9", 10) + "MAX")
+        for i in 0..<xpc_array_get_count(events) {
+            let entry = xpc_array_get_value(events, i)
+            let name = xpc_dictionary_get_string(entry, "name").map { String(cString: $0) } ??
+                       "type \(xpc_dictionary_get_int64(entry, "event_type"))"
+            print(column(name, 14) + column("\(xpc_dictionary_get_uint64(entry, "received"))", 12) +
+                  column("\(xpc_dictionary_get_uint64(entry, "handled"))", 12) +
+                  column("\(xpc_dictionary_get_uint64(entry, "kernel_dropped"))", 14) + latencies(entry))
+        }
+        
+        print("\n🔬 Process lookups")
+        print("=" + String(repeating: "=", count: 89))
+        print(column("CALL", 14) + column("CALLS", 12) + column("FAILED", 12) + column("", 14) +
+              column("P50", 10) + column("P99", 10) + column("P99.9", 10) + "MAX")
+        for i in 0..<xpc_array_get_count(calls) {
+            let entry = xpc_array_get_value(calls, i)
+            print(column(String(cString: xpc_dictionary_get_string(entry, "name")), 14) +
+                  column("\(xpc_dictionary_get_uint64(entry, "count"))", 12) +
+                  column("\(xpc_dictionary_get_uint64(entry, "failures"))", 12) + column("", 14) + latencies(entry))
+        }
+        
+        if let clients = xpc_dictionary_get_value(reply, "es_clients") {
+            print("\n📮 ES clients (delivery: event creation to callback; margin: deadline left at the answer)")
+            print("=" + String(repeating: "=", count: 89))
+            print(column("CLIENT", 14) + column("TYPES", 8) + column("MESSAGES", 12) + column("DELIVERY P50", 14) +
+                  column("P99", 10) + column("MIN MARGIN", 12) + column("MARGIN P50", 12) + "MISSED")
+            for i in 0..<xpc_array_get_count(clients) {
+                let entry = xpc_array_get_value(clients, i)
+                let answered = xpc_dictionary_get_uint64(entry, "responses") > 0
+                print(column(String(cString: xpc_dictionary_get_string(entry, "name")), 14) +
+                      column("\(xpc_dictionary_get_uint64(entry, "event_types"))", 8) +
+                      column("\(xpc_dictionary_get_uint64(entry, "messages"))", 12) +
+                      column(duration(xpc_dictionary_get_uint64(entry, "delivery_p50_ns")), 14) +
+                      column(duration(xpc_dictionary_get_uint64(entry, "delivery_p99_ns")), 10) +
+                      column(answered ? duration(xpc_dictionary_get_uint64(entry, "min_deadline_margin_ns")) : "-", 12) +
+                      column(answered ? duration(xpc_dictionary_get_uint64(entry, "deadline_margin_p50_ns")) : "-", 12) +
+                      "\(xpc_dictionary_get_uint64(entry, "missed_deadlines"))")
+            }
+        }
+        
+        print("\n🚚 Pipeline and database")
+        print("=" + String(repeating: "=", count: 89))
+        print("   Events received:   \(xpc_dictionary_get_uint64(reply, "events_received"))" +
+              " (\(xpc_dictionary_get_uint64(reply, "kernel_dropped")) dropped by the kernel," +
+              " \(xpc_dictionary_get_uint64(reply, "pipeline_dropped")) by a full queue)")
+        print("   Queue depth:       \(xpc_dictionary_get_uint64(reply, "queue_depth"))" +
+              " (max \(xpc_dictionary_get_uint64(reply, "max_queue_depth"))), wait p50 " +
+              duration(xpc_dictionary_get_uint64(reply, "queue_latency_p50_ns")) + ", p99 " +
+              duration(xpc_dictionary_get_uint64(reply, "queue_latency_p99_ns")))
+        print("   DB commits:        \(xpc_dictionary_get_uint64(reply, "db_commits"))" +
+              " (\(xpc_dictionary_get_uint64(reply, "db_commit_failures")) failed), p50 " +
+              duration(xpc_dictionary_get_uint64(reply, "db_commit_p50_ns")) + ", p99 " +
+              duration(xpc_dictionary_get_uint64(reply, "db_commit_p99_ns")) + ", max " +
+              duration(xpc_dictionary_get_uint64(reply, "db_commit_max_ns")))
+        print("   Rows pending:      \(xpc_dictionary_get_uint64(reply, "db_rows_pending"))")
+
+        print("\n💤 Background monitors")
+        print("=" + String(repeating: "=", count: 89))
+        if let monitors = xpc_dictionary_get_value(reply, "monitors") {
+            for i in 0..<xpc_array_get_count(monitors) {
+                let entry = xpc_array_get_value(monitors, i)
+                let runs = xpc_dictionary_get_uint64(entry, "runs")
+                let mean = runs > 0 ? xpc_dictionary_get_uint64(entry, "total_run_ns") / runs : 0
+                print("   " + column(String(cString: xpc_dictionary_get_string(entry, "name")), 48) +
+                      column("\(runs) runs", 12) + column("mean " + duration(mean), 16) +
+                      "next in \(xpc_dictionary_get_uint64(entry, "interval_ms"))ms")
+            }
+        }
+        let watching = xpc_dictionary_get_bool(reply, "fs_watch_running")
+        print("   FSEvents:          " + (watching ? "watching" : "not running") +
+              ", \(xpc_dictionary_get_uint64(reply, "fs_watch_changes")) changes in" +
+              " \(xpc_dictionary_get_uint64(reply, "fs_watch_batches")) batches" +
+              " (\(xpc_dictionary_get_uint64(reply, "fs_watch_rescans")) rescans)")
+        print("   Warm start:        \(xpc_dictionary_get_uint64(reply, "warm_start_restored")) of" +
+              " \(xpc_dictionary_get_uint64(reply, "warm_start_loaded")) saved processes restored" +
+              " (\(xpc_dictionary_get_uint64(reply, "warm_start_stale")) stale)," +
+              " \(xpc_dictionary_get_uint64(reply, "processes_discovered")) discovered," +
+              " \(xpc_dictionary_get_uint64(reply, "discovery_pending")) waiting")
+        print("\n   Signposts: Instruments > os_signpost, subsystem com.example.AudioVideoMonitor.SystemExtension")
+    }
+    
+    private func controlTrace(_ action: String) {
+        let commands = ["start": "start_trace", "stop": "stop_trace", "status": "get_trace_stats"]
+        guard let command = commands[action] else {
+            print("❌ Unknown trace action: \(action) (use start, stop or status)")
+            exit(1)
+        }
+        
+        guard let reply = communicator.sendCommandSync(command, arguments: [:]) else {
+            print("❌ Could not reach the system extension")
+            exit(1)
+        }
+        guard xpc_dictionary_get_bool(reply, "success") else {
+            let error = xpc_dictionary_get_string(reply, "error").map { String(cString: $0) } ?? "unknown error"
+            print("❌ Trace \(action) failed: \(error)")
+            exit(1)
+        }
+        
+        let tracePath = xpc_dictionary_get_string(reply, "path").map { String(cString: $0) } ?? ""
+        let events = xpc_dictionary_get_uint64(reply, "events")
+        let bytes = xpc_dictionary_get_uint64(reply, "bytes")
+        let state = xpc_dictionary_get_bool(reply, "recording") ? "🔴 Recording" : "⏹️  Stopped"
+        print("\(state): \(tracePath.isEmpty ? "no trace" : tracePath)")
+        print("   \(events) events, \(bytes) bytes, \(xpc_dictionary_get_uint64(reply, "strings")) strings" +
+              (events > 0 ? String(format: " (%.1f bytes/event)", Double(bytes) / Double(events)) : ""))
+        let dropped = xpc_dictionary_get_uint64(reply, "dropped")
+        if dropped > 0 {
+            print("   ⚠️  \(dropped) messages not traced: the recorder queue was full")
+        }
+        if action == "stop" && events > 0 {
+            print("   Replay with: avbench replay \(tracePath)")
+        }
+    }
+    
+    private func showProcessTree(_ pid: Int64) {
+        guard let reply = communicator.sendCommandSync("get_lineage", arguments: ["pid": pid]) else {
+            print("❌ Could not reach the system extension")
+            exit(1)
+        }
+        guard xpc_dictionary_get_bool(reply, "success"),
+              let ancestors = xpc_dictionary_get_value(reply, "ancestors"),
+              let descendants = xpc_dictionary_get_value(reply, "descendants") else {
+            let error = xpc_dictionary_get_string(reply, "error").map { String(cString: $0) } ?? "unknown error"
+            print("❌ \(error)")
+            exit(1)
+        }
+        
+        func key(_ pid: Int64, _ version: UInt64) -> String {
+            return "\(pid)/\(version)"
+        }
+        func describe(_ entry: xpc_object_t) -> String {
+            let path = xpc_dictionary_get_string(entry, "path").map { String(cString: $0) } ?? ""
+            let relation = String(cString: xpc_dictionary_get_string(entry, "relation"))
+            let exited = xpc_dictionary_get_int64(entry, "exited")
+            return "\(xpc_dictionary_get_int64(entry, "pid")) \(path.isEmpty ? "?" : path) (\(relation)" +
+                   (exited > 0 ? ", exited \(Date(timeIntervalSince1970: TimeInterval(exited))))" : ")")
+        }
+        
+        let live = xpc_dictionary_get_bool(reply, "live")
+        print("🌳 Lineage of PID \(pid) " + (live ? "(live tree)" : "(history)"))
+        print("=" + String(repeating: "=", count: 79))
+        
+        // Ancestors arrive nearest first; print from the root down to the process
+        let depth = xpc_array_get_count(ancestors)
+        for i in stride(from: depth - 1, through: 1, by: -1) {
+            let indent = String(repeating: "   ", count: depth - 1 - i)
+            print(indent + (i == depth - 1 ? "" : "└─ ") + describe(xpc_array_get_value(ancestors, i)))
+        }
+        
+        // Descendants come in any order; each one hangs off its parent
+        var children: [String: [xpc_object_t]] = [:]
+        var top: xpc_object_t?
+        for i in 0..<xpc_array_get_count(descendants) {
+            let entry = xpc_array_get_value(descendants, i)
+            if xpc_dictionary_get_uint64(entry, "depth") == 0 {
+                top = entry
+            } else {
+                let parent = key(xpc_dictionary_get_int64(entry, "parent_pid"),
+                                 xpc_dictionary_get_uint64(entry, "parent_pid_version"))
+                children[parent, default: []].append(entry)
+            }
+        }
+        func printSubtree(_ entry: xpc_object_t, _ level: Int) {
+            let indent = String(repeating: "   ", count: level)
+            print(indent + (level > 0 ? "└─ " : "") + describe(entry))
+            let own = key(xpc_dictionary_get_int64(entry, "pid"), xpc_dictionary_get_uint64(entry, "pid_version"))
+            for child in children[own] ?? [] {
+                printSubtree(child, level + 1)
+            }
+        }
+        if let top = top {
+            printSubtree(top, max(depth - 1, 0))
+        }
+        
+        print("\n   \(depth > 0 ? depth - 1 : 0) ancestors, \(max(xpc_array_get_count(descendants) - 1, 0)) descendants" +
+              (live ? "; \(xpc_dictionary_get_uint64(reply, "tree_running")) processes running in the tree" : ""))
+    }
+    
+    private func showLogLevels() {
+        guard let reply = communicator.sendCommandSync("get_log_levels"),
+              let categories = xpc_dictionary_get_value(reply, "categories") else {
+            print("❌ Could not get log levels from the system extension")
+            exit(1)
+        }
+        
+        print("📝 Log levels (subsystem com.example.AudioVideoMonitor.SystemExtension)")
+        print("=" + String(repeating: "=", count: 49))
+        for i in 0..<xpc_array_get_count(categories) {
+            let entry = xpc_array_get_value(categories, i)
+            let name = String(cString: xpc_dictionary_get_string(entry, "name"))
+            let level = String(cString: xpc_dictionary_get_string(entry, "level"))
+            print("   " + name.padding(toLength: 12, withPad: " ", startingAt: 0) +
+                  level.padding(toLength: 10, withPad: " ", startingAt: 0) +
+                  "\(xpc_dictionary_get_uint64(entry, "suppressed")) suppressed")
+        }
+        print("\n   Read with: log stream --predicate 'subsystem == \"com.example.AudioVideoMonitor.SystemExtension\"'")
+    }
+    
+    private func setLogLevel(_ category: String, level: String) {
+        guard let reply = communicator.sendCommandSync("set_log_level",
+                                                       arguments: ["category": category, "level": level]) else {
+            print("❌ Could not reach the system extension")
+            exit(1)
+        }
+        guard xpc_dictionary_get_bool(reply, "success") else {
+            let error = xpc_dictionary_get_string(reply, "error").map { String(cString: $0) } ?? "unknown error"
+            print("❌ \(error)")
+            exit(1)
+        }
+        print("✅ \(category) now logs at \(level)")
+    }
+    
     private func displayProcessAnalysis(_ data: [String: Any]) {
         // Display comprehensive process analysis data
         print("Process analysis data received")
@@ -645,11 +1125,239 @@ class SystemMonitorCLI {
     }
 }
 
-// Simplified XPC communicator for monitoring CLI
+// XPC client for the system extension; also receives pushed event batches
 class SystemExtensionCommunicator {
-    func sendCommand(_ command: String, completion: @escaping (Bool, [String: Any]?) -> Void) {
-        // XPC communication implementation
-        completion(true, [:])
+    private let serviceName = "com.example.AudioVideoMonitor.SystemExtension"
+    private var connection: xpc_connection_t?
+    
+    // Messages the extension sends on its own, such as subscribed events
+    var onEvent: ((xpc_object_t) -> Void)?
+    
+    init() {
+        setupConnection()
+    }
+    
+    deinit {
+        if let connection = connection {
+            xpc_connection_cancel(connection)
+        }
+    }
+    
+    private func setupConnection() {
+        connection = xpc_connection_create_mach_service(
+            serviceName,
+            DispatchQueue.main,
+            UInt64(0)
+        )
+        
+        guard let connection = connection else {
+            return
+        }
+        
+        xpc_connection_set_event_handler(connection) { [weak self] event in
+            let type = xpc_get_type(event)
+            if type == XPC_TYPE_DICTIONARY {
+                self?.onEvent?(event)
+            } else if type == XPC_TYPE_ERROR && self?.onEvent != nil {
+                // A live stream can't outlive the extension
+                print("\n❌ Lost connection to system extension")
+                exit(1)
+            }
+        }
+        
+        xpc_connection_resume(connection)
+    }
+    
+    func sendCommand(_ command: String, arguments: [String: Any] = [:],
+                     completion: @escaping (Bool, [String: Any]?) -> Void) {
+        guard let connection = connection else {
+            completion(false, nil)
+            return
+        }
+        
+        let message = makeMessage(command, arguments: arguments)
+        xpc_connection_send_message_with_reply(connection, message, DispatchQueue.main) { reply in
+            guard xpc_get_type(reply) == XPC_TYPE_DICTIONARY else {
+                completion(false, nil)
+                return
+            }
+            
+            let success = xpc_dictionary_get_bool(reply, "success")
+            var resultDict: [String: Any] = ["success": success]
+            if let error = xpc_dictionary_get_string(reply, "error") {
+                resultDict["error"] = String(cString: error)
+            }
+            if let dumpPath = xpc_dictionary_get_string(reply, "dump_path") {
+                resultDict["dump_path"] = String(cString: dumpPath)
+            }
+            completion(success, resultDict)
+        }
+    }
+    
+    // Whole reply of a command, for the ones that return more than success
+    func sendCommandSync(_ command: String, arguments: [String: Any] = [:]) -> xpc_object_t? {
+        guard let connection = connection else {
+            return nil
+        }
+        
+        let reply = xpc_connection_send_message_with_reply_sync(connection, makeMessage(command, arguments: arguments))
+        return xpc_get_type(reply) == XPC_TYPE_DICTIONARY ? reply : nil
+    }
+    
+    private func makeMessage(_ command: String, arguments: [String: Any]) -> xpc_object_t {
+        let message = xpc_dictionary_create(nil, nil, 0)
+        xpc_dictionary_set_string(message, "command", command)
+        for (key, value) in arguments {
+            switch value {
+            case let value as String:
+                xpc_dictionary_set_string(message, key, value)
+            case let value as Int64:
+                xpc_dictionary_set_int64(message, key, value)
+            case let values as [String]:
+                let array = xpc_array_create(nil, 0)
+                for value in values {
+                    xpc_array_append_value(array, xpc_string_create(value))
+                }
+                xpc_dictionary_set_value(message, key, array)
+            default:
+                break
+            }
+        }
+        return message
+    }
+    
+    // Bulk query results, mapped straight from the extension's shared snapshot
+    func fetchSnapshot(_ kind: SnapshotReader.Kind) -> SnapshotReader? {
+        guard let connection = connection else {
+            return nil
+        }
+        
+        let message = xpc_dictionary_create(nil, nil, 0)
+        xpc_dictionary_set_string(message, "command", "get_snapshot")
+        xpc_dictionary_set_string(message, "kind", kind.name)
+        
+        let reply = xpc_connection_send_message_with_reply_sync(connection, message)
+        guard xpc_get_type(reply) == XPC_TYPE_DICTIONARY, xpc_dictionary_get_bool(reply, "success"),
+              let shmem = xpc_dictionary_get_value(reply, "snapshot") else {
+            return nil
+        }
+        return SnapshotReader(shmem: shmem, expecting: kind)
+    }
+}
+
+// Read-only view of a bulk snapshot shared by the extension (get_snapshot).
+// The layout is defined in SystemExtension/SharedSnapshot.h; records are read
+// in place from the mapping, nothing is copied until a field is asked for.
+// Same as ControlApp/SnapshotReader.swift; each CLI tool is one source file.
+final class SnapshotReader {
+    static let magic: UInt32 = 0x4e535641
+    static let version: UInt16 = 1
+    
+    enum Kind: UInt16 {
+        case processes = 1
+        case fileAccess = 2
+        
+        var name: String {
+            return self == .processes ? "processes" : "file_access"
+        }
+    }
+    
+    // Byte offsets within a SnapshotProcess record
+    enum ProcessField {
+        static let pid = 0, ppid = 4, uid = 8, gid = 12
+        static let startTime = 16, cpuTime = 24, memoryUsage = 32
+        static let executablePath = 40, commandLine = 44, bundleIdentifier = 48
+        static let enrichmentTier = 52, flags = 53
+        static let size = 56
+    }
+    
+    // Byte offsets within a SnapshotFileAccess record
+    enum FileAccessField {
+        static let timestamp = 0, lastSeen = 8, pid = 16, count = 20
+        static let path = 24, accessType = 28, reason = 32, blocked = 36
+        static let size = 40
+    }
+    
+    static let systemProcess: UInt8 = 0x01
+    static let audioAccess: UInt8 = 0x02
+    static let videoAccess: UInt8 = 0x04
+    static let networkAccess: UInt8 = 0x08
+    static let fileSystemAccess: UInt8 = 0x10
+    
+    let kind: Kind
+    let count: Int
+    let generation: UInt64
+    let created: Date
+    
+    private let region: UnsafeMutableRawPointer
+    private let mappedSize: Int
+    private let recordSize: Int
+    private let recordsOffset: Int
+    private let stringsOffset: Int
+    private let stringsSize: Int
+    
+    // Nil unless the mapping is a complete snapshot of the expected kind and version
+    init?(shmem: xpc_object_t, expecting expected: Kind) {
+        var mapped: UnsafeMutableRawPointer?
+        let size = xpc_shmem_map(shmem, &mapped)
+        guard size >= 48, let region = mapped else {
+            return nil
+        }
+        mprotect(region, size, PROT_READ)
+        
+        func header<T>(_ offset: Int, _ type: T.Type) -> T {
+            return region.load(fromByteOffset: offset, as: T.self)
+        }
+        
+        let magic = header(0, UInt32.self)
+        let version = header(4, UInt16.self)
+        let kind = Kind(rawValue: header(6, UInt16.self))
+        let count = Int(header(8, UInt32.self))
+        let recordSize = Int(header(12, UInt32.self))
+        let recordsOffset = Int(header(16, UInt32.self))
+        let stringsOffset = Int(header(20, UInt32.self))
+        let stringsSize = Int(header(24, UInt32.self))
+        let totalSize = Int(header(28, UInt32.self))
+        let minimumRecord = expected == .processes ? ProcessField.size : FileAccessField.size
+        
+        // Bounds are checked once here so field reads need no checks of their own
+        guard magic == SnapshotReader.magic, version == SnapshotReader.version, kind == expected,
+              recordSize >= minimumRecord, recordSize % 8 == 0, recordsOffset % 8 == 0,
+              totalSize <= size, stringsSize > 0,
+              recordsOffset + count * recordSize <= stringsOffset,
+              stringsOffset + stringsSize <= totalSize,
+              region.load(fromByteOffset: stringsOffset + stringsSize - 1, as: UInt8.self) == 0 else {
+            munmap(region, size)
+            return nil
+        }
+        
+        self.region = region
+        self.mappedSize = size
+        self.kind = expected
+        self.count = count
+        self.recordSize = recordSize
+        self.recordsOffset = recordsOffset
+        self.stringsOffset = stringsOffset
+        self.stringsSize = stringsSize
+        self.generation = header(32, UInt64.self)
+        self.created = Date(timeIntervalSince1970: TimeInterval(header(40, UInt64.self)) / 1_000_000)
+    }
+    
+    deinit {
+        munmap(region, mappedSize)
+    }
+    
+    func field<T>(_ record: Int, _ offset: Int, as type: T.Type) -> T {
+        precondition(record >= 0 && record < count, "snapshot record out of range")
+        return region.load(fromByteOffset: recordsOffset + record * recordSize + offset, as: T.self)
+    }
+    
+    func string(_ record: Int, _ offset: Int) -> String {
+        let poolOffset = Int(field(record, offset, as: UInt32.self))
+        guard poolOffset < stringsSize else {
+            return ""
+        }
+        return String(cString: (region + stringsOffset + poolOffset).assumingMemoryBound(to: CChar.self))
     }
 }
 
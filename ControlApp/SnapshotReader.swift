@@ -0,0 +1,116 @@
+import Foundation
+
+// Read-only view of a bulk snapshot shared by the extension (get_snapshot).
+// The layout is defined in SystemExtension/SharedSnapshot.h; records are read
+// in place from the mapping, nothing is copied until a field is asked for.
+final class SnapshotReader {
+    static let magic: UInt32 = 0x4e535641
+    static let version: UInt16 = 1
+    
+    enum Kind: UInt16 {
+        case processes = 1
+        case fileAccess = 2
+        
+        var name: String {
+            return self == .processes ? "processes" : "file_access"
+        }
+    }
+    
+    // Byte offsets within a SnapshotProcess record
+    enum ProcessField {
+        static let pid = 0, ppid = 4, uid = 8, gid = 12
+        static let startTime = 16, cpuTime = 24, memoryUsage = 32
+        static let executablePath = 40, commandLine = 44, bundleIdentifier = 48
+        static let enrichmentTier = 52, flags = 53
+        static let size = 56
+    }
+    
+    // Byte offsets within a SnapshotFileAccess record
+    enum FileAccessField {
+        static let timestamp = 0, lastSeen = 8, pid = 16, count = 20
+        static let path = 24, accessType = 28, reason = 32, blocked = 36
+        static let size = 40
+    }
+    
+    static let systemProcess: UInt8 = 0x01
+    static let audioAccess: UInt8 = 0x02
+    static let videoAccess: UInt8 = 0x04
+    static let networkAccess: UInt8 = 0x08
+    static let fileSystemAccess: UInt8 = 0x10
+    
+    let kind: Kind
+    let count: Int
+    let generation: UInt64
+    let created: Date
+    
+    private let region: UnsafeMutableRawPointer
+    private let mappedSize: Int
+    private let recordSize: Int
+    private let recordsOffset: Int
+    private let stringsOffset: Int
+    private let stringsSize: Int
+    
+    // Nil unless the mapping is a complete snapshot of the expected kind and version
+    init?(shmem: xpc_object_t, expecting expected: Kind) {
+        var mapped: UnsafeMutableRawPointer?
+        let size = xpc_shmem_map(shmem, &mapped)
+        guard size >= 48, let region = mapped else {
+            return nil
+        }
+        mprotect(region, size, PROT_READ)
+        
+        func header<T>(_ offset: Int, _ type: T.Type) -> T {
+            return region.load(fromByteOffset: offset, as: T.self)
+        }
+        
+        let magic = header(0, UInt32.self)
+        let version = header(4, UInt16.self)
+        let kind = Kind(rawValue: header(6, UInt16.self))
+        let count = Int(header(8, UInt32.self))
+        let recordSize = Int(header(12, UInt32.self))
+        let recordsOffset = Int(header(16, UInt32.self))
+        let stringsOffset = Int(header(20, UInt32.self))
+        let stringsSize = Int(header(24, UInt32.self))
+        let totalSize = Int(header(28, UInt32.self))
+        let minimumRecord = expected == .processes ? ProcessField.size : FileAccessField.size
+        
+        // Bounds are checked once here so field reads need no checks of their own
+        guard magic == SnapshotReader.magic, version == SnapshotReader.version, kind == expected,
+              recordSize >= minimumRecord, recordSize % 8 == 0, recordsOffset % 8 == 0,
+              totalSize <= size, stringsSize > 0,
+              recordsOffset + count * recordSize <= stringsOffset,
+              stringsOffset + stringsSize <= totalSize,
+              region.load(fromByteOffset: stringsOffset + stringsSize - 1, as: UInt8.self) == 0 else {
+            munmap(region, size)
+            return nil
+        }
+        
+        self.region = region
+        self.mappedSize = size
+        self.kind = expected
+        self.count = count
+        self.recordSize = recordSize
+        self.recordsOffset = recordsOffset
+        self.stringsOffset = stringsOffset
+        self.stringsSize = stringsSize
+        self.generation = header(32, UInt64.self)
+        self.created = Date(timeIntervalSince1970: TimeInterval(header(40, UInt64.self)) / 1_000_000)
+    }
+    
+    deinit {
+        munmap(region, mappedSize)
+    }
+    
+    func field<T>(_ record: Int, _ offset: Int, as type: T.Type) -> T {
+        precondition(record >= 0 && record < count, "snapshot record out of range")
+        return region.load(fromByteOffset: recordsOffset + record * recordSize + offset, as: T.self)
+    }
+    
+    func string(_ record: Int, _ offset: Int) -> String {
+        let poolOffset = Int(field(record, offset, as: UInt32.self))
+        guard poolOffset < stringsSize else {
+            return ""
+        }
+        return String(cString: (region + stringsOffset + poolOffset).assumingMemoryBound(to: CChar.self))
+    }
+}
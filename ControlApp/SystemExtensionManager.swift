@@ -162,4 +162,31 @@ class SystemExtensionCommunicator {
             }
         }
     }
+    
+    // Bulk query results, mapped straight from the extension's shared snapshot
+    func fetchSnapshot(_ kind: SnapshotReader.Kind) -> SnapshotReader? {
+        guard let connection = connection else {
+            os_log("No XPC connection available", log: log, type: .error)
+            return nil
+        }
+        
+        let message = xpc_dictionary_create(nil, nil, 0)
+        xpc_dictionary_set_string(message, "command", "get_snapshot")
+        xpc_dictionary_set_string(message, "kind", kind.name)
+        
+        let reply = xpc_connection_send_message_with_reply_sync(connection, message)
+        guard xpc_get_type(reply) == XPC_TYPE_DICTIONARY, xpc_dictionary_get_bool(reply, "success"),
+              let shmem = xpc_dictionary_get_value(reply, "snapshot") else {
+            if xpc_get_type(reply) == XPC_TYPE_DICTIONARY, let errorString = xpc_dictionary_get_string(reply, "error") {
+                os_log("Snapshot request failed: %@", log: log, type: .error, String(cString: errorString))
+            }
+            return nil
+        }
+        
+        guard let snapshot = SnapshotReader(shmem: shmem, expecting: kind) else {
+            os_log("Snapshot from extension is malformed or a different version", log: log, type: .error)
+            return nil
+        }
+        return snapshot
+    }
 }
\ No newline at end of file
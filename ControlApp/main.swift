@@ -25,6 +25,8 @@ struct AudioVideoMonitorApp {
             uninstallExtension()
         case "status":
             getSystemStatus()
+        case "processes":
+            showRunningProcesses()
         case "control":
             if arguments.count < 3 {
                 print("Error: control command requires an action")
@@ -56,6 +58,7 @@ struct AudioVideoMonitorApp {
           install                Install the system extension
           uninstall              Remove the system extension
           status                 Show extension and device status
+          processes              List running processes the extension is tracking
           control <action>       Control audio/video devices
           cleanup <action>       System cleanup and optimization
         
@@ -81,6 +84,7 @@ struct AudioVideoMonitorApp {
           AudioVideoMonitor cleanup analyze
           AudioVideoMonitor cleanup full --dry-run
           AudioVideoMonitor status
+          AudioVideoMonitor processes
         """)
     }
     
@@ -246,6 +250,28 @@ struct AudioVideoMonitorApp {
         semaphore.wait()
     }
     
+    private func showRunningProcesses() {
+        guard let snapshot = communicator.fetchSnapshot(.processes) else {
+            print("❌ Could not get the process list from the extension")
+            exit(1)
+        }
+        
+        print("📋 Running Processes (\(snapshot.count))")
+        print("=" * 40)
+        print(String(format: "%-8s %-8s %-6s %-5s %s", "PID", "PPID", "UID", "A/V", "EXECUTABLE"))
+        
+        typealias Field = SnapshotReader.ProcessField
+        for i in 0..<snapshot.count {
+            let flags = snapshot.field(i, Field.flags, as: UInt8.self)
+            let audio = flags & SnapshotReader.audioAccess != 0 ? "🎤" : " "
+            let video = flags & SnapshotReader.videoAccess != 0 ? "📹" : " "
+            print(String(format: "%-8d %-8d %-6u ", snapshot.field(i, Field.pid, as: Int32.self),
+                         snapshot.field(i, Field.ppid, as: Int32.self),
+                         snapshot.field(i, Field.uid, as: UInt32.self)) +
+                  "\(audio)\(video)   \(snapshot.string(i, Field.executablePath))")
+        }
+    }
+    
     private func handleControlCommand(_ action: String) {
         let command: String
         let actionDescription: String
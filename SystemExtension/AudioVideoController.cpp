@@ -18,14 +18,36 @@
 AudioVideoController* AudioVideoController::instance = nullptr;
 
 AudioVideoController::AudioVideoController() 
-    : esClient(nullptr), microphoneEnabled(true), cameraEnabled(true), 
-      database(nullptr), monitoringEnabled(false) {
+    : microphoneEnabled(true), cameraEnabled(true), 
+      database(nullptr), librarySets(&stringTable, &pathClassifier), eventStream(&stringTable), readerDatabase(nullptr), monitoringEnabled(false), pipelineRunning(false),
+      pipelineEnqueued(0), pipelineProcessed(0), pipelineDropped(0),
+      pipelineBackpressure(0), pipelineLifecycleWaits(0), pipelineMaxDepth(0),
+      aggregationWindowNs((uint64_t)AGGREGATION_WINDOW_MS * 1000000), authPolicy(0),
+      cacheableResponses(0), kernelCacheClears(0), pathMutesApplied(false),
+      subscriptionProfile(SUBSCRIPTION_PROFILE_DEFAULT), opensFromNotify(false), mutedPaths(0), muteFailures(0),
+      subscriptionSwitches(0), enrichmentRunning(false), warmStart(&stringTable, &librarySets),
+      discoveryPending(0), processesDiscovered(0) {
     pthread_mutex_init(&databaseMutex, nullptr);
+    pthread_mutex_init(&readerMutex, nullptr);
+    pthread_mutex_init(&enrichmentMutex, nullptr);
+    pthread_mutex_init(&subscriptionMutex, nullptr);
+    pthread_cond_init(&enrichmentCond, nullptr);
+    memset(subscribedEvents, 0, sizeof(subscribedEvents));
+    for (int tier = 0; tier < ENRICH_TIER_COUNT; tier++) {
+        enrichmentQueued[tier].store(0, std::memory_order_relaxed);
+        enrichmentCompleted[tier].store(0, std::memory_order_relaxed);
+        enrichmentSkipped[tier].store(0, std::memory_order_relaxed);
+        enrichmentDropped[tier].store(0, std::memory_order_relaxed);
+    }
 }
 
 AudioVideoController::~AudioVideoController() {
     cleanup();
     pthread_mutex_destroy(&databaseMutex);
+    pthread_mutex_destroy(&readerMutex);
+    pthread_mutex_destroy(&enrichmentMutex);
+    pthread_mutex_destroy(&subscriptionMutex);
+    pthread_cond_destroy(&enrichmentCond);
 }
 
 AudioVideoController* AudioVideoController::getInstance() {
@@ -42,75 +64,53 @@ bool AudioVideoController::initialize() {
         return false;
     }
     
-    // Initialize Endpoint Security client with comprehensive event subscription
-    es_new_client_result_t result = es_new_client(&esClient, ^(es_client_t *client, const es_message_t *message) {
-        handleESEvent(client, message);
-    });
+    // Workers must be running before the ES client starts delivering events
+    if (!startEventPipeline()) {
+        syslog(LOG_ERR, "AudioVideoController: Failed to start event pipeline");
+        return false;
+    }
     
-    if (result != ES_NEW_CLIENT_RESULT_SUCCESS) {
-        syslog(LOG_ERR, "AudioVideoController: Failed to create ES client: %d", result);
+    // EXEC handlers hand off the expensive lookups to this thread
+    if (!startProcessEnricher()) {
+        syslog(LOG_ERR, "AudioVideoController: Failed to start process enricher");
         return false;
     }
     
-    // Subscribe to comprehensive set of events for maximum monitoring
-    es_event_type_t events[] = {
-        // Process events
-        ES_EVENT_TYPE_NOTIFY_EXEC,
-        ES_EVENT_TYPE_NOTIFY_EXIT,
-        ES_EVENT_TYPE_NOTIFY_FORK,
-        ES_EVENT_TYPE_NOTIFY_SIGNAL,
-        ES_EVENT_TYPE_NOTIFY_SETUID,
-        ES_EVENT_TYPE_NOTIFY_SETGID,
-        
-        // File system events
-        ES_EVENT_TYPE_AUTH_OPEN,
-        ES_EVENT_TYPE_NOTIFY_OPEN,
-        ES_EVENT_TYPE_NOTIFY_CLOSE,
-        ES_EVENT_TYPE_AUTH_CREATE,
-        ES_EVENT_TYPE_NOTIFY_CREATE,
-        ES_EVENT_TYPE_AUTH_UNLINK,
-        ES_EVENT_TYPE_NOTIFY_UNLINK,
-        ES_EVENT_TYPE_AUTH_RENAME,
-        ES_EVENT_TYPE_NOTIFY_RENAME,
-        ES_EVENT_TYPE_NOTIFY_WRITE,
-        ES_EVENT_TYPE_NOTIFY_ACCESS,
-        ES_EVENT_TYPE_NOTIFY_CHDIR,
-        ES_EVENT_TYPE_NOTIFY_STAT,
-        ES_EVENT_TYPE_NOTIFY_READDIR,
-        
-        // Memory events
-        ES_EVENT_TYPE_NOTIFY_MMAP,
-        ES_EVENT_TYPE_NOTIFY_MMAP,
-        ES_EVENT_TYPE_NOTIFY_MPROTECT,
-        
-        // Network events
-        ES_EVENT_TYPE_AUTH_KEXTLOAD,
-        ES_EVENT_TYPE_NOTIFY_KEXTLOAD,
-        
-        // Authentication events
-        ES_EVENT_TYPE_AUTH_EXEC,
-        ES_EVENT_TYPE_AUTH_FILE_PROVIDER_MATERIALIZE,
-        ES_EVENT_TYPE_AUTH_FILE_PROVIDER_UPDATE,
-        
-        // I/O events
-        ES_EVENT_TYPE_NOTIFY_IOKIT_OPEN,
-        ES_EVENT_TYPE_NOTIFY_DUP,
+    // Handlers publish to subscribed clients from the first event on
+    if (!eventStream.start()) {
+        syslog(LOG_ERR, "AudioVideoController: Failed to start event stream");
+        return false;
+    }
+    
+    // Initialize the Endpoint Security clients, one for AUTH and one for NOTIFY
+    // events; what each subscribes to comes from the profile below
+    for (int role = 0; role < ES_CLIENT_COUNT; role++) {
+        EsClientRole clientRole = (EsClientRole)role;
+        es_new_client_result_t result = es_new_client(&esClients[role].client, ^(es_client_t *client, const es_message_t *message) {
+            handleESEvent(client, message, clientRole);
+        });
         
-        // Additional security events
-        ES_EVENT_TYPE_AUTH_COPYFILE,
-        ES_EVENT_TYPE_NOTIFY_COPYFILE,
-        ES_EVENT_TYPE_AUTH_TRUNCATE,
-        ES_EVENT_TYPE_NOTIFY_TRUNCATE
-    };
+        if (result != ES_NEW_CLIENT_RESULT_SUCCESS) {
+            syslog(LOG_ERR, "AudioVideoController: Failed to create %s ES client: %d", esClientName(clientRole), result);
+            deleteESClients();
+            return false;
+        }
+    }
     
-    es_return_t subscribeResult = es_subscribe(esClient, events, sizeof(events) / sizeof(events[0]));
-    if (subscribeResult != ES_RETURN_SUCCESS) {
-        syslog(LOG_ERR, "AudioVideoController: Failed to subscribe to events: %d", subscribeResult);
-        es_delete_client(esClient);
-        esClient = nullptr;
+    // Only the starting profile's events leave the kernel; set_subscription_profile switches at runtime
+    std::string subscribeError;
+    if (!applySubscriptionProfile((SubscriptionProfile)SUBSCRIPTION_PROFILE_DEFAULT, &subscribeError)) {
+        syslog(LOG_ERR, "AudioVideoController: Failed to subscribe to events: %s", subscribeError.c_str());
+        deleteESClients();
         return false;
     }
     
+    // Processes still running from the last launch skip analysis in the first scan
+    std::string warmStartError;
+    if (!warmStart.load(WARM_START_PATH, &warmStartError)) {
+        syslog(LOG_INFO, "AudioVideoController: cold start: %s", warmStartError.c_str());
+    }
+    
     // Start comprehensive monitoring
     startProcessMonitoring();
     startNetworkMonitoring();
@@ -123,21 +123,34 @@ bool AudioVideoController::initialize() {
 void AudioVideoController::cleanup() {
     monitoringEnabled = false;
     
-    // Wait for monitoring threads to finish
-    if (processMonitorThread) {
-        pthread_join(processMonitorThread, nullptr);
-    }
-    if (networkMonitorThread) {
-        pthread_join(networkMonitorThread, nullptr);
-    }
-    if (fileSystemMonitorThread) {
-        pthread_join(fileSystemMonitorThread, nullptr);
-    }
+    // Waits only for a scan already running, never for a timer to come round
+    monitorScheduler.stop();
+    fileSystemWatcher.stop();
+    
+    deleteESClients();
+    
+    // A trace in progress keeps everything up to the last message
+    eventTrace.stop(nullptr);
+    
+    // No more producers once the client is gone; drain and stop the workers
+    stopEventPipeline();
+    stopProcessEnricher();
+    eventStream.stop();
     
-    if (esClient) {
-        es_delete_client(esClient);
-        esClient = nullptr;
+    // Nothing changes the table any more; the next launch starts from it
+    saveWarmStart();
+    
+    // Commit everything the workers produced before the connection goes away;
+    // the journal hands its last segment to the writer first
+    journal.stop();
+    databaseWriter.stop();
+    
+    pthread_mutex_lock(&readerMutex);
+    if (readerDatabase) {
+        sqlite3_close(readerDatabase);
+        readerDatabase = nullptr;
     }
+    pthread_mutex_unlock(&readerMutex);
     
     if (database) {
         sqlite3_close(database);
@@ -145,9 +158,25 @@ void AudioVideoController::cleanup() {
     }
 }
 
+// Subscriptions and mutes die with the clients
+void AudioVideoController::deleteESClients() {
+    pthread_mutex_lock(&subscriptionMutex);
+    for (int role = 0; role < ES_CLIENT_COUNT; role++) {
+        if (esClients[role].client) {
+            es_delete_client(esClients[role].client);
+            esClients[role].client = nullptr;
+        }
+        esClients[role].selfMuted = false;
+    }
+    memset(subscribedEvents, 0, sizeof(subscribedEvents));
+    pathMutesApplied = false;
+    mutedPaths.store(0, std::memory_order_relaxed);
+    pthread_mutex_unlock(&subscriptionMutex);
+}
+
 bool AudioVideoController::initializeDatabase() {
     // Create database in /var/log for comprehensive logging
-    const char* dbPath = "/var/log/AudioVideoMonitor.db";
+    const char* dbPath = DATABASE_PATH;
     
     pthread_mutex_lock(&databaseMutex);
     
@@ -158,67 +187,138 @@ bool AudioVideoController::initializeDatabase() {
         return false;
     }
     
+    // WAL must be on before the tables exist so every connection sees it
+    if (!configureDatabaseConnection(database, false)) {
+        sqlite3_close(database);
+        database = nullptr;
+        pthread_mutex_unlock(&databaseMutex);
+        return false;
+    }
+    
     // Create comprehensive tables for all monitoring data
     createDatabaseTables();
     
     pthread_mutex_unlock(&databaseMutex);
     
+    // All inserts go through the batched writer from here on
+    databaseWriter.setStringRoots(collectStringRoots, this);
+    if (!databaseWriter.start(database, &databaseMutex, &stringTable)) {
+        syslog(LOG_ERR, "Failed to start database writer");
+        return false;
+    }
+    
+    // Replays whatever a crash left in the journal, then takes the hot path.
+    // Without it rows still reach the writer, just without crash safety.
+    if (!journal.start(EVENT_JOURNAL_DIR, &stringTable, &databaseWriter)) {
+        syslog(LOG_WARNING, "Event journal unavailable; queueing rows for the database directly");
+    }
+    
+    pthread_mutex_lock(&readerMutex);
+    if (sqlite3_open_v2(dbPath, &readerDatabase, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        syslog(LOG_ERR, "Cannot open reader connection: %s", sqlite3_errmsg(readerDatabase));
+        sqlite3_close(readerDatabase);
+        readerDatabase = nullptr;
+    } else {
+        configureDatabaseConnection(readerDatabase, true);
+    }
+    pthread_mutex_unlock(&readerMutex);
+    
     syslog(LOG_INFO, "Database initialized successfully at %s", dbPath);
     return true;
 }
 
+// Schema 2 stores repeated strings once in `strings` and references them by ID;
+// views under the original table names keep existing queries working.
+// Schema 3 adds event_count and last_seen for coalesced file accesses.
+// Schema 4 splits the event tables into day partitions behind the same views.
+// Schema 5 adds the search index over paths and command lines.
+// Schema 6 adds the minute, hour and lifetime event count rollups.
+// Schema 7 adds the process lineage tree and its closure table.
+// Schema 8 stores environment values inline instead of as strings.
+#define DATABASE_SCHEMA_VERSION 8
+
+static bool executeSQL(sqlite3* database, const char* sql) {
+    char* errMsg = 0;
+    int result = sqlite3_exec(database, sql, 0, 0, &errMsg);
+    if (result != SQLITE_OK) {
+        syslog(LOG_ERR, "SQL error: %s", errMsg);
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
+
+static int databaseSchemaVersion(sqlite3* database) {
+    int version = 0;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database, "PRAGMA user_version", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            version = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return version;
+}
+
+static bool tableExists(sqlite3* database, const char* name) {
+    bool exists = false;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?",
+                           -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        exists = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+    }
+    return exists;
+}
+
+// Every early return leaves the schema version where it was, so the next start tries again
 void AudioVideoController::createDatabaseTables() {
+    bool unpartitioned = databaseSchemaVersion(database) < 4;
+    
+    // Schema 1 kept full text in every row; move those tables aside for migration.
+    // A statement that fails stops sqlite3_exec with the transaction still open.
+    bool migrating = databaseSchemaVersion(database) < DATABASE_SCHEMA_VERSION &&
+                     tableExists(database, "file_access");
+    if (migrating) {
+        syslog(LOG_INFO, "Migrating database to schema %d", DATABASE_SCHEMA_VERSION);
+        if (!executeSQL(database,
+                        "BEGIN;"
+                        "ALTER TABLE process_events RENAME TO process_events_v1;"
+                        "ALTER TABLE file_access RENAME TO file_access_v1;"
+                        "ALTER TABLE loaded_libraries RENAME TO loaded_libraries_v1;"
+                        "ALTER TABLE environment_vars RENAME TO environment_vars_v1;"
+                        "COMMIT;")) {
+            sqlite3_exec(database, "ROLLBACK;", 0, 0, 0);
+            syslog(LOG_ERR, "Database migration failed; schema 1 tables left as they were");
+            return;
+        }
+    }
+    
+    // Schema 2 file rows gain the coalescing columns; the view is rebuilt by the writer
+    if (!migrating && databaseSchemaVersion(database) == 2) {
+        if (!executeSQL(database,
+                        "BEGIN;"
+                        "ALTER TABLE file_access_rows ADD COLUMN event_count INTEGER NOT NULL DEFAULT 1;"
+                        "ALTER TABLE file_access_rows ADD COLUMN last_seen INTEGER;"
+                        "DROP VIEW IF EXISTS file_access;"
+                        "COMMIT;")) {
+            sqlite3_exec(database, "ROLLBACK;", 0, 0, 0);
+            return;
+        }
+    }
+    
+    // Renamed just now, or by an earlier start whose migration failed
+    bool legacyRows = tableExists(database, "file_access_v1");
+    
     const char* createTables[] = {
-        // Process events table
-        "CREATE TABLE IF NOT EXISTS process_events ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-        "timestamp INTEGER NOT NULL,"
-        "pid INTEGER NOT NULL,"
-        "ppid INTEGER,"
-        "executable_path TEXT,"
-        "command_line TEXT,"
-        "bundle_id TEXT,"
-        "uid INTEGER,"
-        "gid INTEGER,"
-        "event_type TEXT,"
-        "cpu_time INTEGER,"
-        "memory_usage INTEGER,"
-        "is_system_process BOOLEAN"
+        // Interned strings referenced by the *_id columns of the event tables
+        "CREATE TABLE IF NOT EXISTS strings ("
+        "id INTEGER PRIMARY KEY,"
+        "value TEXT NOT NULL"
         ");",
         
-        // File access table
-        "CREATE TABLE IF NOT EXISTS file_access ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-        "timestamp INTEGER NOT NULL,"
-        "pid INTEGER NOT NULL,"
-        "file_path TEXT NOT NULL,"
-        "access_type TEXT NOT NULL,"
-        "was_blocked BOOLEAN,"
-        "reason TEXT"
-        ");",
-        
-        // Network connections table
-        "CREATE TABLE IF NOT EXISTS network_connections ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-        "timestamp INTEGER NOT NULL,"
-        "pid INTEGER NOT NULL,"
-        "protocol TEXT,"
-        "local_address TEXT,"
-        "local_port INTEGER,"
-        "remote_address TEXT,"
-        "remote_port INTEGER,"
-        "state TEXT"
-        ");",
-        
-        // System calls table
-        "CREATE TABLE IF NOT EXISTS system_calls ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-        "timestamp INTEGER NOT NULL,"
-        "pid INTEGER NOT NULL,"
-        "syscall_name TEXT NOT NULL,"
-        "arguments TEXT,"
-        "return_value TEXT"
-        ");",
+        "INSERT OR IGNORE INTO strings (id, value) VALUES (0, '');",
         
         // Process memory table
         "CREATE TABLE IF NOT EXISTS process_memory ("
@@ -229,71 +329,230 @@ void AudioVideoController::createDatabaseTables() {
         "permissions TEXT,"
         "size INTEGER,"
         "file_path TEXT"
-        ");",
-        
-        // Loaded libraries table
-        "CREATE TABLE IF NOT EXISTS loaded_libraries ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-        "timestamp INTEGER NOT NULL,"
-        "pid INTEGER NOT NULL,"
-        "library_path TEXT NOT NULL,"
-        "load_address TEXT"
-        ");",
-        
-        // Environment variables table
-        "CREATE TABLE IF NOT EXISTS environment_vars ("
-        "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-        "timestamp INTEGER NOT NULL,"
-        "pid INTEGER NOT NULL,"
-        "var_name TEXT NOT NULL,"
-        "var_value TEXT"
         ");"
     };
     
     for (const char* sql : createTables) {
-        char* errMsg = 0;
-        int result = sqlite3_exec(database, sql, 0, 0, &errMsg);
-        if (result != SQLITE_OK) {
-            syslog(LOG_ERR, "SQL error: %s", errMsg);
-            sqlite3_free(errMsg);
+        executeSQL(database, sql);
+    }
+    
+    // Before schema 4 every event table was a single table. Those are still
+    // created here for the migrations below, then adopted as today's partition;
+    // the writer creates the day tables and the views over them from then on.
+    // Schema 1 rows still waiting in *_v1 tables go the same way.
+    if (unpartitioned || legacyRows) {
+        const char* legacyTables[] = {
+            // Process events table
+            "CREATE TABLE IF NOT EXISTS process_event_rows ("
+            "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "timestamp INTEGER NOT NULL,"
+            "pid INTEGER NOT NULL,"
+            "ppid INTEGER,"
+            "executable_path_id INTEGER,"
+            "command_line_id INTEGER,"
+            "bundle_id_id INTEGER,"
+            "uid INTEGER,"
+            "gid INTEGER,"
+            "event_type_id INTEGER,"
+            "cpu_time INTEGER,"
+            "memory_usage INTEGER,"
+            "is_system_process BOOLEAN"
+            ");",
+            
+            // File access table
+            "CREATE TABLE IF NOT EXISTS file_access_rows ("
+            "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "timestamp INTEGER NOT NULL,"
+            "pid INTEGER NOT NULL,"
+            "path_id INTEGER NOT NULL,"
+            "access_type_id INTEGER NOT NULL,"
+            "was_blocked BOOLEAN,"
+            "reason_id INTEGER,"
+            "event_count INTEGER NOT NULL DEFAULT 1,"
+            "last_seen INTEGER"
+            ");",
+            
+            // Network connections table
+            "CREATE TABLE IF NOT EXISTS network_connections ("
+            "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "timestamp INTEGER NOT NULL,"
+            "pid INTEGER NOT NULL,"
+            "protocol TEXT,"
+            "local_address TEXT,"
+            "local_port INTEGER,"
+            "remote_address TEXT,"
+            "remote_port INTEGER,"
+            "state TEXT"
+            ");",
+            
+            // System calls table
+            "CREATE TABLE IF NOT EXISTS system_calls ("
+            "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "timestamp INTEGER NOT NULL,"
+            "pid INTEGER NOT NULL,"
+            "syscall_name TEXT NOT NULL,"
+            "arguments TEXT,"
+            "return_value TEXT"
+            ");",
+            
+            // Loaded libraries table
+            "CREATE TABLE IF NOT EXISTS loaded_library_rows ("
+            "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "timestamp INTEGER NOT NULL,"
+            "pid INTEGER NOT NULL,"
+            "library_path_id INTEGER NOT NULL,"
+            "load_address TEXT"
+            ");",
+            
+            // Environment variables table
+            "CREATE TABLE IF NOT EXISTS environment_var_rows ("
+            "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "timestamp INTEGER NOT NULL,"
+            "pid INTEGER NOT NULL,"
+            "name_id INTEGER NOT NULL,"
+            "value_id INTEGER,"
+            "value TEXT"
+            ");"
+        };
+        
+        for (const char* sql : legacyTables) {
+            executeSQL(database, sql);
+        }
+        
+        if (legacyRows && !migrateLegacyTables()) {
+            return;
+        }
+        
+        // Create indices for better query performance
+        const char* indices[] = {
+            "CREATE INDEX IF NOT EXISTS idx_process_pid ON process_event_rows(pid);",
+            "CREATE INDEX IF NOT EXISTS idx_process_timestamp ON process_event_rows(timestamp);",
+            "CREATE INDEX IF NOT EXISTS idx_file_pid ON file_access_rows(pid);",
+            "CREATE INDEX IF NOT EXISTS idx_file_path ON file_access_rows(path_id);",
+            "CREATE INDEX IF NOT EXISTS idx_network_pid ON network_connections(pid);",
+            "CREATE INDEX IF NOT EXISTS idx_syscall_pid ON system_calls(pid);"
+        };
+        
+        for (const char* sql : indices) {
+            sqlite3_exec(database, sql, 0, 0, 0);
         }
     }
     
-    // Create indices for better query performance
-    const char* indices[] = {
-        "CREATE INDEX IF NOT EXISTS idx_process_pid ON process_events(pid);",
-        "CREATE INDEX IF NOT EXISTS idx_process_timestamp ON process_events(timestamp);",
-        "CREATE INDEX IF NOT EXISTS idx_file_pid ON file_access(pid);",
-        "CREATE INDEX IF NOT EXISTS idx_file_path ON file_access(file_path);",
-        "CREATE INDEX IF NOT EXISTS idx_network_pid ON network_connections(pid);",
-        "CREATE INDEX IF NOT EXISTS idx_syscall_pid ON system_calls(pid);"
-    };
+    bool ready = createRetentionTables(database);
+    // Before adoption, which copies the partition columns from an older table
+    if (ready && databaseSchemaVersion(database) < 8) {
+        ready = addEnvironmentValueColumn(database);
+    }
+    if (ready && (unpartitioned || legacyRows)) {
+        ready = adoptUnpartitionedTables(database, partitionDayFor(time(nullptr)));
+    }
+    // After adoption, so the adopted partitions are queued for search and rollup backfill
+    ready = ready && createSearchIndex(database) && createRollupTables(database) &&
+            createLineageTables(database, time(nullptr));
+    if (!ready) {
+        return;
+    }
+    
+    char versionSQL[64];
+    snprintf(versionSQL, sizeof(versionSQL), "PRAGMA user_version = %d;", DATABASE_SCHEMA_VERSION);
+    executeSQL(database, versionSQL);
+}
+
+// Copies schema 1 rows into the interned tables. On failure the *_v1 tables
+// are left in place so no history is lost, and the next start retries.
+bool AudioVideoController::migrateLegacyTables() {
+    const char* migration =
+        "BEGIN;"
+        
+        // Temporary lookup index; strings.value is otherwise unindexed on disk
+        "CREATE INDEX migrate_strings_value ON strings(value);"
+        
+        "INSERT INTO strings (value) SELECT v FROM ("
+        "SELECT executable_path AS v FROM process_events_v1 "
+        "UNION SELECT command_line FROM process_events_v1 "
+        "UNION SELECT bundle_id FROM process_events_v1 "
+        "UNION SELECT event_type FROM process_events_v1 "
+        "UNION SELECT file_path FROM file_access_v1 "
+        "UNION SELECT access_type FROM file_access_v1 "
+        "UNION SELECT reason FROM file_access_v1 "
+        "UNION SELECT library_path FROM loaded_libraries_v1 "
+        "UNION SELECT var_name FROM environment_vars_v1 "
+        "UNION SELECT var_value FROM environment_vars_v1"
+        ") WHERE v IS NOT NULL AND v != '';"
+        
+        "INSERT INTO process_event_rows (id, timestamp, pid, ppid, executable_path_id, "
+        "command_line_id, bundle_id_id, uid, gid, event_type_id, cpu_time, memory_usage, "
+        "is_system_process) "
+        "SELECT id, timestamp, pid, ppid, "
+        "(SELECT id FROM strings WHERE value = COALESCE(executable_path, '')), "
+        "(SELECT id FROM strings WHERE value = COALESCE(command_line, '')), "
+        "(SELECT id FROM strings WHERE value = COALESCE(bundle_id, '')), "
+        "uid, gid, "
+        "(SELECT id FROM strings WHERE value = COALESCE(event_type, '')), "
+        "cpu_time, memory_usage, is_system_process FROM process_events_v1;"
+        
+        "INSERT INTO file_access_rows (id, timestamp, pid, path_id, access_type_id, "
+        "was_blocked, reason_id) "
+        "SELECT id, timestamp, pid, "
+        "(SELECT id FROM strings WHERE value = COALESCE(file_path, '')), "
+        "(SELECT id FROM strings WHERE value = COALESCE(access_type, '')), "
+        "was_blocked, "
+        "(SELECT id FROM strings WHERE value = COALESCE(reason, '')) FROM file_access_v1;"
+        
+        "INSERT INTO loaded_library_rows (id, timestamp, pid, library_path_id, load_address) "
+        "SELECT id, timestamp, pid, "
+        "(SELECT id FROM strings WHERE value = COALESCE(library_path, '')), "
+        "load_address FROM loaded_libraries_v1;"
+        
+        "INSERT INTO environment_var_rows (id, timestamp, pid, name_id, value_id) "
+        "SELECT id, timestamp, pid, "
+        "(SELECT id FROM strings WHERE value = COALESCE(var_name, '')), "
+        "(SELECT id FROM strings WHERE value = COALESCE(var_value, '')) FROM environment_vars_v1;"
+        
+        "DROP INDEX migrate_strings_value;"
+        "DROP TABLE process_events_v1;"
+        "DROP TABLE file_access_v1;"
+        "DROP TABLE loaded_libraries_v1;"
+        "DROP TABLE environment_vars_v1;"
+        "COMMIT;";
     
-    for (const char* sql : indices) {
-        sqlite3_exec(database, sql, 0, 0, 0);
+    if (!executeSQL(database, migration)) {
+        sqlite3_exec(database, "ROLLBACK;", 0, 0, 0);
+        syslog(LOG_ERR, "Database migration failed; original rows kept in *_v1 tables");
+        return false;
     }
+    syslog(LOG_INFO, "Database migration complete");
+    return true;
 }
 
 bool AudioVideoController::disableMicrophone() {
     microphoneEnabled = false;
+    authPolicy.fetch_or(AUTH_POLICY_MICROPHONE_BLOCKED, std::memory_order_release);
+    invalidateAuthCache();
     syslog(LOG_INFO, "AudioVideoController: Microphone disabled");
     return controlAudioDevices(false);
 }
 
 bool AudioVideoController::enableMicrophone() {
     microphoneEnabled = true;
+    authPolicy.fetch_and(~AUTH_POLICY_MICROPHONE_BLOCKED, std::memory_order_release);
+    invalidateAuthCache();
     syslog(LOG_INFO, "AudioVideoController: Microphone enabled");
     return controlAudioDevices(true);
 }
 
 bool AudioVideoController::disableCamera() {
     cameraEnabled = false;
+    authPolicy.fetch_or(AUTH_POLICY_CAMERA_BLOCKED, std::memory_order_release);
+    invalidateAuthCache();
     syslog(LOG_INFO, "AudioVideoController: Camera disabled");
     return controlVideoDevices(false);
 }
 
 bool AudioVideoController::enableCamera() {
     cameraEnabled = true;
+    authPolicy.fetch_and(~AUTH_POLICY_CAMERA_BLOCKED, std::memory_order_release);
+    invalidateAuthCache();
     syslog(LOG_INFO, "AudioVideoController: Camera enabled");
     return controlVideoDevices(true);
 }
@@ -367,6 +626,7 @@ bool AudioVideoController::shouldBlockProcess(const es_process_t* process) {
 }
 
 void AudioVideoController::logAccessAttempt(const es_process_t* process, const char* deviceType) {
-    syslog(LOG_INFO, "Process %s attempted to access %s", 
-           process->executable->path.data, deviceType);
+    const es_string_token_t& path = process->executable->path;
+    EXT_LOG_DEFAULT(LOG_CATEGORY_DEVICE, "%{private}.*s attempted to access the %{public}s",
+                    (int)path.length, path.data, deviceType);
 }
\ No newline at end of file
@@ -19,57 +19,76 @@
 #include <bsm/audit_kevents.h>
 #include <bsm/libbsm.h>
 #include <sqlite3.h>
+#include <atomic>
 #include <fstream>
 #include <vector>
+#include <deque>
 #include <map>
 #include <string>
 #include <syslog.h>
+#include "MonitoringTypes.h"
+#include "EventPipeline.h"
+#include "LatencyHistogram.h"
+#include "VerdictCache.h"
+#include "DatabaseWriter.h"
+#include "StringTable.h"
+#include "ProcessTracker.h"
+#include "ProcessTable.h"
+#include "NetworkTracker.h"
+#include "EventStream.h"
+#include "SharedSnapshot.h"
+#include "EventJournal.h"
+#include "ProcessEnrichment.h"
+#include "ProcessFds.h"
+#include "PathClassifier.h"
+#include "LibrarySetCache.h"
+#include "FileAccessRing.h"
+#include "SubscriptionProfiles.h"
+#include "EventTrace.h"
+#include "Logging.h"
+#include "Metrics.h"
+#include "MonitorScheduler.h"
+#include "FileSystemWatcher.h"
+#include "WarmStart.h"
 
-// Comprehensive process information structure
-struct ProcessInfo {
-    pid_t pid;
-    pid_t ppid;
-    std::string executablePath;
-    std::string commandLine;
-    std::string bundleIdentifier;
-    uid_t uid;
-    gid_t gid;
-    uint64_t startTime;
-    uint64_t cpuTime;
-    uint64_t memoryUsage;
-    std::vector<std::string> openFiles;
-    std::vector<std::string> networkConnections;
-    std::vector<std::string> loadedLibraries;
-    std::map<std::string, std::string> environmentVariables;
-    bool isSystemProcess;
-    bool hasAudioAccess;
-    bool hasVideoAccess;
-    bool hasNetworkAccess;
-    bool hasFileSystemAccess;
-};
+// Where the event database lives; replay builds point it at a scratch directory
+#ifndef DATABASE_PATH
+#define DATABASE_PATH "/var/log/AudioVideoMonitor.db"
+#endif
+
+// How often the process table is reconciled against the kernel's process list
+#ifndef PROCESS_SCAN_INTERVAL_MS
+#define PROCESS_SCAN_INTERVAL_MS 5000
+#endif
+
+// New processes the scan analyzes per run, and how soon it runs again while
+// more are waiting; launch without a warm start works off ~600 this way
+#ifndef PROCESS_DISCOVERY_BATCH
+#define PROCESS_DISCOVERY_BATCH 16
+#endif
 
-// Network connection information
-struct NetworkConnection {
-    std::string protocol;
-    std::string localAddress;
-    int localPort;
-    std::string remoteAddress;
-    int remotePort;
-    std::string state;
-    pid_t pid;
-    uint64_t timestamp;
+#ifndef PROCESS_DISCOVERY_INTERVAL_MS
+#define PROCESS_DISCOVERY_INTERVAL_MS 250
+#endif
+
+// AUTH response latency for one event type
+struct AuthLatencyStats {
+    es_event_type_t eventType;
+    LatencySummary latency;
 };
 
-// File access information
-struct FileAccess {
-    pid_t pid;
-    std::string filePath;
-    std::string accessType;
-    uint64_t timestamp;
-    bool wasBlocked;
-    std::string reason;
+// Verdict cache effectiveness
+struct AuthCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t cacheableResponses;
+    uint64_t kernelCacheClears;
 };
 
+// Bits of the in-memory policy snapshot consulted by the AUTH fast path
+#define AUTH_POLICY_MICROPHONE_BLOCKED  (1u << 0)
+#define AUTH_POLICY_CAMERA_BLOCKED      (1u << 1)
+
 class AudioVideoController {
 public:
     AudioVideoController();
@@ -102,39 +121,208 @@ public:
     // Data collection methods
     std::vector<ProcessInfo> getAllProcesses();
     ProcessInfo getProcessInfo(pid_t pid);
+    
+    // Process table changes after `since`; false means the caller must resync from getAllProcesses
+    bool getProcessChanges(uint64_t since, std::vector<ProcessChange>* changes, uint64_t* generation);
     std::vector<NetworkConnection> getNetworkConnections();
+    NetworkSamplerStats getNetworkSamplerStats() const { return networkTracker.getStats(); }
     std::vector<FileAccess> getFileAccessHistory();
     
+    // Days each event table keeps; the writer applies a change between batches
+    bool setRetention(const char* table, int days, std::string* error);
+    std::vector<RetentionSetting> getRetention();
+    // Paths and command lines containing `term`, most recently written first
+    bool searchHistory(const char* term, uint32_t kinds, size_t limit,
+                       std::vector<SearchMatch>* matches, std::string* error);
+    // Ancestors and descendants of a process, from the live tree if it's
+    // there (*live) and otherwise from the persisted one; pidVersion 0 is
+    // the latest process with the pid
+    bool getLineage(pid_t pid, uint32_t pidVersion, size_t limit, std::vector<LineageEntry>* ancestors,
+                    std::vector<LineageEntry>* descendants, bool* live, std::string* error);
+    LineageStats getLineageStats() const { return lineage.getStats(); }
+    
+    // Event counts from the rollup tables; see queryRollups
+    bool getRollups(int resolution, RollupDimension dimension, int64_t since, bool series, size_t limit,
+                    std::vector<RollupEntry>* entries, std::string* error);
+    // Newest in-memory file accesses numbered at or after `since`, oldest first;
+    // returns the `since` for the next call
+    uint64_t getRecentFileAccess(uint64_t since, size_t limit, std::vector<FileAccess>* accesses);
+    
+    // getAllProcesses and getFileAccessHistory as flat shared snapshots, rebuilt
+    // only when the data has changed; null if one couldn't be built
+    std::shared_ptr<const SharedSnapshot> getProcessSnapshot();
+    std::shared_ptr<const SharedSnapshot> getFileAccessSnapshot();
+    SnapshotCacheStats getSnapshotStats() const { return snapshots.getStats(); }
+    EventPipelineStats getEventPipelineStats() const;
+    MetricsSnapshot getMetrics() const { return metrics.snapshot(); }
+    std::vector<MonitorTaskStats> getMonitorStats() const { return monitorScheduler.getStats(); }
+    FileSystemWatcherStats getFileSystemWatcherStats() const { return fileSystemWatcher.getStats(); }
+    WarmStartStats getWarmStartStats() const;
+    
+    // Records every ES message the callback sees to a trace file for replay
+    bool startEventTrace(std::string* error);
+    EventTraceStats stopEventTrace();
+    EventTraceStats getEventTraceStats() const { return eventTrace.getStats(); }
+    
+    // Coalescing window for repeated file accesses; 0 logs every access on its own
+    void setAggregationWindow(uint64_t windowMs);
+    AggregationStats getAggregationStats() const;
+    std::vector<AuthLatencyStats> getAuthLatencyStats() const;
+    AuthCacheStats getAuthCacheStats() const;
+    LibrarySetCacheStats getLibrarySetStats() const { return librarySets.getStats(); }
+    ProcessTableStats getProcessTableStats() const { return processTable.getStats(); }
+    
+    // Path classification rules; replacing them takes effect without a restart
+    bool setPathRules(const char* text, std::string* error);
+    std::string getPathRules() const;
+    uint32_t getPathRulesGeneration() const { return pathClassifier.generation(); }
+    std::vector<EnrichmentTierStats> getEnrichmentStats() const;
+    
+    // Live events for XPC clients; the sink runs on the stream's flusher thread
+    uint64_t subscribeEvents(const EventFilter& filter, EventSink sink) { return eventStream.subscribe(filter, sink); }
+    bool unsubscribeEvents(uint64_t client) { return eventStream.unsubscribe(client); }
+    void eventBatchDelivered(uint64_t client) { eventStream.delivered(client); }
+    EventStreamStats getEventStreamStats() const { return eventStream.getStats(); }
+    const char* resolveString(uint32_t id, size_t* length) const { return stringTable.data(id, length); }
+    const char* streamSubject(const StreamEvent& event, char* buffer, size_t size, size_t* length) const {
+        return streamEventSubject(&stringTable, event, buffer, size, length);
+    }
+    
+    // Switches the ES subscription and mutes to a named profile at runtime
+    bool setSubscriptionProfile(const char* name, std::string* error);
+    SubscriptionStats getSubscriptionStats() const;
+    std::vector<EsClientStats> getEsClientStats();
+    
     // Logging and database methods
     bool initializeDatabase();
     void logProcessEvent(const ProcessInfo& process, const std::string& event);
     void logNetworkEvent(const NetworkConnection& connection);
     void logFileAccess(const FileAccess& access);
     void logSystemCall(pid_t pid, const std::string& syscall, const std::string& args);
+    DatabaseWriterStats getDatabaseWriterStats();
+    EventJournalStats getEventJournalStats() const { return journal.getStats(); }
+    StringTableStats getStringTableStats() const;
     
     // Singleton access
     static AudioVideoController* getInstance();
     
 private:
-    es_client_t* esClient;
+    // One ES client per role. Each has its own callback queue, so AUTH answers
+    // don't wait behind NOTIFY deliveries, and its own subscriptions and mutes.
+    struct EsClientState {
+        es_client_t* client;
+        bool selfMuted;                             // guarded by subscriptionMutex
+        std::atomic<uint64_t> messages;
+        std::atomic<uint64_t> missedDeadlines;
+        std::atomic<uint64_t> minDeadlineMarginNs;
+        LatencyHistogram deliveryLatency;
+        LatencyHistogram deadlineMargin;
+        
+        EsClientState()
+            : client(nullptr), selfMuted(false), messages(0), missedDeadlines(0),
+              minDeadlineMarginNs(UINT64_MAX) {}
+    };
+    EsClientState esClients[ES_CLIENT_COUNT];
     bool microphoneEnabled;
     bool cameraEnabled;
     sqlite3* database;
     pthread_mutex_t databaseMutex;
+    DatabaseWriter databaseWriter;
+    
+    // Every path, executable and library string the extension holds, interned once
+    StringTable stringTable;
+    
+    // Device, library and system path rules compiled into one automaton
+    PathClassifier pathClassifier;
+    
+    // Library lists shared by every process running the same image
+    LibrarySetCache librarySets;
+    
+    // Live feed for subscribe_events clients; a single load when nobody listens
+    EventStream eventStream;
+    
+    // Latest bulk-query snapshots, shared by every client that asks
+    SnapshotCache snapshots;
+    
+    // Process and file events land here first; compacted into SQLite in bulk
+    EventJournal journal;
+    
+    // Read-only connection for queries; never contends with the writer
+    sqlite3* readerDatabase;
+    pthread_mutex_t readerMutex;
     bool monitoringEnabled;
     
-    // Monitoring threads
-    pthread_t processMonitorThread;
-    pthread_t networkMonitorThread;
-    pthread_t fileSystemMonitorThread;
+    // Periodic scans on dispatch timers; file system changes from FSEvents
+    MonitorScheduler monitorScheduler;
+    FileSystemWatcher fileSystemWatcher;
     
     // Callback for ES events
-    static void handleESEvent(es_client_t* client, const es_message_t* message);
+    static void handleESEvent(es_client_t* client, const es_message_t* message, EsClientRole role);
+    
+    // Asynchronous event pipeline between the ES callback and the handlers
+    EventWorker eventWorkers[EVENT_PIPELINE_WORKERS];
+    std::atomic<bool> pipelineRunning;
+    std::atomic<uint64_t> pipelineEnqueued;
+    std::atomic<uint64_t> pipelineProcessed;
+    std::atomic<uint64_t> pipelineDropped;
+    std::atomic<uint64_t> pipelineBackpressure;
+    std::atomic<uint64_t> pipelineLifecycleWaits;
+    std::atomic<uint64_t> pipelineMaxDepth;
+    LatencyHistogram pipelineQueueLatency;
+    LatencyHistogram pipelineHandlerLatency;
+    
+    // Per-type event and per-call latencies behind get_metrics
+    HotPathMetrics metrics;
+    
+    // Off unless start_trace asked for it; one relaxed load per message then
+    EventTraceWriter eventTrace;
+    
+    bool startEventPipeline();
+    void stopEventPipeline();
+    bool enqueueEvent(const es_message_t* message, AuthVerdict verdict);
+    void dispatchEvent(const QueuedEvent& event);
+    static void* eventWorkerThread(void* arg);
+    
+    // Coalescing and rate limits, run by each worker for the pids it owns
+    std::atomic<uint64_t> aggregationWindowNs;
+    
+    EventWorker& workerFor(pid_t pid) { return eventWorkers[(uint32_t)pid % EVENT_PIPELINE_WORKERS]; }
+    bool recordFileAccess(const FileAccessRecord& access, EventClass eventClass);
+    void sweepAggregator(EventWorker& worker);
+    void writeAggregated(EventWorker& worker);
+    
+    // AUTH fast path: verdict from the policy snapshot, answered before any enrichment
+    std::atomic<uint32_t> authPolicy;
+    VerdictCache verdictCache;
+    std::atomic<uint64_t> cacheableResponses;
+    std::atomic<uint64_t> kernelCacheClears;
+    LatencyHistogram authLatency[ES_EVENT_TYPE_LAST];
+    
+    // generation is the verdict cache's when the policy was read; the response
+    // is only cacheable if it's still current when sent
+    AuthVerdict decideAuthVerdict(const es_message_t* message, bool* cacheable, uint32_t* generation);
+    void respondToAuthEvent(es_client_t* client, const es_message_t* message,
+                            AuthVerdict verdict, bool cacheable, uint32_t generation, EsClientRole role);
+    void invalidateAuthCache();
+    
+    // Events the clients are subscribed to and the path mutes of the active profile
+    pthread_mutex_t subscriptionMutex;  // guards esClients changes and everything below
+    bool subscribedEvents[ES_EVENT_TYPE_LAST];
+    bool pathMutesApplied;
+    std::atomic<uint8_t> subscriptionProfile;
+    std::atomic<bool> opensFromNotify;  // NOTIFY_OPEN is subscribed; AUTH_OPEN logs only denials
+    std::atomic<uint64_t> mutedPaths;
+    std::atomic<uint64_t> muteFailures;
+    std::atomic<uint64_t> subscriptionSwitches;
+    
+    bool applySubscriptionProfile(SubscriptionProfile profile, std::string* error);
+    void deleteESClients();
+    void updatePathMutes(const SubscriptionProfileSpec& spec, bool mute);
     
     // Enhanced event handlers
     void handleProcessExec(const es_message_t* message);
     void handleProcessExit(const es_message_t* message);
-    void handleFileOpen(const es_message_t* message);
+    void handleFileOpen(const es_message_t* message, AuthVerdict verdict);
     void handleFileWrite(const es_message_t* message);
     void handleFileDelete(const es_message_t* message);
     void handleNetworkConnect(const es_message_t* message);
@@ -151,26 +339,48 @@ private:
     
     // Process analysis methods
     ProcessInfo analyzeProcess(pid_t pid);
-    std::vector<std::string> getProcessOpenFiles(pid_t pid);
-    std::vector<std::string> getProcessNetworkConnections(pid_t pid);
-    std::vector<std::string> getProcessLoadedLibraries(pid_t pid);
+    bool getProcessTaskInfo(pid_t pid, struct proc_taskallinfo* taskInfo);
+    void getProcessDescriptors(pid_t pid, std::vector<std::string>* openFiles,
+                               std::vector<std::string>* connections);
+    uint32_t getProcessLibrarySet(pid_t pid, const uint8_t* cdhash);
+    bool libraryKeyFor(pid_t pid, const uint8_t* cdhash, LibrarySetKey* key);
     std::map<std::string, std::string> getProcessEnvironment(pid_t pid);
     std::string getProcessCommandLine(pid_t pid);
     uint64_t getProcessMemoryUsage(pid_t pid);
     uint64_t getProcessCPUTime(pid_t pid);
     
+    // Tiered enrichment: tier 0 inline in the EXEC handler, tiers 1 and 2 on their own thread
+    pthread_t enrichmentThread;
+    pthread_mutex_t enrichmentMutex;    // guards enrichmentQueues and enrichmentRunning
+    pthread_cond_t enrichmentCond;
+    bool enrichmentRunning;
+    std::deque<EnrichmentTask> enrichmentQueues[ENRICH_TIER_COUNT];
+    LatencyHistogram enrichmentLatency[ENRICH_TIER_COUNT];
+    std::atomic<uint64_t> enrichmentQueued[ENRICH_TIER_COUNT];
+    std::atomic<uint64_t> enrichmentCompleted[ENRICH_TIER_COUNT];
+    std::atomic<uint64_t> enrichmentSkipped[ENRICH_TIER_COUNT];
+    std::atomic<uint64_t> enrichmentDropped[ENRICH_TIER_COUNT];
+    
+    bool startProcessEnricher();
+    void stopProcessEnricher();
+    void scheduleEnrichment(pid_t pid, uint64_t kernelStartUsec, uint8_t tier, uint64_t delayMs,
+                            const uint8_t* cdhash);
+    bool enrichProcess(const EnrichmentTask& task);
+    static void* processEnrichmentThread(void* arg);
+    
     // Network monitoring methods
-    static void* networkMonitoringThread(void* arg);
+    static uint32_t networkScanTask(void* context);
     void scanNetworkConnections();
-    std::vector<NetworkConnection> parseNetstat();
     
     // File system monitoring methods
-    static void* fileSystemMonitoringThread(void* arg);
-    void monitorFileSystemEvents();
+    static void fileSystemChanged(void* context, const char* path, size_t length, FileSystemChange change);
+    void recordFileSystemChange(const char* path, size_t length, FileSystemChange change);
     
     // Process monitoring methods
-    static void* processMonitoringThread(void* arg);
+    static uint32_t processScanTask(void* context);
     void scanRunningProcesses();
+    bool discoverProcesses(size_t limit);
+    void saveWarmStart();
     void detectProcessChanges();
     
     // Memory analysis methods
@@ -180,6 +390,7 @@ private:
     
     // Database operations
     void createDatabaseTables();
+    bool migrateLegacyTables();
     void insertProcessEvent(const ProcessInfo& process, const std::string& event);
     void insertNetworkEvent(const NetworkConnection& connection);
     void insertFileEvent(const FileAccess& access);
@@ -189,12 +400,36 @@ private:
     bool shouldBlockProcess(const es_process_t* process);
     void logAccessAttempt(const es_process_t* process, const char* deviceType);
     bool isSystemCriticalProcess(pid_t pid);
+    bool isSystemPath(const char* path, size_t length) const;
     bool hasElevatedPrivileges(pid_t pid);
     
     // Data structures for tracking
-    std::map<pid_t, ProcessInfo> runningProcesses;
+    ProcessTable processTable;          // readers never lock; records its own change log
+    ProcessTracker processTracker;      // owned by the process scan queue
+    ProcessLineage lineage;             // fed by FORK, EXEC and EXIT on any worker
+    NetworkTracker networkTracker;      // owned by the network scan queue
     std::vector<NetworkConnection> activeConnections;
-    std::vector<FileAccess> recentFileAccess;
+    FileAccessRing recentFileAccess;    // written by the event workers, read without locks
+    
+    // Last run's table, matched against the first scan; processes it doesn't
+    // cover wait in the backlog and are analyzed a batch per scan run
+    WarmStartSnapshot warmStart;
+    std::deque<ProcessIdentity> discoveryBacklog;   // owned by the process scan queue
+    std::atomic<uint64_t> discoveryPending;
+    std::atomic<uint64_t> processesDiscovered;
+    
+    // Conversions between the public string form and the interned form
+    ProcessRecord internProcess(const ProcessInfo& info);
+    ProcessInfo expandProcess(const ProcessRecord& record) const;
+    FileAccess expandFileAccess(const FileAccessRecord& record) const;
+    void logProcessEvent(const ProcessRecord& process, const char* event);
+    void logProcessDetails(const ProcessRecord& process);
+    void streamProcessEvent(const ProcessRecord& process, uint32_t eventId);
+    void logFileAccess(const FileAccessRecord& access);
+    void rememberFileAccess(const FileAccessRecord& access);
+    // String IDs held by the process table, library sets, lineage tree and
+    // recent file accesses, for the writer's string collection
+    static void collectStringRoots(void* context, std::vector<uint32_t>* roots);
     
     // Singleton instance
     static AudioVideoController* instance;
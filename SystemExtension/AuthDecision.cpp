@@ -0,0 +1,175 @@
+// AUTH fast path: decide from the in-memory policy snapshot and respond immediately
+#include "AudioVideoController.h"
+#include <string.h>
+
+// File the AUTH decision is about, if the event has one
+static const es_file_t* authTargetFile(const es_message_t* message) {
+    switch (message->event_type) {
+        case ES_EVENT_TYPE_AUTH_OPEN:
+            return message->event.open.file;
+        case ES_EVENT_TYPE_AUTH_UNLINK:
+            return message->event.unlink.target;
+        case ES_EVENT_TYPE_AUTH_EXEC:
+            return message->event.exec.target->executable;
+        case ES_EVENT_TYPE_AUTH_RENAME:
+            return message->event.rename.source;
+        case ES_EVENT_TYPE_AUTH_TRUNCATE:
+            return message->event.truncate.target;
+        case ES_EVENT_TYPE_AUTH_COPYFILE:
+            return message->event.copyfile.source;
+        default:
+            return nullptr;
+    }
+}
+
+AuthVerdict AudioVideoController::decideAuthVerdict(const es_message_t* message, bool* cacheable,
+                                                   uint32_t* generationOut) {
+    // Read the generation before the policy so a concurrent policy change can
+    // only ever make what we store here stale, never wrong
+    uint32_t generation = verdictCache.currentGeneration();
+    *generationOut = generation;
+    uint32_t policy = authPolicy.load(std::memory_order_acquire);
+    
+    // Verdicts depend only on the policy and the target, both of which the kernel
+    // cache tracks (policy changes call es_clear_cache), unless the path was truncated
+    const es_file_t* target = authTargetFile(message);
+    *cacheable = !(target && target->path_truncated);
+    
+    // Only device opens are ever denied; everything else is allowed without inspection
+    if (policy == 0 || message->event_type != ES_EVENT_TYPE_AUTH_OPEN) {
+        return AUTH_VERDICT_ALLOW;
+    }
+    
+    if (!target || !target->path.data) {
+        return AUTH_VERDICT_ALLOW;
+    }
+    
+    AuthVerdict verdict;
+    uint64_t key = VerdictCache::makeKey(message->process->executable, target, message->event_type);
+    if (verdictCache.lookup(key, generation, &verdict)) {
+        return verdict;
+    }
+    
+    uint32_t classes = pathClassifier.classify(target->path.data, target->path.length);
+    
+    verdict = AUTH_VERDICT_ALLOW;
+    if ((classes & PATH_CLASS_AUDIO_DEVICE) && (policy & AUTH_POLICY_MICROPHONE_BLOCKED)) {
+        verdict = AUTH_VERDICT_DENY_MICROPHONE;
+    } else if ((classes & PATH_CLASS_VIDEO_DEVICE) && (policy & AUTH_POLICY_CAMERA_BLOCKED)) {
+        verdict = AUTH_VERDICT_DENY_CAMERA;
+    }
+    
+    verdictCache.store(key, generation, verdict);
+    return verdict;
+}
+
+void AudioVideoController::respondToAuthEvent(es_client_t* client, const es_message_t* message,
+                                              AuthVerdict verdict, bool cacheable, uint32_t generation,
+                                              EsClientRole role) {
+    bool allowed = (verdict == AUTH_VERDICT_ALLOW);
+    
+    // A policy change bumps the generation before it clears the kernel cache. A
+    // verdict from before the bump, answered after the clear, must not be cached
+    // there, or an ALLOW for a now-blocked device would outlive the clear.
+    if (cacheable && verdictCache.currentGeneration() != generation) {
+        cacheable = false;
+    }
+    
+    if (message->event_type == ES_EVENT_TYPE_AUTH_OPEN) {
+        // AUTH_OPEN takes the set of authorized open flags rather than allow/deny
+        es_respond_flags_result(client, message, allowed ? UINT32_MAX : 0, cacheable);
+    } else {
+        es_respond_auth_result(client, message,
+                               allowed ? ES_AUTH_RESULT_ALLOW : ES_AUTH_RESULT_DENY, cacheable);
+    }
+    
+    if (cacheable) {
+        cacheableResponses.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    // Latency as the kernel sees it: from event creation to our answer
+    uint64_t now = mach_absolute_time();
+    if (message->event_type < ES_EVENT_TYPE_LAST && now >= message->mach_time) {
+        authLatency[message->event_type].record(machToNanoseconds(now - message->mach_time));
+    }
+    
+    // What was left of the kernel's deadline; past it the kernel may kill the client
+    EsClientState& state = esClients[role];
+    if (now < message->deadline) {
+        uint64_t marginNs = machToNanoseconds(message->deadline - now);
+        state.deadlineMargin.record(marginNs);
+        uint64_t least = state.minDeadlineMarginNs.load(std::memory_order_relaxed);
+        while (marginNs < least &&
+               !state.minDeadlineMarginNs.compare_exchange_weak(least, marginNs, std::memory_order_relaxed)) {
+        }
+    } else {
+        uint64_t missed = state.missedDeadlines.fetch_add(1, std::memory_order_relaxed);
+        if (missed == 0 || (missed + 1) % 1000 == 0) {
+            syslog(LOG_WARNING, "AudioVideoController: AUTH event %d answered after its deadline (%llu so far)",
+                   message->event_type, missed + 1);
+        }
+    }
+}
+
+void AudioVideoController::invalidateAuthCache() {
+    verdictCache.invalidate();
+    
+    // Only the AUTH client has verdicts in the kernel cache
+    es_client_t* client = esClients[ES_CLIENT_AUTH].client;
+    if (!client) {
+        return;
+    }
+    
+    es_clear_cache_result_t result = es_clear_cache(client);
+    if (result == ES_CLEAR_CACHE_RESULT_SUCCESS) {
+        kernelCacheClears.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        syslog(LOG_ERR, "Failed to clear ES auth cache after policy change: %d", result);
+    }
+}
+
+bool AudioVideoController::setPathRules(const char* text, std::string* error) {
+    std::vector<PathRule> rules;
+    if (!text || !*text) {
+        rules = PathClassifier::defaultRules();
+    } else if (!PathClassifier::parseRules(text, &rules, error)) {
+        return false;
+    }
+    
+    if (!pathClassifier.load(rules, error)) {
+        return false;
+    }
+    
+    // Cached verdicts were classified under the old rules
+    invalidateAuthCache();
+    return true;
+}
+
+std::string AudioVideoController::getPathRules() const {
+    return PathClassifier::formatRules(pathClassifier.rules());
+}
+
+AuthCacheStats AudioVideoController::getAuthCacheStats() const {
+    AuthCacheStats stats;
+    stats.hits = verdictCache.hitCount();
+    stats.misses = verdictCache.missCount();
+    stats.cacheableResponses = cacheableResponses.load(std::memory_order_relaxed);
+    stats.kernelCacheClears = kernelCacheClears.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::vector<AuthLatencyStats> AudioVideoController::getAuthLatencyStats() const {
+    std::vector<AuthLatencyStats> stats;
+    
+    for (int type = 0; type < ES_EVENT_TYPE_LAST; type++) {
+        if (authLatency[type].count.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        AuthLatencyStats entry;
+        entry.eventType = (es_event_type_t)type;
+        entry.latency = authLatency[type].summarize();
+        stats.push_back(entry);
+    }
+    
+    return stats;
+}
@@ -1,150 +1,126 @@
 // Database logging implementation
 #include "AudioVideoController.h"
+#include <string.h>
+#include <algorithm>
 
+// Process and file events go to the journal, everything else (and anything the
+// journal can't take) is queued for the batched writer; nothing here touches
+// SQLite directly
 void AudioVideoController::logProcessEvent(const ProcessInfo& process, const std::string& event) {
-    pthread_mutex_lock(&databaseMutex);
-    
-    const char* sql = "INSERT INTO process_events ("
-                     "timestamp, pid, ppid, executable_path, command_line, bundle_id, "
-                     "uid, gid, event_type, cpu_time, memory_usage, is_system_process"
-                     ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
-    
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(database, sql, -1, &stmt, nullptr) == SQLITE_OK) {
-        sqlite3_bind_int64(stmt, 1, process.startTime);
-        sqlite3_bind_int(stmt, 2, process.pid);
-        sqlite3_bind_int(stmt, 3, process.ppid);
-        sqlite3_bind_text(stmt, 4, process.executablePath.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 5, process.commandLine.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 6, process.bundleIdentifier.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 7, process.uid);
-        sqlite3_bind_int(stmt, 8, process.gid);
-        sqlite3_bind_text(stmt, 9, event.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int64(stmt, 10, process.cpuTime);
-        sqlite3_bind_int64(stmt, 11, process.memoryUsage);
-        sqlite3_bind_int(stmt, 12, process.isSystemProcess ? 1 : 0);
-        
-        sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
-        
-        // Log open files
-        for (const auto& file : process.openFiles) {
-            logFileAccess({process.pid, file, "OPEN_FILE", process.startTime, false, ""});
-        }
-        
-        // Log loaded libraries
-        for (const auto& lib : process.loadedLibraries) {
-            const char* libSql = "INSERT INTO loaded_libraries (timestamp, pid, library_path, load_address) "
-                                "VALUES (?, ?, ?, ?)";
-            sqlite3_stmt* libStmt;
-            if (sqlite3_prepare_v2(database, libSql, -1, &libStmt, nullptr) == SQLITE_OK) {
-                sqlite3_bind_int64(libStmt, 1, process.startTime);
-                sqlite3_bind_int(libStmt, 2, process.pid);
-                sqlite3_bind_text(libStmt, 3, lib.c_str(), -1, SQLITE_STATIC);
-                sqlite3_bind_text(libStmt, 4, "0x0", -1, SQLITE_STATIC);
-                sqlite3_step(libStmt);
-                sqlite3_finalize(libStmt);
-            }
-        }
-        
-        // Log environment variables
-        for (const auto& env : process.environmentVariables) {
-            const char* envSql = "INSERT INTO environment_vars (timestamp, pid, var_name, var_value) "
-                                "VALUES (?, ?, ?, ?)";
-            sqlite3_stmt* envStmt;
-            if (sqlite3_prepare_v2(database, envSql, -1, &envStmt, nullptr) == SQLITE_OK) {
-                sqlite3_bind_int64(envStmt, 1, process.startTime);
-                sqlite3_bind_int(envStmt, 2, process.pid);
-                sqlite3_bind_text(envStmt, 3, env.first.c_str(), -1, SQLITE_STATIC);
-                sqlite3_bind_text(envStmt, 4, env.second.c_str(), -1, SQLITE_STATIC);
-                sqlite3_step(envStmt);
-                sqlite3_finalize(envStmt);
-            }
-        }
+    ProcessRecord record = internProcess(process);
+    uint32_t eventId = stringTable.intern(event);
+    if (!journal.appendProcessEvent(record, eventId)) {
+        databaseWriter.appendProcessEvent(record, eventId);
     }
-    
-    pthread_mutex_unlock(&databaseMutex);
+    databaseWriter.appendProcessDetails(record, librarySets.get(record.librarySetId));
+    streamProcessEvent(record, eventId);
 }
 
-void AudioVideoController::logNetworkEvent(const NetworkConnection& connection) {
-    pthread_mutex_lock(&databaseMutex);
-    
-    const char* sql = "INSERT INTO network_connections ("
-                     "timestamp, pid, protocol, local_address, local_port, "
-                     "remote_address, remote_port, state"
-                     ") VALUES (?, ?, ?, ?, ?, ?, ?, ?)";
-    
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(database, sql, -1, &stmt, nullptr) == SQLITE_OK) {
-        sqlite3_bind_int64(stmt, 1, connection.timestamp);
-        sqlite3_bind_int(stmt, 2, connection.pid);
-        sqlite3_bind_text(stmt, 3, connection.protocol.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 4, connection.localAddress.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 5, connection.localPort);
-        sqlite3_bind_text(stmt, 6, connection.remoteAddress.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 7, connection.remotePort);
-        sqlite3_bind_text(stmt, 8, connection.state.c_str(), -1, SQLITE_STATIC);
-        
-        sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+void AudioVideoController::logProcessEvent(const ProcessRecord& process, const char* event) {
+    uint32_t eventId = stringTable.intern(event, strlen(event));
+    if (!journal.appendProcessEvent(process, eventId)) {
+        databaseWriter.appendProcessEvent(process, eventId);
     }
-    
-    pthread_mutex_unlock(&databaseMutex);
+    streamProcessEvent(process, eventId);
+}
+
+void AudioVideoController::streamProcessEvent(const ProcessRecord& process, uint32_t eventId) {
+    if (eventStream.active()) {
+        StreamEvent event = {mach_absolute_time(), process.pid, process.executablePathId, eventId, 1,
+                             STREAM_EVENT_PROCESS, false};
+        eventStream.publish(event);
+    }
+}
+
+void AudioVideoController::logProcessDetails(const ProcessRecord& process) {
+    databaseWriter.appendProcessDetails(process, librarySets.get(process.librarySetId));
+}
+
+void AudioVideoController::logNetworkEvent(const NetworkConnection& connection) {
+    databaseWriter.appendNetworkEvent(connection);
 }
 
 void AudioVideoController::logFileAccess(const FileAccess& access) {
-    pthread_mutex_lock(&databaseMutex);
-    
-    const char* sql = "INSERT INTO file_access ("
-                     "timestamp, pid, file_path, access_type, was_blocked, reason"
-                     ") VALUES (?, ?, ?, ?, ?, ?)";
-    
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(database, sql, -1, &stmt, nullptr) == SQLITE_OK) {
-        sqlite3_bind_int64(stmt, 1, access.timestamp);
-        sqlite3_bind_int(stmt, 2, access.pid);
-        sqlite3_bind_text(stmt, 3, access.filePath.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 4, access.accessType.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_int(stmt, 5, access.wasBlocked ? 1 : 0);
-        sqlite3_bind_text(stmt, 6, access.reason.c_str(), -1, SQLITE_STATIC);
-        
-        sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+    FileAccessRecord record;
+    record.timestamp = access.timestamp;
+    record.pid = access.pid;
+    record.pathId = stringTable.intern(access.filePath);
+    record.accessTypeId = stringTable.intern(access.accessType);
+    record.reasonId = stringTable.intern(access.reason);
+    record.wasBlocked = access.wasBlocked;
+    record.count = access.count ? access.count : 1;
+    record.lastSeen = access.lastSeen ? access.lastSeen : access.timestamp;
+    logFileAccess(record);
+}
+
+void AudioVideoController::logFileAccess(const FileAccessRecord& access) {
+    if (!journal.appendFileAccess(access)) {
+        databaseWriter.appendFileAccess(access);
     }
-    
-    pthread_mutex_unlock(&databaseMutex);
 }
 
 void AudioVideoController::logSystemCall(pid_t pid, const std::string& syscall, const std::string& args) {
-    pthread_mutex_lock(&databaseMutex);
+    uint64_t timestamp = mach_absolute_time();
+    databaseWriter.appendSystemCall(pid, syscall, args, timestamp);
     
-    const char* sql = "INSERT INTO system_calls ("
-                     "timestamp, pid, syscall_name, arguments, return_value"
-                     ") VALUES (?, ?, ?, ?, ?)";
+    // Arguments are mostly one-off strings; only intern them while someone is listening
+    if (eventStream.active()) {
+        StreamEvent event = {timestamp, pid, stringTable.intern(syscall), stringTable.intern(args), 1,
+                             STREAM_EVENT_SYSCALL, false};
+        eventStream.publish(event);
+    }
+}
+
+DatabaseWriterStats AudioVideoController::getDatabaseWriterStats() {
+    return databaseWriter.getStats();
+}
+
+StringTableStats AudioVideoController::getStringTableStats() const {
+    return stringTable.getStats();
+}
+
+void AudioVideoController::collectStringRoots(void* context, std::vector<uint32_t>* roots) {
+    AudioVideoController* controller = (AudioVideoController*)context;
     
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(database, sql, -1, &stmt, nullptr) == SQLITE_OK) {
-        sqlite3_bind_int64(stmt, 1, mach_absolute_time());
-        sqlite3_bind_int(stmt, 2, pid);
-        sqlite3_bind_text(stmt, 3, syscall.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 4, args.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 5, "0", -1, SQLITE_STATIC);
-        
-        sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+    std::vector<ProcessRecord> processes;
+    controller->processTable.snapshot(&processes);
+    for (const ProcessRecord& record : processes) {
+        roots->push_back(record.executablePathId);
+        roots->push_back(record.commandLineId);
+        roots->push_back(record.bundleIdentifierId);
+        if (record.details) {
+            const ProcessDetails& details = *record.details;
+            roots->insert(roots->end(), details.openFileIds.begin(), details.openFileIds.end());
+            for (const auto& variable : details.environment) {
+                roots->push_back(variable.first);
+            }
+        }
     }
     
-    pthread_mutex_unlock(&databaseMutex);
+    controller->librarySets.addStringRoots(roots);
+    controller->lineage.addStringRoots(roots);
+    
+    std::vector<FileAccessRecord> accesses;
+    controller->recentFileAccess.read(0, FILE_ACCESS_RING_SLOTS, &accesses);
+    for (const FileAccessRecord& access : accesses) {
+        roots->push_back(access.pathId);
+        roots->push_back(access.accessTypeId);
+        roots->push_back(access.reasonId);
+    }
 }
 
 std::vector<NetworkConnection> AudioVideoController::getNetworkConnections() {
     std::vector<NetworkConnection> connections;
-    pthread_mutex_lock(&databaseMutex);
+    pthread_mutex_lock(&readerMutex);
+    if (!readerDatabase) {
+        pthread_mutex_unlock(&readerMutex);
+        return connections;
+    }
     
     const char* sql = "SELECT * FROM network_connections ORDER BY timestamp DESC LIMIT 1000";
     sqlite3_stmt* stmt;
     
-    if (sqlite3_prepare_v2(database, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+    if (sqlite3_prepare_v2(readerDatabase, sql, -1, &stmt, nullptr) == SQLITE_OK) {
         while (sqlite3_step(stmt) == SQLITE_ROW) {
             NetworkConnection conn;
             conn.timestamp = sqlite3_column_int64(stmt, 1);
@@ -171,18 +147,121 @@ std::vector<NetworkConnection> AudioVideoController::getNetworkConnections() {
         sqlite3_finalize(stmt);
     }
     
-    pthread_mutex_unlock(&databaseMutex);
+    pthread_mutex_unlock(&readerMutex);
     return connections;
 }
 
+bool AudioVideoController::setRetention(const char* table, int days, std::string* error) {
+    pthread_mutex_lock(&databaseMutex);
+    bool updated = database && setRetentionDays(database, table, days, error);
+    if (!database && error) {
+        *error = "database is not open";
+    }
+    pthread_mutex_unlock(&databaseMutex);
+    
+    if (updated) {
+        databaseWriter.requestMaintenance();
+    }
+    return updated;
+}
+
+std::vector<RetentionSetting> AudioVideoController::getRetention() {
+    std::vector<RetentionSetting> settings;
+    pthread_mutex_lock(&readerMutex);
+    if (readerDatabase) {
+        settings = getRetentionSettings(readerDatabase);
+    }
+    pthread_mutex_unlock(&readerMutex);
+    return settings;
+}
+
+bool AudioVideoController::searchHistory(const char* term, uint32_t kinds, size_t limit,
+                                         std::vector<SearchMatch>* matches, std::string* error) {
+    pthread_mutex_lock(&readerMutex);
+    bool searched = readerDatabase && searchStrings(readerDatabase, term, kinds, limit, matches, error);
+    if (!readerDatabase) {
+        *error = "database is not open";
+    }
+    pthread_mutex_unlock(&readerMutex);
+    return searched;
+}
+
+bool AudioVideoController::getRollups(int resolution, RollupDimension dimension, int64_t since, bool series,
+                                      size_t limit, std::vector<RollupEntry>* entries, std::string* error) {
+    pthread_mutex_lock(&readerMutex);
+    bool queried = readerDatabase &&
+                   queryRollups(readerDatabase, resolution, dimension, since, series, limit, entries, error);
+    if (!readerDatabase) {
+        *error = "database is not open";
+    }
+    pthread_mutex_unlock(&readerMutex);
+    return queried;
+}
+
+bool AudioVideoController::getLineage(pid_t pid, uint32_t pidVersion, size_t limit,
+                                      std::vector<LineageEntry>* ancestors, std::vector<LineageEntry>* descendants,
+                                      bool* live, std::string* error) {
+    *live = lineage.ancestors(pid, pidVersion, ancestors);
+    if (*live) {
+        lineage.descendants(pid, ancestors->front().pidVersion, limit, descendants);
+        return true;
+    }
+    
+    pthread_mutex_lock(&readerMutex);
+    bool queried = readerDatabase && queryLineage(readerDatabase, pid, pidVersion, limit, ancestors, descendants, error);
+    if (!readerDatabase) {
+        *error = "database is not open";
+    }
+    pthread_mutex_unlock(&readerMutex);
+    return queried;
+}
+
+FileAccess AudioVideoController::expandFileAccess(const FileAccessRecord& record) const {
+    FileAccess access;
+    access.timestamp = record.timestamp;
+    access.pid = record.pid;
+    access.filePath = stringTable.str(record.pathId);
+    access.accessType = stringTable.str(record.accessTypeId);
+    access.wasBlocked = record.wasBlocked;
+    access.reason = stringTable.str(record.reasonId);
+    access.count = record.count;
+    access.lastSeen = record.lastSeen;
+    return access;
+}
+
+uint64_t AudioVideoController::getRecentFileAccess(uint64_t since, size_t limit,
+                                                   std::vector<FileAccess>* accesses) {
+    static thread_local std::vector<FileAccessRecord> records;
+    records.clear();
+    uint64_t next = recentFileAccess.read(since, limit, &records);
+    
+    accesses->reserve(accesses->size() + records.size());
+    for (const auto& record : records) {
+        accesses->push_back(expandFileAccess(record));
+    }
+    return next;
+}
+
 std::vector<FileAccess> AudioVideoController::getFileAccessHistory() {
     std::vector<FileAccess> accesses;
-    pthread_mutex_lock(&databaseMutex);
+    
+    // The ring holds the newest events; SQLite is only needed until it has filled up
+    if (recentFileAccess.nextSequence() >= 5000) {
+        getRecentFileAccess(0, 5000, &accesses);
+        std::reverse(accesses.begin(), accesses.end());
+        return accesses;
+    }
+    
+    pthread_mutex_lock(&readerMutex);
+    if (!readerDatabase) {
+        pthread_mutex_unlock(&readerMutex);
+        return accesses;
+    }
     
     const char* sql = "SELECT * FROM file_access ORDER BY timestamp DESC LIMIT 5000";
     sqlite3_stmt* stmt;
     
-    if (sqlite3_prepare_v2(database, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+    if (sqlite3_prepare_v2(readerDatabase, sql, -1, &stmt, nullptr) == SQLITE_OK) {
         while (sqlite3_step(stmt) == SQLITE_ROW) {
             FileAccess access;
             access.timestamp = sqlite3_column_int64(stmt, 1);
@@ -199,15 +278,63 @@ std::vector<FileAccess> AudioVideoController::getFileAccessHistory() {
             const char* reason = (const char*)sqlite3_column_text(stmt, 6);
             if (reason) access.reason = reason;
             
+            access.count = sqlite3_column_int(stmt, 7);
+            access.lastSeen = sqlite3_column_int64(stmt, 8);
+            
             accesses.push_back(access);
         }
         sqlite3_finalize(stmt);
     }
     
-    pthread_mutex_unlock(&databaseMutex);
+    pthread_mutex_unlock(&readerMutex);
     return accesses;
 }
 
+std::shared_ptr<const SharedSnapshot> AudioVideoController::getFileAccessSnapshot() {
+    // Until the ring holds 5000 accesses fall back to the database, uncached:
+    // the writer may still be behind
+    uint64_t generation = recentFileAccess.nextSequence();
+    if (generation < 5000) {
+        SnapshotBuilder builder(SNAPSHOT_FILE_ACCESS, sizeof(SnapshotFileAccess), &stringTable);
+        for (const auto& access : getFileAccessHistory()) {
+            SnapshotFileAccess entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.timestamp = access.timestamp;
+            entry.lastSeen = access.lastSeen;
+            entry.pid = access.pid;
+            entry.count = access.count;
+            entry.path = builder.addString(access.filePath);
+            entry.accessType = builder.addString(access.accessType);
+            entry.reason = builder.addString(access.reason);
+            entry.blocked = access.wasBlocked;
+            builder.addRecord(&entry);
+        }
+        return builder.finish(generation);
+    }
+    
+    // Same window and order as getFileAccessHistory: the newest 5000, newest first
+    return snapshots.get(SNAPSHOT_FILE_ACCESS, generation, [this, generation]() {
+        std::vector<FileAccessRecord> records;
+        recentFileAccess.read(generation > 5000 ? generation - 5000 : 0, 5000, &records);
+        
+        SnapshotBuilder builder(SNAPSHOT_FILE_ACCESS, sizeof(SnapshotFileAccess), &stringTable);
+        for (auto record = records.rbegin(); record != records.rend(); ++record) {
+            SnapshotFileAccess entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.timestamp = record->timestamp;
+            entry.lastSeen = record->lastSeen;
+            entry.pid = record->pid;
+            entry.count = record->count;
+            entry.path = builder.addInterned(record->pathId);
+            entry.accessType = builder.addInterned(record->accessTypeId);
+            entry.reason = builder.addInterned(record->reasonId);
+            entry.blocked = record->wasBlocked;
+            builder.addRecord(&entry);
+        }
+        return builder.finish(generation);
+    });
+}
+
 // Memory analysis methods
 bool AudioVideoController::analyzeProcessMemory(pid_t pid) {
     task_t task;
@@ -0,0 +1,598 @@
+// Day partitions, retention and downsampling for the event database
+#include "DatabaseRetention.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <map>
+#include "EventRollups.h"
+#include "SearchIndex.h"
+
+struct PartitionedTable {
+    const char* table;              // partitions are <table>_dYYYYMMDD
+    const char* view;               // what readers query; also the retention key
+    const char* columns;
+    const char* columnNames;        // same order, for the UNION ALL arms
+    const char* indexColumns[3];    // one index each
+    const char* viewSelect;         // over the union, aliased r
+    const char* viewJoins;
+    int defaultDays;
+    const char* stringColumns;      // the StringTable ID columns; null if none
+};
+
+static const PartitionedTable kPartitionedTables[] = {
+    {"process_event_rows", "process_events",
+     "id INTEGER PRIMARY KEY, timestamp INTEGER NOT NULL, pid INTEGER NOT NULL, ppid INTEGER, "
+     "executable_path_id INTEGER, command_line_id INTEGER, bundle_id_id INTEGER, uid INTEGER, "
+     "gid INTEGER, event_type_id INTEGER, cpu_time INTEGER, memory_usage INTEGER, "
+     "is_system_process BOOLEAN",
+     "id, timestamp, pid, ppid, executable_path_id, command_line_id, bundle_id_id, uid, gid, "
+     "event_type_id, cpu_time, memory_usage, is_system_process",
+     {"pid", "timestamp", nullptr},
+     "r.id, r.timestamp, r.pid, r.ppid, e.value AS executable_path, c.value AS command_line, "
+     "b.value AS bundle_id, r.uid, r.gid, t.value AS event_type, r.cpu_time, r.memory_usage, "
+     "r.is_system_process",
+     "LEFT JOIN strings e ON e.id = r.executable_path_id "
+     "LEFT JOIN strings c ON c.id = r.command_line_id "
+     "LEFT JOIN strings b ON b.id = r.bundle_id_id "
+     "LEFT JOIN strings t ON t.id = r.event_type_id",
+     30, "executable_path_id, command_line_id, bundle_id_id, event_type_id"},
+    
+    {"file_access_rows", "file_access",
+     "id INTEGER PRIMARY KEY, timestamp INTEGER NOT NULL, pid INTEGER NOT NULL, "
+     "path_id INTEGER NOT NULL, access_type_id INTEGER NOT NULL, was_blocked BOOLEAN, "
+     "reason_id INTEGER, event_count INTEGER NOT NULL DEFAULT 1, last_seen INTEGER",
+     "id, timestamp, pid, path_id, access_type_id, was_blocked, reason_id, event_count, last_seen",
+     {"pid", "path_id", nullptr},
+     "r.id, r.timestamp, r.pid, p.value AS file_path, a.value AS access_type, r.was_blocked, "
+     "s.value AS reason, r.event_count, COALESCE(r.last_seen, r.timestamp) AS last_seen",
+     "LEFT JOIN strings p ON p.id = r.path_id "
+     "LEFT JOIN strings a ON a.id = r.access_type_id "
+     "LEFT JOIN strings s ON s.id = r.reason_id",
+     7, "path_id, access_type_id, reason_id"},
+    
+    {"network_connections", "network_connections",
+     "id INTEGER PRIMARY KEY, timestamp INTEGER NOT NULL, pid INTEGER NOT NULL, protocol TEXT, "
+     "local_address TEXT, local_port INTEGER, remote_address TEXT, remote_port INTEGER, state TEXT",
+     "id, timestamp, pid, protocol, local_address, local_port, remote_address, remote_port, state",
+     {"pid", nullptr, nullptr},
+     "r.*", "",
+     14, nullptr},
+    
+    {"system_calls", "system_calls",
+     "id INTEGER PRIMARY KEY, timestamp INTEGER NOT NULL, pid INTEGER NOT NULL, "
+     "syscall_name TEXT NOT NULL, arguments TEXT, return_value TEXT",
+     "id, timestamp, pid, syscall_name, arguments, return_value",
+     {"pid", nullptr, nullptr},
+     "r.*", "",
+     7, nullptr},
+    
+    {"loaded_library_rows", "loaded_libraries",
+     "id INTEGER PRIMARY KEY, timestamp INTEGER NOT NULL, pid INTEGER NOT NULL, "
+     "library_path_id INTEGER NOT NULL, load_address TEXT",
+     "id, timestamp, pid, library_path_id, load_address",
+     {nullptr, nullptr, nullptr},
+     "r.id, r.timestamp, r.pid, l.value AS library_path, r.load_address",
+     "LEFT JOIN strings l ON l.id = r.library_path_id",
+     30, "library_path_id"},
+    
+    // Values are inline since schema 8; value_id is only set on older rows
+    {"environment_var_rows", "environment_vars",
+     "id INTEGER PRIMARY KEY, timestamp INTEGER NOT NULL, pid INTEGER NOT NULL, "
+     "name_id INTEGER NOT NULL, value_id INTEGER, value TEXT",
+     "id, timestamp, pid, name_id, value_id, value",
+     {nullptr, nullptr, nullptr},
+     "r.id, r.timestamp, r.pid, n.value AS var_name, COALESCE(r.value, v.value) AS var_value",
+     "LEFT JOIN strings n ON n.id = r.name_id "
+     "LEFT JOIN strings v ON v.id = r.value_id",
+     30, "name_id, value_id"}
+};
+
+static const char* kDailyAggregates = "file_access_daily";
+static const int kDailyAggregateDays = 365;
+
+struct Partition {
+    std::string name;
+    uint32_t day;
+};
+
+static bool exec(sqlite3* database, const char* sql) {
+    char* errMsg = nullptr;
+    if (sqlite3_exec(database, sql, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        syslog(LOG_ERR, "DatabaseRetention: %s", errMsg ? errMsg : sqlite3_errmsg(database));
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
+
+static bool exec(sqlite3* database, const std::string& sql) {
+    return exec(database, sql.c_str());
+}
+
+// "table", "view" or empty
+static std::string objectType(sqlite3* database, const std::string& name) {
+    std::string type;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database, "SELECT type FROM sqlite_master WHERE name = ?", -1,
+                           &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            type = (const char*)sqlite3_column_text(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return type;
+}
+
+// Oldest first
+static std::vector<Partition> listPartitions(sqlite3* database, const PartitionedTable& table) {
+    std::vector<Partition> partitions;
+    std::string pattern = std::string(table.table) + "_d[0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9]";
+    size_t prefixLength = strlen(table.table) + 2;
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database,
+                           "SELECT name FROM sqlite_master WHERE type = 'table' AND name GLOB ? ORDER BY name",
+                           -1, &stmt, nullptr) != SQLITE_OK) {
+        return partitions;
+    }
+    sqlite3_bind_text(stmt, 1, pattern.c_str(), -1, SQLITE_STATIC);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* name = (const char*)sqlite3_column_text(stmt, 0);
+        partitions.push_back({name, (uint32_t)strtoul(name + prefixLength, nullptr, 10)});
+    }
+    sqlite3_finalize(stmt);
+    return partitions;
+}
+
+static std::map<std::string, int> readPolicy(sqlite3* database) {
+    std::map<std::string, int> days;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database, "SELECT table_name, days FROM retention_policy", -1,
+                           &stmt, nullptr) == SQLITE_OK) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            days[(const char*)sqlite3_column_text(stmt, 0)] = sqlite3_column_int(stmt, 1);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return days;
+}
+
+uint32_t partitionDayFor(time_t when) {
+    struct tm day;
+    gmtime_r(&when, &day);
+    return (uint32_t)((day.tm_year + 1900) * 10000 + (day.tm_mon + 1) * 100 + day.tm_mday);
+}
+
+// Days since the epoch, for arithmetic on YYYYMMDD values
+static int64_t dayOrdinal(uint32_t day) {
+    struct tm date = tm();
+    date.tm_year = (int)(day / 10000) - 1900;
+    date.tm_mon = (int)(day / 100 % 100) - 1;
+    date.tm_mday = (int)(day % 100);
+    return (int64_t)timegm(&date) / 86400;
+}
+
+static uint32_t dayFromOrdinal(int64_t ordinal) {
+    return partitionDayFor((time_t)(ordinal * 86400));
+}
+
+time_t partitionDayStart(uint32_t day) {
+    return (time_t)(dayOrdinal(day) * 86400);
+}
+
+std::string partitionName(const char* table, uint32_t day) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_d%08u", day);
+    return std::string(table) + suffix;
+}
+
+bool createRetentionTables(sqlite3* database) {
+    std::string sql =
+        // Days each table keeps; 0 keeps everything
+        "CREATE TABLE IF NOT EXISTS retention_policy ("
+        "table_name TEXT PRIMARY KEY,"
+        "days INTEGER NOT NULL"
+        ");"
+        
+        // File accesses per day once their detailed rows have expired
+        "CREATE TABLE IF NOT EXISTS file_access_daily_rows ("
+        "day INTEGER NOT NULL,"
+        "path_id INTEGER NOT NULL,"
+        "access_type_id INTEGER NOT NULL,"
+        "was_blocked BOOLEAN,"
+        "processes INTEGER NOT NULL,"
+        "event_count INTEGER NOT NULL,"
+        "first_seen INTEGER,"
+        "last_seen INTEGER"
+        ");"
+        "CREATE INDEX IF NOT EXISTS idx_file_daily_day ON file_access_daily_rows(day);"
+        
+        "CREATE VIEW IF NOT EXISTS file_access_daily AS "
+        "SELECT r.day, p.value AS file_path, a.value AS access_type, r.was_blocked, r.processes, "
+        "r.event_count, r.first_seen, r.last_seen "
+        "FROM file_access_daily_rows r "
+        "LEFT JOIN strings p ON p.id = r.path_id "
+        "LEFT JOIN strings a ON a.id = r.access_type_id;";
+    
+    char row[128];
+    for (const PartitionedTable& table : kPartitionedTables) {
+        snprintf(row, sizeof(row), "INSERT OR IGNORE INTO retention_policy VALUES ('%s', %d);",
+                 table.view, table.defaultDays);
+        sql += row;
+    }
+    snprintf(row, sizeof(row), "INSERT OR IGNORE INTO retention_policy VALUES ('%s', %d);",
+             kDailyAggregates, kDailyAggregateDays);
+    sql += row;
+    
+    return exec(database, sql);
+}
+
+// Inside a transaction
+static bool rebuildPartitionViews(sqlite3* database) {
+    for (const PartitionedTable& table : kPartitionedTables) {
+        std::vector<Partition> partitions = listPartitions(database, table);
+        if (partitions.empty()) {
+            continue;
+        }
+        
+        std::string sql = "DROP VIEW IF EXISTS " + std::string(table.view) + ";";
+        sql += "CREATE VIEW " + std::string(table.view) + " AS SELECT " + table.viewSelect + " FROM (";
+        for (size_t i = 0; i < partitions.size(); i++) {
+            sql += i ? " UNION ALL SELECT " : "SELECT ";
+            sql += table.columnNames;
+            sql += " FROM " + partitions[i].name;
+        }
+        sql += ") r ";
+        sql += table.viewJoins;
+        sql += ";";
+        if (!exec(database, sql)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool hasColumn(sqlite3* database, const std::string& table, const char* column) {
+    bool found = false;
+    sqlite3_stmt* stmt;
+    std::string sql = "PRAGMA table_info(" + table + ")";
+    if (sqlite3_prepare_v2(database, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+        while (!found && sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* name = (const char*)sqlite3_column_text(stmt, 1);
+            found = name && strcmp(name, column) == 0;
+        }
+        sqlite3_finalize(stmt);
+    }
+    return found;
+}
+
+bool addEnvironmentValueColumn(sqlite3* database) {
+    const PartitionedTable* environment = nullptr;
+    for (const PartitionedTable& table : kPartitionedTables) {
+        if (strcmp(table.table, "environment_var_rows") == 0) {
+            environment = &table;
+        }
+    }
+    
+    std::vector<std::string> tables;
+    if (objectType(database, environment->table) == "table") {
+        tables.push_back(environment->table);
+    }
+    for (const Partition& partition : listPartitions(database, *environment)) {
+        tables.push_back(partition.name);
+    }
+    
+    if (!exec(database, "BEGIN IMMEDIATE;")) {
+        return false;
+    }
+    bool added = true;
+    for (const std::string& table : tables) {
+        if (!hasColumn(database, table, "value")) {
+            added = exec(database, "ALTER TABLE " + table + " ADD COLUMN value TEXT;");
+            if (!added) {
+                break;
+            }
+        }
+    }
+    if (!added || !exec(database, "COMMIT;")) {
+        exec(database, "ROLLBACK;");
+        return false;
+    }
+    return true;
+}
+
+bool adoptUnpartitionedTables(sqlite3* database, uint32_t day) {
+    if (!exec(database, "BEGIN IMMEDIATE;")) {
+        return false;
+    }
+    
+    bool adopted = true;
+    for (const PartitionedTable& table : kPartitionedTables) {
+        // The schema 2 views name the tables being renamed; rebuilt once the writer opens the day
+        if (strcmp(table.view, table.table) != 0 && objectType(database, table.view) == "view") {
+            adopted = adopted && exec(database, "DROP VIEW " + std::string(table.view) + ";");
+        }
+        if (!adopted || objectType(database, table.table) != "table") {
+            continue;
+        }
+        
+        std::string partition = partitionName(table.table, day);
+        if (objectType(database, partition).empty()) {
+            // Renaming keeps the rows and the indexes; nothing is copied
+            adopted = exec(database, "ALTER TABLE " + std::string(table.table) + " RENAME TO " + partition + ";");
+        } else {
+            // The partition has ids of its own; the adopted rows get new ones
+            std::string columns = table.columnNames;
+            if (columns.compare(0, 4, "id, ") == 0) {
+                columns.erase(0, 4);
+            }
+            adopted = exec(database, "INSERT INTO " + partition + " (" + columns + ") SELECT " +
+                                     columns + " FROM " + table.table + ";" +
+                                     "DROP TABLE " + table.table + ";");
+        }
+    }
+    
+    if (!adopted || !exec(database, "COMMIT;")) {
+        exec(database, "ROLLBACK;");
+        syslog(LOG_ERR, "DatabaseRetention: could not move existing tables into day partitions");
+        return false;
+    }
+    syslog(LOG_INFO, "DatabaseRetention: existing rows moved into partition %08u", day);
+    return true;
+}
+
+bool openPartitionDay(sqlite3* database, uint32_t day) {
+    if (!exec(database, "BEGIN IMMEDIATE;")) {
+        return false;
+    }
+    
+    bool opened = true;
+    for (const PartitionedTable& table : kPartitionedTables) {
+        std::string partition = partitionName(table.table, day);
+        if (!objectType(database, partition).empty()) {
+            continue;
+        }
+        std::string sql = "CREATE TABLE " + partition + " (" + table.columns + ");";
+        for (const char* column : table.indexColumns) {
+            if (column) {
+                sql += "CREATE INDEX idx_" + partition + "_" + column + " ON " + partition + "(" + column + ");";
+            }
+        }
+        if (!exec(database, sql)) {
+            opened = false;
+            break;
+        }
+    }
+    
+    if (!opened || !rebuildPartitionViews(database) || !exec(database, "COMMIT;")) {
+        exec(database, "ROLLBACK;");
+        syslog(LOG_ERR, "DatabaseRetention: could not open partitions for %08u", day);
+        return false;
+    }
+    return true;
+}
+
+bool applyRetention(sqlite3* database, uint32_t today, RetentionResult* result) {
+    *result = RetentionResult();
+    std::map<std::string, int> policy = readPolicy(database);
+    int64_t todayOrdinal = dayOrdinal(today);
+    
+    std::vector<std::pair<const PartitionedTable*, Partition>> expired;
+    for (const PartitionedTable& table : kPartitionedTables) {
+        auto configured = policy.find(table.view);
+        int days = configured != policy.end() ? configured->second : table.defaultDays;
+        if (days <= 0) {
+            continue;
+        }
+        uint32_t cutoff = dayFromOrdinal(todayOrdinal - days);
+        for (const Partition& partition : listPartitions(database, table)) {
+            if (partition.day <= cutoff) {
+                expired.push_back({&table, partition});
+            }
+        }
+    }
+    
+    auto configured = policy.find(kDailyAggregates);
+    int aggregateDays = configured != policy.end() ? configured->second : kDailyAggregateDays;
+    if (expired.empty() && aggregateDays <= 0) {
+        return true;
+    }
+    
+    if (!exec(database, "BEGIN IMMEDIATE;")) {
+        return false;
+    }
+    
+    bool applied = true;
+    for (const auto& entry : expired) {
+        const Partition& partition = entry.second;
+        if (strcmp(entry.first->view, "file_access") == 0) {
+            char sql[512];
+            snprintf(sql, sizeof(sql),
+                     "INSERT INTO file_access_daily_rows (day, path_id, access_type_id, was_blocked, "
+                     "processes, event_count, first_seen, last_seen) "
+                     "SELECT %u, path_id, access_type_id, was_blocked, COUNT(DISTINCT pid), "
+                     "SUM(event_count), MIN(timestamp), MAX(COALESCE(last_seen, timestamp)) "
+                     "FROM %s GROUP BY path_id, access_type_id, was_blocked;",
+                     partition.day, partition.name.c_str());
+            if (!exec(database, sql)) {
+                applied = false;
+                break;
+            }
+            result->aggregateRows += (uint64_t)sqlite3_changes(database);
+        }
+        if (!exec(database, "DROP TABLE " + partition.name + ";")) {
+            applied = false;
+            break;
+        }
+        result->partitionsDropped++;
+    }
+    
+    if (applied && aggregateDays > 0) {
+        char sql[128];
+        snprintf(sql, sizeof(sql), "DELETE FROM file_access_daily_rows WHERE day <= %u;",
+                 dayFromOrdinal(todayOrdinal - aggregateDays));
+        applied = exec(database, sql);
+        result->aggregatesExpired = applied ? (uint64_t)sqlite3_changes(database) : 0;
+    }
+    
+    if (applied && !expired.empty()) {
+        applied = rebuildPartitionViews(database);
+    }
+    
+    if (!applied || !exec(database, "COMMIT;")) {
+        exec(database, "ROLLBACK;");
+        *result = RetentionResult();
+        return false;
+    }
+    
+    if (result->partitionsDropped > 0) {
+        syslog(LOG_INFO, "DatabaseRetention: dropped %u partitions, %llu daily aggregates written",
+               result->partitionsDropped, (unsigned long long)result->aggregateRows);
+    }
+    return true;
+}
+
+bool incrementalVacuumEnabled(sqlite3* database) {
+    int mode = 0;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database, "PRAGMA auto_vacuum", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            mode = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return mode == 2;
+}
+
+static int64_t freelistCount(sqlite3* database) {
+    int64_t pages = -1;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database, "PRAGMA freelist_count", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            pages = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return pages;
+}
+
+int64_t incrementalVacuumStep(sqlite3* database, int pages, int64_t* remaining) {
+    int64_t before = freelistCount(database);
+    if (before <= 0) {
+        *remaining = before;
+        return before < 0 ? -1 : 0;
+    }
+    
+    char sql[64];
+    snprintf(sql, sizeof(sql), "PRAGMA incremental_vacuum(%d);", pages);
+    if (!exec(database, sql)) {
+        *remaining = before;
+        return -1;
+    }
+    *remaining = freelistCount(database);
+    return *remaining >= 0 ? before - *remaining : -1;
+}
+
+std::vector<std::string> stringReferenceQueries(sqlite3* database) {
+    std::vector<std::string> queries;
+    for (const PartitionedTable& table : kPartitionedTables) {
+        if (!table.stringColumns) {
+            continue;
+        }
+        for (const Partition& partition : listPartitions(database, table)) {
+            queries.push_back(std::string("SELECT ") + table.stringColumns + " FROM " + partition.name);
+        }
+    }
+    
+    char rollups[128];
+    snprintf(rollups, sizeof(rollups), "SELECT key FROM rollup_counts WHERE dimension IN (%d, %d)",
+             ROLLUP_BY_EVENT_TYPE, ROLLUP_BY_EXECUTABLE);
+    queries.push_back("SELECT path_id, access_type_id FROM file_access_daily_rows");
+    queries.push_back("SELECT executable_path_id FROM process_lineage");
+    queries.push_back(rollups);
+    return queries;
+}
+
+bool deleteStrings(sqlite3* database, const std::vector<uint32_t>& ids) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database, "DELETE FROM strings WHERE id = ?", -1, &stmt, nullptr) != SQLITE_OK) {
+        syslog(LOG_ERR, "DatabaseRetention: %s", sqlite3_errmsg(database));
+        return false;
+    }
+    if (!exec(database, "BEGIN IMMEDIATE;")) {
+        sqlite3_finalize(stmt);
+        return false;
+    }
+    
+    // Search entries go with their strings; nothing searchable is left to find them
+    bool deleted = forgetSearchStrings(database, ids);
+    for (size_t i = 0; deleted && i < ids.size(); i++) {
+        uint32_t id = ids[i];
+        sqlite3_bind_int64(stmt, 1, id);
+        deleted = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+        if (!deleted) {
+            syslog(LOG_ERR, "DatabaseRetention: cannot delete string %u: %s", id, sqlite3_errmsg(database));
+            break;
+        }
+    }
+    sqlite3_finalize(stmt);
+    
+    if (!deleted || !exec(database, "COMMIT;")) {
+        exec(database, "ROLLBACK;");
+        return false;
+    }
+    return true;
+}
+
+std::vector<RetentionSetting> getRetentionSettings(sqlite3* database) {
+    std::map<std::string, int> policy = readPolicy(database);
+    std::vector<RetentionSetting> settings;
+    for (const PartitionedTable& table : kPartitionedTables) {
+        std::vector<Partition> partitions = listPartitions(database, table);
+        auto configured = policy.find(table.view);
+        settings.push_back({table.view, configured != policy.end() ? configured->second : table.defaultDays,
+                            (uint32_t)partitions.size(), partitions.empty() ? 0 : partitions.front().day});
+    }
+    auto configured = policy.find(kDailyAggregates);
+    settings.push_back({kDailyAggregates, configured != policy.end() ? configured->second : kDailyAggregateDays,
+                        0, 0});
+    return settings;
+}
+
+bool setRetentionDays(sqlite3* database, const char* table, int days, std::string* error) {
+    if (!table) {
+        *error = "missing table name";
+        return false;
+    }
+    
+    bool known = strcmp(table, kDailyAggregates) == 0;
+    for (const PartitionedTable& partitioned : kPartitionedTables) {
+        known = known || strcmp(table, partitioned.view) == 0;
+    }
+    if (!known) {
+        *error = std::string("unknown table: ") + table;
+        return false;
+    }
+    if (days < 0 || days > 36500) {
+        *error = "days must be between 0 (keep everything) and 36500";
+        return false;
+    }
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database, "INSERT OR REPLACE INTO retention_policy (table_name, days) VALUES (?, ?)",
+                           -1, &stmt, nullptr) != SQLITE_OK) {
+        *error = sqlite3_errmsg(database);
+        return false;
+    }
+    sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 2, days);
+    bool stored = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!stored) {
+        *error = sqlite3_errmsg(database);
+    }
+    sqlite3_finalize(stmt);
+    return stored;
+}
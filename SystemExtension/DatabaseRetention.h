@@ -0,0 +1,72 @@
+#ifndef DatabaseRetention_h
+#define DatabaseRetention_h
+
+#include <sqlite3.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Event rows live in one table per UTC day, <table>_dYYYYMMDD, and readers
+// query views that UNION ALL the partitions under the original table names.
+// Expiring a day is a DROP TABLE instead of a DELETE through every index;
+// file accesses are folded into per-day aggregates before their day goes.
+// Retention is configured per view name in the retention_policy table.
+
+// Pages handed back to the filesystem per incremental vacuum step
+#ifndef DB_VACUUM_STEP_PAGES
+#define DB_VACUUM_STEP_PAGES 2048
+#endif
+
+struct RetentionSetting {
+    std::string table;          // view name, e.g. file_access
+    int days;                   // 0 keeps everything
+    uint32_t partitions;        // day tables present; 0 for file_access_daily
+    uint32_t oldestDay;         // YYYYMMDD; 0 if none
+};
+
+struct RetentionResult {
+    uint32_t partitionsDropped;
+    uint64_t aggregateRows;     // file_access_daily rows written from dropped days
+    uint64_t aggregatesExpired;
+};
+
+// YYYYMMDD of the UTC day containing `when`
+uint32_t partitionDayFor(time_t when);
+std::string partitionName(const char* table, uint32_t day);
+// Epoch seconds at the start of a YYYYMMDD day
+time_t partitionDayStart(uint32_t day);
+
+// The retention policy and daily aggregate tables; part of the schema
+bool createRetentionTables(sqlite3* database);
+// Moves tables from before partitioning, with their rows and indexes, into
+// the partition for `day` so they age out with it
+bool adoptUnpartitionedTables(sqlite3* database, uint32_t day);
+
+// Schema 8 keeps environment values inline. Adds the column to the
+// partitions, and any table from before partitioning, that lack it.
+bool addEnvironmentValueColumn(sqlite3* database);
+
+// Creates whatever partitions `day` is missing and points the views at the
+// partitions that exist, in one transaction
+bool openPartitionDay(sqlite3* database, uint32_t day);
+// Drops partitions past their retention, downsampling file accesses first,
+// and rebuilds the views in the same transaction
+bool applyRetention(sqlite3* database, uint32_t today, RetentionResult* result);
+
+// True if freed pages can be returned with incremental_vacuum
+bool incrementalVacuumEnabled(sqlite3* database);
+// One step; returns the pages given back (-1 on error) and sets *remaining
+int64_t incrementalVacuumStep(sqlite3* database, int pages, int64_t* remaining);
+
+// String collection. Between them the queries return every StringTable ID
+// kept on disk; each column of each row is one. The list changes with the
+// partitions, so it is taken again for every collection.
+std::vector<std::string> stringReferenceQueries(sqlite3* database);
+// Deletes the rows of released string IDs, with their search entries, in one transaction
+bool deleteStrings(sqlite3* database, const std::vector<uint32_t>& ids);
+
+std::vector<RetentionSetting> getRetentionSettings(sqlite3* database);
+bool setRetentionDays(sqlite3* database, const char* table, int days, std::string* error);
+
+#endif
@@ -0,0 +1,1153 @@
+// Batched, transactional writer for the event database
+#include "DatabaseWriter.h"
+#include <mach/mach_time.h>
+#include <syslog.h>
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include "LatencyHistogram.h"
+#include "Metrics.h"
+
+// Inserts into event tables name the day partition (%08u)
+static const char* kStatementSQL[] = {
+    "BEGIN IMMEDIATE",
+    "COMMIT",
+    "ROLLBACK",
+    
+    "INSERT INTO process_event_rows_d%08u ("
+    "timestamp, pid, ppid, executable_path_id, command_line_id, bundle_id_id, "
+    "uid, gid, event_type_id, cpu_time, memory_usage, is_system_process"
+    ") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+    
+    "INSERT INTO file_access_rows_d%08u ("
+    "timestamp, pid, path_id, access_type_id, was_blocked, reason_id, event_count, last_seen"
+    ") VALUES (?, ?, ?, ?, ?, ?, ?, ?)",
+    
+    "INSERT INTO network_connections_d%08u ("
+    "timestamp, pid, protocol, local_address, local_port, "
+    "remote_address, remote_port, state"
+    ") VALUES (?, ?, ?, ?, ?, ?, ?, ?)",
+    
+    "INSERT INTO system_calls_d%08u ("
+    "timestamp, pid, syscall_name, arguments, return_value"
+    ") VALUES (?, ?, ?, ?, ?)",
+    
+    "INSERT INTO loaded_library_rows_d%08u (timestamp, pid, library_path_id, load_address) "
+    "VALUES (?, ?, ?, ?)",
+    
+    "INSERT INTO environment_var_rows_d%08u (timestamp, pid, name_id, value) "
+    "VALUES (?, ?, ?, ?)",
+    
+    // A released ID handed out again replaces the row collection left behind
+    "INSERT OR REPLACE INTO strings (id, value) VALUES (?, ?)",
+    
+    "INSERT OR IGNORE INTO search_usage (string_id, kinds, last_seen, last_pid, uses) "
+    "VALUES (?1, ?2, ?3, ?4, ?5)",
+    
+    "UPDATE search_usage SET kinds = kinds | ?2, last_seen = ?3, last_pid = ?4, uses = uses + ?5 "
+    "WHERE string_id = ?1",
+    
+    "INSERT INTO search_index (rowid, value) SELECT id, value FROM strings WHERE id = ?",
+    
+    "INSERT INTO rollup_counts (resolution, bucket, dimension, key, events, blocked) "
+    "VALUES (?, ?, ?, ?, ?, ?) ON CONFLICT (resolution, bucket, dimension, key) "
+    "DO UPDATE SET events = events + excluded.events, blocked = blocked + excluded.blocked",
+    
+    // A root seen again after a restart is the same process, still running
+    "INSERT INTO process_lineage (pid, pid_version, parent_pid, parent_pid_version, relation, "
+    "executable_path_id, started) VALUES (?, ?, ?, ?, ?, ?, ?) "
+    "ON CONFLICT (pid, pid_version) DO UPDATE SET exited = 0",
+    
+    // Itself at distance 0, then each of the parent's ancestors one further away
+    "INSERT OR IGNORE INTO process_lineage_closure "
+    "(ancestor_pid, ancestor_pid_version, distance, descendant_pid, descendant_pid_version) "
+    "SELECT ?1, ?2, 0, ?1, ?2 UNION ALL "
+    "SELECT ancestor_pid, ancestor_pid_version, distance + 1, ?1, ?2 FROM process_lineage_closure "
+    "WHERE descendant_pid = ?3 AND descendant_pid_version = ?4",
+    
+    "UPDATE process_lineage SET exited = ?3 WHERE pid = ?1 AND pid_version = ?2",
+    
+    "UPDATE process_lineage SET executable_path_id = ?3 WHERE pid = ?1 AND pid_version = ?2"
+};
+
+DatabaseWriter::DatabaseWriter()
+    : database(nullptr), databaseMutex(nullptr), strings(nullptr), persistedStrings(0),
+      openFileTypeId(0), running(false),
+      flushRequested(0), flushCompleted(0), rowsQueued(0), rowsWritten(0),
+      rowsDropped(0), rowsFailed(0), batchesCommitted(0), commitFailures(0), lastCommitNs(0),
+      partitionDay(0), maintenanceRequested(false), vacuumEnabled(false), vacuumPending(false),
+      partitionsDropped(0), aggregateRows(0), vacuumedPages(0), lastMaintenanceNs(0),
+      searchIndexed(false), searchStringsIndexed(0), searchBackfillPending(0),
+      rollupRowsUpdated(0), rollupBackfillPending(0), stringRoots(nullptr), stringRootsContext(nullptr),
+      collectionWanted(false), collectionEpoch(0), collectionStarted(0), nextCollectionSource(0),
+      nextSweepId(0), stringCollections(0), stringsCollected(0), lastCollectionNs(0),
+      checkpointDatabase(nullptr), checkpointRunning(false), walPages(0), checkpoints(0),
+      checkpointedPages(0), lastCheckpointNs(0) {
+    for (int i = 0; i < STMT_COUNT; i++) {
+        statements[i] = nullptr;
+    }
+    pthread_mutex_init(&queueMutex, nullptr);
+    pthread_cond_init(&queueCond, nullptr);
+    pthread_cond_init(&flushedCond, nullptr);
+    pthread_mutex_init(&checkpointMutex, nullptr);
+    pthread_cond_init(&checkpointCond, nullptr);
+}
+
+DatabaseWriter::~DatabaseWriter() {
+    stop();
+    pthread_mutex_destroy(&queueMutex);
+    pthread_cond_destroy(&queueCond);
+    pthread_cond_destroy(&flushedCond);
+    pthread_mutex_destroy(&checkpointMutex);
+    pthread_cond_destroy(&checkpointCond);
+}
+
+// Prepares the full set against the partitions for `day`; on failure none are left
+bool DatabaseWriter::prepareStatements(sqlite3_stmt** prepared, uint32_t day) {
+    char sql[512];
+    for (int i = 0; i < STMT_COUNT; i++) {
+        if (i == STMT_INDEX_STRING && !searchIndexed) {
+            prepared[i] = nullptr;
+            continue;
+        }
+        snprintf(sql, sizeof(sql), kStatementSQL[i], day);
+        if (sqlite3_prepare_v3(database, sql, -1, SQLITE_PREPARE_PERSISTENT,
+                               &prepared[i], nullptr) != SQLITE_OK) {
+            syslog(LOG_ERR, "DatabaseWriter: failed to prepare statement %d: %s",
+                   i, sqlite3_errmsg(database));
+            for (int j = 0; j < i; j++) {
+                sqlite3_finalize(prepared[j]);
+                prepared[j] = nullptr;
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+bool configureDatabaseConnection(sqlite3* database, bool readOnly) {
+    char sql[256];
+    
+    // WAL lets systemmonitor and our own readers run alongside the writer;
+    // NORMAL sync only fsyncs at checkpoints, which WAL keeps crash-safe
+    // Incremental auto-vacuum only takes on a database with no tables yet;
+    // older files keep reusing freed pages instead of returning them
+    if (!readOnly) {
+        char* errMsg = nullptr;
+        if (sqlite3_exec(database, "PRAGMA auto_vacuum=INCREMENTAL; PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;",
+                         nullptr, nullptr, &errMsg) != SQLITE_OK) {
+            syslog(LOG_ERR, "Failed to enable WAL journaling: %s", errMsg);
+            sqlite3_free(errMsg);
+            return false;
+        }
+    }
+    
+    snprintf(sql, sizeof(sql),
+             "PRAGMA cache_size=-%d; PRAGMA mmap_size=%lld; PRAGMA temp_store=MEMORY;%s",
+             DB_CACHE_SIZE_KB, (long long)DB_MMAP_SIZE, readOnly ? " PRAGMA query_only=1;" : "");
+    if (sqlite3_exec(database, sql, nullptr, nullptr, nullptr) != SQLITE_OK) {
+        syslog(LOG_WARNING, "Failed to apply database tuning: %s", sqlite3_errmsg(database));
+    }
+    
+    return true;
+}
+
+// Called with databaseMutex held, before anything has been interned
+bool DatabaseWriter::loadStrings() {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database, "SELECT id, value FROM strings ORDER BY id", -1,
+                           &stmt, nullptr) != SQLITE_OK) {
+        syslog(LOG_ERR, "DatabaseWriter: cannot read strings: %s", sqlite3_errmsg(database));
+        return false;
+    }
+    
+    uint32_t restored = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        sqlite3_int64 id = sqlite3_column_int64(stmt, 0);
+        const char* value = (const char*)sqlite3_column_text(stmt, 1);
+        int length = sqlite3_column_bytes(stmt, 1);
+        if (id < 0 || id >= STRING_TABLE_MAX_ENTRIES ||
+            !strings->restore((uint32_t)id, value ? value : "", value ? (size_t)length : 0)) {
+            syslog(LOG_ERR, "DatabaseWriter: cannot restore string %lld", (long long)id);
+            break;
+        }
+        restored++;
+    }
+    sqlite3_finalize(stmt);
+    
+    persistedStrings.store(strings->count(), std::memory_order_relaxed);
+    syslog(LOG_INFO, "DatabaseWriter: restored %u interned strings", restored);
+    return true;
+}
+
+bool DatabaseWriter::writeString(uint32_t id) {
+    size_t length;
+    const char* value = strings->data(id, &length);
+    // Released again before it got here; only ID 0 is really empty
+    if (length == 0 && id != 0) {
+        return true;
+    }
+    sqlite3_stmt* stmt = statements[STMT_INSERT_STRING];
+    sqlite3_bind_int64(stmt, 1, id);
+    sqlite3_bind_text(stmt, 2, value, (int)length, SQLITE_STATIC);
+    return step(STMT_INSERT_STRING);
+}
+
+// Called inside the batch transaction: the new range, then reused IDs below it
+bool DatabaseWriter::writeStrings(uint32_t end) {
+    for (uint32_t id = persistedStrings.load(std::memory_order_relaxed); id < end; id++) {
+        if (!writeString(id)) {
+            return false;
+        }
+    }
+    // Normally collection already removed their search entries; if its delete
+    // failed, the old row is still there and the entry has to go before it does
+    if (!reusedStrings.empty() && !forgetSearchStrings(database, reusedStrings)) {
+        return false;
+    }
+    for (uint32_t id : reusedStrings) {
+        if (!writeString(id)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void DatabaseWriter::finalizeStatements() {
+    for (int i = 0; i < STMT_COUNT; i++) {
+        if (statements[i]) {
+            sqlite3_finalize(statements[i]);
+            statements[i] = nullptr;
+        }
+    }
+}
+
+void DatabaseWriter::setStringRoots(StringRootsCallback callback, void* context) {
+    stringRoots = callback;
+    stringRootsContext = context;
+}
+
+bool DatabaseWriter::start(sqlite3* db, pthread_mutex_t* dbMutex, StringTable* stringTable) {
+    database = db;
+    databaseMutex = dbMutex;
+    strings = stringTable;
+    
+    pthread_mutex_lock(databaseMutex);
+    // systemmonitor reads the same file; wait out its locks instead of failing the commit
+    sqlite3_busy_timeout(database, 5000);
+    uint32_t today = partitionDayFor(time(nullptr));
+    searchIndexed = searchIndexAvailable(database);
+    bool prepared = loadStrings() && openPartitionDay(database, today) && prepareStatements(statements, today);
+    vacuumEnabled = incrementalVacuumEnabled(database);
+    pthread_mutex_unlock(databaseMutex);
+    if (!prepared) {
+        return false;
+    }
+    partitionDay.store(today, std::memory_order_relaxed);
+    if (!vacuumEnabled) {
+        syslog(LOG_NOTICE, "DatabaseWriter: auto_vacuum is off; expired partitions free pages for reuse "
+               "but the file only shrinks after a full VACUUM");
+    }
+    
+    // Retention and any search backfill run with the first batch rather than holding up startup
+    maintenanceRequested.store(true, std::memory_order_relaxed);
+    searchBackfillPending.store(1, std::memory_order_relaxed);
+    rollupBackfillPending.store(1, std::memory_order_relaxed);
+    // Whatever the last run stopped using is collected once the interval has passed
+    collectionWanted = true;
+    
+    openFileTypeId = strings->intern("OPEN_FILE", 9);
+    
+    if (!startCheckpointer()) {
+        finalizeStatements();
+        return false;
+    }
+    
+    running = true;
+    if (pthread_create(&writerThread, nullptr, writerThreadMain, this) != 0) {
+        syslog(LOG_ERR, "DatabaseWriter: failed to start writer thread");
+        running = false;
+        stopCheckpointer();
+        finalizeStatements();
+        return false;
+    }
+    
+    return true;
+}
+
+void DatabaseWriter::stop() {
+    pthread_mutex_lock(&queueMutex);
+    if (!running) {
+        pthread_mutex_unlock(&queueMutex);
+        return;
+    }
+    running = false;
+    pthread_cond_signal(&queueCond);
+    pthread_mutex_unlock(&queueMutex);
+    
+    // The writer commits whatever is still pending before it exits
+    pthread_join(writerThread, nullptr);
+    
+    // Fold the WAL back into the database so the next open starts small
+    stopCheckpointer();
+    
+    pthread_mutex_lock(databaseMutex);
+    sqlite3_wal_hook(database, nullptr, nullptr);
+    finalizeStatements();
+    pthread_mutex_unlock(databaseMutex);
+    
+    syslog(LOG_INFO, "DatabaseWriter stopped: written=%llu dropped=%llu batches=%llu",
+           rowsWritten.load(), rowsDropped.load(), batchesCommitted.load());
+}
+
+void DatabaseWriter::flush() {
+    pthread_mutex_lock(&queueMutex);
+    if (!running) {
+        pthread_mutex_unlock(&queueMutex);
+        return;
+    }
+    uint64_t ticket = ++flushRequested;
+    pthread_cond_signal(&queueCond);
+    while (running && flushCompleted < ticket) {
+        pthread_cond_wait(&flushedCond, &queueMutex);
+    }
+    pthread_mutex_unlock(&queueMutex);
+}
+
+// Called with queueMutex held
+bool DatabaseWriter::reserveRows(size_t count) {
+    if (!running || pending.rows + count > DB_QUEUE_MAX_ROWS) {
+        uint64_t dropped = rowsDropped.fetch_add(count, std::memory_order_relaxed) + count;
+        if (dropped == count) {
+            syslog(LOG_WARNING, "DatabaseWriter: queue full, dropping rows");
+        }
+        return false;
+    }
+    return true;
+}
+
+// Called with queueMutex held, after the rows were pushed
+void DatabaseWriter::rowsAppended(size_t count) {
+    size_t before = pending.rows;
+    pending.rows += count;
+    rowsQueued.fetch_add(count, std::memory_order_relaxed);
+    
+    // Wake the writer to start the batch timer, or to commit a full batch now
+    if (before == 0 || (before < DB_BATCH_MAX_ROWS && pending.rows >= DB_BATCH_MAX_ROWS)) {
+        pthread_cond_signal(&queueCond);
+    }
+}
+
+void DatabaseWriter::appendProcessEvent(const ProcessRecord& process, uint32_t eventTypeId) {
+    pthread_mutex_lock(&queueMutex);
+    if (!reserveRows(1)) {
+        pthread_mutex_unlock(&queueMutex);
+        return;
+    }
+    
+    ProcessEventRow row;
+    row.timestamp = process.startTime;
+    row.pid = process.pid;
+    row.ppid = process.ppid;
+    row.executablePathId = process.executablePathId;
+    row.commandLineId = process.commandLineId;
+    row.bundleIdentifierId = process.bundleIdentifierId;
+    row.uid = process.uid;
+    row.gid = process.gid;
+    row.eventTypeId = eventTypeId;
+    row.cpuTime = process.cpuTime;
+    row.memoryUsage = process.memoryUsage;
+    row.isSystemProcess = process.isSystemProcess;
+    pending.processEvents.push_back(row);
+    
+    rowsAppended(1);
+    pthread_mutex_unlock(&queueMutex);
+}
+
+void DatabaseWriter::appendProcessDetails(const ProcessRecord& process, const LibrarySet* libraries) {
+    static const ProcessDetails noDetails;
+    const ProcessDetails& details = process.details ? *process.details : noDetails;
+    size_t libraryCount = libraries ? libraries->libraryIds.size() : 0;
+    size_t count = details.openFileIds.size() + libraryCount + details.environment.size();
+    if (count == 0) {
+        return;
+    }
+    
+    pthread_mutex_lock(&queueMutex);
+    if (!reserveRows(count)) {
+        pthread_mutex_unlock(&queueMutex);
+        return;
+    }
+    
+    // Open files, loaded libraries and environment go into their own tables
+    for (uint32_t fileId : details.openFileIds) {
+        pending.fileAccesses.push_back({process.startTime, process.pid, fileId, openFileTypeId, 0, false,
+                                        1, process.startTime});
+    }
+    for (size_t i = 0; i < libraryCount; i++) {
+        pending.libraries.push_back({process.startTime, process.pid, libraries->libraryIds[i]});
+    }
+    for (const auto& env : details.environment) {
+        pending.environment.push_back({process.startTime, process.pid, env.first, env.second});
+    }
+    
+    rowsAppended(count);
+    pthread_mutex_unlock(&queueMutex);
+}
+
+void DatabaseWriter::appendFileAccess(const FileAccessRecord& access) {
+    pthread_mutex_lock(&queueMutex);
+    if (reserveRows(1)) {
+        pending.fileAccesses.push_back(access);
+        rowsAppended(1);
+    }
+    pthread_mutex_unlock(&queueMutex);
+}
+
+void DatabaseWriter::appendNetworkEvent(const NetworkConnection& connection) {
+    pthread_mutex_lock(&queueMutex);
+    if (reserveRows(1)) {
+        pending.networkConnections.push_back(connection);
+        rowsAppended(1);
+    }
+    pthread_mutex_unlock(&queueMutex);
+}
+
+void DatabaseWriter::appendSystemCall(pid_t pid, const std::string& syscall,
+                                      const std::string& args, uint64_t timestamp) {
+    pthread_mutex_lock(&queueMutex);
+    if (reserveRows(1)) {
+        pending.systemCalls.push_back({timestamp, pid, syscall, args});
+        rowsAppended(1);
+    }
+    pthread_mutex_unlock(&queueMutex);
+}
+
+void DatabaseWriter::appendLineage(const std::vector<LineageRow>& rows) {
+    if (rows.empty()) {
+        return;
+    }
+    
+    // Not held to the queue cap: the closure table is built from these rows in
+    // order, so one dropped row would cut a whole subtree off from its ancestors
+    // for good. There are one or two per fork, exec or exit, and they're small.
+    pthread_mutex_lock(&queueMutex);
+    if (running) {
+        pending.lineage.insert(pending.lineage.end(), rows.begin(), rows.end());
+        rowsAppended(rows.size());
+    } else {
+        rowsDropped.fetch_add(rows.size(), std::memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&queueMutex);
+}
+
+bool DatabaseWriter::appendRows(const std::vector<ProcessEventRow>& processEvents,
+                                const std::vector<FileAccessRecord>& fileAccesses) {
+    size_t count = processEvents.size() + fileAccesses.size();
+    if (count == 0) {
+        return true;
+    }
+    
+    pthread_mutex_lock(&queueMutex);
+    if (!running || pending.rows + count > DB_QUEUE_MAX_ROWS) {
+        pthread_mutex_unlock(&queueMutex);
+        return false;
+    }
+    pending.processEvents.insert(pending.processEvents.end(), processEvents.begin(), processEvents.end());
+    pending.fileAccesses.insert(pending.fileAccesses.end(), fileAccesses.begin(), fileAccesses.end());
+    rowsAppended(count);
+    pthread_mutex_unlock(&queueMutex);
+    return true;
+}
+
+bool DatabaseWriter::step(Statement statement) {
+    sqlite3_stmt* stmt = statements[statement];
+    int result = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    
+    if (result != SQLITE_DONE) {
+        syslog(LOG_ERR, "DatabaseWriter: statement %d failed: %s",
+               statement, sqlite3_errmsg(database));
+        return false;
+    }
+    return true;
+}
+
+// Writer thread, without the database lock. Starts a new epoch, so anything
+// interned from here on is safe, then marks the roots; the tables follow.
+void DatabaseWriter::startCollection() {
+    collectionWanted = false;
+    collectionStarted = mach_absolute_time();
+    collectionEpoch = strings->beginCollection();
+    stringsMarked.assign(strings->count(), false);
+    
+    std::vector<uint32_t> roots;
+    roots.push_back(openFileTypeId);
+    stringRoots(stringRootsContext, &roots);
+    for (uint32_t id : roots) {
+        if (id < stringsMarked.size()) {
+            stringsMarked[id] = true;
+        }
+    }
+    collectionSources.clear();
+    nextCollectionSource = 0;
+    nextSweepId = 1;
+}
+
+// With the database lock: marks the IDs one table uses, or once every table
+// is marked, releases a run of the unmarked ones and deletes their rows
+void DatabaseWriter::collectStep() {
+    if (nextCollectionSource == 0 && collectionSources.empty()) {
+        collectionSources = stringReferenceQueries(database);
+    }
+    
+    if (nextCollectionSource < collectionSources.size()) {
+        const std::string& sql = collectionSources[nextCollectionSource++];
+        sqlite3_stmt* stmt;
+        int result = sqlite3_prepare_v2(database, sql.c_str(), -1, &stmt, nullptr);
+        if (result == SQLITE_OK) {
+            int columns = sqlite3_column_count(stmt);
+            while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+                for (int column = 0; column < columns; column++) {
+                    sqlite3_int64 id = sqlite3_column_int64(stmt, column);
+                    if (id > 0 && (uint64_t)id < stringsMarked.size()) {
+                        stringsMarked[(size_t)id] = true;
+                    }
+                }
+            }
+            sqlite3_finalize(stmt);
+        }
+        // A table that couldn't be read may hold anything; nothing is released
+        if (result != SQLITE_DONE) {
+            syslog(LOG_ERR, "DatabaseWriter: string collection abandoned at \"%s\": %s",
+                   sql.c_str(), sqlite3_errmsg(database));
+            collectionEpoch = 0;
+            collectionWanted = true;
+            std::vector<bool>().swap(stringsMarked);
+        }
+        return;
+    }
+    
+    std::vector<uint32_t> candidates;
+    uint32_t end = (uint32_t)stringsMarked.size();
+    for (; nextSweepId < end && candidates.size() < DB_STRING_SWEEP_IDS; nextSweepId++) {
+        if (!stringsMarked[nextSweepId]) {
+            candidates.push_back(nextSweepId);
+        }
+    }
+    
+    // Only those still unstamped are released, and their rows go before any
+    // batch can write the IDs again
+    std::vector<uint32_t> released;
+    strings->release(candidates, collectionEpoch, &released);
+    if (!released.empty()) {
+        if (!deleteStrings(database, released)) {
+            syslog(LOG_WARNING, "DatabaseWriter: %zu released strings left in the database until reused",
+                   released.size());
+        }
+        stringsCollected.fetch_add(released.size(), std::memory_order_relaxed);
+    }
+    
+    if (nextSweepId >= end) {
+        uint64_t elapsed = machToNanoseconds(mach_absolute_time() - collectionStarted);
+        StringTableStats table = strings->getStats();
+        syslog(LOG_INFO, "DatabaseWriter: string collection done in %llu ms; %llu live, %llu free",
+               (unsigned long long)(elapsed / 1000000), (unsigned long long)table.strings,
+               (unsigned long long)table.freeIds);
+        collectionEpoch = 0;
+        std::vector<bool>().swap(stringsMarked);
+        stringCollections.fetch_add(1, std::memory_order_relaxed);
+        lastCollectionNs.store(elapsed, std::memory_order_relaxed);
+    }
+}
+
+// Writer thread, between batches: day rollover, retention, one vacuum step,
+// one partition each of search and rollup backfill, and one string collection step
+void DatabaseWriter::maintain() {
+    uint32_t today = partitionDayFor(time(nullptr));
+    bool rollover = today != partitionDay.load(std::memory_order_relaxed);
+    bool retention = maintenanceRequested.exchange(false, std::memory_order_relaxed) || rollover;
+    bool backfill = searchBackfillPending.load(std::memory_order_relaxed) > 0;
+    bool rollupBackfill = rollupBackfillPending.load(std::memory_order_relaxed) > 0;
+    
+    // Retention waits for a running collection: rows moved from a partition
+    // not yet marked into a table already marked would be missed
+    if (retention && collectionEpoch != 0) {
+        maintenanceRequested.store(true, std::memory_order_relaxed);
+        retention = false;
+    }
+    if (collectionEpoch == 0 && stringRoots && (collectionWanted || strings->collectionWanted()) &&
+        (collectionStarted == 0 ||
+         machToNanoseconds(mach_absolute_time() - collectionStarted) >= DB_STRING_COLLECT_INTERVAL_S * 1000000000ull)) {
+        startCollection();
+    }
+    bool collecting = collectionEpoch != 0;
+    
+    if (!retention && !vacuumPending && !backfill && !rollupBackfill && !collecting) {
+        return;
+    }
+    
+    uint64_t started = mach_absolute_time();
+    pthread_mutex_lock(databaseMutex);
+    
+    if (rollover) {
+        // Inserts switch to the new day only once its tables and statements are all ready;
+        // otherwise rows keep going to the previous day rather than failing
+        sqlite3_stmt* prepared[STMT_COUNT];
+        if (openPartitionDay(database, today) && prepareStatements(prepared, today)) {
+            finalizeStatements();
+            for (int i = 0; i < STMT_COUNT; i++) {
+                statements[i] = prepared[i];
+            }
+        } else {
+            syslog(LOG_ERR, "DatabaseWriter: cannot open partitions for %08u; still writing %08u",
+                   today, partitionDay.load(std::memory_order_relaxed));
+        }
+        partitionDay.store(today, std::memory_order_relaxed);
+    }
+    
+    if (retention) {
+        RetentionResult result;
+        if (applyRetention(database, today, &result)) {
+            partitionsDropped.fetch_add(result.partitionsDropped, std::memory_order_relaxed);
+            aggregateRows.fetch_add(result.aggregateRows, std::memory_order_relaxed);
+            if (result.partitionsDropped > 0 || result.aggregatesExpired > 0) {
+                vacuumPending = vacuumEnabled;
+                collectionWanted = true;
+            }
+        }
+        uint64_t expiredRollups = 0;
+        if (expireRollups(database, time(nullptr), &expiredRollups) && expiredRollups > 0) {
+            vacuumPending = vacuumEnabled;
+            collectionWanted = true;
+        }
+        uint64_t expiredLineage = 0;
+        if (expireLineage(database, time(nullptr), &expiredLineage) && expiredLineage > 0) {
+            vacuumPending = vacuumEnabled;
+            collectionWanted = true;
+        }
+    }
+    
+    if (vacuumPending) {
+        int64_t remaining = 0;
+        int64_t reclaimed = incrementalVacuumStep(database, DB_VACUUM_STEP_PAGES, &remaining);
+        if (reclaimed > 0) {
+            vacuumedPages.fetch_add((uint64_t)reclaimed, std::memory_order_relaxed);
+        }
+        vacuumPending = reclaimed > 0 && remaining > 0;
+    }
+    
+    if (backfill) {
+        // Left queued on failure and retried at the next start
+        int64_t remaining = 0;
+        if (!backfillSearchStep(database, searchIndexed, &remaining)) {
+            remaining = 0;
+        }
+        searchBackfillPending.store(remaining, std::memory_order_relaxed);
+    }
+    
+    if (rollupBackfill) {
+        int64_t remaining = 0;
+        if (!backfillRollupStep(database, &remaining)) {
+            remaining = 0;
+        }
+        rollupBackfillPending.store(remaining, std::memory_order_relaxed);
+    }
+    
+    if (collecting) {
+        collectStep();
+    }
+    
+    pthread_mutex_unlock(databaseMutex);
+    lastMaintenanceNs.store(machToNanoseconds(mach_absolute_time() - started), std::memory_order_relaxed);
+}
+
+void DatabaseWriter::noteSearchUse(uint32_t stringId, uint32_t kind, pid_t pid) {
+    if (stringId == 0) {
+        return;
+    }
+    SearchUse& use = searchUses[stringId];
+    use.kinds |= kind;
+    use.pid = pid;
+    use.uses++;
+}
+
+// Inside the batch transaction. A failure here costs search freshness, not rows.
+void DatabaseWriter::writeSearchUses() {
+    sqlite3_int64 now = (sqlite3_int64)time(nullptr);
+    for (const auto& entry : searchUses) {
+        const SearchUse& use = entry.second;
+        for (Statement statement : {STMT_INSERT_SEARCH_USE, STMT_UPDATE_SEARCH_USE}) {
+            sqlite3_stmt* stmt = statements[statement];
+            sqlite3_bind_int64(stmt, 1, entry.first);
+            sqlite3_bind_int64(stmt, 2, use.kinds);
+            sqlite3_bind_int64(stmt, 3, now);
+            sqlite3_bind_int(stmt, 4, use.pid);
+            sqlite3_bind_int64(stmt, 5, (sqlite3_int64)use.uses);
+        }
+        
+        // A new string is indexed once; one seen before only has its usage updated
+        if (!step(STMT_INSERT_SEARCH_USE)) {
+            continue;
+        }
+        if (sqlite3_changes(database) > 0) {
+            if (searchIndexed) {
+                sqlite3_bind_int64(statements[STMT_INDEX_STRING], 1, entry.first);
+                step(STMT_INDEX_STRING);
+            }
+            searchStringsIndexed.fetch_add(1, std::memory_order_relaxed);
+            sqlite3_reset(statements[STMT_UPDATE_SEARCH_USE]);
+            sqlite3_clear_bindings(statements[STMT_UPDATE_SEARCH_USE]);
+        } else {
+            step(STMT_UPDATE_SEARCH_USE);
+        }
+    }
+    searchUses.clear();
+}
+
+void DatabaseWriter::countRollup(RollupDimension dimension, uint32_t key, uint64_t events, bool blocked) {
+    if (events == 0) {
+        return;
+    }
+    RollupCount& count = rollupCounts[(uint64_t)dimension << 32 | key];
+    count.events += events;
+    count.blocked += blocked ? events : 0;
+}
+
+// Inside the batch transaction; each count goes into its minute, its hour and the totals
+void DatabaseWriter::writeRollups() {
+    int64_t now = (int64_t)time(nullptr);
+    const int64_t buckets[][2] = {
+        {ROLLUP_MINUTE, now - now % ROLLUP_MINUTE},
+        {ROLLUP_HOUR, now - now % ROLLUP_HOUR},
+        {ROLLUP_TOTAL, 0}
+    };
+    
+    sqlite3_stmt* stmt = statements[STMT_UPSERT_ROLLUP];
+    for (const auto& entry : rollupCounts) {
+        for (const auto& bucket : buckets) {
+            sqlite3_bind_int64(stmt, 1, bucket[0]);
+            sqlite3_bind_int64(stmt, 2, bucket[1]);
+            sqlite3_bind_int64(stmt, 3, (sqlite3_int64)(entry.first >> 32));
+            sqlite3_bind_int64(stmt, 4, (sqlite3_int64)(entry.first & 0xffffffff));
+            sqlite3_bind_int64(stmt, 5, (sqlite3_int64)entry.second.events);
+            sqlite3_bind_int64(stmt, 6, (sqlite3_int64)entry.second.blocked);
+            if (step(STMT_UPSERT_ROLLUP)) {
+                rollupRowsUpdated.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+    rollupCounts.clear();
+}
+
+void DatabaseWriter::writeBatch(WriteBatch& batch) {
+    MetricsInterval interval(METRIC_INTERVAL_DB_COMMIT, batch.rows);
+    uint64_t started = mach_absolute_time();
+    
+    // Every ID referenced by this batch was interned before its row was queued
+    strings->takeReused(&reusedStrings);
+    uint32_t stringEnd = strings->count();
+    
+    pthread_mutex_lock(databaseMutex);
+    
+    if (!step(STMT_BEGIN)) {
+        pthread_mutex_unlock(databaseMutex);
+        commitFailures.fetch_add(1, std::memory_order_relaxed);
+        rowsDropped.fetch_add(batch.rows, std::memory_order_relaxed);
+        return;
+    }
+    
+    // Rows without their strings would be unreadable; fail the whole batch
+    if (!writeStrings(stringEnd)) {
+        step(STMT_ROLLBACK);
+        pthread_mutex_unlock(databaseMutex);
+        commitFailures.fetch_add(1, std::memory_order_relaxed);
+        rowsDropped.fetch_add(batch.rows, std::memory_order_relaxed);
+        return;
+    }
+    
+    // A row whose insert fails is left out of the rollups and search index, so
+    // they keep agreeing with the tables, and counted as failed, not written
+    uint64_t failed = 0;
+    sqlite3_stmt* stmt = statements[STMT_INSERT_PROCESS];
+    for (const auto& row : batch.processEvents) {
+        sqlite3_bind_int64(stmt, 1, row.timestamp);
+        sqlite3_bind_int(stmt, 2, row.pid);
+        sqlite3_bind_int(stmt, 3, row.ppid);
+        sqlite3_bind_int64(stmt, 4, row.executablePathId);
+        sqlite3_bind_int64(stmt, 5, row.commandLineId);
+        sqlite3_bind_int64(stmt, 6, row.bundleIdentifierId);
+        sqlite3_bind_int(stmt, 7, row.uid);
+        sqlite3_bind_int(stmt, 8, row.gid);
+        sqlite3_bind_int64(stmt, 9, row.eventTypeId);
+        sqlite3_bind_int64(stmt, 10, row.cpuTime);
+        sqlite3_bind_int64(stmt, 11, row.memoryUsage);
+        sqlite3_bind_int(stmt, 12, row.isSystemProcess ? 1 : 0);
+        if (!step(STMT_INSERT_PROCESS)) {
+            failed++;
+            continue;
+        }
+        noteSearchUse(row.executablePathId, SEARCH_EXECUTABLE, row.pid);
+        noteSearchUse(row.commandLineId, SEARCH_COMMAND_LINE, row.pid);
+        countRollup(ROLLUP_BY_TABLE, ROLLUP_PROCESS_EVENTS, 1, false);
+        countRollup(ROLLUP_BY_EVENT_TYPE, row.eventTypeId, 1, false);
+        countRollup(ROLLUP_BY_EXECUTABLE, row.executablePathId, 1, false);
+        countRollup(ROLLUP_BY_PID, (uint32_t)row.pid, 1, false);
+    }
+    
+    stmt = statements[STMT_INSERT_FILE];
+    for (const auto& access : batch.fileAccesses) {
+        sqlite3_bind_int64(stmt, 1, access.timestamp);
+        sqlite3_bind_int(stmt, 2, access.pid);
+        sqlite3_bind_int64(stmt, 3, access.pathId);
+        sqlite3_bind_int64(stmt, 4, access.accessTypeId);
+        sqlite3_bind_int(stmt, 5, access.wasBlocked ? 1 : 0);
+        sqlite3_bind_int64(stmt, 6, access.reasonId);
+        sqlite3_bind_int64(stmt, 7, access.count);
+        sqlite3_bind_int64(stmt, 8, access.lastSeen);
+        if (!step(STMT_INSERT_FILE)) {
+            failed++;
+            continue;
+        }
+        noteSearchUse(access.pathId, SEARCH_FILE_PATH, access.pid);
+        countRollup(ROLLUP_BY_TABLE, ROLLUP_FILE_ACCESS, access.count, access.wasBlocked);
+        countRollup(ROLLUP_BY_EVENT_TYPE, access.accessTypeId, access.count, access.wasBlocked);
+        countRollup(ROLLUP_BY_PID, (uint32_t)access.pid, access.count, access.wasBlocked);
+    }
+    
+    stmt = statements[STMT_INSERT_NETWORK];
+    for (const auto& connection : batch.networkConnections) {
+        sqlite3_bind_int64(stmt, 1, connection.timestamp);
+        sqlite3_bind_int(stmt, 2, connection.pid);
+        sqlite3_bind_text(stmt, 3, connection.protocol.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 4, connection.localAddress.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 5, connection.localPort);
+        sqlite3_bind_text(stmt, 6, connection.remoteAddress.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 7, connection.remotePort);
+        sqlite3_bind_text(stmt, 8, connection.state.c_str(), -1, SQLITE_STATIC);
+        if (!step(STMT_INSERT_NETWORK)) {
+            failed++;
+            continue;
+        }
+        countRollup(ROLLUP_BY_TABLE, ROLLUP_NETWORK_CONNECTIONS, 1, false);
+        countRollup(ROLLUP_BY_PID, (uint32_t)connection.pid, 1, false);
+    }
+    
+    stmt = statements[STMT_INSERT_SYSCALL];
+    for (const auto& row : batch.systemCalls) {
+        sqlite3_bind_int64(stmt, 1, row.timestamp);
+        sqlite3_bind_int(stmt, 2, row.pid);
+        sqlite3_bind_text(stmt, 3, row.syscall.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 4, row.arguments.c_str(), -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 5, "0", -1, SQLITE_STATIC);
+        if (!step(STMT_INSERT_SYSCALL)) {
+            failed++;
+            continue;
+        }
+        countRollup(ROLLUP_BY_TABLE, ROLLUP_SYSTEM_CALLS, 1, false);
+        countRollup(ROLLUP_BY_PID, (uint32_t)row.pid, 1, false);
+    }
+    
+    uint64_t libraries = 0;
+    stmt = statements[STMT_INSERT_LIBRARY];
+    for (const auto& row : batch.libraries) {
+        sqlite3_bind_int64(stmt, 1, row.timestamp);
+        sqlite3_bind_int(stmt, 2, row.pid);
+        sqlite3_bind_int64(stmt, 3, row.libraryPathId);
+        sqlite3_bind_text(stmt, 4, "0x0", -1, SQLITE_STATIC);
+        if (!step(STMT_INSERT_LIBRARY)) {
+            failed++;
+            continue;
+        }
+        libraries++;
+    }
+    countRollup(ROLLUP_BY_TABLE, ROLLUP_LOADED_LIBRARIES, libraries, false);
+    
+    uint64_t environment = 0;
+    stmt = statements[STMT_INSERT_ENVIRONMENT];
+    for (const auto& row : batch.environment) {
+        sqlite3_bind_int64(stmt, 1, row.timestamp);
+        sqlite3_bind_int(stmt, 2, row.pid);
+        sqlite3_bind_int64(stmt, 3, row.nameId);
+        sqlite3_bind_text(stmt, 4, row.value.c_str(), (int)row.value.size(), SQLITE_STATIC);
+        if (!step(STMT_INSERT_ENVIRONMENT)) {
+            failed++;
+            continue;
+        }
+        environment++;
+    }
+    countRollup(ROLLUP_BY_TABLE, ROLLUP_ENVIRONMENT_VARS, environment, false);
+    
+    for (const auto& row : batch.lineage) {
+        if (row.kind == LINEAGE_ROW_START) {
+            stmt = statements[STMT_INSERT_LINEAGE];
+            sqlite3_bind_int(stmt, 1, row.pid);
+            sqlite3_bind_int64(stmt, 2, row.pidVersion);
+            sqlite3_bind_int(stmt, 3, row.parentPid);
+            sqlite3_bind_int64(stmt, 4, row.parentPidVersion);
+            sqlite3_bind_int(stmt, 5, row.relation);
+            sqlite3_bind_int64(stmt, 6, row.executablePathId);
+            sqlite3_bind_int64(stmt, 7, row.time);
+            if (!step(STMT_INSERT_LINEAGE)) {
+                failed++;
+                continue;
+            }
+            
+            stmt = statements[STMT_INSERT_LINEAGE_CLOSURE];
+            sqlite3_bind_int(stmt, 1, row.pid);
+            sqlite3_bind_int64(stmt, 2, row.pidVersion);
+            sqlite3_bind_int(stmt, 3, row.parentPid);
+            sqlite3_bind_int64(stmt, 4, row.parentPidVersion);
+            if (!step(STMT_INSERT_LINEAGE_CLOSURE)) {
+                failed++;
+            }
+        } else {
+            Statement update = row.kind == LINEAGE_ROW_EXIT ? STMT_UPDATE_LINEAGE_EXIT : STMT_UPDATE_LINEAGE_IMAGE;
+            stmt = statements[update];
+            sqlite3_bind_int(stmt, 1, row.pid);
+            sqlite3_bind_int64(stmt, 2, row.pidVersion);
+            sqlite3_bind_int64(stmt, 3, row.kind == LINEAGE_ROW_EXIT ? row.time : row.executablePathId);
+            if (!step(update)) {
+                failed++;
+            }
+        }
+    }
+    
+    writeSearchUses();
+    writeRollups();
+    
+    bool committed = step(STMT_COMMIT);
+    if (!committed) {
+        step(STMT_ROLLBACK);
+    }
+    
+    pthread_mutex_unlock(databaseMutex);
+    
+    if (committed) {
+        persistedStrings.store(stringEnd, std::memory_order_relaxed);
+        reusedStrings.clear();
+        rowsWritten.fetch_add(batch.rows - failed, std::memory_order_relaxed);
+        rowsFailed.fetch_add(failed, std::memory_order_relaxed);
+        batchesCommitted.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        commitFailures.fetch_add(1, std::memory_order_relaxed);
+        rowsDropped.fetch_add(batch.rows, std::memory_order_relaxed);
+    }
+    uint64_t elapsed = machToNanoseconds(mach_absolute_time() - started);
+    lastCommitNs.store(elapsed, std::memory_order_relaxed);
+    commitLatency.record(elapsed);
+}
+
+void* DatabaseWriter::writerThreadMain(void* arg) {
+    DatabaseWriter* writer = (DatabaseWriter*)arg;
+    
+    pthread_mutex_lock(&writer->queueMutex);
+    while (true) {
+        // Sleep until the first row of a new batch arrives
+        while (writer->running && writer->pending.rows == 0 &&
+               writer->flushRequested == writer->flushCompleted) {
+            pthread_cond_wait(&writer->queueCond, &writer->queueMutex);
+        }
+        
+        // Then give the batch up to DB_BATCH_INTERVAL_MS to fill
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)DB_BATCH_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        
+        while (writer->running && writer->pending.rows < DB_BATCH_MAX_ROWS &&
+               writer->flushRequested == writer->flushCompleted) {
+            if (pthread_cond_timedwait(&writer->queueCond, &writer->queueMutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        
+        bool stopping = !writer->running;
+        uint64_t flushTicket = writer->flushRequested;
+        std::swap(writer->pending, writer->writing);
+        pthread_mutex_unlock(&writer->queueMutex);
+        
+        writer->maintain();
+        if (writer->writing.rows > 0) {
+            writer->writeBatch(writer->writing);
+        }
+        writer->writing.clear();
+        
+        pthread_mutex_lock(&writer->queueMutex);
+        writer->flushCompleted = flushTicket;
+        pthread_cond_broadcast(&writer->flushedCond);
+        
+        if (stopping && writer->pending.rows == 0) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&writer->queueMutex);
+    
+    return nullptr;
+}
+
+DatabaseWriterStats DatabaseWriter::getStats() {
+    DatabaseWriterStats stats;
+    stats.rowsQueued = rowsQueued.load(std::memory_order_relaxed);
+    stats.rowsWritten = rowsWritten.load(std::memory_order_relaxed);
+    stats.rowsDropped = rowsDropped.load(std::memory_order_relaxed);
+    stats.rowsFailed = rowsFailed.load(std::memory_order_relaxed);
+    stats.batchesCommitted = batchesCommitted.load(std::memory_order_relaxed);
+    stats.commitFailures = commitFailures.load(std::memory_order_relaxed);
+    stats.lastCommitNs = lastCommitNs.load(std::memory_order_relaxed);
+    stats.commitLatency = commitLatency.summarize();
+    stats.stringsPersisted = persistedStrings.load(std::memory_order_relaxed);
+    stats.walPages = walPages.load(std::memory_order_relaxed);
+    stats.checkpoints = checkpoints.load(std::memory_order_relaxed);
+    stats.checkpointedPages = checkpointedPages.load(std::memory_order_relaxed);
+    stats.lastCheckpointNs = lastCheckpointNs.load(std::memory_order_relaxed);
+    stats.partitionDay = partitionDay.load(std::memory_order_relaxed);
+    stats.searchStringsIndexed = searchStringsIndexed.load(std::memory_order_relaxed);
+    stats.searchBackfillPending = (uint64_t)searchBackfillPending.load(std::memory_order_relaxed);
+    stats.rollupRowsUpdated = rollupRowsUpdated.load(std::memory_order_relaxed);
+    stats.rollupBackfillPending = (uint64_t)rollupBackfillPending.load(std::memory_order_relaxed);
+    stats.partitionsDropped = partitionsDropped.load(std::memory_order_relaxed);
+    stats.aggregateRows = aggregateRows.load(std::memory_order_relaxed);
+    stats.vacuumedPages = vacuumedPages.load(std::memory_order_relaxed);
+    stats.lastMaintenanceNs = lastMaintenanceNs.load(std::memory_order_relaxed);
+    stats.stringCollections = stringCollections.load(std::memory_order_relaxed);
+    stats.stringsCollected = stringsCollected.load(std::memory_order_relaxed);
+    stats.lastCollectionNs = lastCollectionNs.load(std::memory_order_relaxed);
+    
+    pthread_mutex_lock(&queueMutex);
+    stats.pendingRows = pending.rows;
+    pthread_mutex_unlock(&queueMutex);
+    
+    return stats;
+}
+
+bool DatabaseWriter::startCheckpointer() {
+    const char* path = sqlite3_db_filename(database, "main");
+    if (!path || !*path) {
+        syslog(LOG_ERR, "DatabaseWriter: cannot checkpoint an unnamed database");
+        return false;
+    }
+    
+    if (sqlite3_open_v2(path, &checkpointDatabase, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+        syslog(LOG_ERR, "DatabaseWriter: cannot open checkpoint connection: %s",
+               sqlite3_errmsg(checkpointDatabase));
+        sqlite3_close(checkpointDatabase);
+        checkpointDatabase = nullptr;
+        return false;
+    }
+    sqlite3_busy_timeout(checkpointDatabase, 5000);
+    
+    // Registering a WAL hook replaces SQLite's own autocheckpoint on the writer
+    // connection, so commits never pay for a checkpoint inline
+    pthread_mutex_lock(databaseMutex);
+    sqlite3_wal_hook(database, walHook, this);
+    pthread_mutex_unlock(databaseMutex);
+    
+    checkpointRunning = true;
+    if (pthread_create(&checkpointThread, nullptr, checkpointThreadMain, this) != 0) {
+        syslog(LOG_ERR, "DatabaseWriter: failed to start checkpoint thread");
+        checkpointRunning = false;
+        pthread_mutex_lock(databaseMutex);
+        sqlite3_wal_hook(database, nullptr, nullptr);
+        pthread_mutex_unlock(databaseMutex);
+        sqlite3_close(checkpointDatabase);
+        checkpointDatabase = nullptr;
+        return false;
+    }
+    
+    return true;
+}
+
+void DatabaseWriter::stopCheckpointer() {
+    pthread_mutex_lock(&checkpointMutex);
+    if (!checkpointRunning) {
+        pthread_mutex_unlock(&checkpointMutex);
+        return;
+    }
+    checkpointRunning = false;
+    pthread_cond_signal(&checkpointCond);
+    pthread_mutex_unlock(&checkpointMutex);
+    
+    pthread_join(checkpointThread, nullptr);
+    
+    sqlite3_close(checkpointDatabase);
+    checkpointDatabase = nullptr;
+}
+
+// Runs on the writer thread after every commit, with databaseMutex held
+int DatabaseWriter::walHook(void* context, sqlite3* db, const char* name, int pages) {
+    DatabaseWriter* writer = (DatabaseWriter*)context;
+    uint64_t previous = writer->walPages.exchange((uint64_t)pages, std::memory_order_relaxed);
+    
+    if (previous < DB_CHECKPOINT_PAGES && (uint64_t)pages >= DB_CHECKPOINT_PAGES) {
+        pthread_mutex_lock(&writer->checkpointMutex);
+        pthread_cond_signal(&writer->checkpointCond);
+        pthread_mutex_unlock(&writer->checkpointMutex);
+    }
+    return SQLITE_OK;
+}
+
+void DatabaseWriter::checkpoint() {
+    uint64_t pages = walPages.load(std::memory_order_relaxed);
+    if (pages == 0) {
+        return;
+    }
+    
+    // PASSIVE copies what it can without waiting on readers or the writer;
+    // TRUNCATE waits for them so an oversized WAL file gets reset to zero
+    int mode = pages >= DB_WAL_TRUNCATE_PAGES ? SQLITE_CHECKPOINT_TRUNCATE : SQLITE_CHECKPOINT_PASSIVE;
+    int logFrames = 0;
+    int checkpointedFrames = 0;
+    uint64_t started = mach_absolute_time();
+    
+    int result = sqlite3_wal_checkpoint_v2(checkpointDatabase, nullptr, mode,
+                                           &logFrames, &checkpointedFrames);
+    if (result != SQLITE_OK && result != SQLITE_BUSY) {
+        syslog(LOG_WARNING, "DatabaseWriter: checkpoint failed: %s",
+               sqlite3_errmsg(checkpointDatabase));
+        return;
+    }
+    
+    checkpoints.fetch_add(1, std::memory_order_relaxed);
+    if (checkpointedFrames > 0) {
+        checkpointedPages.fetch_add((uint64_t)checkpointedFrames, std::memory_order_relaxed);
+    }
+    lastCheckpointNs.store(machToNanoseconds(mach_absolute_time() - started), std::memory_order_relaxed);
+    
+    // Once everything is backfilled the writer restarts the WAL from the top
+    if (result == SQLITE_OK && logFrames >= 0 && checkpointedFrames >= logFrames) {
+        uint64_t expected = pages;
+        walPages.compare_exchange_strong(expected, 0, std::memory_order_relaxed);
+    }
+}
+
+void* DatabaseWriter::checkpointThreadMain(void* arg) {
+    DatabaseWriter* writer = (DatabaseWriter*)arg;
+    
+    pthread_mutex_lock(&writer->checkpointMutex);
+    while (writer->checkpointRunning) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)(DB_CHECKPOINT_INTERVAL_MS % 1000) * 1000000L;
+        deadline.tv_sec += DB_CHECKPOINT_INTERVAL_MS / 1000 + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        
+        pthread_cond_timedwait(&writer->checkpointCond, &writer->checkpointMutex, &deadline);
+        
+        pthread_mutex_unlock(&writer->checkpointMutex);
+        writer->checkpoint();
+        pthread_mutex_lock(&writer->checkpointMutex);
+    }
+    pthread_mutex_unlock(&writer->checkpointMutex);
+    
+    // Final checkpoint now that the writer has committed its last batch
+    int logFrames = 0;
+    int checkpointedFrames = 0;
+    sqlite3_wal_checkpoint_v2(writer->checkpointDatabase, nullptr, SQLITE_CHECKPOINT_TRUNCATE,
+                              &logFrames, &checkpointedFrames);
+    writer->walPages.store(0, std::memory_order_relaxed);
+    
+    return nullptr;
+}
@@ -0,0 +1,346 @@
+#ifndef DatabaseWriter_h
+#define DatabaseWriter_h
+
+#include <sqlite3.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "MonitoringTypes.h"
+#include "LatencyHistogram.h"
+#include "StringTable.h"
+#include "LibrarySetCache.h"
+#include "DatabaseRetention.h"
+#include "SearchIndex.h"
+#include "EventRollups.h"
+#include "ProcessLineage.h"
+
+// Commit once this many rows are pending...
+#ifndef DB_BATCH_MAX_ROWS
+#define DB_BATCH_MAX_ROWS 512
+#endif
+
+// ...or once the oldest pending row is this old
+#ifndef DB_BATCH_INTERVAL_MS
+#define DB_BATCH_INTERVAL_MS 200
+#endif
+
+// Rows beyond this are dropped rather than blocking event workers
+#ifndef DB_QUEUE_MAX_ROWS
+#define DB_QUEUE_MAX_ROWS 200000
+#endif
+
+// Page cache per connection, in KiB
+#ifndef DB_CACHE_SIZE_KB
+#define DB_CACHE_SIZE_KB 16384
+#endif
+
+// Memory-mapped I/O window per connection, in bytes
+#ifndef DB_MMAP_SIZE
+#define DB_MMAP_SIZE (256ll * 1024 * 1024)
+#endif
+
+// Checkpoint once the WAL holds this many pages, or every interval if it holds any
+#ifndef DB_CHECKPOINT_PAGES
+#define DB_CHECKPOINT_PAGES 1000
+#endif
+
+#ifndef DB_CHECKPOINT_INTERVAL_MS
+#define DB_CHECKPOINT_INTERVAL_MS 5000
+#endif
+
+// Past this many pages, checkpoint in TRUNCATE mode to bound the WAL file size
+#ifndef DB_WAL_TRUNCATE_PAGES
+#define DB_WAL_TRUNCATE_PAGES 16384
+#endif
+
+// Least time between string collections. An ID interned at least this long
+// before a collection and held only outside the tables and the roots (queued
+// rows, stream queues) can be released, so it bounds how long those may keep one.
+#ifndef DB_STRING_COLLECT_INTERVAL_S
+#define DB_STRING_COLLECT_INTERVAL_S 60
+#endif
+
+// Unreferenced IDs released per maintenance step
+#ifndef DB_STRING_SWEEP_IDS
+#define DB_STRING_SWEEP_IDS 65536
+#endif
+
+// Adds the string IDs held in memory to *roots. Called on the writer thread,
+// without the database lock, each time a string collection starts.
+typedef void (*StringRootsCallback)(void* context, std::vector<uint32_t>* roots);
+
+// Row types queued for the writer; string columns are StringTable IDs
+struct ProcessEventRow {
+    uint64_t timestamp;
+    pid_t pid;
+    pid_t ppid;
+    uint32_t executablePathId;
+    uint32_t commandLineId;
+    uint32_t bundleIdentifierId;
+    uid_t uid;
+    gid_t gid;
+    uint32_t eventTypeId;
+    uint64_t cpuTime;
+    uint64_t memoryUsage;
+    bool isSystemProcess;
+};
+
+struct SystemCallRow {
+    uint64_t timestamp;
+    pid_t pid;
+    std::string syscall;
+    std::string arguments;
+};
+
+struct LibraryRow {
+    uint64_t timestamp;
+    pid_t pid;
+    uint32_t libraryPathId;
+};
+
+struct EnvironmentRow {
+    uint64_t timestamp;
+    pid_t pid;
+    uint32_t nameId;
+    std::string value;          // kept inline; values are rarely repeated
+};
+
+// All rows committed together in one transaction
+struct WriteBatch {
+    std::vector<ProcessEventRow> processEvents;
+    std::vector<FileAccessRecord> fileAccesses;
+    std::vector<NetworkConnection> networkConnections;
+    std::vector<SystemCallRow> systemCalls;
+    std::vector<LibraryRow> libraries;
+    std::vector<EnvironmentRow> environment;
+    std::vector<LineageRow> lineage;
+    size_t rows;
+    
+    WriteBatch() : rows(0) {}
+    
+    // Keeps vector capacity so steady-state batching doesn't reallocate
+    void clear() {
+        processEvents.clear();
+        fileAccesses.clear();
+        networkConnections.clear();
+        systemCalls.clear();
+        libraries.clear();
+        environment.clear();
+        lineage.clear();
+        rows = 0;
+    }
+};
+
+struct DatabaseWriterStats {
+    uint64_t rowsQueued;
+    uint64_t rowsWritten;
+    uint64_t rowsDropped;
+    uint64_t rowsFailed;            // inserts that failed inside a committed batch
+    uint64_t batchesCommitted;
+    uint64_t commitFailures;
+    uint64_t lastCommitNs;
+    LatencySummary commitLatency;   // whole batch transactions, successful or not
+    uint64_t pendingRows;
+    uint64_t stringsPersisted;
+    uint64_t walPages;
+    uint64_t checkpoints;
+    uint64_t checkpointedPages;
+    uint64_t lastCheckpointNs;
+    uint64_t partitionDay;          // YYYYMMDD rows are going into
+    uint64_t partitionsDropped;
+    uint64_t aggregateRows;
+    uint64_t vacuumedPages;
+    uint64_t lastMaintenanceNs;
+    uint64_t searchStringsIndexed;  // paths and command lines added to the search index
+    uint64_t searchBackfillPending; // partitions from before the index still to index
+    uint64_t rollupRowsUpdated;
+    uint64_t rollupBackfillPending;
+    uint64_t stringCollections;
+    uint64_t stringsCollected;      // IDs released and deleted from `strings`
+    uint64_t lastCollectionNs;      // whole collection, mark to sweep
+};
+
+// Owns all inserts into the event database. Producers append rows under a short
+// queue lock; a single writer thread commits them in batched transactions using
+// statements prepared once for the life of the connection. WAL checkpoints run
+// on a separate thread and connection so they never stall a commit. Strings
+// interned since the last commit are written to the `strings` table in the same
+// transaction as the rows that reference them. Between batches the writer
+// thread also moves inserts to the new day's partitions, applies retention
+// and returns freed pages a step at a time. Each batch also records the
+// paths and command lines it wrote for search, indexing the new ones, and
+// adds its counts to the minute, hour and lifetime rollups. Once retention
+// has dropped rows, or the string table is full, the writer collects the
+// strings that neither the tables nor the in-memory roots use any more,
+// marking one table per step and then sweeping, and releases their IDs.
+class DatabaseWriter {
+public:
+    DatabaseWriter();
+    ~DatabaseWriter();
+    
+    // Before start; without it strings are never collected
+    void setStringRoots(StringRootsCallback callback, void* context);
+    
+    // Loads the persisted strings into stringTable before any rows are accepted
+    bool start(sqlite3* database, pthread_mutex_t* databaseMutex, StringTable* stringTable);
+    void stop();
+    void flush();
+    // Applies a changed retention policy with the next batch
+    void requestMaintenance() { maintenanceRequested.store(true, std::memory_order_relaxed); }
+    
+    void appendProcessEvent(const ProcessRecord& process, uint32_t eventTypeId);
+    // Open files, libraries and environment; written once per process, not per event
+    void appendProcessDetails(const ProcessRecord& process, const LibrarySet* libraries);
+    void appendFileAccess(const FileAccessRecord& access);
+    void appendNetworkEvent(const NetworkConnection& connection);
+    void appendSystemCall(pid_t pid, const std::string& syscall, const std::string& args,
+                          uint64_t timestamp);
+    // Applied in order, so a node's parent is always written before it. Taken
+    // even when the queue is full; only a stopped writer drops them.
+    void appendLineage(const std::vector<LineageRow>& rows);
+    // Bulk append for rows decoded elsewhere (the event journal). Unlike the
+    // single-row appends, a full queue takes nothing and returns false rather
+    // than dropping, so the caller can flush() and retry.
+    bool appendRows(const std::vector<ProcessEventRow>& processEvents,
+                    const std::vector<FileAccessRecord>& fileAccesses);
+    
+    DatabaseWriterStats getStats();
+
+private:
+    enum Statement {
+        STMT_BEGIN,
+        STMT_COMMIT,
+        STMT_ROLLBACK,
+        STMT_INSERT_PROCESS,
+        STMT_INSERT_FILE,
+        STMT_INSERT_NETWORK,
+        STMT_INSERT_SYSCALL,
+        STMT_INSERT_LIBRARY,
+        STMT_INSERT_ENVIRONMENT,
+        STMT_INSERT_STRING,
+        STMT_INSERT_SEARCH_USE,
+        STMT_UPDATE_SEARCH_USE,
+        STMT_INDEX_STRING,          // null without FTS5 trigram support
+        STMT_UPSERT_ROLLUP,
+        STMT_INSERT_LINEAGE,
+        STMT_INSERT_LINEAGE_CLOSURE,
+        STMT_UPDATE_LINEAGE_EXIT,
+        STMT_UPDATE_LINEAGE_IMAGE,
+        STMT_COUNT
+    };
+    
+    sqlite3* database;
+    pthread_mutex_t* databaseMutex;
+    sqlite3_stmt* statements[STMT_COUNT];
+    
+    StringTable* strings;
+    std::atomic<uint32_t> persistedStrings;     // IDs below this are on disk
+    std::vector<uint32_t> reusedStrings;        // released IDs handed out again, not yet on disk
+    uint32_t openFileTypeId;
+    
+    pthread_t writerThread;
+    pthread_mutex_t queueMutex;
+    pthread_cond_t queueCond;
+    pthread_cond_t flushedCond;
+    bool running;
+    uint64_t flushRequested;
+    uint64_t flushCompleted;
+    
+    WriteBatch pending;     // filled by producers, guarded by queueMutex
+    WriteBatch writing;     // owned by the writer thread
+    
+    std::atomic<uint64_t> rowsQueued;
+    std::atomic<uint64_t> rowsWritten;
+    std::atomic<uint64_t> rowsDropped;
+    std::atomic<uint64_t> rowsFailed;
+    std::atomic<uint64_t> batchesCommitted;
+    std::atomic<uint64_t> commitFailures;
+    std::atomic<uint64_t> lastCommitNs;
+    LatencyHistogram commitLatency;
+    
+    // Writer thread only, apart from the stats
+    std::atomic<uint32_t> partitionDay;
+    std::atomic<bool> maintenanceRequested;
+    bool vacuumEnabled;
+    bool vacuumPending;
+    std::atomic<uint64_t> partitionsDropped;
+    std::atomic<uint64_t> aggregateRows;
+    std::atomic<uint64_t> vacuumedPages;
+    std::atomic<uint64_t> lastMaintenanceNs;
+    
+    // Search uses by string ID within the batch being written
+    struct SearchUse {
+        uint32_t kinds;
+        pid_t pid;
+        uint64_t uses;
+    };
+    std::unordered_map<uint32_t, SearchUse> searchUses;
+    bool searchIndexed;
+    std::atomic<uint64_t> searchStringsIndexed;
+    std::atomic<int64_t> searchBackfillPending;
+    
+    // Counts within the batch being written, by dimension << 32 | key
+    struct RollupCount {
+        uint64_t events;
+        uint64_t blocked;
+    };
+    std::unordered_map<uint64_t, RollupCount> rollupCounts;
+    std::atomic<uint64_t> rollupRowsUpdated;
+    std::atomic<int64_t> rollupBackfillPending;
+    
+    // String collection; epoch 0 when none is running
+    StringRootsCallback stringRoots;
+    void* stringRootsContext;
+    bool collectionWanted;
+    uint32_t collectionEpoch;
+    uint64_t collectionStarted;                 // mach time
+    std::vector<bool> stringsMarked;
+    std::vector<std::string> collectionSources;
+    size_t nextCollectionSource;
+    uint32_t nextSweepId;
+    std::atomic<uint64_t> stringCollections;
+    std::atomic<uint64_t> stringsCollected;
+    std::atomic<uint64_t> lastCollectionNs;
+    
+    sqlite3* checkpointDatabase;
+    pthread_t checkpointThread;
+    pthread_mutex_t checkpointMutex;
+    pthread_cond_t checkpointCond;
+    bool checkpointRunning;
+    std::atomic<uint64_t> walPages;
+    std::atomic<uint64_t> checkpoints;
+    std::atomic<uint64_t> checkpointedPages;
+    std::atomic<uint64_t> lastCheckpointNs;
+    
+    bool prepareStatements(sqlite3_stmt** prepared, uint32_t day);
+    bool loadStrings();
+    bool writeString(uint32_t id);
+    bool writeStrings(uint32_t end);
+    void finalizeStatements();
+    bool reserveRows(size_t count);
+    void rowsAppended(size_t count);
+    bool step(Statement statement);
+    void noteSearchUse(uint32_t stringId, uint32_t kind, pid_t pid);
+    void writeSearchUses();
+    void countRollup(RollupDimension dimension, uint32_t key, uint64_t events, bool blocked);
+    void writeRollups();
+    void startCollection();
+    void collectStep();
+    void maintain();
+    void writeBatch(WriteBatch& batch);
+    static void* writerThreadMain(void* arg);
+    
+    bool startCheckpointer();
+    void stopCheckpointer();
+    void checkpoint();
+    static int walHook(void* context, sqlite3* db, const char* name, int pages);
+    static void* checkpointThreadMain(void* arg);
+};
+
+// Applies the journal, cache and mmap settings shared by every connection
+bool configureDatabaseConnection(sqlite3* database, bool readOnly);
+
+#endif
@@ -0,0 +1,753 @@
+// Parallel getattrlistbulk directory scanning with an FSEvents-checked size cache
+#include "DirectoryScanner.h"
+#include <CoreServices/CoreServices.h>
+#include <dispatch/dispatch.h>
+#include <sys/attr.h>
+#include <sys/stat.h>
+#include <sys/vnode.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <deque>
+#include <unordered_set>
+
+static uint64_t checksum(const uint8_t* data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static std::string childPath(const std::string& parent, const char* name) {
+    std::string path = parent;
+    if (path.empty() || path.back() != '/') {
+        path += '/';
+    }
+    path += name;
+    return path;
+}
+
+static bool isWithin(const std::string& path, const std::string& root) {
+    if (path.compare(0, root.size(), root) != 0) {
+        return false;
+    }
+    return path.size() == root.size() || root.back() == '/' || path[root.size()] == '/';
+}
+
+// True if some proper ancestor of path is in the set
+static bool hasAncestorIn(const std::string& path, const std::unordered_set<std::string>& set) {
+    if (path.size() <= 1) {
+        return false;
+    }
+    for (size_t slash = path.rfind('/'); slash != std::string::npos; slash = path.rfind('/', slash - 1)) {
+        if (set.count(slash == 0 ? std::string("/") : path.substr(0, slash))) {
+            return true;
+        }
+        if (slash == 0) {
+            break;
+        }
+    }
+    return false;
+}
+
+// FSEvents numbers events per volume database; an ID means nothing on another
+static std::string volumeIdentifier(dev_t device) {
+    CFUUIDRef uuid = FSEventsCopyUUIDForDevice(device);
+    if (!uuid) {
+        return std::string();
+    }
+    CFStringRef text = CFUUIDCreateString(kCFAllocatorDefault, uuid);
+    CFRelease(uuid);
+    if (!text) {
+        return std::string();
+    }
+    char buffer[64];
+    bool converted = CFStringGetCString(text, buffer, sizeof(buffer), kCFStringEncodingUTF8);
+    CFRelease(text);
+    return converted ? std::string(buffer) : std::string();
+}
+
+// Traversal
+
+// Recursive items read every subdirectory too; the others only those the cache doesn't have
+struct ScanItem {
+    std::string path;
+    bool recursive;
+};
+
+struct ScanRun;
+
+// Results stay per worker until the scan ends, so reading a directory takes no shared lock
+struct ScanWorker {
+    ScanRun* run;
+    unsigned index;
+    pthread_t thread;
+    pthread_mutex_t mutex;          // guards items; anyone may steal from the front
+    std::deque<ScanItem> items;
+    std::vector<char> buffer;
+    std::vector<std::pair<std::string, CachedDirectory>> results;
+};
+
+struct ScanRun {
+    std::vector<ScanWorker> workers;
+    std::atomic<uint64_t> outstanding;      // queued or being read
+    const std::unordered_map<std::string, CachedDirectory>* cached;
+    const std::unordered_set<std::string>* seeded;  // read as seeds of their own
+    dev_t device;
+};
+
+static void pushItem(ScanWorker* worker, std::string path, bool recursive) {
+    worker->run->outstanding.fetch_add(1, std::memory_order_relaxed);
+    pthread_mutex_lock(&worker->mutex);
+    worker->items.push_back({std::move(path), recursive});
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+static bool takeItem(ScanWorker* worker, ScanItem* item) {
+    // Our newest first: the walk stays depth-first and the queue short
+    pthread_mutex_lock(&worker->mutex);
+    if (!worker->items.empty()) {
+        *item = std::move(worker->items.back());
+        worker->items.pop_back();
+        pthread_mutex_unlock(&worker->mutex);
+        return true;
+    }
+    pthread_mutex_unlock(&worker->mutex);
+    
+    // Then another's oldest, nearest the root and so the most work to take away
+    ScanRun* run = worker->run;
+    size_t count = run->workers.size();
+    for (size_t i = 1; i < count; i++) {
+        ScanWorker& victim = run->workers[(worker->index + i) % count];
+        pthread_mutex_lock(&victim.mutex);
+        if (!victim.items.empty()) {
+            *item = std::move(victim.items.front());
+            victim.items.pop_front();
+            pthread_mutex_unlock(&victim.mutex);
+            return true;
+        }
+        pthread_mutex_unlock(&victim.mutex);
+    }
+    return false;
+}
+
+// getattrlistbulk packs each entry's attributes in bit order, after its
+// length and the set actually returned; ATTR_CMN_ERROR comes first of all
+static void readDirectory(ScanWorker* worker, const ScanItem& item) {
+    ScanRun* run = worker->run;
+    CachedDirectory directory = {0, 0, true, {}};
+    
+    int fd = open(item.path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        directory.readable = false;
+        worker->results.emplace_back(item.path, std::move(directory));
+        return;
+    }
+    
+    struct attrlist attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.bitmapcount = ATTR_BIT_MAP_COUNT;
+    attributes.commonattr = ATTR_CMN_RETURNED_ATTRS | ATTR_CMN_NAME | ATTR_CMN_DEVID | ATTR_CMN_OBJTYPE |
+                            ATTR_CMN_ERROR;
+    attributes.fileattr = ATTR_FILE_DATALENGTH;
+    
+    while (true) {
+        int count = getattrlistbulk(fd, &attributes, worker->buffer.data(), worker->buffer.size(), 0);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            if (count < 0) {
+                directory.readable = false;
+            }
+            break;
+        }
+        
+        const char* entry = worker->buffer.data();
+        for (int i = 0; i < count; i++) {
+            uint32_t length;
+            memcpy(&length, entry, sizeof(length));
+            const char* field = entry + sizeof(length);
+            entry += length;
+            
+            attribute_set_t returned;
+            memcpy(&returned, field, sizeof(returned));
+            field += sizeof(returned);
+            
+            uint32_t entryError = 0;
+            if (returned.commonattr & ATTR_CMN_ERROR) {
+                memcpy(&entryError, field, sizeof(entryError));
+                field += sizeof(entryError);
+            }
+            const char* name = nullptr;
+            if (returned.commonattr & ATTR_CMN_NAME) {
+                attrreference_t reference;
+                memcpy(&reference, field, sizeof(reference));
+                name = field + reference.attr_dataoffset;
+                field += sizeof(reference);
+            }
+            dev_t device = run->device;
+            if (returned.commonattr & ATTR_CMN_DEVID) {
+                memcpy(&device, field, sizeof(device));
+                field += sizeof(device);
+            }
+            fsobj_type_t type = VNON;
+            if (returned.commonattr & ATTR_CMN_OBJTYPE) {
+                memcpy(&type, field, sizeof(type));
+                field += sizeof(type);
+            }
+            off_t size = 0;
+            if (returned.fileattr & ATTR_FILE_DATALENGTH) {
+                memcpy(&size, field, sizeof(size));
+            }
+            
+            if (entryError != 0 || !name) {
+                directory.readable = false;
+                continue;
+            }
+            if (type != VDIR) {
+                directory.files++;
+                directory.bytes += size > 0 ? (uint64_t)size : 0;
+                continue;
+            }
+            
+            // Another volume mounted here has its own sizes and its own event history
+            if (device != run->device) {
+                continue;
+            }
+            directory.children.push_back(name);
+            std::string path = childPath(item.path, name);
+            if (item.recursive) {
+                pushItem(worker, std::move(path), true);
+            } else if (!run->cached->count(path) && !run->seeded->count(path)) {
+                pushItem(worker, std::move(path), true);
+            }
+        }
+    }
+    close(fd);
+    
+    worker->results.emplace_back(item.path, std::move(directory));
+}
+
+static void* scanWorkerThread(void* argument) {
+    ScanWorker* worker = (ScanWorker*)argument;
+    ScanRun* run = worker->run;
+    unsigned idle = 0;
+    
+    while (true) {
+        ScanItem item;
+        if (takeItem(worker, &item)) {
+            readDirectory(worker, item);
+            // Its subdirectories were queued first, so zero really means done
+            run->outstanding.fetch_sub(1, std::memory_order_acq_rel);
+            idle = 0;
+            continue;
+        }
+        if (run->outstanding.load(std::memory_order_acquire) == 0) {
+            break;
+        }
+        // Someone is still reading a directory that may yield more work
+        if (++idle < 64) {
+            sched_yield();
+        } else {
+            usleep(100);
+        }
+    }
+    return nullptr;
+}
+
+// Seeds are dealt round-robin; the calling thread is worker 0
+static void runScan(ScanRun* run, unsigned threads, std::vector<ScanItem>& seeds) {
+    run->workers.resize(threads);
+    for (unsigned i = 0; i < threads; i++) {
+        ScanWorker& worker = run->workers[i];
+        worker.run = run;
+        worker.index = i;
+        pthread_mutex_init(&worker.mutex, nullptr);
+        worker.buffer.resize(DIRECTORY_SCAN_BUFFER_SIZE);
+    }
+    for (size_t i = 0; i < seeds.size(); i++) {
+        pushItem(&run->workers[i % threads], std::move(seeds[i].path), seeds[i].recursive);
+    }
+    
+    // Worker 0 steals from everyone, so a thread that didn't start only costs speed
+    std::vector<bool> started(threads, false);
+    for (unsigned i = 1; i < threads; i++) {
+        started[i] = pthread_create(&run->workers[i].thread, nullptr, scanWorkerThread, &run->workers[i]) == 0;
+    }
+    scanWorkerThread(&run->workers[0]);
+    for (unsigned i = 1; i < threads; i++) {
+        if (started[i]) {
+            pthread_join(run->workers[i].thread, nullptr);
+        }
+    }
+    
+    for (ScanWorker& worker : run->workers) {
+        pthread_mutex_destroy(&worker.mutex);
+    }
+}
+
+// FSEvents history
+
+struct HistoryQuery {
+    std::vector<std::string>* changed;
+    std::vector<std::string>* rescan;
+    bool complete;                  // HistoryDone arrived
+    bool lost;                      // dropped events, wrapped IDs, or the root itself moved
+    dispatch_semaphore_t done;
+};
+
+static void historyCallback(ConstFSEventStreamRef stream, void* info, size_t count, void* eventPaths,
+                            const FSEventStreamEventFlags* flags, const FSEventStreamEventId* ids) {
+    HistoryQuery* query = (HistoryQuery*)info;
+    const char* const* paths = (const char* const*)eventPaths;
+    const FSEventStreamEventFlags unreliable = kFSEventStreamEventFlagUserDropped | kFSEventStreamEventFlagKernelDropped |
+                                               kFSEventStreamEventFlagEventIdsWrapped | kFSEventStreamEventFlagRootChanged |
+                                               kFSEventStreamEventFlagMount | kFSEventStreamEventFlagUnmount;
+    
+    for (size_t i = 0; i < count && !query->complete; i++) {
+        if (flags[i] & kFSEventStreamEventFlagHistoryDone) {
+            // Live events after this belong to the next scan's history
+            query->complete = true;
+            dispatch_semaphore_signal(query->done);
+            break;
+        }
+        if (flags[i] & unreliable) {
+            query->lost = true;
+            continue;
+        }
+        
+        // Directory-level events: the path is the directory whose entries changed
+        std::string path = paths[i];
+        while (path.size() > 1 && path.back() == '/') {
+            path.pop_back();
+        }
+        if (flags[i] & kFSEventStreamEventFlagMustScanSubDirs) {
+            query->rescan->push_back(path);
+        } else {
+            query->changed->push_back(path);
+        }
+    }
+}
+
+static void stopHistoryStream(void* context) {
+    FSEventStreamRef stream = (FSEventStreamRef)context;
+    FSEventStreamStop(stream);
+    FSEventStreamInvalidate(stream);
+}
+
+// Directories under root that changed after eventId; false if the history can't say
+bool DirectoryScanner::changedSince(const std::string& root, uint64_t eventId, std::vector<std::string>* changed,
+                                    std::vector<std::string>* rescan) {
+    CFStringRef name = CFStringCreateWithCString(kCFAllocatorDefault, root.c_str(), kCFStringEncodingUTF8);
+    if (!name) {
+        return false;
+    }
+    CFArrayRef watched = CFArrayCreate(kCFAllocatorDefault, (const void**)&name, 1, &kCFTypeArrayCallBacks);
+    CFRelease(name);
+    if (!watched) {
+        return false;
+    }
+    
+    HistoryQuery query = {changed, rescan, false, false, dispatch_semaphore_create(0)};
+    FSEventStreamContext context = {0, &query, nullptr, nullptr, nullptr};
+    FSEventStreamRef stream = FSEventStreamCreate(kCFAllocatorDefault, historyCallback, &context, watched,
+                                                  eventId, 0, kFSEventStreamCreateFlagNoDefer);
+    CFRelease(watched);
+    if (!stream) {
+        dispatch_release(query.done);
+        return false;
+    }
+    
+    dispatch_queue_t queue = dispatch_queue_create("com.example.AudioVideoMonitor.size-history", nullptr);
+    FSEventStreamSetDispatchQueue(stream, queue);
+    bool started = FSEventStreamStart(stream);
+    if (started) {
+        dispatch_semaphore_wait(query.done, dispatch_time(DISPATCH_TIME_NOW,
+                                                          (int64_t)DIRECTORY_HISTORY_TIMEOUT_MS * 1000000));
+        // On the stream's queue, so no callback is still filling the lists
+        dispatch_sync_f(queue, stream, stopHistoryStream);
+    } else {
+        FSEventStreamInvalidate(stream);
+    }
+    FSEventStreamRelease(stream);
+    dispatch_release(queue);
+    dispatch_release(query.done);
+    
+    return started && query.complete && !query.lost;
+}
+
+// Scanning
+
+DirectoryScanner::DirectoryScanner(unsigned threads) : threadCount(threads) {
+    if (threadCount == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = cpus > 0 ? (unsigned)cpus : 1;
+    }
+}
+
+bool DirectoryScanner::scan(const char* path, DirectoryTotals* totals, std::string* error) {
+    memset(totals, 0, sizeof(*totals));
+    
+    char resolved[PATH_MAX];
+    struct stat info;
+    if (!realpath(path, resolved) || stat(resolved, &info) != 0) {
+        *error = std::string("cannot resolve ") + path + ": " + strerror(errno);
+        return false;
+    }
+    if (!S_ISDIR(info.st_mode)) {
+        *error = std::string(path) + " is not a directory";
+        return false;
+    }
+    std::string root = resolved;
+    
+    // Taken before anything is read, so changes made during the scan are in the next one's history
+    uint64_t eventId = FSEventsGetCurrentEventId();
+    std::string volume = volumeIdentifier(info.st_dev);
+    
+    Tree& tree = trees[root];
+    std::vector<std::string> changed;
+    std::vector<std::string> rescan;
+    bool cached = !tree.directories.empty() && !volume.empty() && tree.volume == volume &&
+                  tree.inode == (uint64_t)info.st_ino && tree.eventId <= eventId &&
+                  changedSince(root, tree.eventId, &changed, &rescan);
+    
+    std::vector<ScanItem> seeds;
+    std::unordered_set<std::string> seeded;
+    if (!cached) {
+        tree.directories.clear();
+        seeds.push_back({root, true});
+    } else {
+        // A directory the cache has never seen is new, and so is everything in it
+        std::unordered_set<std::string> recursive;
+        for (const std::string& directory : rescan) {
+            if (isWithin(directory, root)) {
+                recursive.insert(directory);
+            }
+        }
+        for (const std::string& directory : changed) {
+            if (isWithin(directory, root) && !tree.directories.count(directory)) {
+                recursive.insert(directory);
+            }
+        }
+        
+        // Nothing under a directory that's read recursively anyway needs a seed of its own
+        for (const std::string& directory : recursive) {
+            if (!hasAncestorIn(directory, recursive)) {
+                seeds.push_back({directory, true});
+                seeded.insert(directory);
+            }
+        }
+        for (const std::string& directory : changed) {
+            if (isWithin(directory, root) && !recursive.count(directory) &&
+                !hasAncestorIn(directory, recursive) && seeded.insert(directory).second) {
+                seeds.push_back({directory, false});
+            }
+        }
+    }
+    
+    if (!seeds.empty()) {
+        ScanRun run;
+        run.outstanding.store(0, std::memory_order_relaxed);
+        run.cached = &tree.directories;
+        run.seeded = &seeded;
+        run.device = info.st_dev;
+        runScan(&run, threadCount, seeds);
+        
+        for (ScanWorker& worker : run.workers) {
+            totals->directoriesRead += worker.results.size();
+            for (auto& result : worker.results) {
+                tree.directories[result.first] = std::move(result.second);
+            }
+        }
+    }
+    
+    total(&tree, root, totals);
+    tree.eventId = eventId;
+    tree.volume = volume;
+    tree.inode = (uint64_t)info.st_ino;
+    
+    // Without an event history there's nothing to check a cached copy against
+    if (volume.empty()) {
+        trees.erase(root);
+    }
+    return true;
+}
+
+// Sums the tree from its root, and drops directories no longer in it
+void DirectoryScanner::total(Tree* tree, const std::string& root, DirectoryTotals* totals) {
+    std::unordered_set<const CachedDirectory*> reached;
+    std::vector<std::string> stack;
+    stack.push_back(root);
+    
+    while (!stack.empty()) {
+        std::string path = std::move(stack.back());
+        stack.pop_back();
+        auto found = tree->directories.find(path);
+        if (found == tree->directories.end()) {
+            continue;
+        }
+        
+        const CachedDirectory& directory = found->second;
+        reached.insert(&directory);
+        totals->bytes += directory.bytes;
+        totals->files += directory.files;
+        totals->directories++;
+        totals->errors += !directory.readable;
+        for (const std::string& child : directory.children) {
+            stack.push_back(childPath(path, child.c_str()));
+        }
+    }
+    
+    for (auto it = tree->directories.begin(); it != tree->directories.end();) {
+        if (reached.count(&it->second)) {
+            ++it;
+        } else {
+            it = tree->directories.erase(it);
+        }
+    }
+}
+
+void DirectoryScanner::invalidate(const char* path) {
+    char resolved[PATH_MAX];
+    std::string target = realpath(path, resolved) ? resolved : path;
+    for (auto it = trees.begin(); it != trees.end();) {
+        if (isWithin(it->first, target) || isWithin(target, it->first)) {
+            it = trees.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Cache file: the magic, then per tree its root, event ID, volume and root
+// inode, and its directories depth-first from the root. Each directory is
+// its name, sizes, readable flag and subdirectory count, with the
+// subdirectories following it. All numbers are varints; an FNV-1a checksum
+// of everything before it ends the file.
+
+struct SizeCacheEncoder {
+    std::vector<uint8_t> buffer;
+    
+    void putVarint(uint64_t value) {
+        while (value >= 0x80) {
+            buffer.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        buffer.push_back((uint8_t)value);
+    }
+    
+    void putString(const std::string& value) {
+        putVarint(value.size());
+        buffer.insert(buffer.end(), value.begin(), value.end());
+    }
+};
+
+struct SizeCacheDecoder {
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+    
+    bool getVarint(uint64_t* value) {
+        *value = 0;
+        for (int shift = 0; shift < 64 && offset < size; shift += 7) {
+            uint8_t byte = data[offset++];
+            *value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    bool getString(std::string* value) {
+        uint64_t length;
+        if (!getVarint(&length) || length > size - offset) {
+            return false;
+        }
+        value->assign((const char*)data + offset, (size_t)length);
+        offset += (size_t)length;
+        return true;
+    }
+};
+
+bool DirectoryScanner::save(const char* path, std::string* error) {
+    SizeCacheEncoder encoder;
+    encoder.buffer.insert(encoder.buffer.end(), DIRECTORY_SIZE_CACHE_MAGIC, DIRECTORY_SIZE_CACHE_MAGIC + 8);
+    encoder.putVarint(trees.size());
+    
+    for (const auto& entry : trees) {
+        const Tree& tree = entry.second;
+        encoder.putString(entry.first);
+        encoder.putVarint(tree.eventId);
+        encoder.putString(tree.volume);
+        encoder.putVarint(tree.inode);
+        
+        // Depth-first; a directory's subdirectories follow it, so paths needn't be stored
+        std::vector<std::pair<std::string, std::string>> stack;     // path, name
+        stack.emplace_back(entry.first, std::string());
+        while (!stack.empty()) {
+            std::pair<std::string, std::string> next = std::move(stack.back());
+            stack.pop_back();
+            auto found = tree.directories.find(next.first);
+            const CachedDirectory* directory = found != tree.directories.end() ? &found->second : nullptr;
+            
+            encoder.putString(next.second);
+            encoder.putVarint(directory ? directory->bytes : 0);
+            encoder.putVarint(directory ? directory->files : 0);
+            encoder.buffer.push_back(directory && directory->readable);
+            
+            std::vector<std::string> present;
+            if (directory) {
+                for (const std::string& child : directory->children) {
+                    std::string childFullPath = childPath(next.first, child.c_str());
+                    if (tree.directories.count(childFullPath)) {
+                        present.push_back(child);
+                    }
+                }
+            }
+            encoder.putVarint(present.size());
+            // Reversed onto the stack so they come out in the listed order
+            for (auto child = present.rbegin(); child != present.rend(); ++child) {
+                stack.emplace_back(childPath(next.first, child->c_str()), *child);
+            }
+        }
+    }
+    
+    uint64_t sum = checksum(encoder.buffer.data(), encoder.buffer.size());
+    const uint8_t* sumBytes = (const uint8_t*)&sum;
+    encoder.buffer.insert(encoder.buffer.end(), sumBytes, sumBytes + sizeof(sum));
+    
+    std::string temporary = std::string(path) + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        *error = "cannot create " + temporary + ": " + strerror(errno);
+        return false;
+    }
+    size_t written = 0;
+    while (written < encoder.buffer.size()) {
+        ssize_t result = write(fd, encoder.buffer.data() + written, encoder.buffer.size() - written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            *error = "cannot write " + temporary + ": " + strerror(errno);
+            close(fd);
+            unlink(temporary.c_str());
+            return false;
+        }
+        written += (size_t)result;
+    }
+    close(fd);
+    if (rename(temporary.c_str(), path) != 0) {
+        *error = std::string("cannot replace ") + path + ": " + strerror(errno);
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool DirectoryScanner::load(const char* path, std::string* error) {
+    trees.clear();
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        *error = std::string("cannot open ") + path + ": " + strerror(errno);
+        return false;
+    }
+    
+    std::vector<uint8_t> contents;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 16) {
+        contents.resize((size_t)info.st_size);
+        size_t done = 0;
+        while (done < contents.size()) {
+            ssize_t result = read(fd, contents.data() + done, contents.size() - done);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                break;
+            }
+            done += (size_t)result;
+        }
+        contents.resize(done);
+    }
+    close(fd);
+    
+    uint64_t sum = 0;
+    if (contents.size() > 16) {
+        memcpy(&sum, contents.data() + contents.size() - sizeof(sum), sizeof(sum));
+    }
+    if (contents.size() <= 16 || memcmp(contents.data(), DIRECTORY_SIZE_CACHE_MAGIC, 8) != 0 ||
+        checksum(contents.data(), contents.size() - sizeof(sum)) != sum) {
+        *error = std::string(path) + " is damaged";
+        return false;
+    }
+    
+    SizeCacheDecoder decoder = {contents.data(), contents.size() - sizeof(sum), 8};
+    uint64_t treeCount;
+    bool valid = decoder.getVarint(&treeCount);
+    for (uint64_t t = 0; valid && t < treeCount; t++) {
+        std::string root;
+        Tree tree;
+        valid = decoder.getString(&root) && decoder.getVarint(&tree.eventId) &&
+                decoder.getString(&tree.volume) && decoder.getVarint(&tree.inode);
+        
+        // Each frame is a directory and how many of its subdirectories are still to come
+        std::vector<std::pair<std::string, uint64_t>> stack;
+        bool first = true;
+        while (valid && (first || !stack.empty())) {
+            if (!first && stack.back().second == 0) {
+                stack.pop_back();
+                continue;
+            }
+            
+            std::string name;
+            CachedDirectory directory = {0, 0, false, {}};
+            uint64_t childCount;
+            valid = decoder.getString(&name) && decoder.getVarint(&directory.bytes) &&
+                    decoder.getVarint(&directory.files) && decoder.offset < decoder.size;
+            if (!valid) {
+                break;
+            }
+            directory.readable = decoder.data[decoder.offset++] != 0;
+            valid = decoder.getVarint(&childCount) && childCount <= decoder.size - decoder.offset;
+            if (!valid) {
+                break;
+            }
+            
+            std::string directoryPath = root;
+            if (!first) {
+                stack.back().second--;
+                directoryPath = childPath(stack.back().first, name.c_str());
+                tree.directories[stack.back().first].children.push_back(name);
+            }
+            first = false;
+            tree.directories[directoryPath] = std::move(directory);
+            if (childCount > 0) {
+                stack.emplace_back(directoryPath, childCount);
+            }
+        }
+        
+        if (valid) {
+            trees[root] = std::move(tree);
+        }
+    }
+    
+    if (!valid) {
+        trees.clear();
+        *error = std::string(path) + " is damaged";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+#ifndef DirectoryScanner_h
+#define DirectoryScanner_h
+
+#include <sys/types.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+// Sizes of directory trees. Directories are read with getattrlistbulk,
+// which returns name, type and size for a whole batch of entries per call,
+// so a file costs no stat of its own. Every directory is a work item, and
+// the threads share them by work stealing: each takes its newest item and,
+// when it runs dry, the oldest of another's, which is nearest the root and
+// so the largest piece of tree left.
+//
+// What a scan found is kept per directory, in a cache file, with the
+// FSEvents ID it's current as of. The next scan of the tree asks FSEvents
+// which directories changed since then, rereads only those, and takes the
+// rest from the cache. A tree whose volume, root or event history doesn't
+// match is scanned from scratch. Mount points aren't crossed.
+
+#define DIRECTORY_SIZE_CACHE_MAGIC "AVSIZE01"
+
+// Threads per scan; 0 is one per active CPU
+#ifndef DIRECTORY_SCAN_THREADS
+#define DIRECTORY_SCAN_THREADS 0
+#endif
+
+// Bytes per getattrlistbulk call, per thread
+#ifndef DIRECTORY_SCAN_BUFFER_SIZE
+#define DIRECTORY_SCAN_BUFFER_SIZE (64 * 1024)
+#endif
+
+// How long FSEvents gets to replay the history since a cached scan
+#ifndef DIRECTORY_HISTORY_TIMEOUT_MS
+#define DIRECTORY_HISTORY_TIMEOUT_MS 5000
+#endif
+
+struct DirectoryTotals {
+    uint64_t bytes;                 // logical sizes of everything but directories
+    uint64_t files;
+    uint64_t directories;
+    uint64_t directoriesRead;       // read by this scan; the rest came from the cache
+    uint64_t errors;                // directories that couldn't be read in full
+};
+
+// A directory as it was last read
+struct CachedDirectory {
+    uint64_t bytes;                 // of the entries directly inside it
+    uint64_t files;
+    bool readable;
+    std::vector<std::string> children;          // subdirectory names
+};
+
+// Not thread-safe; a scan runs its own threads and returns when they're done
+class DirectoryScanner {
+public:
+    DirectoryScanner(unsigned threads);
+    
+    // An empty or missing file is an empty cache
+    bool load(const char* path, std::string* error);
+    // Replaces the file in one rename
+    bool save(const char* path, std::string* error);
+    
+    // False if path isn't a directory
+    bool scan(const char* path, DirectoryTotals* totals, std::string* error);
+    
+    // Forgets the cached trees that path is in or contains, for callers that
+    // just changed it; FSEvents may not have recorded the change yet
+    void invalidate(const char* path);
+
+private:
+    struct Tree {
+        uint64_t eventId;           // FSEvents ID the directories are current as of
+        std::string volume;         // FSEvents UUID of the volume
+        uint64_t inode;             // of the root, so a replaced root isn't mistaken for it
+        std::unordered_map<std::string, CachedDirectory> directories;     // by path
+    };
+    
+    unsigned threadCount;
+    std::unordered_map<std::string, Tree> trees;    // by root, resolved
+    
+    bool changedSince(const std::string& root, uint64_t eventId, std::vector<std::string>* changed,
+                      std::vector<std::string>* rescan);
+    void total(Tree* tree, const std::string& root, DirectoryTotals* totals);
+};
+
+#endif
@@ -0,0 +1,199 @@
+// Coalescing of repeated file accesses and per-pid rate limits
+#include "EventAggregator.h"
+#include "LatencyHistogram.h"
+
+static const uint64_t kTokenScale = 1000000000ull;
+static const uint64_t kBucketCapacity = (uint64_t)RATE_LIMIT_BURST * kTokenScale;
+
+// A bucket idle this long is full again, so its state can be forgotten
+static const uint64_t kIdleNs = (uint64_t)RATE_LIMIT_BURST * 1000000000ull / RATE_LIMIT_EVENTS_PER_SEC;
+
+// Sweeps at least this far apart, whatever the window
+static const uint64_t kMinSweepIntervalNs = 100 * 1000 * 1000;
+
+// Access types are small string IDs; the top bits hold the path
+static uint64_t summaryKey(const FileAccessRecord& access) {
+    return ((uint64_t)access.pathId << 32) | ((uint64_t)(access.accessTypeId & 0x7fffffff) << 1) |
+           (access.wasBlocked ? 1 : 0);
+}
+
+const char* eventClassName(EventClass eventClass) {
+    static const char* names[EVENT_CLASS_COUNT] = {"open", "write", "unlink", "mmap"};
+    return eventClass < EVENT_CLASS_COUNT ? names[eventClass] : "unknown";
+}
+
+EventAggregator::EventAggregator()
+    : nextSweepNs(0), pendingCount(0), absorbed(0), summaries(0), rateLimited(0) {
+}
+
+bool EventAggregator::take(ProcessState& state, EventClass eventClass, uint64_t timestamp) {
+    TokenBucket& bucket = state.buckets[eventClass];
+    
+    if (bucket.lastRefill == 0) {
+        bucket.tokens = kBucketCapacity;
+    } else if (timestamp > bucket.lastRefill) {
+        uint64_t elapsedNs = machToNanoseconds(timestamp - bucket.lastRefill);
+        if (elapsedNs >= kIdleNs) {
+            bucket.tokens = kBucketCapacity;
+        } else {
+            bucket.tokens += elapsedNs * RATE_LIMIT_EVENTS_PER_SEC;
+            if (bucket.tokens > kBucketCapacity) {
+                bucket.tokens = kBucketCapacity;
+            }
+        }
+    }
+    bucket.lastRefill = timestamp;
+    
+    if (bucket.tokens < kTokenScale) {
+        return false;
+    }
+    bucket.tokens -= kTokenScale;
+    return true;
+}
+
+bool EventAggregator::absorb(const FileAccessRecord& access, EventClass eventClass, uint64_t windowNs,
+                             AggregatorOutput* output) {
+    if (windowNs == 0) {
+        return false;
+    }
+    
+    // Bounded memory: a flood across many distinct paths just ends windows early
+    if (pendingCount.load(std::memory_order_relaxed) >= AGGREGATION_MAX_PENDING) {
+        flushAll(output);
+    }
+    
+    ProcessState& state = processes[access.pid];
+    state.lastActivity = access.timestamp;
+    
+    uint64_t key = summaryKey(access);
+    auto it = state.pending.find(key);
+    if (it != state.pending.end()) {
+        PendingSummary& summary = it->second;
+        if (access.timestamp >= summary.windowStart &&
+            machToNanoseconds(access.timestamp - summary.windowStart) < windowNs) {
+            if (summary.record.count == 0) {
+                summary.record.timestamp = access.timestamp;
+            }
+            summary.record.count++;
+            summary.record.lastSeen = access.timestamp;
+            absorbed.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        
+        // That window is over; report its repeats and open a new one with this access
+        emit(summary, output);
+        state.pending.erase(it);
+        pendingCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+    
+    PendingSummary summary;
+    summary.record = access;
+    summary.record.count = 0;
+    summary.windowStart = access.timestamp;
+    
+    bool allowed = take(state, eventClass, access.timestamp);
+    if (!allowed) {
+        // Over budget: even the first access waits for the summary
+        summary.record.count = 1;
+        rateLimited.fetch_add(1, std::memory_order_relaxed);
+        absorbed.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    state.pending.insert(std::make_pair(key, summary));
+    pendingCount.fetch_add(1, std::memory_order_relaxed);
+    return !allowed;
+}
+
+bool EventAggregator::admit(pid_t pid, EventClass eventClass, uint64_t timestamp) {
+    ProcessState& state = processes[pid];
+    state.lastActivity = timestamp;
+    
+    if (take(state, eventClass, timestamp)) {
+        return true;
+    }
+    state.suppressed[eventClass]++;
+    rateLimited.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void EventAggregator::emit(const PendingSummary& summary, AggregatorOutput* output) {
+    if (summary.record.count == 0) {
+        return;
+    }
+    output->accesses.push_back(summary.record);
+    summaries.fetch_add(1, std::memory_order_relaxed);
+}
+
+void EventAggregator::emitSuppressed(pid_t pid, ProcessState& state, AggregatorOutput* output) {
+    for (int eventClass = 0; eventClass < EVENT_CLASS_COUNT; eventClass++) {
+        if (state.suppressed[eventClass]) {
+            output->suppressed.push_back({pid, (EventClass)eventClass, state.suppressed[eventClass]});
+            state.suppressed[eventClass] = 0;
+        }
+    }
+}
+
+void EventAggregator::sweep(uint64_t now, uint64_t windowNs, AggregatorOutput* output) {
+    uint64_t nowNs = machToNanoseconds(now);
+    if (nowNs < nextSweepNs) {
+        return;
+    }
+    uint64_t interval = windowNs / 2;
+    nextSweepNs = nowNs + (interval > kMinSweepIntervalNs ? interval : kMinSweepIntervalNs);
+    
+    for (auto process = processes.begin(); process != processes.end();) {
+        ProcessState& state = process->second;
+        
+        for (auto it = state.pending.begin(); it != state.pending.end();) {
+            const PendingSummary& summary = it->second;
+            if (now > summary.windowStart && machToNanoseconds(now - summary.windowStart) >= windowNs) {
+                emit(summary, output);
+                it = state.pending.erase(it);
+                pendingCount.fetch_sub(1, std::memory_order_relaxed);
+            } else {
+                ++it;
+            }
+        }
+        emitSuppressed(process->first, state, output);
+        
+        // Nothing open and every bucket refilled: the state carries no information
+        if (state.pending.empty() && now > state.lastActivity &&
+            machToNanoseconds(now - state.lastActivity) >= kIdleNs) {
+            process = processes.erase(process);
+        } else {
+            ++process;
+        }
+    }
+}
+
+void EventAggregator::flushProcess(pid_t pid, AggregatorOutput* output) {
+    auto process = processes.find(pid);
+    if (process == processes.end()) {
+        return;
+    }
+    
+    for (const auto& entry : process->second.pending) {
+        emit(entry.second, output);
+    }
+    pendingCount.fetch_sub(process->second.pending.size(), std::memory_order_relaxed);
+    emitSuppressed(pid, process->second, output);
+    processes.erase(process);
+}
+
+void EventAggregator::flushAll(AggregatorOutput* output) {
+    for (auto& process : processes) {
+        for (const auto& entry : process.second.pending) {
+            emit(entry.second, output);
+        }
+        emitSuppressed(process.first, process.second, output);
+    }
+    processes.clear();
+    pendingCount.store(0, std::memory_order_relaxed);
+}
+
+void EventAggregator::addStats(AggregationStats* stats) const {
+    stats->absorbed += absorbed.load(std::memory_order_relaxed);
+    stats->summaries += summaries.load(std::memory_order_relaxed);
+    stats->rateLimited += rateLimited.load(std::memory_order_relaxed);
+    stats->pending += pendingCount.load(std::memory_order_relaxed);
+}
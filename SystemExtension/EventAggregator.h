@@ -0,0 +1,126 @@
+#ifndef EventAggregator_h
+#define EventAggregator_h
+
+#include <sys/types.h>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "MonitoringTypes.h"
+
+// Repeats of a (pid, path, access type) inside this window collapse into one
+// summary record; can be changed at runtime, 0 turns coalescing and the file
+// event budgets off
+#ifndef AGGREGATION_WINDOW_MS
+#define AGGREGATION_WINDOW_MS 1000
+#endif
+
+// Individual records each pid may produce per event class; past the budget
+// events only count toward the summaries
+#ifndef RATE_LIMIT_EVENTS_PER_SEC
+#define RATE_LIMIT_EVENTS_PER_SEC 100
+#endif
+
+#ifndef RATE_LIMIT_BURST
+#define RATE_LIMIT_BURST 500
+#endif
+
+// Open summaries per worker beyond which everything is flushed early
+#ifndef AGGREGATION_MAX_PENDING
+#define AGGREGATION_MAX_PENDING 8192
+#endif
+
+enum EventClass : uint8_t {
+    EVENT_CLASS_FILE_OPEN,
+    EVENT_CLASS_FILE_WRITE,
+    EVENT_CLASS_FILE_DELETE,
+    EVENT_CLASS_MMAP,
+    EVENT_CLASS_COUNT
+};
+
+const char* eventClassName(EventClass eventClass);
+
+// Rate-limited events that have no record of their own to be counted in
+struct SuppressedEvents {
+    pid_t pid;
+    EventClass eventClass;
+    uint32_t count;
+};
+
+// What a flush hands back to be logged
+struct AggregatorOutput {
+    std::vector<FileAccessRecord> accesses;
+    std::vector<SuppressedEvents> suppressed;
+    
+    bool empty() const { return accesses.empty() && suppressed.empty(); }
+    void clear() {
+        accesses.clear();
+        suppressed.clear();
+    }
+};
+
+struct AggregationStats {
+    uint64_t absorbed;          // accesses folded into a summary
+    uint64_t summaries;         // summary records emitted
+    uint64_t rateLimited;       // events that were over their pid's budget
+    uint64_t pending;           // summaries still open
+    uint64_t windowMs;
+};
+
+// Per-worker coalescing stage. Events are sharded by pid, so every event of
+// a process meets the same aggregator on the same thread and none of this
+// needs a lock; only the counters are read from elsewhere.
+//
+// The first access of a window is logged as usual, so "who touched what"
+// shows up at once. Repeats are counted and emitted as one record with the
+// count and first/last times when the window closes, the process exits, or
+// too many summaries are open.
+class EventAggregator {
+public:
+    EventAggregator();
+    
+    // True if the access was folded into a summary; false means log it as is
+    bool absorb(const FileAccessRecord& access, EventClass eventClass, uint64_t windowNs,
+                AggregatorOutput* output);
+    
+    // Token bucket check for events that are not coalesced; over budget they are only counted
+    bool admit(pid_t pid, EventClass eventClass, uint64_t timestamp);
+    
+    // Closes expired windows; cheap when the next sweep isn't due yet
+    void sweep(uint64_t now, uint64_t windowNs, AggregatorOutput* output);
+    void flushProcess(pid_t pid, AggregatorOutput* output);
+    void flushAll(AggregatorOutput* output);
+    
+    void addStats(AggregationStats* stats) const;
+
+private:
+    struct TokenBucket {
+        uint64_t tokens;            // in billionths of a token
+        uint64_t lastRefill;        // mach time; 0 until first use
+    };
+    
+    struct PendingSummary {
+        FileAccessRecord record;    // count 0 until a repeat arrives
+        uint64_t windowStart;       // mach time
+    };
+    
+    struct ProcessState {
+        TokenBucket buckets[EVENT_CLASS_COUNT];
+        uint32_t suppressed[EVENT_CLASS_COUNT];
+        uint64_t lastActivity;
+        std::unordered_map<uint64_t, PendingSummary> pending;
+    };
+    
+    std::unordered_map<pid_t, ProcessState> processes;
+    uint64_t nextSweepNs;
+    std::atomic<uint64_t> pendingCount;
+    std::atomic<uint64_t> absorbed;
+    std::atomic<uint64_t> summaries;
+    std::atomic<uint64_t> rateLimited;
+    
+    bool take(ProcessState& state, EventClass eventClass, uint64_t timestamp);
+    void emit(const PendingSummary& summary, AggregatorOutput* output);
+    void emitSuppressed(pid_t pid, ProcessState& state, AggregatorOutput* output);
+};
+
+#endif
@@ -0,0 +1,746 @@
+// Append-only mapped event journal in front of the database writer
+#include "EventJournal.h"
+#include "LatencyHistogram.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <mach/mach_time.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+
+// The first record-sized block holds the segment header
+static const uint32_t kSegmentCapacity = JOURNAL_SEGMENT_BYTES / sizeof(JournalRecord) - 1;
+
+EventJournal::EventJournal()
+    : strings(nullptr), writer(nullptr), active(nullptr), compactorRunning(false), nextSequence(1),
+      journaledStrings(0), appended(0), fallbacks(0), rotations(0), compacted(0), recovered(0),
+      lastCompactNs(0) {
+    pthread_mutex_init(&mutex, nullptr);
+    pthread_cond_init(&cond, nullptr);
+    pthread_mutex_init(&stringMutex, nullptr);
+    for (Segment& segment : segments) {
+        segment.state.store(SEGMENT_FREE, std::memory_order_relaxed);
+        segment.tail.store(0, std::memory_order_relaxed);
+        segment.writers.store(0, std::memory_order_relaxed);
+        segment.sequence = 0;
+        segment.openedNs = 0;
+        segment.fd = -1;
+        segment.base = nullptr;
+        segment.records = nullptr;
+        segment.capacity = 0;
+    }
+}
+
+EventJournal::~EventJournal() {
+    stop();
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&stringMutex);
+}
+
+bool EventJournal::start(const char* dir, StringTable* stringTable, DatabaseWriter* databaseWriter) {
+    if (running()) {
+        return true;
+    }
+    directory = dir;
+    strings = stringTable;
+    writer = databaseWriter;
+    
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        syslog(LOG_ERR, "EventJournal: cannot create %s: %s", dir, strerror(errno));
+        return false;
+    }
+    
+    if (!recover()) {
+        syslog(LOG_WARNING, "EventJournal: some segments could not be replayed and were kept");
+    }
+    
+    // Strings the database already has need no journal records; anything
+    // interned since (including by the replay) is journaled with the first append
+    journaledStrings.store((uint32_t)writer->getStats().stringsPersisted, std::memory_order_relaxed);
+    
+    Segment* first = openSegment();
+    if (!first) {
+        return false;
+    }
+    // The spare is only a head start; rotation works without one, just later
+    openSegment();
+    
+    pthread_mutex_lock(&mutex);
+    first->openedNs = machToNanoseconds(mach_absolute_time());
+    first->state.store(SEGMENT_ACTIVE, std::memory_order_relaxed);
+    compactorRunning = true;
+    if (pthread_create(&compactorThread, nullptr, compactorThreadMain, this) != 0) {
+        syslog(LOG_ERR, "EventJournal: failed to start compactor thread");
+        compactorRunning = false;
+        for (Segment& segment : segments) {
+            if (segment.state.load(std::memory_order_relaxed) != SEGMENT_FREE) {
+                closeSegment(&segment, true);
+            }
+        }
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    active.store(first, std::memory_order_release);
+    pthread_mutex_unlock(&mutex);
+    
+    syslog(LOG_INFO, "EventJournal: journaling to %s", dir);
+    return true;
+}
+
+void EventJournal::stop() {
+    pthread_mutex_lock(&mutex);
+    Segment* last = active.load(std::memory_order_relaxed);
+    if (!last) {
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    // Appends still in progress finish into the last segment; new ones fail
+    active.store(nullptr, std::memory_order_seq_cst);
+    last->state.store(SEGMENT_SEALING, std::memory_order_relaxed);
+    compactorRunning = false;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+    
+    // The compactor loads every sealed segment before it exits
+    pthread_join(compactorThread, nullptr);
+    
+    pthread_mutex_lock(&mutex);
+    for (Segment& segment : segments) {
+        if (segment.state.load(std::memory_order_relaxed) == SEGMENT_SPARE) {
+            closeSegment(&segment, true);
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    
+    syslog(LOG_INFO, "EventJournal stopped: appended=%llu compacted=%llu fallbacks=%llu",
+           appended.load(), compacted.load(), fallbacks.load());
+}
+
+std::string EventJournal::segmentPath(uint64_t sequence) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.avj", (unsigned long long)sequence);
+    return directory + name;
+}
+
+// Creates, sizes, maps and prefaults the file for a new spare segment. Slow
+// (it touches every page), so it is never called on the event path.
+EventJournal::Segment* EventJournal::openSegment() {
+    Segment* segment = nullptr;
+    uint64_t sequence;
+    pthread_mutex_lock(&mutex);
+    for (Segment& candidate : segments) {
+        if (candidate.state.load(std::memory_order_relaxed) == SEGMENT_FREE) {
+            segment = &candidate;
+            break;
+        }
+    }
+    if (!segment) {
+        pthread_mutex_unlock(&mutex);
+        return nullptr;
+    }
+    segment->state.store(SEGMENT_OPENING, std::memory_order_relaxed);
+    sequence = nextSequence++;
+    pthread_mutex_unlock(&mutex);
+    
+    std::string path = segmentPath(sequence);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        syslog(LOG_ERR, "EventJournal: cannot create %s: %s", path.c_str(), strerror(errno));
+        segment->state.store(SEGMENT_FREE, std::memory_order_release);
+        return nullptr;
+    }
+    if (ftruncate(fd, JOURNAL_SEGMENT_BYTES) != 0) {
+        syslog(LOG_ERR, "EventJournal: cannot size %s: %s", path.c_str(), strerror(errno));
+        close(fd);
+        unlink(path.c_str());
+        segment->state.store(SEGMENT_FREE, std::memory_order_release);
+        return nullptr;
+    }
+    void* base = mmap(nullptr, JOURNAL_SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        syslog(LOG_ERR, "EventJournal: cannot map %s: %s", path.c_str(), strerror(errno));
+        close(fd);
+        unlink(path.c_str());
+        segment->state.store(SEGMENT_FREE, std::memory_order_release);
+        return nullptr;
+    }
+    
+    // Take the page faults now rather than on first append
+    size_t page = (size_t)getpagesize();
+    for (size_t offset = 0; offset < JOURNAL_SEGMENT_BYTES; offset += page) {
+        ((volatile uint8_t*)base)[offset] = 0;
+    }
+    
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    JournalSegmentHeader* header = (JournalSegmentHeader*)base;
+    header->magic = JOURNAL_MAGIC;
+    header->version = JOURNAL_VERSION;
+    header->recordSize = sizeof(JournalRecord);
+    header->sequence = sequence;
+    header->capacity = kSegmentCapacity;
+    header->sealed = 0;
+    header->records = 0;
+    header->createdUsec = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+    
+    segment->sequence = sequence;
+    segment->openedNs = 0;
+    segment->fd = fd;
+    segment->base = (uint8_t*)base;
+    segment->records = (JournalRecord*)(segment->base + sizeof(JournalRecord));
+    segment->capacity = kSegmentCapacity;
+    segment->tail.store(0, std::memory_order_relaxed);
+    segment->writers.store(0, std::memory_order_relaxed);
+    segment->state.store(SEGMENT_SPARE, std::memory_order_release);
+    return segment;
+}
+
+// Keeps a spare ready so rotation never creates files on the event path
+bool EventJournal::ensureSpare() {
+    pthread_mutex_lock(&mutex);
+    bool haveSpare = false;
+    for (Segment& segment : segments) {
+        uint8_t state = segment.state.load(std::memory_order_relaxed);
+        if (state == SEGMENT_SPARE || state == SEGMENT_OPENING) {
+            haveSpare = true;
+        }
+    }
+    bool stopping = !compactorRunning;
+    pthread_mutex_unlock(&mutex);
+    if (haveSpare) {
+        return true;
+    }
+    return !stopping && openSegment() != nullptr;
+}
+
+// Called with mutex held
+void EventJournal::closeSegment(Segment* segment, bool remove) {
+    munmap(segment->base, JOURNAL_SEGMENT_BYTES);
+    close(segment->fd);
+    if (remove) {
+        unlink(segmentPath(segment->sequence).c_str());
+    }
+    segment->fd = -1;
+    segment->base = nullptr;
+    segment->records = nullptr;
+    segment->capacity = 0;
+    segment->state.store(SEGMENT_FREE, std::memory_order_release);
+}
+
+// Swaps the spare in for `full`. False only when there is no spare yet, in
+// which case the caller falls back and the compactor is asked for one.
+bool EventJournal::rotate(Segment* full) {
+    pthread_mutex_lock(&mutex);
+    Segment* current = active.load(std::memory_order_relaxed);
+    if (current != full) {
+        // Someone else rotated first (or the journal stopped)
+        pthread_mutex_unlock(&mutex);
+        return current != nullptr;
+    }
+    
+    Segment* next = nullptr;
+    for (Segment& candidate : segments) {
+        if (candidate.state.load(std::memory_order_acquire) == SEGMENT_SPARE) {
+            next = &candidate;
+            break;
+        }
+    }
+    pthread_cond_signal(&cond);
+    if (!next) {
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    
+    next->openedNs = machToNanoseconds(mach_absolute_time());
+    next->state.store(SEGMENT_ACTIVE, std::memory_order_relaxed);
+    full->state.store(SEGMENT_SEALING, std::memory_order_relaxed);
+    active.store(next, std::memory_order_seq_cst);
+    rotations.fetch_add(1, std::memory_order_relaxed);
+    pthread_mutex_unlock(&mutex);
+    return true;
+}
+
+// Reserves `count` consecutive records in the active segment. On success the
+// caller fills and commits them, then drops its writer count on `reserved`.
+JournalRecord* EventJournal::reserve(uint32_t count, Segment** reserved) {
+    while (true) {
+        Segment* segment = active.load(std::memory_order_acquire);
+        if (!segment) {
+            return nullptr;
+        }
+        // Announce ourselves before checking the segment is still active; once it
+        // is rotated out the compactor waits for writers to drain, and late
+        // arrivals like us see the new active segment and leave without touching it
+        segment->writers.fetch_add(1, std::memory_order_seq_cst);
+        if (active.load(std::memory_order_seq_cst) != segment) {
+            segment->writers.fetch_sub(1, std::memory_order_release);
+            continue;
+        }
+        
+        uint64_t index = segment->tail.fetch_add(count, std::memory_order_relaxed);
+        if (index + count <= segment->capacity) {
+            *reserved = segment;
+            return &segment->records[index];
+        }
+        
+        // Whatever part of the reservation landed inside the segment is padding
+        for (uint64_t i = index; i < segment->capacity; i++) {
+            segment->records[i].type = JOURNAL_PAD;
+            segment->records[i].commit.store(JOURNAL_COMMITTED, std::memory_order_release);
+        }
+        segment->writers.fetch_sub(1, std::memory_order_release);
+        if (!rotate(segment)) {
+            return nullptr;
+        }
+    }
+}
+
+// Called with stringMutex held
+bool EventJournal::journalString(uint32_t id, uint64_t machTime) {
+    size_t length;
+    const char* data = strings->data(id, &length);
+    length = std::min<size_t>(length, JOURNAL_STRING_MAX);
+    uint32_t count = 1;
+    if (length > JOURNAL_STRING_HEAD) {
+        count += (uint32_t)((length - JOURNAL_STRING_HEAD + JOURNAL_STRING_MORE_BYTES - 1) /
+                            JOURNAL_STRING_MORE_BYTES);
+    }
+    
+    Segment* segment;
+    JournalRecord* records = reserve(count, &segment);
+    if (!records) {
+        return false;
+    }
+    
+    size_t offset = std::min<size_t>(length, JOURNAL_STRING_HEAD);
+    records[0].type = JOURNAL_STRING;
+    records[0].machTime = machTime;
+    records[0].string.id = id;
+    records[0].string.length = (uint32_t)length;
+    memcpy(records[0].string.data, data, offset);
+    for (uint32_t i = 1; i < count; i++) {
+        size_t chunk = std::min<size_t>(length - offset, JOURNAL_STRING_MORE_BYTES);
+        records[i].type = JOURNAL_STRING_MORE;
+        records[i].machTime = machTime;
+        memcpy(records[i].more, data + offset, chunk);
+        offset += chunk;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        records[i].commit.store(JOURNAL_COMMITTED, std::memory_order_release);
+    }
+    segment->writers.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+// Makes sure every string ID a record uses is journaled before the record
+// refers to it. Takes a lock only when there is something new to write: IDs
+// past the journaled range, or released IDs the string table handed out again.
+bool EventJournal::journalStrings(std::initializer_list<uint32_t> ids) {
+    uint32_t highestId = std::max(ids);
+    uint32_t reused[4];
+    size_t reusedCount = 0;
+    for (uint32_t id : ids) {
+        if (reusedCount < 4 && strings->takeUnjournaled(id)) {
+            reused[reusedCount++] = id;
+        }
+    }
+    if (reusedCount == 0 && highestId < journaledStrings.load(std::memory_order_acquire)) {
+        return true;
+    }
+    
+    pthread_mutex_lock(&stringMutex);
+    uint64_t machTime = mach_absolute_time();
+    bool complete = true;
+    uint32_t id = journaledStrings.load(std::memory_order_relaxed);
+    // Reused IDs sit below the range; one inside it is written by the loop below.
+    // A reuse that can't be journaled sends the record to the writer instead.
+    for (size_t i = 0; i < reusedCount && complete; i++) {
+        if (reused[i] < id) {
+            complete = journalString(reused[i], machTime);
+        }
+    }
+    
+    // Everything interned so far, not just ours; other threads' IDs come next
+    uint32_t end = strings->count();
+    while (complete && id < end) {
+        if (!journalString(id, machTime)) {
+            complete = false;
+            break;
+        }
+        id++;
+    }
+    journaledStrings.store(id, std::memory_order_release);
+    pthread_mutex_unlock(&stringMutex);
+    return complete && highestId < id;
+}
+
+bool EventJournal::appendProcessEvent(const ProcessRecord& process, uint32_t eventTypeId) {
+    Segment* segment;
+    JournalRecord* record = nullptr;
+    if (journalStrings({process.executablePathId, process.commandLineId,
+                        process.bundleIdentifierId, eventTypeId})) {
+        record = reserve(1, &segment);
+    }
+    if (!record) {
+        fallbacks.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    // Segments start zeroed and are never reused, so unset fields stay 0
+    record->type = JOURNAL_PROCESS;
+    record->flags = process.isSystemProcess ? JOURNAL_FLAG_SYSTEM : 0;
+    record->machTime = mach_absolute_time();
+    record->pid = process.pid;
+    record->pidVersion = process.pidVersion;
+    record->process.timestamp = process.startTime;
+    record->process.cpuTime = process.cpuTime;
+    record->process.memoryUsage = process.memoryUsage;
+    record->process.ppid = process.ppid;
+    record->process.uid = process.uid;
+    record->process.gid = process.gid;
+    record->process.executablePathId = process.executablePathId;
+    record->process.commandLineId = process.commandLineId;
+    record->process.bundleIdentifierId = process.bundleIdentifierId;
+    record->process.eventTypeId = eventTypeId;
+    record->commit.store(JOURNAL_COMMITTED, std::memory_order_release);
+    segment->writers.fetch_sub(1, std::memory_order_release);
+    
+    appended.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool EventJournal::appendFileAccess(const FileAccessRecord& access) {
+    Segment* segment;
+    JournalRecord* record = nullptr;
+    if (journalStrings({access.pathId, access.accessTypeId, access.reasonId})) {
+        record = reserve(1, &segment);
+    }
+    if (!record) {
+        fallbacks.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    record->type = JOURNAL_FILE;
+    record->flags = access.wasBlocked ? JOURNAL_FLAG_BLOCKED : 0;
+    record->machTime = mach_absolute_time();
+    record->pid = access.pid;
+    record->file.timestamp = access.timestamp;
+    record->file.lastSeen = access.lastSeen;
+    record->file.pathId = access.pathId;
+    record->file.accessTypeId = access.accessTypeId;
+    record->file.reasonId = access.reasonId;
+    record->file.count = access.count;
+    record->commit.store(JOURNAL_COMMITTED, std::memory_order_release);
+    segment->writers.fetch_sub(1, std::memory_order_release);
+    
+    appended.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// Waits out the appends still finishing into a rotated segment, then marks it sealed
+void EventJournal::seal(Segment* segment) {
+    while (segment->writers.load(std::memory_order_acquire) != 0) {
+        sched_yield();
+    }
+    JournalSegmentHeader* header = (JournalSegmentHeader*)segment->base;
+    header->records = std::min<uint64_t>(segment->tail.load(std::memory_order_acquire), segment->capacity);
+    header->sealed = 1;
+    msync(segment->base, JOURNAL_SEGMENT_BYTES, MS_ASYNC);
+}
+
+uint32_t EventJournal::mapId(const Replay* replay, uint32_t id) const {
+    if (replay->remap.empty()) {
+        return id;
+    }
+    auto mapped = replay->remap.find(id);
+    return mapped == replay->remap.end() ? id : mapped->second;
+}
+
+// Decodes committed records into rows and hands them to the writer in chunks.
+// Records never committed belong to appends a crash cut short and are skipped.
+bool EventJournal::load(const JournalRecord* records, uint32_t count, Replay* replay) {
+    for (uint32_t i = 0; i < count; i++) {
+        const JournalRecord& record = records[i];
+        if (record.commit.load(std::memory_order_acquire) != JOURNAL_COMMITTED) {
+            continue;
+        }
+        
+        switch (record.type) {
+            case JOURNAL_PROCESS: {
+                ProcessEventRow row;
+                row.timestamp = record.process.timestamp;
+                row.pid = record.pid;
+                row.ppid = record.process.ppid;
+                row.executablePathId = mapId(replay, record.process.executablePathId);
+                row.commandLineId = mapId(replay, record.process.commandLineId);
+                row.bundleIdentifierId = mapId(replay, record.process.bundleIdentifierId);
+                row.uid = record.process.uid;
+                row.gid = record.process.gid;
+                row.eventTypeId = mapId(replay, record.process.eventTypeId);
+                row.cpuTime = record.process.cpuTime;
+                row.memoryUsage = record.process.memoryUsage;
+                row.isSystemProcess = (record.flags & JOURNAL_FLAG_SYSTEM) != 0;
+                replay->processEvents.push_back(row);
+                break;
+            }
+            case JOURNAL_FILE: {
+                FileAccessRecord row;
+                row.timestamp = record.file.timestamp;
+                row.pid = record.pid;
+                row.pathId = mapId(replay, record.file.pathId);
+                row.accessTypeId = mapId(replay, record.file.accessTypeId);
+                row.reasonId = mapId(replay, record.file.reasonId);
+                row.wasBlocked = (record.flags & JOURNAL_FLAG_BLOCKED) != 0;
+                row.count = record.file.count;
+                row.lastSeen = record.file.lastSeen;
+                replay->fileAccesses.push_back(row);
+                break;
+            }
+            case JOURNAL_STRING:
+                // Live strings are already in the table; only a replay needs them
+                if (replay->recovering) {
+                    i += restoreString(records, count, i, replay);
+                }
+                break;
+            default:
+                break;
+        }
+        
+        if (replay->processEvents.size() + replay->fileAccesses.size() >= JOURNAL_LOAD_BATCH &&
+            !handOver(replay)) {
+            return false;
+        }
+    }
+    return handOver(replay);
+}
+
+// Puts a journaled string back under its ID. Returns how many continuation
+// records it consumed.
+uint32_t EventJournal::restoreString(const JournalRecord* records, uint32_t count, uint32_t index,
+                                     Replay* replay) {
+    const JournalRecord& head = records[index];
+    uint32_t length = head.string.length;
+    std::string value(head.string.data, std::min<uint32_t>(length, JOURNAL_STRING_HEAD));
+    uint32_t used = 0;
+    while (value.size() < length) {
+        uint32_t next = index + 1 + used;
+        if (next >= count || records[next].commit.load(std::memory_order_acquire) != JOURNAL_COMMITTED ||
+            records[next].type != JOURNAL_STRING_MORE) {
+            // Torn by the crash; the ID ends up an empty placeholder
+            return used;
+        }
+        value.append(records[next].more, std::min<size_t>(length - value.size(), JOURNAL_STRING_MORE_BYTES));
+        used++;
+    }
+    
+    uint32_t id = head.string.id;
+    if (id >= strings->count()) {
+        if (!strings->restore(id, value.data(), value.size())) {
+            syslog(LOG_WARNING, "EventJournal: cannot restore string %u", id);
+        }
+        return used;
+    }
+    
+    // The ID was handed out again before the crash was noticed (strings
+    // interned since start); point this segment's rows at the right text
+    size_t existingLength;
+    const char* existing = strings->data(id, &existingLength);
+    if (existingLength != value.size() || memcmp(existing, value.data(), value.size()) != 0) {
+        replay->remap[id] = strings->intern(value);
+    }
+    return used;
+}
+
+// Queues the decoded rows; when the writer pushes back, waits for it to commit
+bool EventJournal::handOver(Replay* replay) {
+    size_t rows = replay->processEvents.size() + replay->fileAccesses.size();
+    if (rows == 0) {
+        return true;
+    }
+    for (int attempt = 0; !writer->appendRows(replay->processEvents, replay->fileAccesses); attempt++) {
+        if (attempt == 3) {
+            syslog(LOG_ERR, "EventJournal: database writer is not taking rows");
+            return false;
+        }
+        writer->flush();
+    }
+    replay->rows += rows;
+    replay->processEvents.clear();
+    replay->fileAccesses.clear();
+    return true;
+}
+
+// Replays segments an earlier run left behind, oldest first, and deletes them.
+// Stops at the first one that can't be loaded so later segments don't lose
+// the strings it defines.
+bool EventJournal::recover() {
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        syslog(LOG_ERR, "EventJournal: cannot open %s: %s", directory.c_str(), strerror(errno));
+        return false;
+    }
+    std::vector<uint64_t> found;
+    while (struct dirent* entry = readdir(dir)) {
+        unsigned long long sequence;
+        char suffix[8];
+        if (sscanf(entry->d_name, "%16llx.%7s", &sequence, suffix) == 2 && strcmp(suffix, "avj") == 0) {
+            found.push_back(sequence);
+        }
+    }
+    closedir(dir);
+    std::sort(found.begin(), found.end());
+    
+    // One replay for all of them: a remapped ID stays remapped in later segments
+    Replay replay;
+    replay.recovering = true;
+    for (uint64_t sequence : found) {
+        nextSequence = std::max(nextSequence, sequence + 1);
+        std::string path = segmentPath(sequence);
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0 || info.st_size < (off_t)(2 * sizeof(JournalRecord))) {
+            syslog(LOG_WARNING, "EventJournal: discarding unreadable segment %s", path.c_str());
+            if (fd >= 0) {
+                close(fd);
+            }
+            unlink(path.c_str());
+            continue;
+        }
+        void* base = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            syslog(LOG_ERR, "EventJournal: cannot map %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        
+        const JournalSegmentHeader* header = (const JournalSegmentHeader*)base;
+        if (header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION ||
+            header->recordSize != sizeof(JournalRecord)) {
+            syslog(LOG_WARNING, "EventJournal: %s is not a journal segment this version reads", path.c_str());
+            munmap(base, (size_t)info.st_size);
+            return false;
+        }
+        
+        uint32_t capacity = std::min<uint32_t>(header->capacity,
+                                               (uint32_t)(info.st_size / sizeof(JournalRecord)) - 1);
+        bool sealed = header->sealed != 0;
+        replay.rows = 0;
+        bool loaded = load((const JournalRecord*)((const uint8_t*)base + sizeof(JournalRecord)), capacity, &replay);
+        munmap(base, (size_t)info.st_size);
+        if (!loaded) {
+            syslog(LOG_ERR, "EventJournal: keeping %s for the next start", path.c_str());
+            return false;
+        }
+        
+        // Delete only once the rows are committed
+        writer->flush();
+        unlink(path.c_str());
+        recovered.fetch_add(replay.rows, std::memory_order_relaxed);
+        syslog(LOG_NOTICE, "EventJournal: replayed %llu rows from %s segment %s",
+               (unsigned long long)replay.rows, sealed ? "sealed" : "unsealed", path.c_str());
+    }
+    return true;
+}
+
+// Loads every sealing segment into the database, oldest first, and deletes it
+void EventJournal::compactSealed() {
+    while (true) {
+        Segment* oldest = nullptr;
+        pthread_mutex_lock(&mutex);
+        for (Segment& segment : segments) {
+            if (segment.state.load(std::memory_order_relaxed) == SEGMENT_SEALING &&
+                (!oldest || segment.sequence < oldest->sequence)) {
+                oldest = &segment;
+            }
+        }
+        pthread_mutex_unlock(&mutex);
+        if (!oldest) {
+            return;
+        }
+        // Loading takes a while; make sure producers have somewhere to go meanwhile
+        ensureSpare();
+        
+        uint64_t started = mach_absolute_time();
+        seal(oldest);
+        Replay replay;
+        replay.recovering = false;
+        replay.rows = 0;
+        uint32_t count = (uint32_t)((const JournalSegmentHeader*)oldest->base)->records;
+        if (!load(oldest->records, count, &replay)) {
+            // Only when the writer has stopped. The file stays and is replayed at
+            // the next start; rows already handed over may then be written twice.
+            return;
+        }
+        writer->flush();
+        
+        compacted.fetch_add(replay.rows, std::memory_order_relaxed);
+        lastCompactNs.store(machToNanoseconds(mach_absolute_time() - started), std::memory_order_relaxed);
+        pthread_mutex_lock(&mutex);
+        closeSegment(oldest, true);
+        pthread_mutex_unlock(&mutex);
+    }
+}
+
+void* EventJournal::compactorThreadMain(void* arg) {
+    EventJournal* journal = (EventJournal*)arg;
+    
+    pthread_mutex_lock(&journal->mutex);
+    while (true) {
+        bool stopping = !journal->compactorRunning;
+        Segment* current = journal->active.load(std::memory_order_relaxed);
+        pthread_mutex_unlock(&journal->mutex);
+        
+        bool haveSpare = !stopping && journal->ensureSpare();
+        
+        // Seal on age too, so the database trails by at most about an interval
+        if (current && haveSpare && current->tail.load(std::memory_order_relaxed) > 0 &&
+            machToNanoseconds(mach_absolute_time()) - current->openedNs >=
+                (uint64_t)JOURNAL_SEAL_INTERVAL_MS * 1000000) {
+            journal->rotate(current);
+        }
+        journal->compactSealed();
+        
+        pthread_mutex_lock(&journal->mutex);
+        if (stopping) {
+            break;
+        }
+        if (!journal->compactorRunning) {
+            continue;
+        }
+        
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)JOURNAL_SEAL_INTERVAL_MS * 1000000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        pthread_cond_timedwait(&journal->cond, &journal->mutex, &deadline);
+    }
+    pthread_mutex_unlock(&journal->mutex);
+    return nullptr;
+}
+
+EventJournalStats EventJournal::getStats() const {
+    EventJournalStats stats = EventJournalStats();
+    for (const Segment& segment : segments) {
+        uint8_t state = segment.state.load(std::memory_order_relaxed);
+        if (state != SEGMENT_FREE && state != SEGMENT_OPENING) {
+            stats.segments++;
+        }
+    }
+    stats.appended = appended.load(std::memory_order_relaxed);
+    stats.fallbacks = fallbacks.load(std::memory_order_relaxed);
+    stats.rotations = rotations.load(std::memory_order_relaxed);
+    stats.compacted = compacted.load(std::memory_order_relaxed);
+    stats.recovered = recovered.load(std::memory_order_relaxed);
+    stats.lastCompactNs = lastCompactNs.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,239 @@
+#ifndef EventJournal_h
+#define EventJournal_h
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <atomic>
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "MonitoringTypes.h"
+#include "StringTable.h"
+#include "DatabaseWriter.h"
+
+// Where segment files live
+#ifndef EVENT_JOURNAL_DIR
+#define EVENT_JOURNAL_DIR "/var/log/AudioVideoMonitor.journal"
+#endif
+
+// Size of one segment file; a full segment is sealed and a fresh one takes over
+#ifndef JOURNAL_SEGMENT_BYTES
+#define JOURNAL_SEGMENT_BYTES (8u * 1024 * 1024)
+#endif
+
+// A segment with anything in it is also sealed once it is this old, which
+// bounds how far the database trails the journal
+#ifndef JOURNAL_SEAL_INTERVAL_MS
+#define JOURNAL_SEAL_INTERVAL_MS 500
+#endif
+
+// Segments that may exist at once; past this appends fail and callers fall
+// back to queueing rows for the database writer directly
+#ifndef JOURNAL_MAX_SEGMENTS
+#define JOURNAL_MAX_SEGMENTS 32
+#endif
+
+// Rows handed to the database writer per call while compacting
+#ifndef JOURNAL_LOAD_BATCH
+#define JOURNAL_LOAD_BATCH 4096
+#endif
+
+#define JOURNAL_MAGIC     0x314a5641    // "AVJ1"
+#define JOURNAL_VERSION   1
+#define JOURNAL_COMMITTED 0x52434556    // written last; anything else is not a record yet
+
+enum JournalRecordType : uint8_t {
+    JOURNAL_EMPTY,
+    JOURNAL_PAD,                // reserved past the end of a segment, never filled
+    JOURNAL_PROCESS,
+    JOURNAL_FILE,
+    JOURNAL_STRING,             // an interned string, so a replay can resolve the IDs
+    JOURNAL_STRING_MORE         // continues the string before it
+};
+
+#define JOURNAL_FLAG_SYSTEM     0x01    // process events
+#define JOURNAL_FLAG_BLOCKED    0x01    // file accesses
+
+#define JOURNAL_STRING_HEAD 64
+#define JOURNAL_STRING_MORE_BYTES 72
+
+// Longer strings are journaled truncated; they only matter to a crash replay
+#ifndef JOURNAL_STRING_MAX
+#define JOURNAL_STRING_MAX (16 * 1024)
+#endif
+
+// Fixed layout, written in place in the mapped segment. 96 bytes so the
+// largest row (a process event) fits whole.
+struct JournalRecord {
+    std::atomic<uint32_t> commit;       // JOURNAL_COMMITTED once the rest is written
+    uint8_t type;                       // JournalRecordType
+    uint8_t flags;
+    uint16_t reserved;
+    uint64_t machTime;                  // when it was appended
+    pid_t pid;
+    uint32_t pidVersion;
+    union {
+        struct {
+            uint64_t timestamp;
+            uint64_t cpuTime;
+            uint64_t memoryUsage;
+            pid_t ppid;
+            uid_t uid;
+            gid_t gid;
+            uint32_t executablePathId;
+            uint32_t commandLineId;
+            uint32_t bundleIdentifierId;
+            uint32_t eventTypeId;
+        } process;
+        struct {
+            uint64_t timestamp;
+            uint64_t lastSeen;
+            uint32_t pathId;
+            uint32_t accessTypeId;
+            uint32_t reasonId;
+            uint32_t count;
+        } file;
+        struct {
+            uint32_t id;
+            uint32_t length;            // of the whole string
+            char data[JOURNAL_STRING_HEAD];
+        } string;
+        char more[JOURNAL_STRING_MORE_BYTES];
+    };
+};
+
+static_assert(sizeof(JournalRecord) == 96, "JournalRecord is an on-disk layout");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "commit words live in shared mappings");
+
+// First record-sized block of every segment file
+struct JournalSegmentHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint64_t sequence;
+    uint32_t capacity;                  // records after the header
+    uint32_t sealed;                    // 1 once no more records will be added
+    uint64_t records;                   // reserved when sealed, including padding
+    uint64_t createdUsec;
+};
+
+static_assert(sizeof(JournalSegmentHeader) <= sizeof(JournalRecord), "header must fit the first block");
+
+struct EventJournalStats {
+    uint64_t segments;          // files on disk, including the active one
+    uint64_t appended;
+    uint64_t fallbacks;         // appends that went to the database writer instead
+    uint64_t rotations;
+    uint64_t compacted;         // rows loaded into the database
+    uint64_t recovered;         // rows replayed from segments left by a crash
+    uint64_t lastCompactNs;     // loading the latest sealed segment
+};
+
+// Append-only hot store in front of the database. Producers reserve a record
+// in the active segment with one fetch_add and fill it in place; nothing
+// locks, allocates or parses SQL on the event path. Segments are files
+// mapped MAP_SHARED, so whatever was committed survives a crash of the
+// extension. A compactor thread seals full or old segments, loads them into
+// SQLite in bulk through the database writer and deletes them; at start it
+// first replays whatever an earlier run left behind, sealed or not.
+//
+// Strings are journaled before the first record that references them, so a
+// replay can rebuild IDs the database never saw.
+class EventJournal {
+public:
+    EventJournal();
+    ~EventJournal();
+    
+    // Call once the writer has loaded the persisted strings and before events flow
+    bool start(const char* directory, StringTable* strings, DatabaseWriter* writer);
+    // Seals and loads everything left, so a clean stop leaves no segments behind
+    void stop();
+    
+    bool running() const { return active.load(std::memory_order_acquire) != nullptr; }
+    
+    // False when the journal can't take the row; the caller writes it some other way
+    bool appendProcessEvent(const ProcessRecord& process, uint32_t eventTypeId);
+    bool appendFileAccess(const FileAccessRecord& access);
+    
+    EventJournalStats getStats() const;
+
+private:
+    enum SegmentState : uint8_t {
+        SEGMENT_FREE,
+        SEGMENT_OPENING,        // slot claimed, file being created
+        SEGMENT_SPARE,          // ready for the next rotation
+        SEGMENT_ACTIVE,
+        SEGMENT_SEALING         // rotated out; writers may still be finishing
+    };
+    
+    // Slots are never freed, only reused, so a writer holding a stale pointer
+    // can always safely look at it and notice it is no longer the active one
+    struct Segment {
+        std::atomic<uint8_t> state;
+        std::atomic<uint64_t> tail;         // records reserved
+        std::atomic<uint32_t> writers;      // appends in progress
+        uint64_t sequence;
+        uint64_t openedNs;
+        int fd;
+        uint8_t* base;
+        JournalRecord* records;
+        uint32_t capacity;
+    };
+    
+    std::string directory;
+    StringTable* strings;
+    DatabaseWriter* writer;
+    
+    Segment segments[JOURNAL_MAX_SEGMENTS];
+    std::atomic<Segment*> active;
+    
+    pthread_mutex_t mutex;              // rotation, slot claims and the compactor
+    pthread_cond_t cond;
+    bool compactorRunning;
+    pthread_t compactorThread;
+    uint64_t nextSequence;
+    
+    // IDs below this are journaled or already in the database
+    std::atomic<uint32_t> journaledStrings;
+    pthread_mutex_t stringMutex;
+    
+    std::atomic<uint64_t> appended;
+    std::atomic<uint64_t> fallbacks;
+    std::atomic<uint64_t> rotations;
+    std::atomic<uint64_t> compacted;
+    std::atomic<uint64_t> recovered;
+    std::atomic<uint64_t> lastCompactNs;
+    
+    JournalRecord* reserve(uint32_t count, Segment** segment);
+    bool journalString(uint32_t id, uint64_t machTime);
+    bool journalStrings(std::initializer_list<uint32_t> ids);
+    
+    std::string segmentPath(uint64_t sequence) const;
+    Segment* openSegment();
+    bool ensureSpare();
+    void closeSegment(Segment* segment, bool remove);
+    bool rotate(Segment* full);
+    void seal(Segment* segment);
+    
+    // Replay of one segment's records into the database; remapping IDs only
+    // matters when recovering, where strings are restored as they are met
+    struct Replay {
+        bool recovering;
+        std::unordered_map<uint32_t, uint32_t> remap;
+        std::vector<ProcessEventRow> processEvents;
+        std::vector<FileAccessRecord> fileAccesses;
+        uint64_t rows;
+    };
+    bool load(const JournalRecord* records, uint32_t count, Replay* replay);
+    uint32_t restoreString(const JournalRecord* records, uint32_t count, uint32_t index, Replay* replay);
+    uint32_t mapId(const Replay* replay, uint32_t id) const;
+    bool handOver(Replay* replay);
+    bool recover();
+    
+    void compactSealed();
+    static void* compactorThreadMain(void* arg);
+};
+
+#endif
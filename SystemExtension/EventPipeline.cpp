@@ -0,0 +1,297 @@
+// Asynchronous event pipeline: ES callback -> bounded rings -> worker threads
+#include "AudioVideoController.h"
+#include <sched.h>
+#include <time.h>
+
+const es_message_t* retainMessage(const es_message_t* message, bool* isCopy) {
+    if (__builtin_available(macOS 11.0, *)) {
+        es_retain_message(message);
+        *isCopy = false;
+        return message;
+    }
+    *isCopy = true;
+    return es_copy_message(message);
+}
+
+void releaseMessage(const es_message_t* message, bool isCopy) {
+    if (isCopy) {
+        es_free_message((es_message_t*)message);
+        return;
+    }
+    if (__builtin_available(macOS 11.0, *)) {
+        es_release_message(message);
+    }
+}
+
+bool AudioVideoController::startEventPipeline() {
+    pipelineRunning = true;
+    
+    // AUTH answers are sent from the ES callback before anything is queued, so
+    // the workers' logging and enrichment can run at utility QoS
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_set_qos_class_np(&attributes, QOS_CLASS_UTILITY, 0);
+    
+    for (int i = 0; i < EVENT_PIPELINE_WORKERS; i++) {
+        EventWorker& worker = eventWorkers[i];
+        worker.controller = this;
+        worker.index = i;
+        worker.sleeping = false;
+        pthread_mutex_init(&worker.wakeMutex, nullptr);
+        pthread_cond_init(&worker.wakeCond, nullptr);
+        
+        if (pthread_create(&worker.thread, &attributes, eventWorkerThread, &worker) != 0) {
+            syslog(LOG_ERR, "Failed to start event worker %d", i);
+            pthread_attr_destroy(&attributes);
+            pipelineRunning = false;
+            return false;
+        }
+    }
+    pthread_attr_destroy(&attributes);
+    
+    syslog(LOG_INFO, "Event pipeline started: %d workers, %d slots each",
+           EVENT_PIPELINE_WORKERS, EVENT_PIPELINE_CAPACITY);
+    return true;
+}
+
+void AudioVideoController::stopEventPipeline() {
+    if (!pipelineRunning.exchange(false)) {
+        return;
+    }
+    
+    for (int i = 0; i < EVENT_PIPELINE_WORKERS; i++) {
+        EventWorker& worker = eventWorkers[i];
+        pthread_mutex_lock(&worker.wakeMutex);
+        pthread_cond_signal(&worker.wakeCond);
+        pthread_mutex_unlock(&worker.wakeMutex);
+        pthread_join(worker.thread, nullptr);
+        pthread_mutex_destroy(&worker.wakeMutex);
+        pthread_cond_destroy(&worker.wakeCond);
+    }
+    
+    syslog(LOG_INFO, "Event pipeline stopped: enqueued=%llu processed=%llu dropped=%llu",
+           pipelineEnqueued.load(), pipelineProcessed.load(), pipelineDropped.load());
+}
+
+bool AudioVideoController::enqueueEvent(const es_message_t* message, AuthVerdict verdict) {
+    if (!pipelineRunning.load(std::memory_order_relaxed)) {
+        pipelineDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    // Shard by pid so every event of a process is handled in order by one worker.
+    // A fork is the child's first event, so it goes where the child's exec and exit will.
+    const es_process_t* subject = message->event_type == ES_EVENT_TYPE_NOTIFY_FORK ?
+                                  message->event.fork.child : message->process;
+    pid_t pid = audit_token_to_pid(subject->audit_token);
+    EventWorker& worker = workerFor(pid);
+    
+    // The process tree, lineage and process table are all built from these, and
+    // one lost EXIT leaks its process for good
+    bool lifecycle = message->event_type == ES_EVENT_TYPE_NOTIFY_EXEC ||
+                     message->event_type == ES_EVENT_TYPE_AUTH_EXEC ||
+                     message->event_type == ES_EVENT_TYPE_NOTIFY_FORK ||
+                     message->event_type == ES_EVENT_TYPE_NOTIFY_EXIT;
+    
+    QueuedEvent event;
+    event.message = retainMessage(message, &event.isCopy);
+    event.enqueueTime = mach_absolute_time();
+    event.verdict = verdict;
+    
+    bool pushed;
+    if (lifecycle) {
+        pushed = worker.ring.tryPush(event);
+        if (!pushed) {
+            // AUTH verdicts are already sent, so holding the callback queue only
+            // delays later events; wait for the worker to make room
+            pipelineLifecycleWaits.fetch_add(1, std::memory_order_relaxed);
+            while (!(pushed = worker.ring.tryPush(event)) && pipelineRunning.load(std::memory_order_relaxed)) {
+                sched_yield();
+            }
+        }
+    } else {
+        pushed = worker.ring.size() + EVENT_PIPELINE_LIFECYCLE_RESERVE < worker.ring.capacity() &&
+                 worker.ring.tryPush(event);
+    }
+    
+    if (!pushed) {
+        releaseMessage(event.message, event.isCopy);
+        uint64_t dropped = pipelineDropped.fetch_add(1, std::memory_order_relaxed) + 1;
+        
+        // Report the first drop and then every 10000th so the log itself doesn't flood.
+        // Only non-lifecycle events get here while the pipeline runs.
+        if (dropped == 1 || dropped % 10000 == 0) {
+            syslog(LOG_WARNING, "Event pipeline full: %llu events dropped so far", dropped);
+        }
+        return false;
+    }
+    
+    pipelineEnqueued.fetch_add(1, std::memory_order_relaxed);
+    
+    size_t depth = worker.ring.size();
+    if (depth * 100 >= worker.ring.capacity() * EVENT_PIPELINE_HIGH_WATER_PERCENT) {
+        pipelineBackpressure.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    uint64_t maxDepth = pipelineMaxDepth.load(std::memory_order_relaxed);
+    while (depth > maxDepth &&
+           !pipelineMaxDepth.compare_exchange_weak(maxDepth, depth, std::memory_order_relaxed)) {
+    }
+    
+    // Only pay for the wakeup when the worker is actually parked. The fence pairs
+    // with the one in eventWorkerThread so either we see the flag or it sees the push.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (worker.sleeping.load(std::memory_order_relaxed)) {
+        pthread_mutex_lock(&worker.wakeMutex);
+        pthread_cond_signal(&worker.wakeCond);
+        pthread_mutex_unlock(&worker.wakeMutex);
+    }
+    
+    return true;
+}
+
+void* AudioVideoController::eventWorkerThread(void* arg) {
+    EventWorker* worker = (EventWorker*)arg;
+    AudioVideoController* controller = worker->controller;
+    QueuedEvent event;
+    
+    while (true) {
+        if (worker->ring.tryPop(event)) {
+            uint64_t started = mach_absolute_time();
+            controller->pipelineQueueLatency.record(machToNanoseconds(started - event.enqueueTime));
+            {
+                MetricsInterval interval(METRIC_INTERVAL_EVENT, event.message->event_type);
+                controller->dispatchEvent(event);
+            }
+            uint64_t handledNs = machToNanoseconds(mach_absolute_time() - started);
+            controller->pipelineHandlerLatency.record(handledNs);
+            controller->metrics.eventHandled(event.message->event_type, handledNs);
+            releaseMessage(event.message, event.isCopy);
+            controller->pipelineProcessed.fetch_add(1, std::memory_order_relaxed);
+            controller->sweepAggregator(*worker);
+            continue;
+        }
+        
+        if (!controller->pipelineRunning.load()) {
+            break;
+        }
+        
+        // Park until a producer signals; re-check after publishing the flag so a
+        // push racing with the transition is never missed. The timeout is a safety net.
+        pthread_mutex_lock(&worker->wakeMutex);
+        worker->sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (worker->ring.size() == 0 && controller->pipelineRunning.load()) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 100 * 1000 * 1000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&worker->wakeCond, &worker->wakeMutex, &deadline);
+        }
+        worker->sleeping = false;
+        pthread_mutex_unlock(&worker->wakeMutex);
+        
+        // Windows still close while the worker is idle
+        controller->sweepAggregator(*worker);
+    }
+    
+    // Drain whatever was queued before shutdown
+    while (worker->ring.tryPop(event)) {
+        controller->dispatchEvent(event);
+        releaseMessage(event.message, event.isCopy);
+        controller->pipelineProcessed.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    // Nothing coalesced may be lost at shutdown; the database writer is still running
+    worker->aggregator.flushAll(&worker->aggregated);
+    controller->writeAggregated(*worker);
+    
+    return nullptr;
+}
+
+bool AudioVideoController::recordFileAccess(const FileAccessRecord& access, EventClass eventClass) {
+    EventWorker& worker = workerFor(access.pid);
+    bool absorbed = worker.aggregator.absorb(access, eventClass,
+                                             aggregationWindowNs.load(std::memory_order_relaxed),
+                                             &worker.aggregated);
+    
+    // A window closing early hands back what it had collected
+    if (!worker.aggregated.empty()) {
+        writeAggregated(worker);
+    }
+    if (absorbed) {
+        return false;
+    }
+    
+    logFileAccess(access);
+    rememberFileAccess(access);
+    return true;
+}
+
+void AudioVideoController::sweepAggregator(EventWorker& worker) {
+    worker.aggregator.sweep(mach_absolute_time(), aggregationWindowNs.load(std::memory_order_relaxed),
+                            &worker.aggregated);
+    if (!worker.aggregated.empty()) {
+        writeAggregated(worker);
+    }
+}
+
+void AudioVideoController::writeAggregated(EventWorker& worker) {
+    for (const auto& access : worker.aggregated.accesses) {
+        logFileAccess(access);
+        rememberFileAccess(access);
+    }
+    
+    for (const auto& events : worker.aggregated.suppressed) {
+        char args[64];
+        snprintf(args, sizeof(args), "%u events over rate limit", events.count);
+        logSystemCall(events.pid, eventClassName(events.eventClass), args);
+    }
+    
+    worker.aggregated.clear();
+}
+
+void AudioVideoController::setAggregationWindow(uint64_t windowMs) {
+    aggregationWindowNs.store(windowMs * 1000000, std::memory_order_relaxed);
+    syslog(LOG_INFO, "Event aggregation window set to %llu ms", windowMs);
+}
+
+AggregationStats AudioVideoController::getAggregationStats() const {
+    AggregationStats stats = {};
+    for (int i = 0; i < EVENT_PIPELINE_WORKERS; i++) {
+        eventWorkers[i].aggregator.addStats(&stats);
+    }
+    stats.windowMs = aggregationWindowNs.load(std::memory_order_relaxed) / 1000000;
+    return stats;
+}
+
+EventPipelineStats AudioVideoController::getEventPipelineStats() const {
+    EventPipelineStats stats;
+    stats.enqueued = pipelineEnqueued.load(std::memory_order_relaxed);
+    stats.processed = pipelineProcessed.load(std::memory_order_relaxed);
+    stats.dropped = pipelineDropped.load(std::memory_order_relaxed);
+    stats.backpressure = pipelineBackpressure.load(std::memory_order_relaxed);
+    stats.lifecycleWaits = pipelineLifecycleWaits.load(std::memory_order_relaxed);
+    stats.maxQueueDepth = pipelineMaxDepth.load(std::memory_order_relaxed);
+    stats.workerCount = EVENT_PIPELINE_WORKERS;
+    stats.queueDepth = 0;
+    for (int i = 0; i < EVENT_PIPELINE_WORKERS; i++) {
+        stats.queueDepth += eventWorkers[i].ring.size();
+    }
+    stats.queueLatency = pipelineQueueLatency.summarize();
+    stats.handlerLatency = pipelineHandlerLatency.summarize();
+    return stats;
+}
+
+bool AudioVideoController::startEventTrace(std::string* error) {
+    return eventTrace.startInDirectory(EVENT_TRACE_DIR, error);
+}
+
+EventTraceStats AudioVideoController::stopEventTrace() {
+    EventTraceStats stats;
+    eventTrace.stop(&stats);
+    return stats;
+}
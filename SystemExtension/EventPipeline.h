@@ -0,0 +1,158 @@
+#ifndef EventPipeline_h
+#define EventPipeline_h
+
+#include <EndpointSecurity/EndpointSecurity.h>
+#include <pthread.h>
+#include <atomic>
+#include <stdint.h>
+#include "EventAggregator.h"
+#include "LatencyHistogram.h"
+
+// Ring capacity per worker (must be a power of two) and number of workers.
+// Both can be overridden at build time with -D.
+#ifndef EVENT_PIPELINE_CAPACITY
+#define EVENT_PIPELINE_CAPACITY 16384
+#endif
+
+#ifndef EVENT_PIPELINE_WORKERS
+#define EVENT_PIPELINE_WORKERS 2
+#endif
+
+// Queue depth (percent of capacity) above which an enqueue counts as backpressure
+#ifndef EVENT_PIPELINE_HIGH_WATER_PERCENT
+#define EVENT_PIPELINE_HIGH_WATER_PERCENT 75
+#endif
+
+// Slots per ring that only EXEC, FORK and EXIT may fill. Other events are shed
+// once a ring is this close to full; lifecycle events are never dropped.
+#ifndef EVENT_PIPELINE_LIFECYCLE_RESERVE
+#define EVENT_PIPELINE_LIFECYCLE_RESERVE 1024
+#endif
+static_assert(EVENT_PIPELINE_LIFECYCLE_RESERVE < EVENT_PIPELINE_CAPACITY,
+              "EVENT_PIPELINE_LIFECYCLE_RESERVE must leave room for other events");
+
+// Bounded lock-free multi-producer / single-consumer ring.
+// Each cell carries a sequence number so producers claim slots with a single
+// CAS on the tail and the consumer never touches producer-owned state.
+template <typename T, size_t Capacity>
+class MPSCRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "MPSCRing capacity must be a power of two");
+
+public:
+    MPSCRing() : head(0), tail(0) {
+        for (size_t i = 0; i < Capacity; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    
+    // Returns false when the ring is full; never blocks.
+    bool tryPush(const T& value) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & (Capacity - 1)];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    
+    // Must only be called from the single consumer thread.
+    bool tryPop(T& value) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        Cell& cell = cells[pos & (Capacity - 1)];
+        size_t seq = cell.sequence.load(std::memory_order_acquire);
+        
+        if ((intptr_t)seq - (intptr_t)(pos + 1) < 0) {
+            return false;
+        }
+        
+        value = cell.value;
+        cell.sequence.store(pos + Capacity, std::memory_order_release);
+        head.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+    
+    // Approximate number of queued items, safe to call from any thread
+    size_t size() const {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_relaxed);
+        return t > h ? t - h : 0;
+    }
+    
+    size_t capacity() const { return Capacity; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) Cell cells[Capacity];
+};
+
+// Verdict already sent to the kernel for an AUTH event, carried to the worker
+// so the deferred log records what was actually decided
+enum AuthVerdict : uint8_t {
+    AUTH_VERDICT_NONE = 0,          // NOTIFY event, nothing was answered
+    AUTH_VERDICT_ALLOW,
+    AUTH_VERDICT_DENY_MICROPHONE,
+    AUTH_VERDICT_DENY_CAMERA
+};
+
+// An ES message handed from the callback queue to a worker.
+// The message stays retained until the worker releases it.
+struct QueuedEvent {
+    const es_message_t* message;
+    uint64_t enqueueTime;
+    bool isCopy;            // es_copy_message fallback on macOS 10.15
+    AuthVerdict verdict;
+};
+
+// Keeps a message past its callback: a reference from macOS 11, a copy on 10.15
+const es_message_t* retainMessage(const es_message_t* message, bool* isCopy);
+void releaseMessage(const es_message_t* message, bool isCopy);
+
+class AudioVideoController;
+
+struct EventWorker {
+    MPSCRing<QueuedEvent, EVENT_PIPELINE_CAPACITY> ring;
+    pthread_t thread;
+    pthread_mutex_t wakeMutex;
+    pthread_cond_t wakeCond;
+    std::atomic<bool> sleeping;
+    AudioVideoController* controller;
+    int index;
+    
+    // Only touched by this worker's thread
+    EventAggregator aggregator;
+    AggregatorOutput aggregated;
+};
+
+// Snapshot of pipeline counters
+struct EventPipelineStats {
+    uint64_t enqueued;
+    uint64_t processed;
+    uint64_t dropped;
+    uint64_t backpressure;
+    uint64_t lifecycleWaits;        // lifecycle events that found even the reserve full
+    uint64_t queueDepth;
+    uint64_t maxQueueDepth;
+    uint32_t workerCount;
+    LatencySummary queueLatency;    // enqueue to the start of the handler
+    LatencySummary handlerLatency;  // dispatchEvent alone, every event type
+};
+
+#endif
@@ -0,0 +1,245 @@
+// Minute, hour and lifetime event count rollups
+#include "EventRollups.h"
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+
+// What each partitioned table contributes to the totals when backfilled
+struct RollupSource {
+    const char* prefix;             // partitions are <prefix>YYYYMMDD
+    RollupTable table;
+    const char* events;             // per group
+    const char* blocked;
+    const char* typeColumn;         // null if not rolled up by type
+    const char* executableColumn;
+    bool byPid;
+};
+
+static const RollupSource kRollupSources[] = {
+    {"process_event_rows_d", ROLLUP_PROCESS_EVENTS, "COUNT(*)", "0",
+     "event_type_id", "executable_path_id", true},
+    {"file_access_rows_d", ROLLUP_FILE_ACCESS, "SUM(event_count)",
+     "SUM(CASE WHEN was_blocked THEN event_count ELSE 0 END)", "access_type_id", nullptr, true},
+    {"network_connections_d", ROLLUP_NETWORK_CONNECTIONS, "COUNT(*)", "0", nullptr, nullptr, true},
+    {"system_calls_d", ROLLUP_SYSTEM_CALLS, "COUNT(*)", "0", nullptr, nullptr, true},
+    {"loaded_library_rows_d", ROLLUP_LOADED_LIBRARIES, "COUNT(*)", "0", nullptr, nullptr, false},
+    {"environment_var_rows_d", ROLLUP_ENVIRONMENT_VARS, "COUNT(*)", "0", nullptr, nullptr, false}
+};
+
+// Over rollup_counts r LEFT JOIN strings s ON kRollupNameJoin
+static const char* kRollupName =
+    "CASE WHEN r.dimension = 1 THEN CASE r.key WHEN 1 THEN 'process_events' WHEN 2 THEN 'file_access' "
+    "WHEN 3 THEN 'network_connections' WHEN 4 THEN 'system_calls' WHEN 5 THEN 'loaded_libraries' "
+    "WHEN 6 THEN 'environment_vars' END WHEN r.dimension IN (2, 3) THEN s.value ELSE '' END";
+static const char* kRollupNameJoin = "r.dimension IN (2, 3) AND s.id = r.key";
+
+static bool exec(sqlite3* database, const std::string& sql) {
+    char* errMsg = nullptr;
+    if (sqlite3_exec(database, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        syslog(LOG_ERR, "EventRollups: %s", errMsg ? errMsg : sqlite3_errmsg(database));
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
+
+static bool tableExists(sqlite3* database, const char* name) {
+    sqlite3_stmt* stmt;
+    bool exists = false;
+    if (sqlite3_prepare_v2(database, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?",
+                           -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        exists = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+    }
+    return exists;
+}
+
+bool createRollupTables(sqlite3* database) {
+    bool backfill = !tableExists(database, "rollup_counts");
+    
+    std::string sql =
+        "BEGIN IMMEDIATE;"
+        // Keyed so a time range of one resolution is a single range scan
+        "CREATE TABLE IF NOT EXISTS rollup_counts ("
+        "resolution INTEGER NOT NULL,"
+        "bucket INTEGER NOT NULL,"
+        "dimension INTEGER NOT NULL,"
+        "key INTEGER NOT NULL,"
+        "events INTEGER NOT NULL,"
+        "blocked INTEGER NOT NULL,"
+        "PRIMARY KEY (resolution, bucket, dimension, key)"
+        ") WITHOUT ROWID;"
+        "CREATE TABLE IF NOT EXISTS rollup_backfill (table_name TEXT PRIMARY KEY);"
+        
+        "CREATE VIEW IF NOT EXISTS event_rollups AS "
+        "SELECT CASE r.resolution WHEN 60 THEN 'minute' WHEN 3600 THEN 'hour' ELSE 'total' END AS resolution, "
+        "r.bucket, CASE r.dimension WHEN 1 THEN 'table' WHEN 2 THEN 'event_type' "
+        "WHEN 3 THEN 'executable' ELSE 'pid' END AS dimension, r.key, ";
+    sql += kRollupName;
+    sql += " AS name, r.events, r.blocked FROM rollup_counts r LEFT JOIN strings s ON ";
+    sql += kRollupNameJoin;
+    sql += ";";
+    
+    // Totals start from what is already on disk; the writer counts it a partition at a time
+    if (backfill) {
+        for (const RollupSource& source : kRollupSources) {
+            sql += std::string("INSERT OR IGNORE INTO rollup_backfill SELECT name FROM sqlite_master "
+                               "WHERE type = 'table' AND name GLOB '") + source.prefix + "[0-9]*';";
+        }
+    }
+    sql += "COMMIT;";
+    
+    if (!exec(database, sql)) {
+        exec(database, "ROLLBACK;");
+        return false;
+    }
+    return true;
+}
+
+// Adds one grouping of a partition to the totals. An empty partition has no
+// groups, so it adds no rows either. The table key groups on a string
+// constant, since a bare number would be read as a result column.
+static bool backfillTotals(sqlite3* database, const std::string& partition, const RollupSource& source,
+                           RollupDimension dimension, const char* keyColumn) {
+    char sql[1024];
+    snprintf(sql, sizeof(sql),
+             "INSERT INTO rollup_counts (resolution, bucket, dimension, key, events, blocked) "
+             "SELECT 0, 0, %d, %s, %s, %s FROM %s WHERE true GROUP BY %s "
+             "ON CONFLICT (resolution, bucket, dimension, key) DO UPDATE SET "
+             "events = events + excluded.events, blocked = blocked + excluded.blocked;",
+             dimension, keyColumn, source.events, source.blocked, partition.c_str(),
+             dimension == ROLLUP_BY_TABLE ? "'table'" : keyColumn);
+    return exec(database, sql);
+}
+
+static bool backfillPartition(sqlite3* database, const std::string& partition) {
+    for (const RollupSource& source : kRollupSources) {
+        if (strncmp(partition.c_str(), source.prefix, strlen(source.prefix)) != 0) {
+            continue;
+        }
+        
+        char tableKey[16];
+        snprintf(tableKey, sizeof(tableKey), "%d", source.table);
+        return backfillTotals(database, partition, source, ROLLUP_BY_TABLE, tableKey) &&
+               (!source.typeColumn ||
+                backfillTotals(database, partition, source, ROLLUP_BY_EVENT_TYPE, source.typeColumn)) &&
+               (!source.executableColumn ||
+                backfillTotals(database, partition, source, ROLLUP_BY_EXECUTABLE, source.executableColumn)) &&
+               (!source.byPid || backfillTotals(database, partition, source, ROLLUP_BY_PID, "pid"));
+    }
+    return true;
+}
+
+bool backfillRollupStep(sqlite3* database, int64_t* remaining) {
+    *remaining = 0;
+    std::string partition;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database, "SELECT table_name, (SELECT count(*) FROM rollup_backfill) "
+                           "FROM rollup_backfill ORDER BY table_name LIMIT 1", -1, &stmt, nullptr) != SQLITE_OK) {
+        return false;
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        partition = (const char*)sqlite3_column_text(stmt, 0);
+        *remaining = sqlite3_column_int64(stmt, 1);
+    }
+    sqlite3_finalize(stmt);
+    if (partition.empty()) {
+        return true;
+    }
+    
+    if (!exec(database, "BEGIN IMMEDIATE;")) {
+        return false;
+    }
+    // Retention may have dropped it since it was queued
+    bool done = !tableExists(database, partition.c_str()) || backfillPartition(database, partition);
+    if (done) {
+        sqlite3_prepare_v2(database, "DELETE FROM rollup_backfill WHERE table_name = ?", -1, &stmt, nullptr);
+        sqlite3_bind_text(stmt, 1, partition.c_str(), -1, SQLITE_STATIC);
+        done = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+    }
+    if (!done || !exec(database, "COMMIT;")) {
+        exec(database, "ROLLBACK;");
+        return false;
+    }
+    
+    (*remaining)--;
+    return true;
+}
+
+bool expireRollups(sqlite3* database, time_t now, uint64_t* removed) {
+    char sql[256];
+    snprintf(sql, sizeof(sql),
+             "DELETE FROM rollup_counts WHERE resolution = %d AND bucket < %lld;"
+             "DELETE FROM rollup_counts WHERE resolution = %d AND bucket < %lld;",
+             ROLLUP_MINUTE, (long long)now - ROLLUP_MINUTE_DAYS * 86400ll,
+             ROLLUP_HOUR, (long long)now - ROLLUP_HOUR_DAYS * 86400ll);
+    int before = sqlite3_total_changes(database);
+    bool expired = exec(database, sql);
+    *removed = (uint64_t)(sqlite3_total_changes(database) - before);
+    return expired;
+}
+
+bool parseRollupResolution(const char* name, int* resolution) {
+    if (!name || strcmp(name, "total") == 0) {
+        *resolution = ROLLUP_TOTAL;
+    } else if (strcmp(name, "minute") == 0) {
+        *resolution = ROLLUP_MINUTE;
+    } else if (strcmp(name, "hour") == 0) {
+        *resolution = ROLLUP_HOUR;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parseRollupDimension(const char* name, RollupDimension* dimension) {
+    static const char* names[] = {"table", "event_type", "executable", "pid"};
+    for (int i = 0; i < 4; i++) {
+        if (name && strcmp(name, names[i]) == 0) {
+            *dimension = (RollupDimension)(ROLLUP_BY_TABLE + i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool queryRollups(sqlite3* database, int resolution, RollupDimension dimension, int64_t since,
+                  bool series, size_t limit, std::vector<RollupEntry>* entries, std::string* error) {
+    std::string sql = series ? "SELECT r.bucket, r.key, r.events, r.blocked, " :
+                               "SELECT 0, r.key, SUM(r.events) AS total, SUM(r.blocked), ";
+    sql += kRollupName;
+    sql += " FROM rollup_counts r LEFT JOIN strings s ON ";
+    sql += kRollupNameJoin;
+    sql += " WHERE r.resolution = ?1 AND r.bucket >= ?2 AND r.dimension = ?3 ";
+    sql += series ? "ORDER BY r.bucket DESC, r.events DESC LIMIT ?4" :
+                    "GROUP BY r.key ORDER BY total DESC LIMIT ?4";
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        *error = sqlite3_errmsg(database);
+        return false;
+    }
+    sqlite3_bind_int(stmt, 1, resolution);
+    sqlite3_bind_int64(stmt, 2, resolution == ROLLUP_TOTAL ? 0 : since);
+    sqlite3_bind_int(stmt, 3, dimension);
+    sqlite3_bind_int64(stmt, 4, limit ? (sqlite3_int64)limit : -1);
+    
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        RollupEntry entry;
+        entry.bucket = sqlite3_column_int64(stmt, 0);
+        entry.key = sqlite3_column_int64(stmt, 1);
+        entry.events = (uint64_t)sqlite3_column_int64(stmt, 2);
+        entry.blocked = (uint64_t)sqlite3_column_int64(stmt, 3);
+        const char* name = (const char*)sqlite3_column_text(stmt, 4);
+        entry.name = name ? name : "";
+        entries->push_back(entry);
+    }
+    if (result != SQLITE_DONE) {
+        *error = sqlite3_errmsg(database);
+    }
+    sqlite3_finalize(stmt);
+    return result == SQLITE_DONE;
+}
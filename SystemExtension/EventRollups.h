@@ -0,0 +1,71 @@
+#ifndef EventRollups_h
+#define EventRollups_h
+
+#include <sqlite3.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Event counts kept per minute, per hour and since the database was created.
+// The database writer adds each batch's counts in the same transaction as its
+// rows, so the stats views and dashboards read rollup rows instead of counting
+// or grouping the event tables. Buckets are by write time, in epoch seconds.
+
+#define ROLLUP_MINUTE   60
+#define ROLLUP_HOUR     3600
+#define ROLLUP_TOTAL    0           // one bucket, 0, never expired
+
+// How long the timed rollups are kept
+#ifndef ROLLUP_MINUTE_DAYS
+#define ROLLUP_MINUTE_DAYS 2
+#endif
+
+#ifndef ROLLUP_HOUR_DAYS
+#define ROLLUP_HOUR_DAYS 90
+#endif
+
+enum RollupDimension {
+    ROLLUP_BY_TABLE = 1,        // key is a RollupTable
+    ROLLUP_BY_EVENT_TYPE,       // key is the string ID of the event or access type
+    ROLLUP_BY_EXECUTABLE,       // process events; key is the executable path ID
+    ROLLUP_BY_PID
+};
+
+enum RollupTable {
+    ROLLUP_PROCESS_EVENTS = 1,
+    ROLLUP_FILE_ACCESS,
+    ROLLUP_NETWORK_CONNECTIONS,
+    ROLLUP_SYSTEM_CALLS,
+    ROLLUP_LOADED_LIBRARIES,
+    ROLLUP_ENVIRONMENT_VARS
+};
+
+struct RollupEntry {
+    int64_t bucket;             // start of the bucket; 0 when summed over a range
+    int64_t key;
+    std::string name;           // table, type or executable; empty for pids
+    uint64_t events;            // coalesced file accesses count every access
+    uint64_t blocked;           // file accesses that were denied
+};
+
+// Part of the schema; totals for history already in the database are
+// queued to be counted by the writer
+bool createRollupTables(sqlite3* database);
+
+// Counts one queued partition from before the rollups existed into the
+// totals, in its own transaction; *remaining is the partitions left
+bool backfillRollupStep(sqlite3* database, int64_t* remaining);
+// Deletes timed buckets past their retention
+bool expireRollups(sqlite3* database, time_t now, uint64_t* removed);
+
+bool parseRollupResolution(const char* name, int* resolution);
+bool parseRollupDimension(const char* name, RollupDimension* dimension);
+
+// `since` bounds the buckets read (ignored for ROLLUP_TOTAL). Without
+// `series` the buckets are summed per key, largest first; with it every
+// bucket is returned, newest first.
+bool queryRollups(sqlite3* database, int resolution, RollupDimension dimension, int64_t since,
+                  bool series, size_t limit, std::vector<RollupEntry>* entries, std::string* error);
+
+#endif
@@ -0,0 +1,314 @@
+// Live event fan-out to subscribed clients
+#include "EventStream.h"
+#include <netinet/in.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+
+static const char* streamEventTypeNames[STREAM_EVENT_TYPE_COUNT] = {"process", "file", "network", "syscall"};
+
+const char* streamEventTypeName(StreamEventType type) {
+    return type < STREAM_EVENT_TYPE_COUNT ? streamEventTypeNames[type] : "unknown";
+}
+
+bool parseStreamEventType(const char* name, StreamEventType* type) {
+    if (!name) {
+        return false;
+    }
+    for (int i = 0; i < STREAM_EVENT_TYPE_COUNT; i++) {
+        if (strcmp(name, streamEventTypeNames[i]) == 0) {
+            *type = (StreamEventType)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+EventStream::EventStream(const StringTable* strings)
+    : strings(strings), clientCount(0), nextId(1), wakePending(false), running(false),
+      published(0), deliveredEvents(0), droppedEvents(0), batches(0) {
+    pthread_mutex_init(&mutex, nullptr);
+    pthread_cond_init(&cond, nullptr);
+    for (Client& client : clients) {
+        client.state.store(CLIENT_FREE, std::memory_order_relaxed);
+        client.producers.store(0, std::memory_order_relaxed);
+        client.inFlight.store(false, std::memory_order_relaxed);
+        client.dropped.store(0, std::memory_order_relaxed);
+        client.id = 0;
+    }
+}
+
+EventStream::~EventStream() {
+    stop();
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&cond);
+}
+
+bool EventStream::start() {
+    pthread_mutex_lock(&mutex);
+    if (running) {
+        pthread_mutex_unlock(&mutex);
+        return true;
+    }
+    running = true;
+    pthread_mutex_unlock(&mutex);
+    
+    if (pthread_create(&flusherThread, nullptr, flusherThreadMain, this) != 0) {
+        syslog(LOG_ERR, "EventStream: failed to start flusher thread");
+        running = false;
+        return false;
+    }
+    return true;
+}
+
+void EventStream::stop() {
+    pthread_mutex_lock(&mutex);
+    if (!running) {
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    running = false;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+    
+    pthread_join(flusherThread, nullptr);
+    
+    // No flusher left to hand batches to; drop the clients and their sinks
+    pthread_mutex_lock(&mutex);
+    for (Client& client : clients) {
+        if (client.state.load(std::memory_order_relaxed) == CLIENT_ACTIVE) {
+            clientCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+        client.state.store(CLIENT_CLOSING, std::memory_order_seq_cst);
+    }
+    for (Client& client : clients) {
+        // Producers only hold a client for one push
+        while (client.producers.load(std::memory_order_seq_cst) != 0) {
+            sched_yield();
+        }
+        StreamEvent event;
+        while (client.queue.tryPop(event)) {
+        }
+        client.sink = nullptr;
+        client.filter = EventFilter();
+        client.state.store(CLIENT_FREE, std::memory_order_release);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+uint64_t EventStream::subscribe(const EventFilter& filter, EventSink sink) {
+    pthread_mutex_lock(&mutex);
+    if (!running) {
+        pthread_mutex_unlock(&mutex);
+        return 0;
+    }
+    
+    for (Client& client : clients) {
+        if (client.state.load(std::memory_order_relaxed) != CLIENT_FREE) {
+            continue;
+        }
+        client.id = nextId++;
+        client.filter = filter;
+        client.sink = sink;
+        client.inFlight.store(false, std::memory_order_relaxed);
+        client.dropped.store(0, std::memory_order_relaxed);
+        
+        // Producers read the filter only after seeing ACTIVE
+        client.state.store(CLIENT_ACTIVE, std::memory_order_release);
+        clientCount.fetch_add(1, std::memory_order_relaxed);
+        
+        uint64_t id = client.id;
+        pthread_mutex_unlock(&mutex);
+        return id;
+    }
+    
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+bool EventStream::unsubscribe(uint64_t id) {
+    pthread_mutex_lock(&mutex);
+    for (Client& client : clients) {
+        if (client.state.load(std::memory_order_relaxed) == CLIENT_ACTIVE && client.id == id) {
+            client.state.store(CLIENT_CLOSING, std::memory_order_seq_cst);
+            clientCount.fetch_sub(1, std::memory_order_relaxed);
+            pthread_mutex_unlock(&mutex);
+            
+            // The flusher frees the slot once producers have let go of it
+            wake();
+            return true;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    return false;
+}
+
+void EventStream::delivered(uint64_t id) {
+    for (Client& client : clients) {
+        if (client.state.load(std::memory_order_acquire) == CLIENT_ACTIVE && client.id == id) {
+            client.inFlight.store(false, std::memory_order_release);
+            wake();
+            return;
+        }
+    }
+}
+
+const char* streamEventSubject(const StringTable* strings, const StreamEvent& event,
+                               char* buffer, size_t size, size_t* length) {
+    if (event.type != STREAM_EVENT_NETWORK) {
+        return strings->data(event.subjectId, length);
+    }
+    
+    // Same form as formatSocketEntry; IPv6 hosts are the ones with colons
+    const char* protocol = event.protocol == IPPROTO_TCP ? "TCP" :
+                           event.protocol == IPPROTO_UDP ? "UDP" : "IP";
+    size_t localLength, remoteLength;
+    const char* local = strings->data(event.localAddressId, &localLength);
+    const char* remote = strings->data(event.subjectId, &remoteLength);
+    bool localV6 = memchr(local, ':', localLength) != nullptr;
+    bool remoteV6 = memchr(remote, ':', remoteLength) != nullptr;
+    int written = snprintf(buffer, size, "%s %s%.*s%s:%u -> %s%.*s%s:%u", protocol,
+                           localV6 ? "[" : "", (int)localLength, local, localV6 ? "]" : "", event.localPort,
+                           remoteV6 ? "[" : "", (int)remoteLength, remote, remoteV6 ? "]" : "", event.remotePort);
+    *length = written < 0 ? 0 : (size_t)written < size ? (size_t)written : size - 1;
+    return buffer;
+}
+
+bool EventStream::matches(const EventFilter& filter, const StreamEvent& event) const {
+    if (filter.types && !(filter.types & (1u << event.type))) {
+        return false;
+    }
+    if (filter.pid && filter.pid != event.pid) {
+        return false;
+    }
+    if (!filter.pathPrefix.empty()) {
+        char buffer[128];
+        size_t length;
+        const char* subject = streamEventSubject(strings, event, buffer, sizeof(buffer), &length);
+        if (length < filter.pathPrefix.size() ||
+            memcmp(subject, filter.pathPrefix.data(), filter.pathPrefix.size()) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void EventStream::publish(const StreamEvent& event) {
+    if (!active()) {
+        return;
+    }
+    
+    bool matched = false;
+    bool queued = false;
+    for (Client& client : clients) {
+        if (client.state.load(std::memory_order_acquire) != CLIENT_ACTIVE) {
+            continue;
+        }
+        
+        // Announce before the second look so a closing client can't be freed under us
+        client.producers.fetch_add(1, std::memory_order_seq_cst);
+        if (client.state.load(std::memory_order_seq_cst) == CLIENT_ACTIVE && matches(client.filter, event)) {
+            matched = true;
+            if (client.queue.tryPush(event)) {
+                queued = true;
+            } else {
+                client.dropped.fetch_add(1, std::memory_order_relaxed);
+                droppedEvents.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        client.producers.fetch_sub(1, std::memory_order_release);
+    }
+    
+    if (matched) {
+        published.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (queued) {
+        wake();
+    }
+}
+
+// Only the first event after the flusher went to sleep pays for the lock
+void EventStream::wake() {
+    if (!wakePending.exchange(true, std::memory_order_acq_rel)) {
+        pthread_mutex_lock(&mutex);
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+}
+
+void EventStream::flush(std::vector<StreamEvent>* batch) {
+    for (Client& client : clients) {
+        if (client.state.load(std::memory_order_acquire) != CLIENT_ACTIVE ||
+            client.inFlight.load(std::memory_order_acquire)) {
+            continue;
+        }
+        
+        batch->clear();
+        StreamEvent event;
+        while (batch->size() < EVENT_STREAM_BATCH_MAX && client.queue.tryPop(event)) {
+            batch->push_back(event);
+        }
+        uint64_t dropped = client.dropped.exchange(0, std::memory_order_relaxed);
+        if (batch->empty() && dropped == 0) {
+            continue;
+        }
+        
+        // Whatever is left goes out once the client has taken this batch
+        client.inFlight.store(true, std::memory_order_relaxed);
+        client.sink(client.id, batch->data(), batch->size(), dropped);
+        deliveredEvents.fetch_add(batch->size(), std::memory_order_relaxed);
+        batches.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void* EventStream::flusherThreadMain(void* arg) {
+    EventStream* stream = (EventStream*)arg;
+    std::vector<StreamEvent> batch;
+    batch.reserve(EVENT_STREAM_BATCH_MAX);
+    
+    pthread_mutex_lock(&stream->mutex);
+    while (stream->running) {
+        if (!stream->wakePending.load(std::memory_order_acquire)) {
+            pthread_cond_wait(&stream->cond, &stream->mutex);
+            continue;
+        }
+        stream->wakePending.store(false, std::memory_order_release);
+        
+        // Free unsubscribed slots; one a producer is still inside is retried next pass
+        for (Client& client : stream->clients) {
+            if (client.state.load(std::memory_order_relaxed) != CLIENT_CLOSING) {
+                continue;
+            }
+            if (client.producers.load(std::memory_order_seq_cst) != 0) {
+                stream->wakePending.store(true, std::memory_order_relaxed);
+                continue;
+            }
+            StreamEvent event;
+            while (client.queue.tryPop(event)) {
+            }
+            client.sink = nullptr;
+            client.filter = EventFilter();
+            client.state.store(CLIENT_FREE, std::memory_order_release);
+        }
+        pthread_mutex_unlock(&stream->mutex);
+        
+        // Sinks run without the lock so they can call back into delivered()
+        stream->flush(&batch);
+        
+        pthread_mutex_lock(&stream->mutex);
+    }
+    pthread_mutex_unlock(&stream->mutex);
+    
+    return nullptr;
+}
+
+EventStreamStats EventStream::getStats() const {
+    EventStreamStats stats;
+    stats.clients = clientCount.load(std::memory_order_relaxed);
+    stats.published = published.load(std::memory_order_relaxed);
+    stats.delivered = deliveredEvents.load(std::memory_order_relaxed);
+    stats.dropped = droppedEvents.load(std::memory_order_relaxed);
+    stats.batches = batches.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,143 @@
+#ifndef EventStream_h
+#define EventStream_h
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "EventPipeline.h"
+#include "StringTable.h"
+
+// Clients that can be subscribed at once
+#ifndef EVENT_STREAM_MAX_CLIENTS
+#define EVENT_STREAM_MAX_CLIENTS 8
+#endif
+
+// Events queued per client (power of two); past it new events are dropped and counted
+#ifndef EVENT_STREAM_CLIENT_QUEUE
+#define EVENT_STREAM_CLIENT_QUEUE 4096
+#endif
+
+// Most events handed over in one batch
+#ifndef EVENT_STREAM_BATCH_MAX
+#define EVENT_STREAM_BATCH_MAX 256
+#endif
+
+enum StreamEventType : uint8_t {
+    STREAM_EVENT_PROCESS,
+    STREAM_EVENT_FILE,
+    STREAM_EVENT_NETWORK,
+    STREAM_EVENT_SYSCALL,
+    STREAM_EVENT_TYPE_COUNT
+};
+
+const char* streamEventTypeName(StreamEventType type);
+// The subject as clients see it. Network events are put together in `buffer`
+// as "TCP 10.0.0.2:50123 -> 17.253.144.10:443"; the rest are the interned string.
+const char* streamEventSubject(const StringTable* strings, const StreamEvent& event,
+                               char* buffer, size_t size, size_t* length);
+bool parseStreamEventType(const char* name, StreamEventType* type);
+
+// Everything is an interned string ID or a number, so publishing never allocates
+struct StreamEvent {
+    uint64_t timestamp;         // mach time
+    pid_t pid;
+    uint32_t subjectId;         // executable, file path, remote address or syscall name
+    uint32_t actionId;          // process event, access type, connection state or arguments
+    uint32_t count;             // > 1 for coalesced file accesses
+    StreamEventType type;
+    bool blocked;
+    // The rest of a network event's connection. Addresses repeat; whole
+    // 5-tuples with their ephemeral ports don't, so they are never interned.
+    uint8_t protocol;           // IPPROTO_*
+    uint16_t localPort;
+    uint16_t remotePort;
+    uint32_t localAddressId;
+};
+
+struct EventFilter {
+    uint32_t types;             // bit per StreamEventType; 0 for all
+    pid_t pid;                  // 0 for any
+    std::string pathPrefix;     // compared with the subject; empty for any
+};
+
+struct EventStreamStats {
+    uint64_t clients;
+    uint64_t published;         // events matched against at least one client
+    uint64_t delivered;
+    uint64_t dropped;           // client queue full
+    uint64_t batches;
+};
+
+// Called on the flusher thread with a batch and the events dropped since the
+// previous one. The batch is in flight until delivered() is called for the
+// client; until then its events keep queueing (and eventually dropping).
+typedef std::function<void(uint64_t client, const StreamEvent* events, size_t count, uint64_t dropped)> EventSink;
+
+// Fans events out to subscribed clients. Producers filter and push into each
+// matching client's MPSC ring without locking; one flusher thread drains the
+// rings into batches. With nobody subscribed publishing is a single load.
+class EventStream {
+public:
+    explicit EventStream(const StringTable* strings);
+    ~EventStream();
+    
+    bool start();
+    void stop();
+    
+    // 0 if every client slot is taken. The sink is destroyed on the flusher
+    // thread once the client is gone, so it may own the client's connection.
+    uint64_t subscribe(const EventFilter& filter, EventSink sink);
+    bool unsubscribe(uint64_t client);
+    void delivered(uint64_t client);
+    
+    bool active() const { return clientCount.load(std::memory_order_relaxed) > 0; }
+    void publish(const StreamEvent& event);
+    
+    EventStreamStats getStats() const;
+
+private:
+    enum ClientState : uint8_t {
+        CLIENT_FREE,
+        CLIENT_ACTIVE,
+        CLIENT_CLOSING      // unsubscribed; freed once no producer is inside
+    };
+    
+    struct Client {
+        std::atomic<uint8_t> state;
+        std::atomic<uint32_t> producers;
+        std::atomic<bool> inFlight;
+        std::atomic<uint64_t> dropped;
+        uint64_t id;
+        EventFilter filter;         // fixed while ACTIVE
+        EventSink sink;             // only touched by the flusher once ACTIVE
+        MPSCRing<StreamEvent, EVENT_STREAM_CLIENT_QUEUE> queue;
+    };
+    
+    const StringTable* strings;
+    Client clients[EVENT_STREAM_MAX_CLIENTS];
+    std::atomic<uint32_t> clientCount;
+    uint64_t nextId;
+    
+    pthread_mutex_t mutex;          // subscribe/unsubscribe and flusher wakeups
+    pthread_cond_t cond;
+    std::atomic<bool> wakePending;
+    bool running;
+    pthread_t flusherThread;
+    
+    std::atomic<uint64_t> published;
+    std::atomic<uint64_t> deliveredEvents;
+    std::atomic<uint64_t> droppedEvents;
+    std::atomic<uint64_t> batches;
+    
+    bool matches(const EventFilter& filter, const StreamEvent& event) const;
+    void wake();
+    void flush(std::vector<StreamEvent>* batch);
+    
+    static void* flusherThreadMain(void* arg);
+};
+
+#endif
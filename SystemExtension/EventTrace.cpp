@@ -0,0 +1,603 @@
+// Compact ES message traces for replay and benchmarking
+#include "EventTrace.h"
+#include "LatencyHistogram.h"
+#include "ProcessTracker.h"
+#include <bsm/libbsm.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static void traceFile(const es_file_t* file, TraceFile* out) {
+    if (!file) {
+        *out = TraceFile();
+        return;
+    }
+    out->path.length = file->path.length;
+    out->path.data = file->path.data;
+    out->truncated = file->path_truncated;
+    out->device = (uint64_t)file->stat.st_dev;
+    out->inode = (uint64_t)file->stat.st_ino;
+}
+
+static void traceProcess(const es_process_t* process, uint32_t version, TraceProcess* out) {
+    out->pid = audit_token_to_pid(process->audit_token);
+    out->ppid = process->ppid;
+    out->pidVersion = (uint32_t)audit_token_to_pidversion(process->audit_token);
+    out->euid = audit_token_to_euid(process->audit_token);
+    out->rgid = audit_token_to_rgid(process->audit_token);
+    out->platformBinary = process->is_platform_binary;
+    out->signingId.length = process->signing_id.length;
+    out->signingId.data = process->signing_id.data;
+    traceFile(process->executable, &out->executable);
+    out->startUsec = version >= 3 ? timevalToUsec(process->start_time) : 0;
+}
+
+void traceMessage(const es_message_t* message, uint64_t timeNs, TraceEvent* event) {
+    event->timeNs = timeNs;
+    event->eventType = (uint32_t)message->event_type;
+    event->actionType = (uint32_t)message->action_type;
+    event->version = message->version;
+    event->fields = 0;
+    event->value = 0;
+    event->args.clear();
+    traceProcess(message->process, message->version, &event->process);
+    
+    // Only what the handlers and the AUTH path read
+    switch (message->event_type) {
+        case ES_EVENT_TYPE_AUTH_EXEC:
+        case ES_EVENT_TYPE_NOTIFY_EXEC: {
+            traceProcess(message->event.exec.target, message->version, &event->target);
+            uint32_t count = es_exec_arg_count(&message->event.exec);
+            for (uint32_t i = 0; i < count; i++) {
+                es_string_token_t arg = es_exec_arg(&message->event.exec, i);
+                event->args.push_back({arg.length, arg.data});
+            }
+            event->fields = TRACE_HAS_TARGET | TRACE_HAS_ARGS;
+            break;
+        }
+        case ES_EVENT_TYPE_NOTIFY_FORK:
+            traceProcess(message->event.fork.child, message->version, &event->target);
+            event->fields = TRACE_HAS_TARGET;
+            break;
+        case ES_EVENT_TYPE_NOTIFY_EXIT:
+            event->value = message->event.exit.stat;
+            event->fields = TRACE_HAS_VALUE;
+            break;
+        case ES_EVENT_TYPE_AUTH_OPEN:
+        case ES_EVENT_TYPE_NOTIFY_OPEN:
+            traceFile(message->event.open.file, &event->file);
+            event->value = message->event.open.fflag;
+            event->fields = TRACE_HAS_FILE | TRACE_HAS_VALUE;
+            break;
+        case ES_EVENT_TYPE_NOTIFY_WRITE:
+            traceFile(message->event.write.target, &event->file);
+            event->fields = TRACE_HAS_FILE;
+            break;
+        case ES_EVENT_TYPE_AUTH_UNLINK:
+        case ES_EVENT_TYPE_NOTIFY_UNLINK:
+            traceFile(message->event.unlink.target, &event->file);
+            event->fields = TRACE_HAS_FILE;
+            break;
+        case ES_EVENT_TYPE_NOTIFY_MMAP:
+            traceFile(message->event.mmap.source, &event->file);
+            event->fields = TRACE_HAS_FILE;
+            break;
+        case ES_EVENT_TYPE_NOTIFY_SIGNAL:
+            traceProcess(message->event.signal.target, message->version, &event->target);
+            event->value = message->event.signal.sig;
+            event->fields = TRACE_HAS_TARGET | TRACE_HAS_VALUE;
+            break;
+        case ES_EVENT_TYPE_NOTIFY_SETUID:
+            event->value = message->event.setuid.uid;
+            event->fields = TRACE_HAS_VALUE;
+            break;
+        default:
+            break;
+    }
+}
+
+EventTraceWriter::EventTraceWriter()
+    : active(false), producers(0), dropped(0),
+      queue(new MPSCRing<TracedMessage, EVENT_TRACE_QUEUE_CAPACITY>()), recorderRunning(false),
+      quitting(false), fd(-1), strings(nullptr), stringsWritten(0), firstMachTime(0),
+      lastTimeNs(0), events(0), bytes(0) {
+    pthread_mutex_init(&mutex, nullptr);
+    pthread_cond_init(&cond, nullptr);
+}
+
+EventTraceWriter::~EventTraceWriter() {
+    stop(nullptr);
+    
+    pthread_mutex_lock(&mutex);
+    quitting = true;
+    bool running = recorderRunning;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+    if (running) {
+        pthread_join(recorderThread, nullptr);
+    }
+    
+    delete queue;
+    delete strings;
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+}
+
+// Sleeps while nothing is recording and nothing is queued
+void* EventTraceWriter::recorderThreadMain(void* argument) {
+    EventTraceWriter* writer = (EventTraceWriter*)argument;
+    pthread_mutex_lock(&writer->mutex);
+    while (!writer->quitting) {
+        writer->drainLocked();
+        if (writer->fd >= 0 || writer->queue->size() > 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)EVENT_TRACE_DRAIN_MS * 1000000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&writer->cond, &writer->mutex, &deadline);
+        } else {
+            pthread_cond_wait(&writer->cond, &writer->mutex);
+        }
+    }
+    writer->drainLocked();
+    pthread_mutex_unlock(&writer->mutex);
+    return nullptr;
+}
+
+bool EventTraceWriter::start(const char* path, std::string* error) {
+    pthread_mutex_lock(&mutex);
+    if (fd >= 0) {
+        *error = "already recording to " + tracePath;
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    
+    int traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (traceFd < 0) {
+        *error = std::string("cannot create ") + path + ": " + strerror(errno);
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    bool started = beginLocked(traceFd, path, error);
+    pthread_mutex_unlock(&mutex);
+    return started;
+}
+
+bool EventTraceWriter::startInDirectory(const char* directory, std::string* error) {
+    pthread_mutex_lock(&mutex);
+    if (fd >= 0) {
+        *error = "already recording to " + tracePath;
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    
+    // Nothing in the path below the directory is followed, and a directory
+    // someone else could plant links in is refused
+    if (mkdir(directory, 0700) != 0 && errno != EEXIST) {
+        *error = std::string("cannot create ") + directory + ": " + strerror(errno);
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    int directoryFd = open(directory, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat info;
+    if (directoryFd < 0 || fstat(directoryFd, &info) != 0 || info.st_uid != geteuid() ||
+        (info.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        *error = std::string(directory) + " is not a private directory";
+        if (directoryFd >= 0) {
+            close(directoryFd);
+        }
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    
+    char stamp[32];
+    time_t now = time(nullptr);
+    struct tm local;
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime_r(&now, &local));
+    std::string name;
+    int traceFd = -1;
+    for (int attempt = 0; traceFd < 0 && attempt < 100; attempt++) {
+        name = std::string("trace-") + stamp + (attempt ? "-" + std::to_string(attempt) : "") + ".avtrace";
+        traceFd = openat(directoryFd, name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (traceFd < 0 && errno != EEXIST) {
+            break;
+        }
+    }
+    int openError = errno;
+    close(directoryFd);
+    std::string path = std::string(directory) + "/" + name;
+    if (traceFd < 0) {
+        *error = "cannot create " + path + ": " + strerror(openError);
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    bool started = beginLocked(traceFd, path, error);
+    pthread_mutex_unlock(&mutex);
+    return started;
+}
+
+bool EventTraceWriter::beginLocked(int traceFd, const std::string& path, std::string* error) {
+    if (!recorderRunning) {
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_set_qos_class_np(&attributes, QOS_CLASS_UTILITY, 0);
+        recorderRunning = pthread_create(&recorderThread, &attributes, recorderThreadMain, this) == 0;
+        pthread_attr_destroy(&attributes);
+        if (!recorderRunning) {
+            *error = "cannot start the trace recorder thread";
+            close(traceFd);
+            return false;
+        }
+    }
+    
+    fd = traceFd;
+    tracePath = path;
+    delete strings;
+    strings = new StringTable();
+    stringsWritten = 1;             // ID 0, the empty string, is implied
+    buffer.clear();
+    buffer.reserve(EVENT_TRACE_BUFFER_BYTES * 2);
+    buffer.insert(buffer.end(), EVENT_TRACE_MAGIC, EVENT_TRACE_MAGIC + 8);
+    firstMachTime = 0;
+    lastTimeNs = 0;
+    events = 0;
+    bytes = 0;
+    dropped.store(0, std::memory_order_relaxed);
+    active.store(true, std::memory_order_seq_cst);
+    pthread_cond_signal(&cond);
+    
+    syslog(LOG_NOTICE, "EventTrace: recording ES messages to %s", path.c_str());
+    return true;
+}
+
+void EventTraceWriter::stop(EventTraceStats* stats) {
+    // Once no record() can still push, whatever is queued is all there is
+    active.store(false, std::memory_order_seq_cst);
+    while (producers.load(std::memory_order_acquire) != 0) {
+        sched_yield();
+    }
+    
+    pthread_mutex_lock(&mutex);
+    drainLocked();
+    if (fd >= 0) {
+        flushLocked();
+        close(fd);
+        fd = -1;
+        syslog(LOG_NOTICE, "EventTrace: %llu events, %llu bytes written to %s",
+               events, bytes, tracePath.c_str());
+    }
+    pthread_mutex_unlock(&mutex);
+    
+    if (stats) {
+        *stats = getStats();
+    }
+}
+
+EventTraceStats EventTraceWriter::getStats() const {
+    pthread_mutex_lock(&mutex);
+    EventTraceStats stats;
+    stats.recording = fd >= 0;
+    stats.path = tracePath;
+    stats.events = events;
+    stats.bytes = bytes + (fd >= 0 ? buffer.size() : 0);
+    stats.strings = stringsWritten ? stringsWritten - 1 : 0;
+    stats.dropped = dropped.load(std::memory_order_relaxed);
+    pthread_mutex_unlock(&mutex);
+    return stats;
+}
+
+void EventTraceWriter::record(const es_message_t* message) {
+    // Counted before active is read, so stop() can wait for pushes that saw it set
+    producers.fetch_add(1, std::memory_order_seq_cst);
+    if (active.load(std::memory_order_seq_cst)) {
+        TracedMessage traced;
+        traced.message = retainMessage(message, &traced.isCopy);
+        if (!queue->tryPush(traced)) {
+            releaseMessage(traced.message, traced.isCopy);
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    producers.fetch_sub(1, std::memory_order_release);
+}
+
+// Timestamps come from the messages, so encoding late doesn't change the trace
+void EventTraceWriter::drainLocked() {
+    TracedMessage traced;
+    while (queue->tryPop(traced)) {
+        const es_message_t* message = traced.message;
+        if (fd >= 0) {
+            if (firstMachTime == 0) {
+                firstMachTime = message->mach_time;
+            }
+            uint64_t elapsed = message->mach_time > firstMachTime ? message->mach_time - firstMachTime : 0;
+            traceMessage(message, machToNanoseconds(elapsed), &scratch);
+            appendLocked(scratch);
+        }
+        releaseMessage(message, traced.isCopy);
+    }
+}
+
+void EventTraceWriter::append(const TraceEvent& event) {
+    pthread_mutex_lock(&mutex);
+    if (fd >= 0) {
+        appendLocked(event);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void EventTraceWriter::putVarint(uint64_t value) {
+    while (value >= 0x80) {
+        buffer.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back((uint8_t)value);
+}
+
+// The next unused ID announces a new string, which follows inline
+void EventTraceWriter::putString(const TraceString& value) {
+    uint32_t id = strings->intern(value.data, value.length);
+    putVarint(id);
+    if (id != 0 && id == stringsWritten) {
+        putVarint(value.length);
+        buffer.insert(buffer.end(), (const uint8_t*)value.data, (const uint8_t*)value.data + value.length);
+        stringsWritten++;
+    }
+}
+
+void EventTraceWriter::putFile(const TraceFile& file) {
+    putString(file.path);
+    buffer.push_back(file.truncated ? 1 : 0);
+    putVarint(file.device);
+    putVarint(file.inode);
+}
+
+void EventTraceWriter::putProcess(const TraceProcess& process) {
+    putVarint((uint32_t)process.pid);
+    putVarint((uint32_t)process.ppid);
+    putVarint(process.pidVersion);
+    putVarint(process.euid);
+    putVarint(process.rgid);
+    buffer.push_back(process.platformBinary ? 1 : 0);
+    putString(process.signingId);
+    putFile(process.executable);
+    putVarint(process.startUsec);
+}
+
+void EventTraceWriter::appendLocked(const TraceEvent& event) {
+    // Timestamps are deltas, so a steady stream costs a byte or two each
+    putVarint(event.timeNs > lastTimeNs ? event.timeNs - lastTimeNs : 0);
+    lastTimeNs = event.timeNs > lastTimeNs ? event.timeNs : lastTimeNs;
+    putVarint(event.eventType);
+    putVarint(event.actionType);
+    putVarint(event.version);
+    putVarint(event.fields);
+    putProcess(event.process);
+    if (event.fields & TRACE_HAS_TARGET) {
+        putProcess(event.target);
+    }
+    if (event.fields & TRACE_HAS_FILE) {
+        putFile(event.file);
+    }
+    if (event.fields & TRACE_HAS_VALUE) {
+        // Zigzag, so small negative values stay short
+        putVarint(((uint64_t)event.value << 1) ^ (uint64_t)(event.value >> 63));
+    }
+    if (event.fields & TRACE_HAS_ARGS) {
+        putVarint(event.args.size());
+        for (const TraceString& arg : event.args) {
+            putString(arg);
+        }
+    }
+    events++;
+    
+    if (buffer.size() >= EVENT_TRACE_BUFFER_BYTES && !flushLocked()) {
+        return;
+    }
+    if (bytes >= EVENT_TRACE_MAX_BYTES) {
+        syslog(LOG_NOTICE, "EventTrace: %s reached %llu bytes; recording stopped",
+               tracePath.c_str(), bytes);
+        active.store(false, std::memory_order_relaxed);
+        close(fd);
+        fd = -1;
+    }
+}
+
+bool EventTraceWriter::flushLocked() {
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t result = write(fd, buffer.data() + written, buffer.size() - written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            // A partial trace is still readable up to its last whole record
+            syslog(LOG_ERR, "EventTrace: cannot write %s: %s; recording stopped",
+                   tracePath.c_str(), strerror(errno));
+            active.store(false, std::memory_order_relaxed);
+            close(fd);
+            fd = -1;
+            buffer.clear();
+            return false;
+        }
+        written += (size_t)result;
+    }
+    bytes += written;
+    buffer.clear();
+    return true;
+}
+
+EventTraceReader::EventTraceReader()
+    : base(nullptr), size(0), offset(0), timeNs(0), corrupt(false) {
+}
+
+EventTraceReader::~EventTraceReader() {
+    close();
+}
+
+bool EventTraceReader::open(const char* path, std::string* error) {
+    close();
+    
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *error = std::string("cannot open ") + path + ": " + strerror(errno);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < 8) {
+        *error = std::string(path) + " is not a trace";
+        ::close(fd);
+        return false;
+    }
+    
+    void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        *error = std::string("cannot map ") + path + ": " + strerror(errno);
+        return false;
+    }
+    if (memcmp(mapped, EVENT_TRACE_MAGIC, 8) != 0) {
+        munmap(mapped, (size_t)info.st_size);
+        *error = std::string(path) + " is not a trace";
+        return false;
+    }
+    
+    base = (const uint8_t*)mapped;
+    size = (size_t)info.st_size;
+    rewind();
+    return true;
+}
+
+void EventTraceReader::close() {
+    if (base) {
+        munmap((void*)base, size);
+        base = nullptr;
+    }
+    size = 0;
+    offset = 0;
+}
+
+void EventTraceReader::rewind() {
+    offset = 8;
+    timeNs = 0;
+    corrupt = false;
+    strings.clear();
+    strings.push_back({0, ""});
+}
+
+bool EventTraceReader::getVarint(uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && offset < size; shift += 7) {
+        uint8_t byte = base[offset++];
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool EventTraceReader::getString(TraceString* value) {
+    uint64_t id;
+    if (!getVarint(&id) || id > strings.size()) {
+        return false;
+    }
+    if (id < strings.size()) {
+        *value = strings[id];
+        return true;
+    }
+    
+    uint64_t length;
+    if (!getVarint(&length) || length > size - offset) {
+        return false;
+    }
+    value->length = (size_t)length;
+    value->data = (const char*)base + offset;
+    offset += (size_t)length;
+    strings.push_back(*value);
+    return true;
+}
+
+bool EventTraceReader::getFile(TraceFile* file) {
+    uint64_t device, inode;
+    if (!getString(&file->path) || offset >= size) {
+        return false;
+    }
+    file->truncated = base[offset++] != 0;
+    if (!getVarint(&device) || !getVarint(&inode)) {
+        return false;
+    }
+    file->device = device;
+    file->inode = inode;
+    return true;
+}
+
+bool EventTraceReader::getProcess(TraceProcess* process) {
+    uint64_t pid, ppid, pidVersion, euid, rgid, startUsec;
+    if (!getVarint(&pid) || !getVarint(&ppid) || !getVarint(&pidVersion) ||
+        !getVarint(&euid) || !getVarint(&rgid) || offset >= size) {
+        return false;
+    }
+    process->pid = (pid_t)pid;
+    process->ppid = (pid_t)ppid;
+    process->pidVersion = (uint32_t)pidVersion;
+    process->euid = (uid_t)euid;
+    process->rgid = (gid_t)rgid;
+    process->platformBinary = base[offset++] != 0;
+    if (!getString(&process->signingId) || !getFile(&process->executable) || !getVarint(&startUsec)) {
+        return false;
+    }
+    process->startUsec = startUsec;
+    return true;
+}
+
+bool EventTraceReader::next(TraceEvent* event) {
+    if (!base || corrupt || offset >= size) {
+        return false;
+    }
+    
+    uint64_t delta, eventType, actionType, version, fields;
+    bool valid = getVarint(&delta) && getVarint(&eventType) && getVarint(&actionType) &&
+                 getVarint(&version) && getVarint(&fields) && getProcess(&event->process);
+    event->fields = (uint32_t)fields;
+    event->value = 0;
+    event->args.clear();
+    if (valid && (fields & TRACE_HAS_TARGET)) {
+        valid = getProcess(&event->target);
+    }
+    if (valid && (fields & TRACE_HAS_FILE)) {
+        valid = getFile(&event->file);
+    }
+    if (valid && (fields & TRACE_HAS_VALUE)) {
+        uint64_t zigzag;
+        valid = getVarint(&zigzag);
+        event->value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    }
+    if (valid && (fields & TRACE_HAS_ARGS)) {
+        uint64_t count;
+        valid = getVarint(&count) && count <= size - offset;
+        for (uint64_t i = 0; valid && i < count; i++) {
+            TraceString arg;
+            valid = getString(&arg);
+            event->args.push_back(arg);
+        }
+    }
+    if (!valid) {
+        // A recording cut short by a crash ends mid-record
+        corrupt = true;
+        return false;
+    }
+    
+    timeNs += delta;
+    event->timeNs = timeNs;
+    event->eventType = (uint32_t)eventType;
+    event->actionType = (uint32_t)actionType;
+    event->version = (uint32_t)version;
+    return true;
+}
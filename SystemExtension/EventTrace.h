@@ -0,0 +1,194 @@
+#ifndef EventTrace_h
+#define EventTrace_h
+
+#include <EndpointSecurity/EndpointSecurity.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "EventPipeline.h"
+#include "StringTable.h"
+
+// ES message streams recorded to a file, so the handlers can be replayed and
+// benchmarked away from the kernel (see Benchmarks/). A trace keeps only the
+// fields the extension reads: the processes involved, the file the event is
+// about, exec arguments and when the message arrived. Numbers are varints and
+// each distinct string is written once, then referred to by its ID.
+
+#define EVENT_TRACE_MAGIC "AVTRACE1"
+
+// Recording stops by itself once a trace file reaches this size
+#ifndef EVENT_TRACE_MAX_BYTES
+#define EVENT_TRACE_MAX_BYTES (1024ull * 1024 * 1024)
+#endif
+
+// Encoded records are written out in blocks of this size
+#ifndef EVENT_TRACE_BUFFER_BYTES
+#define EVENT_TRACE_BUFFER_BYTES (64 * 1024)
+#endif
+
+// Messages waiting for the recorder thread; past this they aren't traced
+#ifndef EVENT_TRACE_QUEUE_CAPACITY
+#define EVENT_TRACE_QUEUE_CAPACITY 16384
+#endif
+
+// How often the recorder thread drains the queue while a trace is recording
+#ifndef EVENT_TRACE_DRAIN_MS
+#define EVENT_TRACE_DRAIN_MS 10
+#endif
+
+// Traces started over XPC go here, root-owned, under names the extension picks
+#ifndef EVENT_TRACE_DIR
+#define EVENT_TRACE_DIR "/var/log/AudioVideoMonitor.traces"
+#endif
+
+// Which of the optional parts of a TraceEvent the message had
+#define TRACE_HAS_TARGET    0x01
+#define TRACE_HAS_FILE      0x02
+#define TRACE_HAS_VALUE     0x04
+#define TRACE_HAS_ARGS      0x08
+
+// Same layout as es_string_token_t; points into the message or the trace
+struct TraceString {
+    size_t length;
+    const char* data;
+};
+
+struct TraceFile {
+    TraceString path;
+    bool truncated;
+    uint64_t device;
+    uint64_t inode;
+};
+
+struct TraceProcess {
+    pid_t pid;
+    pid_t ppid;
+    uint32_t pidVersion;
+    uid_t euid;
+    gid_t rgid;
+    bool platformBinary;
+    TraceString signingId;
+    TraceFile executable;
+    uint64_t startUsec;
+};
+
+// What the trace knows about one message. Strings stay valid until the
+// next event is read or recorded.
+struct TraceEvent {
+    uint64_t timeNs;                // since the first event of the trace
+    uint32_t eventType;             // es_event_type_t
+    uint32_t actionType;            // es_action_type_t
+    uint32_t version;
+    uint32_t fields;                // TRACE_HAS_*
+    TraceProcess process;
+    TraceProcess target;            // exec target, fork child, signal target
+    TraceFile file;                 // open, write, unlink or mmap
+    int64_t value;                  // open fflag, signal, setuid uid, exit status
+    std::vector<TraceString> args;  // exec
+};
+
+struct EventTraceStats {
+    bool recording;
+    std::string path;
+    uint64_t events;
+    uint64_t bytes;
+    uint64_t strings;
+    uint64_t dropped;               // messages the recorder queue had no room for
+};
+
+// A message retained for the recorder thread
+struct TracedMessage {
+    const es_message_t* message;
+    bool isCopy;
+};
+
+class EventTraceWriter {
+public:
+    EventTraceWriter();
+    ~EventTraceWriter();
+    
+    // For local tools; creates or truncates path
+    bool start(const char* path, std::string* error);
+    // A new trace-<time>.avtrace in directory, which must be a real directory
+    // owned by us and writable by no one else; it's created if missing
+    bool startInDirectory(const char* directory, std::string* error);
+    // Flushes and closes the file; the stats describe the finished trace
+    void stop(EventTraceStats* stats);
+    bool recording() const { return active.load(std::memory_order_relaxed); }
+    
+    // Called on the ES callback queue. Retains the message and queues it
+    // without locking; the recorder thread encodes and writes it.
+    void record(const es_message_t* message);
+    // For traces built without a kernel, e.g. synthetic benchmark loads
+    void append(const TraceEvent& event);
+    
+    EventTraceStats getStats() const;
+
+private:
+    std::atomic<bool> active;
+    std::atomic<uint32_t> producers;        // record() calls that may still push
+    std::atomic<uint64_t> dropped;
+    MPSCRing<TracedMessage, EVENT_TRACE_QUEUE_CAPACITY>* queue;
+    
+    mutable pthread_mutex_t mutex;  // guards everything below, and popping the queue
+    pthread_cond_t cond;
+    pthread_t recorderThread;
+    bool recorderRunning;
+    bool quitting;
+    int fd;
+    std::string tracePath;
+    StringTable* strings;           // this trace's IDs; a fresh table per trace
+    uint32_t stringsWritten;        // IDs below this are already in the file
+    std::vector<uint8_t> buffer;
+    TraceEvent scratch;
+    uint64_t firstMachTime;
+    uint64_t lastTimeNs;
+    uint64_t events;
+    uint64_t bytes;
+    
+    static void* recorderThreadMain(void* argument);
+    bool beginLocked(int traceFd, const std::string& path, std::string* error);
+    void drainLocked();
+    void appendLocked(const TraceEvent& event);
+    void putVarint(uint64_t value);
+    void putString(const TraceString& value);
+    void putFile(const TraceFile& file);
+    void putProcess(const TraceProcess& process);
+    bool flushLocked();
+};
+
+// Reads a whole trace from a read-only mapping; strings point into it
+class EventTraceReader {
+public:
+    EventTraceReader();
+    ~EventTraceReader();
+    
+    bool open(const char* path, std::string* error);
+    void close();
+    // False at the end of the trace or at a damaged record
+    bool next(TraceEvent* event);
+    // Back to the first event, e.g. to loop a short trace
+    void rewind();
+    bool damaged() const { return corrupt; }
+
+private:
+    const uint8_t* base;
+    size_t size;
+    size_t offset;
+    uint64_t timeNs;
+    bool corrupt;
+    std::vector<TraceString> strings;
+    
+    bool getVarint(uint64_t* value);
+    bool getString(TraceString* value);
+    bool getFile(TraceFile* file);
+    bool getProcess(TraceProcess* process);
+};
+
+// The trace's view of a message, for record() and for tools that inspect messages
+void traceMessage(const es_message_t* message, uint64_t timeNs, TraceEvent* event);
+
+#endif
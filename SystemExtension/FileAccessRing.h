@@ -0,0 +1,135 @@
+#ifndef FileAccessRing_h
+#define FileAccessRing_h
+
+#include <sched.h>
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include "MonitoringTypes.h"
+
+// Number of recent file accesses kept in memory (power of two)
+#ifndef FILE_ACCESS_RING_SLOTS
+#define FILE_ACCESS_RING_SLOTS 16384
+#endif
+
+// Preallocated ring of the most recent file accesses, pushed to by every event
+// worker and the FS watcher. A writer takes a ticket with one fetch_add, then
+// claims the ticket's slot by CAS-ing its sequence from the last lap's even
+// value to its own odd one, so only one writer is ever inside a slot. It
+// publishes with the matching even value; pushing never allocates or moves.
+// Readers copy a slot and keep it only if its sequence was its ticket's
+// across the copy (a per-slot seqlock).
+class FileAccessRing {
+    static_assert((FILE_ACCESS_RING_SLOTS & (FILE_ACCESS_RING_SLOTS - 1)) == 0,
+                  "FILE_ACCESS_RING_SLOTS must be a power of two");
+    static_assert(sizeof(FileAccessRecord) <= 5 * sizeof(uint64_t),
+                  "FileAccessRecord must fit in a ring slot");
+
+public:
+    FileAccessRing() : head(0), skipped(0) {
+        for (size_t i = 0; i < FILE_ACCESS_RING_SLOTS; i++) {
+            slots[i].sequence.store(0, std::memory_order_relaxed);
+            for (int w = 0; w < kWords; w++) {
+                slots[i].words[w].store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void push(const FileAccessRecord& access) {
+        uint64_t ticket = head.fetch_add(1, std::memory_order_relaxed);
+        Slot& slot = slots[ticket & (FILE_ACCESS_RING_SLOTS - 1)];
+
+        uint64_t words[kWords] = {};
+        memcpy(words, &access, sizeof(access));
+
+        // Odd while the slot is being written; 2 * (ticket + 1) once it holds ticket.
+        // A writer a lap behind that is still inside the slot is waited out, which
+        // takes a few stores; one a lap ahead means this record is already gone.
+        uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+        for (;;) {
+            if (sequence >= 2 * ticket + 1) {
+                return;
+            }
+            if (sequence & 1) {
+                sched_yield();
+                sequence = slot.sequence.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (slot.sequence.compare_exchange_weak(sequence, 2 * ticket + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        for (int w = 0; w < kWords; w++) {
+            slot.words[w].store(words[w], std::memory_order_relaxed);
+        }
+        slot.sequence.store(2 * (ticket + 1), std::memory_order_release);
+    }
+
+    // Sequence the next push will get; also the count of pushes so far
+    uint64_t nextSequence() const { return head.load(std::memory_order_acquire); }
+
+    // Appends, oldest first, up to `limit` of the newest records numbered at or
+    // after `since`, and returns the sequence to pass as `since` next time. It
+    // stops at the first record still being written, so that one is returned
+    // by the next call; records overwritten before they were read are skipped.
+    uint64_t read(uint64_t since, size_t limit, std::vector<FileAccessRecord>* records) const {
+        uint64_t end = head.load(std::memory_order_acquire);
+        uint64_t start = end > FILE_ACCESS_RING_SLOTS ? end - FILE_ACCESS_RING_SLOTS : 0;
+        if (since > start) {
+            start = since;
+        }
+        if (end - start > limit) {
+            start = end - limit;
+        }
+
+        uint64_t next = start;
+        for (uint64_t ticket = start; ticket < end; ticket++) {
+            const Slot& slot = slots[ticket & (FILE_ACCESS_RING_SLOTS - 1)];
+            uint64_t expected = 2 * (ticket + 1);
+            uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence < expected) {
+                break;
+            }
+            next = ticket + 1;
+            if (sequence != expected) {
+                skipped.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            uint64_t words[kWords];
+            for (int w = 0; w < kWords; w++) {
+                words[w] = slot.words[w].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != expected) {
+                skipped.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            FileAccessRecord access;
+            memcpy(&access, words, sizeof(access));
+            records->push_back(access);
+        }
+
+        return next;
+    }
+
+    // Records a reader missed because a later lap overwrote them first
+    uint64_t skippedCount() const { return skipped.load(std::memory_order_relaxed); }
+
+private:
+    static const int kWords = 5;
+
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        std::atomic<uint64_t> words[kWords];
+    };
+
+    Slot slots[FILE_ACCESS_RING_SLOTS];
+    std::atomic<uint64_t> head;
+    mutable std::atomic<uint64_t> skipped;
+};
+
+#endif
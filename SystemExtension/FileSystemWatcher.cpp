@@ -0,0 +1,129 @@
+// FSEvents stream for the watched trees
+#include "FileSystemWatcher.h"
+#include <string.h>
+#include <syslog.h>
+#include <vector>
+
+FileSystemWatcher::FileSystemWatcher()
+    : stream(nullptr), queue(nullptr), running(false), function(nullptr), context(nullptr),
+      batches(0), changes(0), rescans(0) {
+}
+
+FileSystemWatcher::~FileSystemWatcher() {
+    stop();
+}
+
+bool FileSystemWatcher::start(const char* const* paths, size_t count, FileSystemChangeFunction changeFunction,
+                              void* changeContext, std::string* error) {
+    if (stream) {
+        return true;
+    }
+    
+    std::vector<CFStringRef> names;
+    for (size_t i = 0; i < count; i++) {
+        CFStringRef name = CFStringCreateWithCString(kCFAllocatorDefault, paths[i], kCFStringEncodingUTF8);
+        if (name) {
+            names.push_back(name);
+        }
+    }
+    CFArrayRef watched = CFArrayCreate(kCFAllocatorDefault, (const void**)names.data(), (CFIndex)names.size(),
+                                       &kCFTypeArrayCallBacks);
+    for (CFStringRef name : names) {
+        CFRelease(name);
+    }
+    if (!watched) {
+        *error = "could not build the watched path list";
+        return false;
+    }
+    
+    function = changeFunction;
+    context = changeContext;
+    FSEventStreamContext streamContext = {0, this, nullptr, nullptr, nullptr};
+    
+    // Per-file events, coalesced over the latency window and never delivered early
+    stream = FSEventStreamCreate(kCFAllocatorDefault, streamCallback, &streamContext, watched,
+                                 kFSEventStreamEventIdSinceNow, FS_WATCH_LATENCY_MS / 1000.0,
+                                 kFSEventStreamCreateFlagFileEvents | kFSEventStreamCreateFlagIgnoreSelf);
+    CFRelease(watched);
+    if (!stream) {
+        *error = "FSEventStreamCreate failed";
+        return false;
+    }
+    
+    dispatch_queue_attr_t attributes = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL,
+                                                                               QOS_CLASS_BACKGROUND, 0);
+    queue = dispatch_queue_create("com.example.AudioVideoMonitor.fsevents", attributes);
+    FSEventStreamSetDispatchQueue(stream, queue);
+    if (!FSEventStreamStart(stream)) {
+        FSEventStreamInvalidate(stream);
+        FSEventStreamRelease(stream);
+        stream = nullptr;
+        dispatch_release(queue);
+        queue = nullptr;
+        *error = "FSEventStreamStart failed";
+        return false;
+    }
+    
+    running.store(true, std::memory_order_relaxed);
+    syslog(LOG_INFO, "FileSystemWatcher: watching %zu trees", names.size());
+    return true;
+}
+
+// On the stream's queue, so it can't overlap a callback
+void FileSystemWatcher::stopOnQueue(void* context) {
+    FSEventStreamRef stream = (FSEventStreamRef)context;
+    FSEventStreamStop(stream);
+    FSEventStreamInvalidate(stream);
+}
+
+void FileSystemWatcher::stop() {
+    if (!stream) {
+        return;
+    }
+    running.store(false, std::memory_order_relaxed);
+    dispatch_sync_f(queue, stream, stopOnQueue);
+    FSEventStreamRelease(stream);
+    stream = nullptr;
+    dispatch_release(queue);
+    queue = nullptr;
+}
+
+void FileSystemWatcher::streamCallback(ConstFSEventStreamRef stream, void* info, size_t count, void* paths,
+                                       const FSEventStreamEventFlags flags[], const FSEventStreamEventId ids[]) {
+    FileSystemWatcher* watcher = (FileSystemWatcher*)info;
+    const char* const* eventPaths = (const char* const*)paths;
+    watcher->batches.fetch_add(1, std::memory_order_relaxed);
+    
+    for (size_t i = 0; i < count; i++) {
+        FSEventStreamEventFlags eventFlags = flags[i];
+        FileSystemChange change;
+        if (eventFlags & (kFSEventStreamEventFlagMustScanSubDirs | kFSEventStreamEventFlagUserDropped |
+                          kFSEventStreamEventFlagKernelDropped)) {
+            change = FS_CHANGE_RESCAN;
+            watcher->rescans.fetch_add(1, std::memory_order_relaxed);
+        } else if (eventFlags & kFSEventStreamEventFlagItemRemoved) {
+            change = FS_CHANGE_REMOVED;
+        } else if (eventFlags & kFSEventStreamEventFlagItemRenamed) {
+            change = FS_CHANGE_RENAMED;
+        } else if (eventFlags & kFSEventStreamEventFlagItemCreated) {
+            change = FS_CHANGE_CREATED;
+        } else if (eventFlags & (kFSEventStreamEventFlagItemModified | kFSEventStreamEventFlagItemInodeMetaMod |
+                                 kFSEventStreamEventFlagItemChangeOwner | kFSEventStreamEventFlagItemXattrMod)) {
+            change = FS_CHANGE_MODIFIED;
+        } else {
+            // History markers, mounts and Finder info
+            continue;
+        }
+        watcher->changes.fetch_add(1, std::memory_order_relaxed);
+        watcher->function(watcher->context, eventPaths[i], strlen(eventPaths[i]), change);
+    }
+}
+
+FileSystemWatcherStats FileSystemWatcher::getStats() const {
+    FileSystemWatcherStats stats;
+    stats.running = running.load(std::memory_order_relaxed);
+    stats.batches = batches.load(std::memory_order_relaxed);
+    stats.changes = changes.load(std::memory_order_relaxed);
+    stats.rescans = rescans.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,71 @@
+#ifndef FileSystemWatcher_h
+#define FileSystemWatcher_h
+
+#include <CoreServices/CoreServices.h>
+#include <dispatch/dispatch.h>
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+// Trees watched with an FSEvents stream. Their changes are logged whatever
+// the ES subscription profile; the default profile doesn't subscribe to
+// writes, and these are where persistence and configuration live.
+#ifndef FS_WATCH_PATHS
+#define FS_WATCH_PATHS "/Library/LaunchAgents", "/Library/LaunchDaemons", "/Library/StartupItems", \
+                       "/Library/Security/SecurityAgentPlugins", "/private/etc"
+#endif
+
+// How long FSEvents coalesces changes before delivering a batch
+#ifndef FS_WATCH_LATENCY_MS
+#define FS_WATCH_LATENCY_MS 1000
+#endif
+
+// What happened to a path, from the item flags FSEvents coalesced into one event
+enum FileSystemChange : uint8_t {
+    FS_CHANGE_CREATED,
+    FS_CHANGE_MODIFIED,
+    FS_CHANGE_RENAMED,
+    FS_CHANGE_REMOVED,
+    FS_CHANGE_RESCAN                // events were dropped; everything under the path may have changed
+};
+
+// Called on the watcher's queue for each changed path
+typedef void (*FileSystemChangeFunction)(void* context, const char* path, size_t length, FileSystemChange change);
+
+struct FileSystemWatcherStats {
+    bool running;
+    uint64_t batches;
+    uint64_t changes;
+    uint64_t rescans;
+};
+
+// One FSEvents stream with per-file events, delivered on a background-QoS
+// serial queue. Nothing wakes up until something under a watched tree changes.
+class FileSystemWatcher {
+public:
+    FileSystemWatcher();
+    ~FileSystemWatcher();
+    
+    bool start(const char* const* paths, size_t count, FileSystemChangeFunction function, void* context,
+               std::string* error);
+    // Returns once no callback is running or will run again
+    void stop();
+    
+    FileSystemWatcherStats getStats() const;
+
+private:
+    FSEventStreamRef stream;
+    dispatch_queue_t queue;
+    std::atomic<bool> running;
+    FileSystemChangeFunction function;
+    void* context;
+    std::atomic<uint64_t> batches;
+    std::atomic<uint64_t> changes;
+    std::atomic<uint64_t> rescans;
+    
+    static void streamCallback(ConstFSEventStreamRef stream, void* info, size_t count, void* paths,
+                               const FSEventStreamEventFlags flags[], const FSEventStreamEventId ids[]);
+    static void stopOnQueue(void* context);
+};
+
+#endif
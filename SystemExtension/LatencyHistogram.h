@@ -0,0 +1,124 @@
+#ifndef LatencyHistogram_h
+#define LatencyHistogram_h
+
+#include <mach/mach_time.h>
+#include <atomic>
+#include <stdint.h>
+
+// Log-linear buckets: 8 linear sub-buckets per power of two (~12% resolution),
+// covering 0ns up to 2^37ns (~137s). Larger samples land in one overflow bucket.
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_MAX_MAGNITUDE 37
+#define LATENCY_HISTOGRAM_BUCKETS ((LATENCY_MAX_MAGNITUDE - 2) * LATENCY_SUB_BUCKETS + 1)
+
+// Summary computed from a histogram snapshot
+struct LatencySummary {
+    uint64_t count;
+    uint64_t meanNs;
+    uint64_t p50Ns;
+    uint64_t p99Ns;
+    uint64_t p999Ns;
+    uint64_t maxNs;
+};
+
+inline uint64_t machToNanoseconds(uint64_t machTime) {
+    static mach_timebase_info_data_t timebase = {0, 0};
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    return machTime * timebase.numer / timebase.denom;
+}
+
+inline uint64_t nanosecondsToMach(uint64_t ns) {
+    static mach_timebase_info_data_t timebase = {0, 0};
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    return ns * timebase.denom / timebase.numer;
+}
+
+// Lock-free latency histogram. record() is a handful of relaxed atomic adds,
+// cheap enough to call on the ES callback queue.
+struct LatencyHistogram {
+    std::atomic<uint64_t> buckets[LATENCY_HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+    
+    LatencyHistogram() { reset(); }
+    
+    void reset() {
+        for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+            buckets[i].store(0, std::memory_order_relaxed);
+        }
+        count.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+    
+    static int bucketIndex(uint64_t ns) {
+        if (ns < LATENCY_SUB_BUCKETS) {
+            return (int)ns;
+        }
+        int magnitude = 63 - __builtin_clzll(ns);
+        if (magnitude >= LATENCY_MAX_MAGNITUDE) {
+            return LATENCY_HISTOGRAM_BUCKETS - 1;
+        }
+        int sub = (int)((ns >> (magnitude - 3)) & (LATENCY_SUB_BUCKETS - 1));
+        return (magnitude - 2) * LATENCY_SUB_BUCKETS + sub;
+    }
+    
+    // Upper bound (inclusive) of the values that map to a bucket
+    static uint64_t bucketUpperBound(int index) {
+        if (index < LATENCY_SUB_BUCKETS) {
+            return (uint64_t)index;
+        }
+        int magnitude = index / LATENCY_SUB_BUCKETS + 2;
+        uint64_t sub = (uint64_t)(index % LATENCY_SUB_BUCKETS);
+        return ((LATENCY_SUB_BUCKETS + sub + 1) << (magnitude - 3)) - 1;
+    }
+    
+    void record(uint64_t ns) {
+        buckets[bucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+        
+        uint64_t current = max.load(std::memory_order_relaxed);
+        while (ns > current &&
+               !max.compare_exchange_weak(current, ns, std::memory_order_relaxed)) {
+        }
+    }
+    
+    uint64_t percentile(double fraction) const {
+        uint64_t total = count.load(std::memory_order_relaxed);
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t target = (uint64_t)(fraction * (double)total);
+        if (target == 0) {
+            target = 1;
+        }
+        uint64_t seen = 0;
+        for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= target) {
+                return i == LATENCY_HISTOGRAM_BUCKETS - 1 ? max.load(std::memory_order_relaxed)
+                                                            : bucketUpperBound(i);
+            }
+        }
+        return max.load(std::memory_order_relaxed);
+    }
+    
+    LatencySummary summarize() const {
+        LatencySummary summary;
+        summary.count = count.load(std::memory_order_relaxed);
+        summary.meanNs = summary.count ? sum.load(std::memory_order_relaxed) / summary.count : 0;
+        summary.p50Ns = percentile(0.50);
+        summary.p99Ns = percentile(0.99);
+        summary.p999Ns = percentile(0.999);
+        summary.maxNs = max.load(std::memory_order_relaxed);
+        return summary;
+    }
+};
+
+#endif
@@ -0,0 +1,214 @@
+// Library sets shared between processes running the same executable
+#include "LibrarySetCache.h"
+#include <string.h>
+#include <syslog.h>
+
+bool LibrarySetKey::operator==(const LibrarySetKey& other) const {
+    return kind == other.kind && memcmp(digest, other.digest, sizeof(digest)) == 0;
+}
+
+size_t LibrarySetKeyHash::operator()(const LibrarySetKey& key) const {
+    uint64_t hash = 0xcbf29ce484222325ull ^ key.kind;
+    for (size_t i = 0; i < sizeof(key.digest); i++) {
+        hash = (hash ^ key.digest[i]) * 0x100000001b3ull;
+    }
+    return (size_t)hash;
+}
+
+static uint64_t hashLibraryIds(const std::vector<uint32_t>& libraryIds) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint32_t id : libraryIds) {
+        hash = (hash ^ id) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+LibrarySetCache::LibrarySetCache(StringTable* strings, const PathClassifier* classifier)
+    : strings(strings), classifier(classifier), setCount(1), hits(0), misses(0), uncached(0) {
+    sets = new const LibrarySet*[LIBRARY_SET_MAX]();
+    pthread_rwlock_init(&lock, nullptr);
+}
+
+LibrarySetCache::~LibrarySetCache() {
+    uint32_t count = setCount.load(std::memory_order_relaxed);
+    for (uint32_t i = 1; i < count; i++) {
+        delete sets[i];
+    }
+    delete[] sets;
+    pthread_rwlock_destroy(&lock);
+}
+
+LibrarySetKey LibrarySetCache::cdhashKey(const uint8_t* cdhash) {
+    LibrarySetKey key;
+    key.kind = LIBRARY_KEY_CDHASH;
+    memcpy(key.digest, cdhash, sizeof(key.digest));
+    return key;
+}
+
+LibrarySetKey LibrarySetCache::fileKey(uint32_t pathId, int64_t mtime, uint64_t size) {
+    LibrarySetKey key;
+    key.kind = LIBRARY_KEY_FILE;
+    memcpy(key.digest, &pathId, 4);
+    memcpy(key.digest + 4, &mtime, 8);
+    memcpy(key.digest + 12, &size, 8);
+    return key;
+}
+
+uint32_t LibrarySetCache::keyPathId(const LibrarySetKey& key) {
+    uint32_t pathId = 0;
+    if (key.kind == LIBRARY_KEY_FILE) {
+        memcpy(&pathId, key.digest, 4);
+    }
+    return pathId;
+}
+
+LibrarySetKey LibrarySetCache::withPathId(const LibrarySetKey& key, uint32_t pathId) {
+    LibrarySetKey renamed = key;
+    if (renamed.kind == LIBRARY_KEY_FILE) {
+        memcpy(renamed.digest, &pathId, 4);
+    }
+    return renamed;
+}
+
+uint32_t LibrarySetCache::lookup(const LibrarySetKey& key, uint32_t imageCount) {
+    pthread_rwlock_rdlock(&lock);
+    auto it = keys.find(key);
+    // A different image count means the process dlopen'd something; read it again
+    uint32_t setId = it != keys.end() && it->second.imageCount == imageCount ? it->second.setId : 0;
+    pthread_rwlock_unlock(&lock);
+    
+    if (setId) {
+        hits.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        misses.fetch_add(1, std::memory_order_relaxed);
+    }
+    return setId;
+}
+
+uint32_t LibrarySetCache::insert(const LibrarySetKey& key, uint32_t imageCount,
+                                 const std::vector<uint32_t>& libraryIds) {
+    pthread_rwlock_wrlock(&lock);
+    uint32_t setId = internLocked(libraryIds);
+    if (setId) {
+        if (keys.size() >= LIBRARY_SET_MAX_KEYS && keys.find(key) == keys.end()) {
+            keys.clear();
+        }
+        keys[key] = {setId, imageCount};
+    }
+    pthread_rwlock_unlock(&lock);
+    return setId;
+}
+
+uint32_t LibrarySetCache::intern(const std::vector<uint32_t>& libraryIds) {
+    if (libraryIds.empty()) {
+        return 0;
+    }
+    pthread_rwlock_wrlock(&lock);
+    uint32_t setId = internLocked(libraryIds);
+    pthread_rwlock_unlock(&lock);
+    return setId;
+}
+
+uint32_t LibrarySetCache::internLocked(const std::vector<uint32_t>& libraryIds) {
+    uint64_t hash = hashLibraryIds(libraryIds);
+    
+    // Most launches of a binary load exactly the same images
+    std::vector<uint32_t>& candidates = setsByHash[hash];
+    for (uint32_t candidate : candidates) {
+        if (sets[candidate]->libraryIds == libraryIds) {
+            return candidate;
+        }
+    }
+    
+    uint32_t id = setCount.load(std::memory_order_relaxed);
+    if (id >= LIBRARY_SET_MAX) {
+        if (uncached.fetch_add(1, std::memory_order_relaxed) == 0) {
+            syslog(LOG_WARNING, "LibrarySetCache: limit of %u sets reached", LIBRARY_SET_MAX);
+        }
+        return 0;
+    }
+    
+    LibrarySet* set = new LibrarySet();
+    set->id = id;
+    set->hash = hash;
+    set->libraryIds = libraryIds;
+    set->rulesGeneration.store(classifier->generation(), std::memory_order_relaxed);
+    set->capabilities.store(capabilitiesOf(libraryIds), std::memory_order_relaxed);
+    sets[id] = set;
+    setCount.store(id + 1, std::memory_order_release);
+    candidates.push_back(id);
+    return id;
+}
+
+// The framework checks, done once per set instead of once per process
+uint32_t LibrarySetCache::capabilitiesOf(const std::vector<uint32_t>& libraryIds) const {
+    uint32_t capabilities = 0;
+    
+    for (uint32_t id : libraryIds) {
+        size_t length = 0;
+        const char* path = strings->data(id, &length);
+        capabilities |= classifier->classify(path, length) & LIBRARY_CAP_MASK;
+        if (capabilities == LIBRARY_CAP_MASK) {
+            break;
+        }
+    }
+    
+    return capabilities;
+}
+
+uint32_t LibrarySetCache::capabilities(uint32_t id) const {
+    const LibrarySet* set = get(id);
+    if (!set) {
+        return 0;
+    }
+    
+    // Rules were reloaded since this set was scanned; racing rescans agree on the result
+    uint32_t generation = classifier->generation();
+    if (set->rulesGeneration.load(std::memory_order_acquire) != generation) {
+        set->capabilities.store(capabilitiesOf(set->libraryIds), std::memory_order_relaxed);
+        set->rulesGeneration.store(generation, std::memory_order_release);
+    }
+    return set->capabilities.load(std::memory_order_relaxed);
+}
+
+const LibrarySet* LibrarySetCache::get(uint32_t id) const {
+    if (id == 0 || id >= setCount.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    return sets[id];
+}
+
+void LibrarySetCache::exportKeys(std::vector<LibrarySetKeyEntry>* entries) const {
+    pthread_rwlock_rdlock(&lock);
+    entries->reserve(entries->size() + keys.size());
+    for (const auto& key : keys) {
+        entries->push_back({key.first, key.second.setId, key.second.imageCount});
+    }
+    pthread_rwlock_unlock(&lock);
+}
+
+void LibrarySetCache::addStringRoots(std::vector<uint32_t>* roots) const {
+    pthread_rwlock_rdlock(&lock);
+    uint32_t count = setCount.load(std::memory_order_acquire);
+    for (uint32_t id = 1; id < count; id++) {
+        if (sets[id]) {
+            roots->insert(roots->end(), sets[id]->libraryIds.begin(), sets[id]->libraryIds.end());
+        }
+    }
+    for (const auto& key : keys) {
+        roots->push_back(keyPathId(key.first));
+    }
+    pthread_rwlock_unlock(&lock);
+}
+
+LibrarySetCacheStats LibrarySetCache::getStats() const {
+    LibrarySetCacheStats stats;
+    stats.sets = setCount.load(std::memory_order_relaxed) - 1;
+    pthread_rwlock_rdlock(&lock);
+    stats.keys = keys.size();
+    pthread_rwlock_unlock(&lock);
+    stats.hits = hits.load(std::memory_order_relaxed);
+    stats.misses = misses.load(std::memory_order_relaxed);
+    stats.uncached = uncached.load(std::memory_order_relaxed);
+    return stats;
+}
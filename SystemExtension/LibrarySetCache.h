@@ -0,0 +1,139 @@
+#ifndef LibrarySetCache_h
+#define LibrarySetCache_h
+
+#include <pthread.h>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include "StringTable.h"
+#include "PathClassifier.h"
+
+// Distinct library lists kept; past this new lists aren't cached (set ID 0)
+#ifndef LIBRARY_SET_MAX
+#define LIBRARY_SET_MAX 8192
+#endif
+
+// Executable identities remembered; the key index is cleared when it fills up
+#ifndef LIBRARY_SET_MAX_KEYS
+#define LIBRARY_SET_MAX_KEYS 16384
+#endif
+
+// Remote path strings closer together than this are fetched in one read
+#ifndef LIBRARY_PATH_CLUSTER_GAP
+#define LIBRARY_PATH_CLUSTER_GAP (64 * 1024)
+#endif
+
+// Largest single read of the remote path region
+#ifndef LIBRARY_PATH_READ_MAX
+#define LIBRARY_PATH_READ_MAX (1024 * 1024)
+#endif
+
+// Capabilities implied by the frameworks in a set
+#define LIBRARY_CAP_AUDIO    PATH_CLASS_AUDIO_LIBRARY
+#define LIBRARY_CAP_VIDEO    PATH_CLASS_VIDEO_LIBRARY
+#define LIBRARY_CAP_NETWORK  PATH_CLASS_NETWORK_LIBRARY
+#define LIBRARY_CAP_MASK     (LIBRARY_CAP_AUDIO | LIBRARY_CAP_VIDEO | LIBRARY_CAP_NETWORK)
+
+// What a library list is cached under: the cdhash when ES gave us one,
+// otherwise the executable path and its mtime and size
+struct LibrarySetKey {
+    uint8_t kind;               // LIBRARY_KEY_*
+    uint8_t digest[20];
+    
+    bool operator==(const LibrarySetKey& other) const;
+};
+
+#define LIBRARY_KEY_CDHASH 1
+#define LIBRARY_KEY_FILE   2
+
+struct LibrarySetKeyHash {
+    size_t operator()(const LibrarySetKey& key) const;
+};
+
+// Immutable once published, apart from the capability bits, which are
+// recomputed when the path rules change; referenced by ID from process records
+struct LibrarySet {
+    uint32_t id;
+    uint64_t hash;
+    std::vector<uint32_t> libraryIds;   // StringTable IDs, in dyld load order
+    mutable std::atomic<uint32_t> capabilities;         // LIBRARY_CAP_* bits
+    mutable std::atomic<uint32_t> rulesGeneration;      // classifier generation they came from
+};
+
+// A remembered key and the set it names
+struct LibrarySetKeyEntry {
+    LibrarySetKey key;
+    uint32_t setId;
+    uint32_t imageCount;
+};
+
+struct LibrarySetCacheStats {
+    uint64_t sets;
+    uint64_t keys;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t uncached;
+};
+
+// Deduplicated library sets shared by every process running the same image.
+// Lookups by set ID are lock-free; inserts take the write lock.
+class LibrarySetCache {
+public:
+    LibrarySetCache(StringTable* strings, const PathClassifier* classifier);
+    ~LibrarySetCache();
+    
+    static LibrarySetKey cdhashKey(const uint8_t* cdhash);
+    static LibrarySetKey fileKey(uint32_t pathId, int64_t mtime, uint64_t size);
+    // File keys hold a string ID, which means nothing to the next run; 0 for cdhash keys
+    static uint32_t keyPathId(const LibrarySetKey& key);
+    static LibrarySetKey withPathId(const LibrarySetKey& key, uint32_t pathId);
+    
+    // Set ID for a known image whose dyld list still has imageCount entries; 0 on a miss
+    uint32_t lookup(const LibrarySetKey& key, uint32_t imageCount);
+    
+    // Publishes a list (or finds an identical one) and remembers it under the key
+    uint32_t insert(const LibrarySetKey& key, uint32_t imageCount, const std::vector<uint32_t>& libraryIds);
+    
+    // Same, for lists that didn't come from a dyld read
+    uint32_t intern(const std::vector<uint32_t>& libraryIds);
+    
+    // nullptr for ID 0 or unknown IDs
+    const LibrarySet* get(uint32_t id) const;
+    
+    // LIBRARY_CAP_* bits for a set under the current path rules; 0 for ID 0
+    uint32_t capabilities(uint32_t id) const;
+    
+    // Every remembered key, for saving the cache across restarts
+    void exportKeys(std::vector<LibrarySetKeyEntry>* entries) const;
+    
+    // Every library path ID in a set and every path ID in a file key; sets
+    // live for the whole run, so their strings are never collected
+    void addStringRoots(std::vector<uint32_t>* roots) const;
+    
+    LibrarySetCacheStats getStats() const;
+
+private:
+    struct KeyEntry {
+        uint32_t setId;
+        uint32_t imageCount;
+    };
+    
+    StringTable* strings;
+    const PathClassifier* classifier;
+    const LibrarySet** sets;            // LIBRARY_SET_MAX slots, never reallocated
+    std::atomic<uint32_t> setCount;     // slot 0 unused
+    std::unordered_map<uint64_t, std::vector<uint32_t>> setsByHash;
+    std::unordered_map<LibrarySetKey, KeyEntry, LibrarySetKeyHash> keys;
+    
+    mutable pthread_rwlock_t lock;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> uncached;
+    
+    uint32_t internLocked(const std::vector<uint32_t>& libraryIds);
+    uint32_t capabilitiesOf(const std::vector<uint32_t>& libraryIds) const;
+};
+
+#endif
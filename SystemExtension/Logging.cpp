@@ -0,0 +1,108 @@
+// os_log categories, runtime levels and call-site rate limits
+#include "Logging.h"
+#include "LatencyHistogram.h"
+#include <pthread.h>
+#include <string.h>
+
+static const char* categoryNames[LOG_CATEGORY_COUNT] = {
+    "process", "file", "device", "xpc"
+};
+
+static const char* levelNames[LOG_LEVEL_COUNT] = {
+    "off", "error", "default", "info", "debug"
+};
+
+static const os_log_type_t levelTypes[LOG_LEVEL_COUNT] = {
+    OS_LOG_TYPE_DEFAULT, OS_LOG_TYPE_ERROR, OS_LOG_TYPE_DEFAULT, OS_LOG_TYPE_INFO, OS_LOG_TYPE_DEBUG
+};
+
+std::atomic<uint8_t> logLevels[LOG_CATEGORY_COUNT] = {
+    {LOG_DEFAULT_LEVEL}, {LOG_DEFAULT_LEVEL}, {LOG_DEFAULT_LEVEL}, {LOG_DEFAULT_LEVEL}
+};
+
+static std::atomic<uint64_t> categorySuppressed[LOG_CATEGORY_COUNT];
+
+static os_log_t categoryLogs[LOG_CATEGORY_COUNT];
+static pthread_once_t categoryLogsOnce = PTHREAD_ONCE_INIT;
+
+static void createCategoryLogs() {
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++) {
+        categoryLogs[i] = os_log_create(LOG_SUBSYSTEM, categoryNames[i]);
+        if (!categoryLogs[i]) {
+            categoryLogs[i] = OS_LOG_DISABLED;
+        }
+    }
+}
+
+os_log_t logHandle(LogCategory category) {
+    pthread_once(&categoryLogsOnce, createCategoryLogs);
+    return categoryLogs[category];
+}
+
+os_log_type_t logType(LogLevel level) {
+    return levelTypes[level];
+}
+
+const char* logLevelName(LogLevel level) {
+    return level < LOG_LEVEL_COUNT ? levelNames[level] : "unknown";
+}
+
+bool logAdmit(LogRateLimit* limit, LogCategory category, uint32_t* suppressed) {
+    uint64_t now = mach_absolute_time();
+    uint64_t start = limit->windowStart.load(std::memory_order_relaxed);
+    
+    // The caller that opens a new window reports what the last one held back
+    if (machToNanoseconds(now - start) >= (uint64_t)LOG_RATE_WINDOW_MS * 1000000ULL &&
+        limit->windowStart.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+        limit->logged.store(1, std::memory_order_relaxed);
+        *suppressed = limit->suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+    
+    *suppressed = 0;
+    if (limit->logged.fetch_add(1, std::memory_order_relaxed) < LOG_RATE_LIMIT) {
+        return true;
+    }
+    limit->suppressed.fetch_add(1, std::memory_order_relaxed);
+    categorySuppressed[category].fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool setLogLevel(const char* category, const char* level, std::string* error) {
+    int levelIndex = -1;
+    for (int i = 0; i < LOG_LEVEL_COUNT; i++) {
+        if (strcmp(level, levelNames[i]) == 0) {
+            levelIndex = i;
+        }
+    }
+    if (levelIndex < 0) {
+        *error = std::string("unknown log level ") + level;
+        return false;
+    }
+    
+    bool all = strcmp(category, "all") == 0;
+    bool matched = false;
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++) {
+        if (all || strcmp(category, categoryNames[i]) == 0) {
+            logLevels[i].store((uint8_t)levelIndex, std::memory_order_relaxed);
+            matched = true;
+        }
+    }
+    if (!matched) {
+        *error = std::string("unknown log category ") + category;
+        return false;
+    }
+    return true;
+}
+
+std::vector<LogCategoryStats> getLogStats() {
+    std::vector<LogCategoryStats> stats;
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++) {
+        LogCategoryStats entry;
+        entry.name = categoryNames[i];
+        entry.level = (LogLevel)logLevels[i].load(std::memory_order_relaxed);
+        entry.suppressed = categorySuppressed[i].load(std::memory_order_relaxed);
+        stats.push_back(entry);
+    }
+    return stats;
+}
@@ -0,0 +1,102 @@
+#ifndef Logging_h
+#define Logging_h
+
+#include <os/log.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Per-event logging on os_log. Format strings are literals, so a call copies
+// its arguments into the log buffer and formatting waits until someone reads
+// the log. Each category has a level settable at runtime over XPC; a call
+// below it costs one relaxed load. Each call site is rate limited too, and
+// the next message it lets through says how many it held back. Paths and
+// command lines are logged %{private}; pids, kinds and codes are public.
+
+#define LOG_SUBSYSTEM "com.example.AudioVideoMonitor.SystemExtension"
+
+// Messages one call site may log per window; the rest are counted
+#ifndef LOG_RATE_LIMIT
+#define LOG_RATE_LIMIT 20
+#endif
+
+#ifndef LOG_RATE_WINDOW_MS
+#define LOG_RATE_WINDOW_MS 1000
+#endif
+
+// Categories in the unified log; names are in Logging.cpp
+enum LogCategory : uint8_t {
+    LOG_CATEGORY_PROCESS,           // exec, exit, fork, signals, setuid
+    LOG_CATEGORY_FILE,              // opens, writes, deletes, mappings
+    LOG_CATEGORY_DEVICE,            // microphone and camera access
+    LOG_CATEGORY_XPC,               // commands from the app and the CLI
+    LOG_CATEGORY_COUNT
+};
+
+// A category logs messages at its level and every level before it
+enum LogLevel : uint8_t {
+    LOG_LEVEL_OFF,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_DEFAULT,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_COUNT
+};
+
+// What every category starts at; per-event messages are INFO and DEBUG
+#ifndef LOG_DEFAULT_LEVEL
+#define LOG_DEFAULT_LEVEL LOG_LEVEL_DEFAULT
+#endif
+
+struct LogCategoryStats {
+    const char* name;
+    LogLevel level;
+    uint64_t suppressed;            // by call-site rate limits
+};
+
+// One per call site. A zero-initialised static, so the first call runs no
+// constructor and takes no guard.
+struct LogRateLimit {
+    std::atomic<uint64_t> windowStart;  // mach time the window opened
+    std::atomic<uint32_t> logged;
+    std::atomic<uint32_t> suppressed;
+};
+
+extern std::atomic<uint8_t> logLevels[LOG_CATEGORY_COUNT];
+
+inline bool logEnabled(LogCategory category, LogLevel level) {
+    return level <= logLevels[category].load(std::memory_order_relaxed);
+}
+
+// OS_LOG_DISABLED if the category's log couldn't be created
+os_log_t logHandle(LogCategory category);
+os_log_type_t logType(LogLevel level);
+// True if the site may log now; *suppressed is how many it held back since it last did
+bool logAdmit(LogRateLimit* limit, LogCategory category, uint32_t* suppressed);
+
+// category is a name from getLogStats or "all"; level is off, error, default, info or debug
+bool setLogLevel(const char* category, const char* level, std::string* error);
+std::vector<LogCategoryStats> getLogStats();
+const char* logLevelName(LogLevel level);
+
+#define EXT_LOG(category, level, format, ...) do { \
+    if (logEnabled(category, level)) { \
+        static LogRateLimit extLogLimit; \
+        uint32_t extLogSuppressed; \
+        if (logAdmit(&extLogLimit, category, &extLogSuppressed)) { \
+            if (extLogSuppressed) { \
+                os_log_with_type(logHandle(category), logType(level), \
+                                 "%u more like the next were suppressed", extLogSuppressed); \
+            } \
+            os_log_with_type(logHandle(category), logType(level), format, ##__VA_ARGS__); \
+        } \
+    } \
+} while (0)
+
+#define EXT_LOG_ERROR(category, format, ...) EXT_LOG(category, LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#define EXT_LOG_DEFAULT(category, format, ...) EXT_LOG(category, LOG_LEVEL_DEFAULT, format, ##__VA_ARGS__)
+#define EXT_LOG_INFO(category, format, ...) EXT_LOG(category, LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define EXT_LOG_DEBUG(category, format, ...) EXT_LOG(category, LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,201 @@
+// Per-thread hot-path counters, latency histograms and signposts
+#include "Metrics.h"
+#include <pthread.h>
+
+static const char* callNames[METRIC_CALL_COUNT] = {
+    "task_info", "command_line", "descriptors", "libraries", "environment"
+};
+
+// Shard indexes are handed out once per thread, for every HotPathMetrics
+static std::atomic<uint32_t> nextShard(0);
+static thread_local uint32_t threadShard = UINT32_MAX;
+
+static const char* eventTypeName(uint32_t type) {
+    switch (type) {
+        case ES_EVENT_TYPE_AUTH_EXEC: return "auth_exec";
+        case ES_EVENT_TYPE_AUTH_OPEN: return "auth_open";
+        case ES_EVENT_TYPE_AUTH_UNLINK: return "auth_unlink";
+        case ES_EVENT_TYPE_NOTIFY_CLOSE: return "close";
+        case ES_EVENT_TYPE_NOTIFY_COPYFILE: return "copyfile";
+        case ES_EVENT_TYPE_NOTIFY_CREATE: return "create";
+        case ES_EVENT_TYPE_NOTIFY_EXEC: return "exec";
+        case ES_EVENT_TYPE_NOTIFY_EXIT: return "exit";
+        case ES_EVENT_TYPE_NOTIFY_FORK: return "fork";
+        case ES_EVENT_TYPE_NOTIFY_IOKIT_OPEN: return "iokit_open";
+        case ES_EVENT_TYPE_NOTIFY_KEXTLOAD: return "kextload";
+        case ES_EVENT_TYPE_NOTIFY_MMAP: return "mmap";
+        case ES_EVENT_TYPE_NOTIFY_MPROTECT: return "mprotect";
+        case ES_EVENT_TYPE_NOTIFY_OPEN: return "open";
+        case ES_EVENT_TYPE_NOTIFY_RENAME: return "rename";
+        case ES_EVENT_TYPE_NOTIFY_SETGID: return "setgid";
+        case ES_EVENT_TYPE_NOTIFY_SETUID: return "setuid";
+        case ES_EVENT_TYPE_NOTIFY_SIGNAL: return "signal";
+        case ES_EVENT_TYPE_NOTIFY_TRUNCATE: return "truncate";
+        case ES_EVENT_TYPE_NOTIFY_UNLINK: return "unlink";
+        case ES_EVENT_TYPE_NOTIFY_WRITE: return "write";
+        default: return nullptr;
+    }
+}
+
+HotPathMetrics::HotPathMetrics() {
+    for (int i = 0; i < METRICS_MAX_SHARDS; i++) {
+        for (int type = 0; type < ES_EVENT_TYPE_LAST; type++) {
+            shards[i].received[type].store(0, std::memory_order_relaxed);
+        }
+        for (int call = 0; call < METRIC_CALL_COUNT; call++) {
+            shards[i].callFailures[call].store(0, std::memory_order_relaxed);
+        }
+    }
+    for (int type = 0; type < ES_EVENT_TYPE_LAST; type++) {
+        handlerLatency[type].store(nullptr, std::memory_order_relaxed);
+        nextSequence[type].store(0, std::memory_order_relaxed);
+        kernelDropped[type].store(0, std::memory_order_relaxed);
+    }
+}
+
+HotPathMetrics::~HotPathMetrics() {
+    for (int type = 0; type < ES_EVENT_TYPE_LAST; type++) {
+        delete handlerLatency[type].load(std::memory_order_relaxed);
+    }
+}
+
+HotPathMetrics::Shard& HotPathMetrics::shard() {
+    if (threadShard == UINT32_MAX) {
+        uint32_t index = nextShard.fetch_add(1, std::memory_order_relaxed);
+        threadShard = index < METRICS_MAX_SHARDS ? index : METRICS_MAX_SHARDS - 1;
+    }
+    return shards[threadShard];
+}
+
+void HotPathMetrics::eventReceived(const es_message_t* message) {
+    uint32_t type = message->event_type;
+    if (type >= ES_EVENT_TYPE_LAST) {
+        return;
+    }
+    shard().received[type].fetch_add(1, std::memory_order_relaxed);
+    
+    // seq_num is consecutive per client and type unless the kernel dropped some
+    if (message->version >= 2) {
+        uint64_t expected = nextSequence[type].load(std::memory_order_relaxed);
+        if (expected != 0 && message->seq_num > expected) {
+            kernelDropped[type].fetch_add(message->seq_num - expected, std::memory_order_relaxed);
+        }
+        nextSequence[type].store(message->seq_num + 1, std::memory_order_relaxed);
+    }
+}
+
+void HotPathMetrics::eventHandled(es_event_type_t type, uint64_t ns) {
+    if ((uint32_t)type >= ES_EVENT_TYPE_LAST) {
+        return;
+    }
+    LatencyHistogram* histogram = handlerLatency[type].load(std::memory_order_acquire);
+    if (!histogram) {
+        // Two workers may race to create it; the loser frees its copy
+        LatencyHistogram* created = new LatencyHistogram();
+        if (handlerLatency[type].compare_exchange_strong(histogram, created, std::memory_order_acq_rel)) {
+            histogram = created;
+        } else {
+            delete created;
+        }
+    }
+    histogram->record(ns);
+}
+
+void HotPathMetrics::callCompleted(MetricCall call, uint64_t ns, bool succeeded) {
+    callLatency[call].record(ns);
+    if (!succeeded) {
+        shard().callFailures[call].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+MetricsSnapshot HotPathMetrics::snapshot() const {
+    MetricsSnapshot snapshot;
+    snapshot.received = 0;
+    snapshot.kernelDropped = 0;
+    uint32_t shardsInUse = nextShard.load(std::memory_order_relaxed);
+    snapshot.shardsInUse = shardsInUse < METRICS_MAX_SHARDS ? shardsInUse : METRICS_MAX_SHARDS;
+    
+    for (uint32_t type = 0; type < ES_EVENT_TYPE_LAST; type++) {
+        EventTypeMetrics entry;
+        entry.eventType = type;
+        entry.name = eventTypeName(type);
+        entry.received = 0;
+        for (int i = 0; i < METRICS_MAX_SHARDS; i++) {
+            entry.received += shards[i].received[type].load(std::memory_order_relaxed);
+        }
+        entry.kernelDropped = kernelDropped[type].load(std::memory_order_relaxed);
+        LatencyHistogram* histogram = handlerLatency[type].load(std::memory_order_acquire);
+        if (entry.received == 0 && !histogram) {
+            continue;
+        }
+        entry.handler = histogram ? histogram->summarize() : LatencySummary();
+        snapshot.received += entry.received;
+        snapshot.kernelDropped += entry.kernelDropped;
+        snapshot.events.push_back(entry);
+    }
+    
+    for (int call = 0; call < METRIC_CALL_COUNT; call++) {
+        CallMetrics entry;
+        entry.name = callNames[call];
+        entry.failures = 0;
+        for (int i = 0; i < METRICS_MAX_SHARDS; i++) {
+            entry.failures += shards[i].callFailures[call].load(std::memory_order_relaxed);
+        }
+        entry.latency = callLatency[call].summarize();
+        snapshot.calls.push_back(entry);
+    }
+    return snapshot;
+}
+
+static os_log_t signpostLog = nullptr;
+static pthread_once_t signpostLogOnce = PTHREAD_ONCE_INIT;
+
+static void createSignpostLog() {
+    signpostLog = os_log_create(METRICS_LOG_SUBSYSTEM, METRICS_LOG_CATEGORY);
+    if (!signpostLog) {
+        signpostLog = OS_LOG_DISABLED;
+    }
+}
+
+os_log_t metricsLog() {
+    pthread_once(&signpostLogOnce, createSignpostLog);
+    return signpostLog;
+}
+
+// os_signpost needs the interval names as literals, hence one case per kind
+void metricsIntervalBegin(MetricInterval interval, os_signpost_id_t id, uint64_t argument) {
+    os_log_t log = metricsLog();
+    switch (interval) {
+        case METRIC_INTERVAL_EVENT:
+            os_signpost_interval_begin(log, id, "ESEvent", "type %llu", argument);
+            break;
+        case METRIC_INTERVAL_ENRICHMENT:
+            os_signpost_interval_begin(log, id, "Enrichment", "tier %llu", argument);
+            break;
+        case METRIC_INTERVAL_CALL:
+            os_signpost_interval_begin(log, id, "ProcessCall", "%{public}s",
+                                       argument < METRIC_CALL_COUNT ? callNames[argument] : "unknown");
+            break;
+        case METRIC_INTERVAL_DB_COMMIT:
+            os_signpost_interval_begin(log, id, "DBCommit", "%llu rows", argument);
+            break;
+    }
+}
+
+void metricsIntervalEnd(MetricInterval interval, os_signpost_id_t id) {
+    os_log_t log = metricsLog();
+    switch (interval) {
+        case METRIC_INTERVAL_EVENT:
+            os_signpost_interval_end(log, id, "ESEvent");
+            break;
+        case METRIC_INTERVAL_ENRICHMENT:
+            os_signpost_interval_end(log, id, "Enrichment");
+            break;
+        case METRIC_INTERVAL_CALL:
+            os_signpost_interval_end(log, id, "ProcessCall");
+            break;
+        case METRIC_INTERVAL_DB_COMMIT:
+            os_signpost_interval_end(log, id, "DBCommit");
+            break;
+    }
+}
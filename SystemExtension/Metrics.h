@@ -0,0 +1,144 @@
+#ifndef Metrics_h
+#define Metrics_h
+
+#include <EndpointSecurity/EndpointSecurity.h>
+#include <os/log.h>
+#include <os/signpost.h>
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include "LatencyHistogram.h"
+#include "Logging.h"
+
+// Hot-path counters and latency histograms, read by the get_metrics command.
+// Counters live in per-thread shards, so recording is an uncontended relaxed
+// add on a cache line no other thread writes; reads sum the shards. Every
+// timed scope is also an os_signpost interval, so Instruments' os_signpost
+// instrument shows the same spans on a production build.
+
+// Threads past this many share the last shard; its counts stay exact, they
+// just contend. ES callback threads come from a dispatch pool and may change.
+#ifndef METRICS_MAX_SHARDS
+#define METRICS_MAX_SHARDS 32
+#endif
+
+// Subsystem and category the signposts are logged under
+#define METRICS_LOG_SUBSYSTEM LOG_SUBSYSTEM
+#define METRICS_LOG_CATEGORY "HotPath"
+
+// Calls that ask the kernel about a process, timed wherever they're made
+enum MetricCall {
+    METRIC_CALL_TASK_INFO,          // proc_pidinfo task and BSD info
+    METRIC_CALL_COMMAND_LINE,       // getProcessCommandLine
+    METRIC_CALL_DESCRIPTORS,        // fd and socket snapshot
+    METRIC_CALL_LIBRARIES,          // getProcessLibrarySet (dyld image list)
+    METRIC_CALL_ENVIRONMENT,        // getProcessEnvironment
+    METRIC_CALL_COUNT
+};
+
+// Spans marked with os_signpost; names in Instruments are in Metrics.cpp
+enum MetricInterval {
+    METRIC_INTERVAL_EVENT,          // one ES message in a pipeline worker
+    METRIC_INTERVAL_ENRICHMENT,     // one tier 1/2 enrichment task
+    METRIC_INTERVAL_CALL,           // one MetricCall
+    METRIC_INTERVAL_DB_COMMIT       // one database writer transaction
+};
+
+struct EventTypeMetrics {
+    uint32_t eventType;
+    const char* name;               // null for types the extension doesn't name
+    uint64_t received;              // by the ES callback
+    uint64_t kernelDropped;         // gaps in the message seq_num
+    LatencySummary handler;         // dispatchEvent on a worker
+};
+
+struct CallMetrics {
+    const char* name;
+    uint64_t failures;
+    LatencySummary latency;
+};
+
+struct MetricsSnapshot {
+    std::vector<EventTypeMetrics> events;   // types seen so far
+    std::vector<CallMetrics> calls;
+    uint64_t received;
+    uint64_t kernelDropped;
+    uint32_t shardsInUse;
+};
+
+class HotPathMetrics {
+public:
+    HotPathMetrics();
+    ~HotPathMetrics();
+    
+    // On the ES callback queue: counts the message and any messages the
+    // kernel dropped before it (seq_num counts per event type, version 2+)
+    void eventReceived(const es_message_t* message);
+    void eventHandled(es_event_type_t type, uint64_t ns);
+    void callCompleted(MetricCall call, uint64_t ns, bool succeeded);
+    
+    MetricsSnapshot snapshot() const;
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> received[ES_EVENT_TYPE_LAST];
+        std::atomic<uint64_t> callFailures[METRIC_CALL_COUNT];
+    };
+    
+    Shard shards[METRICS_MAX_SHARDS];
+    // Allocated the first time a type is handled, so unsubscribed types cost nothing
+    std::atomic<LatencyHistogram*> handlerLatency[ES_EVENT_TYPE_LAST];
+    LatencyHistogram callLatency[METRIC_CALL_COUNT];
+    // seq_num expected next per type, 0 before the first; written only by the
+    // callback queue that delivers the type
+    std::atomic<uint64_t> nextSequence[ES_EVENT_TYPE_LAST];
+    std::atomic<uint64_t> kernelDropped[ES_EVENT_TYPE_LAST];
+    
+    Shard& shard();
+};
+
+// The log signposts go to; OS_LOG_DISABLED if it couldn't be created
+os_log_t metricsLog();
+void metricsIntervalBegin(MetricInterval interval, os_signpost_id_t id, uint64_t argument);
+void metricsIntervalEnd(MetricInterval interval, os_signpost_id_t id);
+
+// Marks a scope as a signpost interval; nearly free while nothing records
+class MetricsInterval {
+public:
+    MetricsInterval(MetricInterval interval, uint64_t argument) : kind(interval), id(OS_SIGNPOST_ID_NULL) {
+        if (os_signpost_enabled(metricsLog())) {
+            id = os_signpost_id_make_with_pointer(metricsLog(), this);
+            metricsIntervalBegin(kind, id, argument);
+        }
+    }
+    ~MetricsInterval() {
+        if (id != OS_SIGNPOST_ID_NULL) {
+            metricsIntervalEnd(kind, id);
+        }
+    }
+
+private:
+    MetricInterval kind;
+    os_signpost_id_t id;
+};
+
+// Times one MetricCall into its histogram, as a signpost interval too
+class MetricsCallTimer {
+public:
+    MetricsCallTimer(HotPathMetrics& metrics, MetricCall call)
+        : metrics(metrics), call(call), succeeded(true), interval(METRIC_INTERVAL_CALL, call),
+          started(mach_absolute_time()) {}
+    ~MetricsCallTimer() {
+        metrics.callCompleted(call, machToNanoseconds(mach_absolute_time() - started), succeeded);
+    }
+    void failed() { succeeded = false; }
+
+private:
+    HotPathMetrics& metrics;
+    MetricCall call;
+    bool succeeded;
+    MetricsInterval interval;
+    uint64_t started;
+};
+
+#endif
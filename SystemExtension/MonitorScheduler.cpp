@@ -0,0 +1,115 @@
+// Dispatch timer scheduling for the periodic monitors
+#include "MonitorScheduler.h"
+#include "LatencyHistogram.h"
+#include <syslog.h>
+
+MonitorScheduler::MonitorScheduler() : stopping(false) {
+    pthread_mutex_init(&mutex, nullptr);
+}
+
+MonitorScheduler::~MonitorScheduler() {
+    stop();
+    pthread_mutex_destroy(&mutex);
+}
+
+bool MonitorScheduler::addTask(const char* name, dispatch_qos_class_t qos, uint32_t initialDelayMs,
+                               MonitorTaskFunction function, void* context) {
+    dispatch_queue_attr_t attributes = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, qos, 0);
+    dispatch_queue_t queue = dispatch_queue_create(name, attributes);
+    if (!queue) {
+        syslog(LOG_ERR, "MonitorScheduler: could not create a queue for %s", name);
+        return false;
+    }
+    dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+    if (!timer) {
+        syslog(LOG_ERR, "MonitorScheduler: could not create a timer for %s", name);
+        dispatch_release(queue);
+        return false;
+    }
+    
+    Task* task = new Task();
+    task->scheduler = this;
+    task->name = name;
+    task->queue = queue;
+    task->timer = timer;
+    task->function = function;
+    task->context = context;
+    task->runs.store(0, std::memory_order_relaxed);
+    task->totalRunNs.store(0, std::memory_order_relaxed);
+    task->lastRunNs.store(0, std::memory_order_relaxed);
+    task->intervalMs.store(initialDelayMs, std::memory_order_relaxed);
+    
+    dispatch_set_context(timer, task);
+    dispatch_source_set_event_handler_f(timer, fire);
+    arm(task, initialDelayMs);
+    
+    pthread_mutex_lock(&mutex);
+    stopping.store(false, std::memory_order_relaxed);
+    tasks.push_back(task);
+    pthread_mutex_unlock(&mutex);
+    
+    dispatch_resume(timer);
+    return true;
+}
+
+// One-shot: fire() re-arms it with whatever interval the task asks for next
+void MonitorScheduler::arm(Task* task, uint32_t delayMs) {
+    uint64_t intervalNs = (uint64_t)delayMs * NSEC_PER_MSEC;
+    dispatch_source_set_timer(task->timer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)intervalNs),
+                              DISPATCH_TIME_FOREVER, intervalNs * MONITOR_TIMER_LEEWAY_PERCENT / 100);
+}
+
+void MonitorScheduler::fire(void* context) {
+    Task* task = (Task*)context;
+    if (task->scheduler->stopping.load(std::memory_order_relaxed)) {
+        return;
+    }
+    
+    uint64_t started = mach_absolute_time();
+    uint32_t nextMs = task->function(task->context);
+    uint64_t elapsed = machToNanoseconds(mach_absolute_time() - started);
+    
+    task->runs.fetch_add(1, std::memory_order_relaxed);
+    task->totalRunNs.fetch_add(elapsed, std::memory_order_relaxed);
+    task->lastRunNs.store(elapsed, std::memory_order_relaxed);
+    task->intervalMs.store(nextMs, std::memory_order_relaxed);
+    
+    // Re-arming a cancelled source is harmless; it just never fires again
+    arm(task, nextMs ? nextMs : 1);
+}
+
+void MonitorScheduler::drained(void* context) {
+}
+
+void MonitorScheduler::stop() {
+    pthread_mutex_lock(&mutex);
+    stopping.store(true, std::memory_order_relaxed);
+    std::vector<Task*> stopped;
+    stopped.swap(tasks);
+    pthread_mutex_unlock(&mutex);
+    
+    for (Task* task : stopped) {
+        dispatch_source_cancel(task->timer);
+        // Anything still running finishes before the empty block behind it
+        dispatch_sync_f(task->queue, nullptr, drained);
+        dispatch_release(task->timer);
+        dispatch_release(task->queue);
+        delete task;
+    }
+}
+
+std::vector<MonitorTaskStats> MonitorScheduler::getStats() const {
+    std::vector<MonitorTaskStats> stats;
+    pthread_mutex_lock(&mutex);
+    for (const Task* task : tasks) {
+        MonitorTaskStats entry;
+        entry.name = task->name;
+        entry.runs = task->runs.load(std::memory_order_relaxed);
+        entry.totalRunNs = task->totalRunNs.load(std::memory_order_relaxed);
+        entry.lastRunNs = task->lastRunNs.load(std::memory_order_relaxed);
+        entry.intervalMs = task->intervalMs.load(std::memory_order_relaxed);
+        stats.push_back(entry);
+    }
+    pthread_mutex_unlock(&mutex);
+    return stats;
+}
@@ -0,0 +1,69 @@
+#ifndef MonitorScheduler_h
+#define MonitorScheduler_h
+
+#include <dispatch/dispatch.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Periodic background work on dispatch timer sources instead of sleeping
+// threads. Each task runs on its own serial queue at its own QoS class and
+// says when it next wants to run; the timer is re-armed for that, with a
+// leeway so the kernel can coalesce wakeups with other timers on the system.
+// Stopping cancels the timers and waits only for a run already in progress.
+
+// Leeway as a percentage of each task's interval
+#ifndef MONITOR_TIMER_LEEWAY_PERCENT
+#define MONITOR_TIMER_LEEWAY_PERCENT 20
+#endif
+
+// Returns how long to wait before the next run, in milliseconds
+typedef uint32_t (*MonitorTaskFunction)(void* context);
+
+struct MonitorTaskStats {
+    const char* name;
+    uint64_t runs;
+    uint64_t totalRunNs;
+    uint64_t lastRunNs;
+    uint32_t intervalMs;            // the wait the task asked for last
+};
+
+class MonitorScheduler {
+public:
+    MonitorScheduler();
+    ~MonitorScheduler();
+    
+    // The first run is after initialDelayMs; false if the source couldn't be made
+    bool addTask(const char* name, dispatch_qos_class_t qos, uint32_t initialDelayMs,
+                 MonitorTaskFunction function, void* context);
+    // Returns once no task is running or will run again
+    void stop();
+    
+    std::vector<MonitorTaskStats> getStats() const;
+
+private:
+    struct Task {
+        MonitorScheduler* scheduler;
+        const char* name;
+        dispatch_queue_t queue;
+        dispatch_source_t timer;
+        MonitorTaskFunction function;
+        void* context;
+        std::atomic<uint64_t> runs;
+        std::atomic<uint64_t> totalRunNs;
+        std::atomic<uint64_t> lastRunNs;
+        std::atomic<uint32_t> intervalMs;
+    };
+    
+    mutable pthread_mutex_t mutex;  // guards tasks
+    std::vector<Task*> tasks;
+    std::atomic<bool> stopping;
+    
+    static void arm(Task* task, uint32_t delayMs);
+    static void fire(void* context);
+    static void drained(void* context);
+};
+
+#endif
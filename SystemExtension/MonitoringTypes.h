@@ -0,0 +1,108 @@
+#ifndef MonitoringTypes_h
+#define MonitoringTypes_h
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <utility>
+#include <memory>
+
+// Comprehensive process information structure
+struct ProcessInfo {
+    pid_t pid;
+    pid_t ppid;
+    std::string executablePath;
+    std::string commandLine;
+    std::string bundleIdentifier;
+    uid_t uid;
+    gid_t gid;
+    uint64_t startTime;
+    uint64_t cpuTime;
+    uint64_t memoryUsage;
+    std::vector<std::string> openFiles;
+    std::vector<std::string> networkConnections;
+    std::vector<std::string> loadedLibraries;
+    uint32_t librarySetId;          // LibrarySetCache ID behind loadedLibraries; 0 if none
+    std::map<std::string, std::string> environmentVariables;
+    bool isSystemProcess;
+    bool hasAudioAccess;
+    bool hasVideoAccess;
+    bool hasNetworkAccess;
+    bool hasFileSystemAccess;
+    uint8_t enrichmentTier;         // 0 = ES message only, 1 = task info, 2 = fds/libraries/env
+};
+
+// Network connection information
+struct NetworkConnection {
+    std::string protocol;
+    std::string localAddress;
+    int localPort;
+    std::string remoteAddress;
+    int remotePort;
+    std::string state;
+    pid_t pid;
+    uint64_t timestamp;
+};
+
+// File access information
+struct FileAccess {
+    pid_t pid;
+    std::string filePath;
+    std::string accessType;
+    uint64_t timestamp;
+    bool wasBlocked;
+    std::string reason;
+    uint32_t count;             // accesses this entry stands for; more than 1 when coalesced
+    uint64_t lastSeen;
+};
+
+// Interned forms kept in hot in-memory structures and queued for the database.
+// String fields are StringTable IDs (0 = empty).
+
+// Tier 2 results: large, rarely read, and never changed once built, so every
+// version of a record (and a forked child) shares one copy. Socket entries and
+// environment values are nearly all distinct (ports, tokens), so they are kept
+// as text instead of filling the string table.
+struct ProcessDetails {
+    std::vector<uint32_t> openFileIds;
+    std::vector<std::string> networkConnections;
+    std::vector<std::pair<uint32_t, std::string>> environment;     // name ID, value
+};
+
+struct ProcessRecord {
+    pid_t pid;
+    pid_t ppid;
+    uint32_t pidVersion;            // from the audit token; 0 if unknown
+    uint32_t executablePathId;
+    uint32_t commandLineId;
+    uint32_t bundleIdentifierId;
+    uid_t uid;
+    gid_t gid;
+    uint64_t startTime;
+    uint64_t kernelStartUsec;       // process start as the kernel reports it; 0 if unknown
+    uint64_t cpuTime;
+    uint64_t memoryUsage;
+    uint32_t librarySetId;          // shared, immutable LibrarySet; 0 if none
+    std::shared_ptr<const ProcessDetails> details;  // null until tier 2
+    bool isSystemProcess;
+    bool hasAudioAccess;
+    bool hasVideoAccess;
+    bool hasNetworkAccess;
+    bool hasFileSystemAccess;
+    uint8_t enrichmentTier;
+};
+
+struct FileAccessRecord {
+    uint64_t timestamp;         // first access
+    pid_t pid;
+    uint32_t pathId;
+    uint32_t accessTypeId;
+    uint32_t reasonId;
+    bool wasBlocked;
+    uint32_t count;             // accesses coalesced into this record
+    uint64_t lastSeen;          // last access; equals timestamp when count is 1
+};
+
+#endif
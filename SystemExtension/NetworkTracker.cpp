@@ -0,0 +1,169 @@
+// Incremental network connection sampling
+#include "NetworkTracker.h"
+#include "LatencyHistogram.h"
+#include <libproc.h>
+#include <mach/mach_time.h>
+#include <errno.h>
+#include <syslog.h>
+
+// Indexed by TSI_S_*, the order the kernel numbers TCP states in
+static const char* tcpStateNames[] = {
+    "CLOSED", "LISTEN", "SYN_SENT", "SYN_RECEIVED", "ESTABLISHED", "CLOSE_WAIT",
+    "FIN_WAIT_1", "CLOSING", "LAST_ACK", "FIN_WAIT_2", "TIME_WAIT"
+};
+
+const char* connectionStateName(int32_t tcpState) {
+    if (tcpState < 0) {
+        return "OPEN";
+    }
+    if ((size_t)tcpState < sizeof(tcpStateNames) / sizeof(tcpStateNames[0])) {
+        return tcpStateNames[tcpState];
+    }
+    return "UNKNOWN";
+}
+
+NetworkTracker::NetworkTracker()
+    : interval(NETWORK_SAMPLE_INITIAL_MS), samples(0), connections(0), opened(0), closed(0),
+      stateChanges(0), lastSampleNs(0) {
+}
+
+// FNV-1a over the fields, so padding never reaches the hash
+size_t NetworkTracker::ConnectionKeyHash::operator()(const ConnectionKey& key) const {
+    uint64_t hash = 1469598103934665603ull;
+    auto mix = [&hash](const void* data, size_t length) {
+        const uint8_t* bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < length; i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    };
+    mix(&key.pid, sizeof(key.pid));
+    mix(&key.fd, sizeof(key.fd));
+    mix(&key.protocol, sizeof(key.protocol));
+    mix(&key.localPort, sizeof(key.localPort));
+    mix(&key.remotePort, sizeof(key.remotePort));
+    mix(key.localAddress, sizeof(key.localAddress));
+    mix(key.remoteAddress, sizeof(key.remoteAddress));
+    return (size_t)hash;
+}
+
+NetworkTracker::ConnectionKey NetworkTracker::keyFor(pid_t pid, const FdSocketEntry& socket) {
+    ConnectionKey key;
+    key.pid = pid;
+    key.fd = socket.fd;
+    key.protocol = socket.protocol;
+    key.localPort = socket.localPort;
+    key.remotePort = socket.remotePort;
+    memcpy(key.localAddress, socket.localAddress, sizeof(key.localAddress));
+    memcpy(key.remoteAddress, socket.remoteAddress, sizeof(key.remoteAddress));
+    return key;
+}
+
+// Fills the reused pid buffer, growing it only when the kernel filled it completely
+bool NetworkTracker::listProcesses(size_t* count) {
+    if (pids.empty()) {
+        pids.resize(1024);
+    }
+    
+    for (int attempt = 0; attempt < 4; attempt++) {
+        int capacity = (int)(pids.size() * sizeof(pid_t));
+        int listed = proc_listallpids(pids.data(), capacity);
+        if (listed < 0) {
+            break;
+        }
+        if ((size_t)listed < pids.size()) {
+            *count = (size_t)listed;
+            return true;
+        }
+        pids.resize(pids.size() * 2);
+    }
+    
+    syslog(LOG_ERR, "NetworkTracker: cannot list processes: %d", errno);
+    return false;
+}
+
+bool NetworkTracker::sample() {
+    uint64_t started = mach_absolute_time();
+    size_t count = 0;
+    if (!listProcesses(&count)) {
+        return false;
+    }
+    
+    // One PROC_PIDLISTFDS per process plus one PROC_PIDFDSOCKETINFO per socket
+    current.clear();
+    for (size_t i = 0; i < count; i++) {
+        pid_t pid = pids[i];
+        if (pid <= 0 || !snapshot.capture(pid, false)) {
+            continue;
+        }
+        for (const FdSocketEntry& socket : snapshot.sockets()) {
+            current.insert(std::make_pair(keyFor(pid, socket), socket));
+        }
+    }
+    
+    // New keys opened; whatever is left of the previous sample afterwards closed
+    changeSet.clear();
+    for (const auto& entry : current) {
+        auto before = previous.find(entry.first);
+        if (before == previous.end()) {
+            changeSet.push_back({CONNECTION_OPENED, entry.first.pid, entry.second});
+            continue;
+        }
+        if (before->second.tcpState != entry.second.tcpState) {
+            changeSet.push_back({CONNECTION_STATE_CHANGED, entry.first.pid, entry.second});
+        }
+        previous.erase(before);
+    }
+    for (const auto& entry : previous) {
+        changeSet.push_back({CONNECTION_CLOSED, entry.first.pid, entry.second});
+    }
+    
+    // The first sample is the baseline; it says nothing about churn
+    bool first = samples.load(std::memory_order_relaxed) == 0;
+    for (const ConnectionChange& change : changeSet) {
+        if (change.kind == CONNECTION_OPENED) {
+            opened.fetch_add(1, std::memory_order_relaxed);
+        } else if (change.kind == CONNECTION_CLOSED) {
+            closed.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            stateChanges.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    if (!first) {
+        adapt();
+    }
+    
+    previous.swap(current);
+    connections.store(previous.size(), std::memory_order_relaxed);
+    samples.fetch_add(1, std::memory_order_relaxed);
+    lastSampleNs.store(machToNanoseconds(mach_absolute_time() - started), std::memory_order_relaxed);
+    return true;
+}
+
+// Halve the wait while connections churn, double it while nothing changes
+void NetworkTracker::adapt() {
+    uint32_t next = interval.load(std::memory_order_relaxed);
+    if (changeSet.size() >= NETWORK_CHURN_FAST) {
+        next /= 2;
+    } else if (changeSet.empty()) {
+        next *= 2;
+    }
+    if (next < NETWORK_SAMPLE_MIN_MS) {
+        next = NETWORK_SAMPLE_MIN_MS;
+    }
+    if (next > NETWORK_SAMPLE_MAX_MS) {
+        next = NETWORK_SAMPLE_MAX_MS;
+    }
+    interval.store(next, std::memory_order_relaxed);
+}
+
+NetworkSamplerStats NetworkTracker::getStats() const {
+    NetworkSamplerStats stats;
+    stats.samples = samples.load(std::memory_order_relaxed);
+    stats.connections = connections.load(std::memory_order_relaxed);
+    stats.opened = opened.load(std::memory_order_relaxed);
+    stats.closed = closed.load(std::memory_order_relaxed);
+    stats.stateChanges = stateChanges.load(std::memory_order_relaxed);
+    stats.intervalMs = interval.load(std::memory_order_relaxed);
+    stats.lastSampleNs = lastSampleNs.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,114 @@
+#ifndef NetworkTracker_h
+#define NetworkTracker_h
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+#include "ProcessFds.h"
+
+// Sampling interval bounds; quiet networks drift toward the maximum, churning
+// ones toward the minimum
+#ifndef NETWORK_SAMPLE_MIN_MS
+#define NETWORK_SAMPLE_MIN_MS 1000
+#endif
+
+#ifndef NETWORK_SAMPLE_MAX_MS
+#define NETWORK_SAMPLE_MAX_MS 30000
+#endif
+
+#ifndef NETWORK_SAMPLE_INITIAL_MS
+#define NETWORK_SAMPLE_INITIAL_MS 10000
+#endif
+
+// Changes in one sample at or above which the next one comes twice as soon
+#ifndef NETWORK_CHURN_FAST
+#define NETWORK_CHURN_FAST 8
+#endif
+
+enum ConnectionChangeKind : uint8_t {
+    CONNECTION_OPENED,
+    CONNECTION_CLOSED,
+    CONNECTION_STATE_CHANGED
+};
+
+struct ConnectionChange {
+    ConnectionChangeKind kind;
+    pid_t pid;
+    FdSocketEntry socket;       // as last seen; the old entry for CLOSED
+};
+
+struct NetworkSamplerStats {
+    uint64_t samples;
+    uint64_t connections;       // in the latest sample
+    uint64_t opened;
+    uint64_t closed;
+    uint64_t stateChanges;
+    uint64_t intervalMs;        // until the next sample
+    uint64_t lastSampleNs;      // how long the latest sample took
+};
+
+// Samples every process's IPv4/IPv6 sockets and diffs them against the
+// previous sample, so only opens, closes and TCP state changes need logging.
+// Not thread-safe; one sampler thread owns it. Stats may be read from anywhere.
+class NetworkTracker {
+public:
+    NetworkTracker();
+    
+    // Refreshes changes(); false if the process list couldn't be read
+    bool sample();
+    
+    const std::vector<ConnectionChange>& changes() const { return changeSet; }
+    uint32_t intervalMs() const { return interval.load(std::memory_order_relaxed); }
+    NetworkSamplerStats getStats() const;
+
+private:
+    // A socket of a process; the fd keeps unconnected sockets on the same port apart
+    struct ConnectionKey {
+        pid_t pid;
+        int32_t fd;
+        uint8_t protocol;
+        uint16_t localPort;
+        uint16_t remotePort;
+        uint8_t localAddress[16];
+        uint8_t remoteAddress[16];
+        
+        bool operator==(const ConnectionKey& other) const {
+            return pid == other.pid && fd == other.fd && protocol == other.protocol &&
+                   localPort == other.localPort && remotePort == other.remotePort &&
+                   memcmp(localAddress, other.localAddress, sizeof(localAddress)) == 0 &&
+                   memcmp(remoteAddress, other.remoteAddress, sizeof(remoteAddress)) == 0;
+        }
+    };
+    
+    struct ConnectionKeyHash {
+        size_t operator()(const ConnectionKey& key) const;
+    };
+    
+    typedef std::unordered_map<ConnectionKey, FdSocketEntry, ConnectionKeyHash> ConnectionMap;
+    
+    std::vector<pid_t> pids;
+    FdSnapshot snapshot;
+    ConnectionMap previous;
+    ConnectionMap current;
+    std::vector<ConnectionChange> changeSet;
+    
+    std::atomic<uint32_t> interval;
+    std::atomic<uint64_t> samples;
+    std::atomic<uint64_t> connections;
+    std::atomic<uint64_t> opened;
+    std::atomic<uint64_t> closed;
+    std::atomic<uint64_t> stateChanges;
+    std::atomic<uint64_t> lastSampleNs;
+    
+    bool listProcesses(size_t* count);
+    static ConnectionKey keyFor(pid_t pid, const FdSocketEntry& socket);
+    void adapt();
+};
+
+// Name of a TSI_S_* TCP state, "OPEN" for sockets without one
+const char* connectionStateName(int32_t tcpState);
+
+#endif
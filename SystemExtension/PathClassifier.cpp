@@ -0,0 +1,401 @@
+// Multi-pattern path classification shared by the AUTH path, enrichment and library scans
+#include "PathClassifier.h"
+#include <string.h>
+#include <syslog.h>
+
+#define PATH_STATE_NONE 0xFFFF
+
+struct PathClassifier::Automaton {
+    uint8_t byteClass[256];         // 0 for bytes no pattern uses
+    uint32_t classCount;
+    std::vector<uint16_t> next;     // [state * classCount + class], failure links folded in
+    std::vector<uint32_t> output;   // categories matched on entering a state, suffixes included
+    std::vector<uint16_t> prefixNext;   // trie of the prefix and exact rules; PATH_STATE_NONE is dead
+    std::vector<uint32_t> prefixOutput;
+    std::vector<uint32_t> exactOutput;  // matched only if the path ends in the state
+    uint32_t allCategories;         // classify() stops once every category is found
+    uint32_t generation;
+    std::vector<PathRule> rules;
+};
+
+static const struct {
+    const char* name;
+    uint32_t category;
+} categoryNames[] = {
+    {"audio-device", PATH_CLASS_AUDIO_DEVICE},
+    {"video-device", PATH_CLASS_VIDEO_DEVICE},
+    {"audio-library", PATH_CLASS_AUDIO_LIBRARY},
+    {"video-library", PATH_CLASS_VIDEO_LIBRARY},
+    {"network-library", PATH_CLASS_NETWORK_LIBRARY},
+    {"system", PATH_CLASS_SYSTEM},
+};
+
+// Where device rules may point. AUTH_OPEN denies whatever they match, so a
+// rule like "audio-device prefix /" would deny every open on the machine.
+static const char* deviceRoots[] = {
+    "/dev/",
+    "/Library/Audio/Plug-Ins/",
+    "/Library/CoreMediaIO/Plug-Ins/",
+    "/System/Library/Extensions/",
+    "/System/Library/Frameworks/CoreAudio.framework/",
+    "/System/Library/Frameworks/CoreMediaIO.framework/",
+    "/usr/sbin/",
+};
+
+#define PATH_CLASS_DEVICES (PATH_CLASS_AUDIO_DEVICE | PATH_CLASS_VIDEO_DEVICE)
+
+// Anchored, past one of the roots, and without ".." to climb back out of it
+static bool deviceRuleAnchored(const PathRule& rule) {
+    if (rule.anchor == PATH_RULE_CONTAINS || rule.pattern.find("/..") != std::string::npos) {
+        return false;
+    }
+    for (const char* root : deviceRoots) {
+        size_t length = strlen(root);
+        if (rule.pattern.size() > length && rule.pattern.compare(0, length, root) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+PathClassifier::PathClassifier() : current(nullptr) {
+    pthread_mutex_init(&loadMutex, nullptr);
+    
+    std::string error;
+    if (!load(defaultRules(), &error)) {
+        syslog(LOG_ERR, "PathClassifier: default rules failed to compile: %s", error.c_str());
+    }
+}
+
+PathClassifier::~PathClassifier() {
+    delete current.load(std::memory_order_relaxed);
+    for (const Automaton* automaton : retired) {
+        delete automaton;
+    }
+    pthread_mutex_destroy(&loadMutex);
+}
+
+std::vector<PathRule> PathClassifier::defaultRules() {
+    std::vector<PathRule> rules = {
+        // Device nodes and drivers behind the microphone and camera. AUTH_OPEN
+        // denies these, so they're anchored: a file that merely mentions
+        // coreaudio or AVCapture in its name isn't a device.
+        {PATH_CLASS_AUDIO_DEVICE, PATH_RULE_PREFIX, "/dev/audio"},
+        {PATH_CLASS_AUDIO_DEVICE, PATH_RULE_PREFIX, "/Library/Audio/Plug-Ins/HAL/"},
+        {PATH_CLASS_AUDIO_DEVICE, PATH_RULE_EXACT, "/usr/sbin/coreaudiod"},
+        {PATH_CLASS_VIDEO_DEVICE, PATH_RULE_PREFIX, "/dev/video"},
+        {PATH_CLASS_VIDEO_DEVICE, PATH_RULE_PREFIX, "/Library/CoreMediaIO/Plug-Ins/DAL/"},
+        {PATH_CLASS_VIDEO_DEVICE, PATH_RULE_EXACT,
+         "/System/Library/Frameworks/CoreMediaIO.framework/Versions/A/Resources/VDC.plugin/Contents/Resources/VDCAssistant"},
+        
+        // Frameworks whose presence implies a capability
+        {PATH_CLASS_AUDIO_LIBRARY, PATH_RULE_CONTAINS, "AVFoundation"},
+        {PATH_CLASS_AUDIO_LIBRARY, PATH_RULE_CONTAINS, "CoreAudio"},
+        {PATH_CLASS_AUDIO_LIBRARY, PATH_RULE_CONTAINS, "AudioUnit"},
+        {PATH_CLASS_VIDEO_LIBRARY, PATH_RULE_CONTAINS, "AVCapture"},
+        {PATH_CLASS_VIDEO_LIBRARY, PATH_RULE_CONTAINS, "CoreMediaIO"},
+        {PATH_CLASS_NETWORK_LIBRARY, PATH_RULE_CONTAINS, "Network"},
+        {PATH_CLASS_NETWORK_LIBRARY, PATH_RULE_CONTAINS, "CFNetwork"},
+        
+        // System locations and well-known system processes
+        {PATH_CLASS_SYSTEM, PATH_RULE_PREFIX, "/System/"},
+        {PATH_CLASS_SYSTEM, PATH_RULE_PREFIX, "/usr/"},
+        {PATH_CLASS_SYSTEM, PATH_RULE_PREFIX, "/sbin/"},
+        {PATH_CLASS_SYSTEM, PATH_RULE_PREFIX, "/bin/"},
+    };
+    
+    static const char* systemProcesses[] = {
+        "kernel_task", "launchd", "kextd", "UserEventAgent",
+        "loginwindow", "WindowServer", "Dock", "Finder",
+        "SystemUIServer", "coreaudiod", "VDCAssistant"
+    };
+    for (const char* name : systemProcesses) {
+        rules.push_back({PATH_CLASS_SYSTEM, PATH_RULE_CONTAINS, name});
+    }
+    
+    return rules;
+}
+
+static bool parseCategories(const std::string& field, uint32_t* categories) {
+    *categories = 0;
+    size_t start = 0;
+    while (start <= field.size()) {
+        size_t end = field.find(',', start);
+        if (end == std::string::npos) {
+            end = field.size();
+        }
+        std::string name = field.substr(start, end - start);
+        
+        uint32_t category = 0;
+        for (const auto& entry : categoryNames) {
+            if (name == entry.name) {
+                category = entry.category;
+            }
+        }
+        if (category == 0) {
+            return false;
+        }
+        *categories |= category;
+        start = end + 1;
+    }
+    return true;
+}
+
+bool PathClassifier::parseRules(const char* text, std::vector<PathRule>* rules, std::string* error) {
+    rules->clear();
+    int lineNumber = 0;
+    
+    const char* line = text;
+    while (line && *line) {
+        const char* lineEnd = strchr(line, '\n');
+        std::string content = lineEnd ? std::string(line, lineEnd - line) : std::string(line);
+        line = lineEnd ? lineEnd + 1 : nullptr;
+        lineNumber++;
+        
+        size_t comment = content.find('#');
+        if (comment != std::string::npos) {
+            content.erase(comment);
+        }
+        
+        // Category and anchor are single words; the pattern is the rest of the line
+        std::vector<std::string> fields;
+        size_t pos = 0;
+        while (fields.size() < 2) {
+            pos = content.find_first_not_of(" \t\r", pos);
+            if (pos == std::string::npos) {
+                break;
+            }
+            size_t end = content.find_first_of(" \t\r", pos);
+            fields.push_back(content.substr(pos, end - pos));
+            pos = end;
+        }
+        if (fields.empty()) {
+            continue;
+        }
+        
+        std::string pattern;
+        if (pos != std::string::npos) {
+            size_t start = content.find_first_not_of(" \t", pos);
+            size_t end = content.find_last_not_of(" \t\r");
+            if (start != std::string::npos) {
+                pattern = content.substr(start, end - start + 1);
+            }
+        }
+        
+        PathRule rule;
+        if (fields.size() < 2 || pattern.empty()) {
+            *error = "line " + std::to_string(lineNumber) + ": expected <category> <contains|prefix|exact> <pattern>";
+            return false;
+        }
+        if (!parseCategories(fields[0], &rule.categories)) {
+            *error = "line " + std::to_string(lineNumber) + ": unknown category '" + fields[0] + "'";
+            return false;
+        }
+        if (fields[1] == "contains") {
+            rule.anchor = PATH_RULE_CONTAINS;
+        } else if (fields[1] == "prefix") {
+            rule.anchor = PATH_RULE_PREFIX;
+        } else if (fields[1] == "exact") {
+            rule.anchor = PATH_RULE_EXACT;
+        } else {
+            *error = "line " + std::to_string(lineNumber) + ": unknown match '" + fields[1] + "'";
+            return false;
+        }
+        rule.pattern = pattern;
+        if ((rule.categories & PATH_CLASS_DEVICES) && !deviceRuleAnchored(rule)) {
+            *error = "line " + std::to_string(lineNumber) +
+                     ": device rules must be prefix or exact matches under a device or driver directory";
+            return false;
+        }
+        rules->push_back(rule);
+    }
+    
+    return true;
+}
+
+std::string PathClassifier::formatRules(const std::vector<PathRule>& rules) {
+    std::string text;
+    for (const auto& rule : rules) {
+        std::string categories;
+        for (const auto& entry : categoryNames) {
+            if (rule.categories & entry.category) {
+                if (!categories.empty()) {
+                    categories += ",";
+                }
+                categories += entry.name;
+            }
+        }
+        text += categories;
+        text += rule.anchor == PATH_RULE_PREFIX ? " prefix " : rule.anchor == PATH_RULE_EXACT ? " exact " : " contains ";
+        text += rule.pattern;
+        text += "\n";
+    }
+    return text;
+}
+
+PathClassifier::Automaton* PathClassifier::compile(const std::vector<PathRule>& rules, std::string* error) {
+    size_t totalBytes = 0;
+    for (const auto& rule : rules) {
+        if (rule.pattern.empty() || rule.categories == 0) {
+            *error = "empty pattern or category";
+            return nullptr;
+        }
+        totalBytes += rule.pattern.size();
+    }
+    if (totalBytes > PATH_RULES_MAX_BYTES) {
+        *error = "rule set too large";
+        return nullptr;
+    }
+    
+    Automaton* automaton = new Automaton();
+    automaton->rules = rules;
+    automaton->allCategories = 0;
+    
+    // Only bytes that occur in some pattern get their own column
+    memset(automaton->byteClass, 0, sizeof(automaton->byteClass));
+    automaton->classCount = 1;
+    for (const auto& rule : rules) {
+        for (unsigned char c : rule.pattern) {
+            if (automaton->byteClass[c] == 0) {
+                automaton->byteClass[c] = (uint8_t)automaton->classCount++;
+            }
+        }
+        automaton->allCategories |= rule.categories;
+    }
+    const uint32_t classes = automaton->classCount;
+    
+    // Tries for both rule kinds
+    std::vector<uint16_t>& next = automaton->next;
+    std::vector<uint32_t>& output = automaton->output;
+    std::vector<uint16_t>& prefixNext = automaton->prefixNext;
+    std::vector<uint32_t>& prefixOutput = automaton->prefixOutput;
+    std::vector<uint32_t>& exactOutput = automaton->exactOutput;
+    next.assign(classes, PATH_STATE_NONE);
+    output.assign(1, 0);
+    prefixNext.assign(classes, PATH_STATE_NONE);
+    prefixOutput.assign(1, 0);
+    exactOutput.assign(1, 0);
+    
+    for (const auto& rule : rules) {
+        bool anchored = rule.anchor != PATH_RULE_CONTAINS;
+        std::vector<uint16_t>& table = anchored ? prefixNext : next;
+        std::vector<uint32_t>& outputs = anchored ? prefixOutput : output;
+        
+        uint32_t state = 0;
+        for (unsigned char c : rule.pattern) {
+            uint32_t slot = state * classes + automaton->byteClass[c];
+            if (table[slot] == PATH_STATE_NONE) {
+                table[slot] = (uint16_t)outputs.size();
+                outputs.push_back(0);
+                if (anchored) {
+                    exactOutput.push_back(0);
+                }
+                table.resize(outputs.size() * classes, PATH_STATE_NONE);
+            }
+            state = table[slot];
+        }
+        (rule.anchor == PATH_RULE_EXACT ? exactOutput : outputs)[state] |= rule.categories;
+    }
+    
+    // Breadth-first failure links, folded into the transition table so matching
+    // never follows a link at runtime
+    std::vector<uint16_t> fail(output.size(), 0);
+    std::vector<uint16_t> queue;
+    for (uint32_t c = 0; c < classes; c++) {
+        uint16_t child = next[c];
+        if (child == PATH_STATE_NONE) {
+            next[c] = 0;
+        } else {
+            fail[child] = 0;
+            queue.push_back(child);
+        }
+    }
+    for (size_t head = 0; head < queue.size(); head++) {
+        uint16_t state = queue[head];
+        output[state] |= output[fail[state]];
+        for (uint32_t c = 0; c < classes; c++) {
+            uint16_t child = next[state * classes + c];
+            if (child == PATH_STATE_NONE) {
+                next[state * classes + c] = next[fail[state] * classes + c];
+            } else {
+                fail[child] = next[fail[state] * classes + c];
+                queue.push_back(child);
+            }
+        }
+    }
+    
+    return automaton;
+}
+
+bool PathClassifier::load(const std::vector<PathRule>& rules, std::string* error) {
+    Automaton* automaton = compile(rules, error);
+    if (!automaton) {
+        return false;
+    }
+    
+    pthread_mutex_lock(&loadMutex);
+    const Automaton* previous = current.load(std::memory_order_relaxed);
+    automaton->generation = previous ? previous->generation + 1 : 1;
+    current.store(automaton, std::memory_order_release);
+    if (previous) {
+        retired.push_back(previous);
+    }
+    pthread_mutex_unlock(&loadMutex);
+    
+    syslog(LOG_INFO, "PathClassifier: loaded %zu rules (%zu states), generation %u",
+           rules.size(), automaton->output.size(), automaton->generation);
+    return true;
+}
+
+uint32_t PathClassifier::classify(const char* path, size_t length) const {
+    const Automaton* automaton = current.load(std::memory_order_acquire);
+    if (!automaton) {
+        return 0;
+    }
+    
+    const uint8_t* bytes = (const uint8_t*)path;
+    const uint16_t* next = automaton->next.data();
+    const uint32_t* output = automaton->output.data();
+    const uint32_t classes = automaton->classCount;
+    uint32_t categories = 0;
+    uint32_t state = 0;
+    uint32_t prefixState = 0;
+    bool inPrefix = true;
+    size_t i = 0;
+    
+    for (; i < length; i++) {
+        uint32_t c = automaton->byteClass[bytes[i]];
+        state = next[state * classes + c];
+        categories |= output[state];
+        
+        if (inPrefix) {
+            prefixState = automaton->prefixNext[prefixState * classes + c];
+            if (prefixState == PATH_STATE_NONE) {
+                inPrefix = false;
+            } else {
+                categories |= automaton->prefixOutput[prefixState];
+            }
+        }
+        
+        if (categories == automaton->allCategories) {
+            break;
+        }
+    }
+    
+    // Still on the trie at the end of the path: the exact rules ending here match
+    if (i == length && inPrefix) {
+        categories |= automaton->exactOutput[prefixState];
+    }
+    
+    return categories;
+}
+
+uint32_t PathClassifier::generation() const {
+    const Automaton* automaton = current.load(std::memory_order_acquire);
+    return automaton ? automaton->generation : 0;
+}
+
+std::vector<PathRule> PathClassifier::rules() const {
+    const Automaton* automaton = current.load(std::memory_order_acquire);
+    return automaton ? automaton->rules : std::vector<PathRule>();
+}
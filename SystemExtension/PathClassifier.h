@@ -0,0 +1,72 @@
+#ifndef PathClassifier_h
+#define PathClassifier_h
+
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+// Categories a path can fall into; classify() returns a mask of these
+#define PATH_CLASS_AUDIO_DEVICE     (1u << 0)
+#define PATH_CLASS_VIDEO_DEVICE     (1u << 1)
+#define PATH_CLASS_AUDIO_LIBRARY    (1u << 2)
+#define PATH_CLASS_VIDEO_LIBRARY    (1u << 3)
+#define PATH_CLASS_NETWORK_LIBRARY  (1u << 4)
+#define PATH_CLASS_SYSTEM           (1u << 5)
+
+// Total pattern bytes per rule set; states are 16-bit
+#ifndef PATH_RULES_MAX_BYTES
+#define PATH_RULES_MAX_BYTES 60000
+#endif
+
+enum PathRuleAnchor : uint8_t {
+    PATH_RULE_CONTAINS,         // anywhere in the path
+    PATH_RULE_PREFIX,           // at the start of the path
+    PATH_RULE_EXACT             // the whole path
+};
+
+struct PathRule {
+    uint32_t categories;
+    PathRuleAnchor anchor;
+    std::string pattern;
+};
+
+// Every rule set compiled into one Aho-Corasick automaton over byte classes,
+// plus a trie for the prefix rules, walked together in a single pass over the
+// path. Rule sets are swapped atomically: classify() never locks, and replaced
+// automatons are kept until the classifier is destroyed so a reader still
+// walking one is never left with freed memory.
+class PathClassifier {
+public:
+    PathClassifier();
+    ~PathClassifier();
+    
+    // The rules the extension has always applied
+    static std::vector<PathRule> defaultRules();
+    
+    // One rule per line: "<category> <contains|prefix|exact> <pattern>"; '#' starts a comment
+    static bool parseRules(const char* text, std::vector<PathRule>* rules, std::string* error);
+    static std::string formatRules(const std::vector<PathRule>& rules);
+    
+    // Compiles and publishes a rule set; the old one stays active on failure
+    bool load(const std::vector<PathRule>& rules, std::string* error);
+    
+    uint32_t classify(const char* path, size_t length) const;
+    
+    // Bumped by every successful load
+    uint32_t generation() const;
+    std::vector<PathRule> rules() const;
+
+private:
+    struct Automaton;
+    
+    std::atomic<const Automaton*> current;
+    std::vector<const Automaton*> retired;
+    mutable pthread_mutex_t loadMutex;  // serializes load(), guards retired
+    
+    static Automaton* compile(const std::vector<PathRule>& rules, std::string* error);
+};
+
+#endif
@@ -1,16 +1,19 @@
-// Process analysis and monitoring thread implementations
+// Process analysis and periodic monitor implementations
 #include "AudioVideoController.h"
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <mach-o/dyld_images.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
 
 ProcessInfo AudioVideoController::analyzeProcess(pid_t pid) {
-    ProcessInfo info;
+    ProcessInfo info = ProcessInfo();
     info.pid = pid;
     
     // Get process information using libproc
     struct proc_taskallinfo taskInfo;
-    if (proc_pidinfo(pid, PROC_PIDTASKALLINFO, 0, &taskInfo, sizeof(taskInfo)) > 0) {
+    if (getProcessTaskInfo(pid, &taskInfo)) {
         info.ppid = taskInfo.pbsd.pbi_ppid;
         info.uid = taskInfo.pbsd.pbi_uid;
         info.gid = taskInfo.pbsd.pbi_gid;
@@ -32,25 +35,44 @@ ProcessInfo AudioVideoController::analyzeProcess(pid_t pid) {
     // Get command line arguments
     info.commandLine = getProcessCommandLine(pid);
     
-    // Get open files
-    info.openFiles = getProcessOpenFiles(pid);
-    
-    // Get network connections
-    info.networkConnections = getProcessNetworkConnections(pid);
+    // Open files and network connections from one pass over the fd table
+    getProcessDescriptors(pid, &info.openFiles, &info.networkConnections);
     
-    // Get loaded libraries
-    info.loadedLibraries = getProcessLoadedLibraries(pid);
+    // Get loaded libraries; the set is shared with every process running this image
+    info.librarySetId = getProcessLibrarySet(pid, nullptr);
+    if (const LibrarySet* libraries = librarySets.get(info.librarySetId)) {
+        for (uint32_t id : libraries->libraryIds) {
+            info.loadedLibraries.push_back(stringTable.str(id));
+        }
+    }
+    uint32_t capabilities = librarySets.capabilities(info.librarySetId);
     
     // Get environment variables
     info.environmentVariables = getProcessEnvironment(pid);
     
     // Determine if system process
-    info.isSystemProcess = isSystemCriticalProcess(pid);
+    info.isSystemProcess = isSystemPath(info.executablePath.data(), info.executablePath.size());
+    
+    info.hasAudioAccess = (capabilities & LIBRARY_CAP_AUDIO) != 0;
+    info.hasVideoAccess = (capabilities & LIBRARY_CAP_VIDEO) != 0;
+    info.hasNetworkAccess = (capabilities & LIBRARY_CAP_NETWORK) != 0;
+    info.hasFileSystemAccess = true;
+    info.enrichmentTier = 2;
     
     return info;
 }
 
+bool AudioVideoController::getProcessTaskInfo(pid_t pid, struct proc_taskallinfo* taskInfo) {
+    MetricsCallTimer timer(metrics, METRIC_CALL_TASK_INFO);
+    if (proc_pidinfo(pid, PROC_PIDTASKALLINFO, 0, taskInfo, sizeof(*taskInfo)) > 0) {
+        return true;
+    }
+    timer.failed();
+    return false;
+}
+
 std::string AudioVideoController::getProcessCommandLine(pid_t pid) {
+    MetricsCallTimer timer(metrics, METRIC_CALL_COMMAND_LINE);
     char pathBuffer[4096];
     size_t size = sizeof(pathBuffer);
     
@@ -74,117 +96,181 @@ std::string AudioVideoController::getProcessCommandLine(pid_t pid) {
         return cmdline;
     }
     
+    timer.failed();
     return "";
 }
 
-std::vector<std::string> AudioVideoController::getProcessOpenFiles(pid_t pid) {
-    std::vector<std::string> openFiles;
+void AudioVideoController::getProcessDescriptors(pid_t pid, std::vector<std::string>* openFiles,
+                                                 std::vector<std::string>* connections) {
+    static thread_local FdSnapshot snapshot;
+    {
+        MetricsCallTimer timer(metrics, METRIC_CALL_DESCRIPTORS);
+        if (!snapshot.capture(pid)) {
+            timer.failed();
+            return;
+        }
+    }
     
-    struct proc_fdinfo *fdInfos = nullptr;
-    int numFds = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, nullptr, 0);
+    for (const auto& file : snapshot.files()) {
+        openFiles->push_back(std::string(snapshot.path(file), file.pathLength));
+    }
     
-    if (numFds > 0) {
-        fdInfos = (struct proc_fdinfo*)malloc(numFds);
-        numFds = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, fdInfos, numFds);
+    char connStr[256];
+    for (const auto& socket : snapshot.sockets()) {
+        size_t length = formatSocketEntry(socket, connStr, sizeof(connStr));
+        connections->push_back(std::string(connStr, length));
+    }
+}
+
+// Copies remote memory into a local buffer; false unless all of it was readable
+static bool readTaskMemory(task_t task, mach_vm_address_t address, size_t size, void* buffer) {
+    mach_vm_size_t copied = 0;
+    return mach_vm_read_overwrite(task, address, size, (mach_vm_address_t)buffer, &copied) == KERN_SUCCESS &&
+           copied == size;
+}
+
+// Reads every image path with as few remote reads as possible. Paths mostly sit
+// next to each other (the shared cache keeps them together), so sort them by
+// address and fetch each cluster in one read, falling back per image only when
+// a cluster spans something unmapped.
+static void readLibraryPaths(task_t task, const struct dyld_image_info* images, uint32_t count,
+                             StringTable& strings, std::vector<uint32_t>* libraryIds) {
+    static thread_local std::vector<std::pair<mach_vm_address_t, uint32_t>> order;
+    static thread_local std::vector<char> region;
+    
+    order.clear();
+    for (uint32_t i = 0; i < count; i++) {
+        if (images[i].imageFilePath) {
+            order.push_back(std::make_pair((mach_vm_address_t)images[i].imageFilePath, i));
+        }
+    }
+    std::sort(order.begin(), order.end());
+    
+    std::vector<uint32_t> ids(count, 0);
+    size_t first = 0;
+    while (first < order.size()) {
+        mach_vm_address_t start = order[first].first;
+        size_t last = first;
+        while (last + 1 < order.size() &&
+               order[last + 1].first - order[last].first <= LIBRARY_PATH_CLUSTER_GAP &&
+               order[last + 1].first + MAXPATHLEN - start <= LIBRARY_PATH_READ_MAX) {
+            last++;
+        }
         
-        int actualFds = numFds / sizeof(struct proc_fdinfo);
+        // The last path may run up to MAXPATHLEN past its start
+        size_t span = (size_t)(order[last].first - start) + MAXPATHLEN;
+        region.resize(span);
+        bool bulk = readTaskMemory(task, start, span, region.data());
         
-        for (int i = 0; i < actualFds; i++) {
-            if (fdInfos[i].proc_fdtype == PROX_FDTYPE_VNODE) {
-                struct vnode_fdinfowithpath vnodeInfo;
-                if (proc_pidfdinfo(pid, fdInfos[i].proc_fd, PROC_PIDFDVNODEPATHINFO, 
-                                 &vnodeInfo, sizeof(vnodeInfo)) > 0) {
-                    openFiles.push_back(std::string(vnodeInfo.pvip.vip_path));
+        for (size_t i = first; i <= last; i++) {
+            const char* path = nullptr;
+            size_t available = 0;
+            char single[MAXPATHLEN];
+            
+            if (bulk) {
+                path = region.data() + (order[i].first - start);
+                available = span - (size_t)(order[i].first - start);
+            } else {
+                // Stay within the path's 4K page so an unmapped neighbour can't fail the read
+                available = 4096 - (size_t)(order[i].first & 4095);
+                if (available > sizeof(single)) {
+                    available = sizeof(single);
                 }
+                if (!readTaskMemory(task, order[i].first, available, single)) {
+                    continue;
+                }
+                path = single;
+            }
+            
+            const char* end = (const char*)memchr(path, '\0', available);
+            if (end) {
+                ids[order[i].second] = strings.intern(path, (size_t)(end - path));
             }
         }
-        
-        free(fdInfos);
+        first = last + 1;
     }
     
-    return openFiles;
+    // Back to dyld load order
+    libraryIds->clear();
+    for (uint32_t id : ids) {
+        if (id) {
+            libraryIds->push_back(id);
+        }
+    }
 }
 
-std::vector<std::string> AudioVideoController::getProcessNetworkConnections(pid_t pid) {
-    std::vector<std::string> connections;
-    
-    // Get network socket information
-    struct proc_fdinfo *fdInfos = nullptr;
-    int numFds = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, nullptr, 0);
-    
-    if (numFds > 0) {
-        fdInfos = (struct proc_fdinfo*)malloc(numFds);
-        numFds = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, fdInfos, numFds);
-        
-        int actualFds = numFds / sizeof(struct proc_fdinfo);
-        
-        for (int i = 0; i < actualFds; i++) {
-            if (fdInfos[i].proc_fdtype == PROX_FDTYPE_SOCKET) {
-                struct socket_fdinfo socketInfo;
-                if (proc_pidfdinfo(pid, fdInfos[i].proc_fd, PROC_PIDFDSOCKETINFO,
-                                 &socketInfo, sizeof(socketInfo)) > 0) {
-                    
-                    char connStr[256];
-                    if (socketInfo.psi.soi_family == AF_INET) {
-                        struct sockaddr_in *local = (struct sockaddr_in*)&socketInfo.psi.soi_proto.pri_tcp.tcpsi_ini.insi_laddr;
-                        struct sockaddr_in *remote = (struct sockaddr_in*)&socketInfo.psi.soi_proto.pri_tcp.tcpsi_ini.insi_faddr;
-                        
-                        snprintf(connStr, sizeof(connStr), "TCP %s:%d -> %s:%d",
-                                inet_ntoa(local->sin_addr), ntohs(local->sin_port),
-                                inet_ntoa(remote->sin_addr), ntohs(remote->sin_port));
-                        connections.push_back(std::string(connStr));
-                    }
-                }
+bool AudioVideoController::libraryKeyFor(pid_t pid, const uint8_t* cdhash, LibrarySetKey* key) {
+    if (cdhash) {
+        for (int i = 0; i < 20; i++) {
+            if (cdhash[i]) {
+                *key = LibrarySetCache::cdhashKey(cdhash);
+                return true;
             }
         }
-        
-        free(fdInfos);
     }
     
-    return connections;
+    // Unsigned or not from an EXEC message: the executable file's identity will do
+    char pathBuffer[PROC_PIDPATHINFO_MAXSIZE];
+    int length = proc_pidpath(pid, pathBuffer, sizeof(pathBuffer));
+    struct stat st;
+    if (length <= 0 || stat(pathBuffer, &st) != 0) {
+        return false;
+    }
+    *key = LibrarySetCache::fileKey(stringTable.intern(pathBuffer, (size_t)length),
+                                    (int64_t)st.st_mtime, (uint64_t)st.st_size);
+    return true;
 }
 
-std::vector<std::string> AudioVideoController::getProcessLoadedLibraries(pid_t pid) {
-    std::vector<std::string> libraries;
-    
+uint32_t AudioVideoController::getProcessLibrarySet(pid_t pid, const uint8_t* cdhash) {
+    MetricsCallTimer timer(metrics, METRIC_CALL_LIBRARIES);
     task_t task;
     if (task_for_pid(mach_task_self(), pid, &task) != KERN_SUCCESS) {
-        return libraries;
+        timer.failed();
+        return 0;
     }
     
+    uint32_t setId = 0;
     struct task_dyld_info dyld_info;
     mach_msg_type_number_t count = TASK_DYLD_INFO_COUNT;
+    struct dyld_all_image_infos infos;
+    memset(&infos, 0, sizeof(infos));
     
     if (task_info(task, TASK_DYLD_INFO, (task_info_t)&dyld_info, &count) == KERN_SUCCESS) {
-        mach_msg_type_number_t size;
-        vm_offset_t data;
+        size_t headerSize = sizeof(infos) < dyld_info.all_image_info_size ? sizeof(infos)
+                                                                          : (size_t)dyld_info.all_image_info_size;
         
-        if (mach_vm_read(task, dyld_info.all_image_info_addr, 
-                        dyld_info.all_image_info_size, &data, &size) == KERN_SUCCESS) {
-            
-            struct dyld_all_image_infos *infos = (struct dyld_all_image_infos *)data;
+        // infoArray is NULL while dyld is in the middle of updating it
+        if (readTaskMemory(task, dyld_info.all_image_info_addr, headerSize, &infos) &&
+            infos.infoArray != nullptr) {
+            LibrarySetKey key;
+            bool haveKey = libraryKeyFor(pid, cdhash, &key);
+            if (haveKey) {
+                setId = librarySets.lookup(key, infos.infoArrayCount);
+            }
             
-            for (uint32_t i = 0; i < infos->infoArrayCount; i++) {
-                mach_msg_type_number_t pathSize;
-                vm_offset_t pathData;
-                
-                if (mach_vm_read(task, (mach_vm_address_t)infos->infoArray[i].imageFilePath,
-                               256, &pathData, &pathSize) == KERN_SUCCESS) {
-                    char *path = (char *)pathData;
-                    libraries.push_back(std::string(path));
-                    vm_deallocate(mach_task_self(), pathData, pathSize);
+            if (setId == 0) {
+                static thread_local std::vector<struct dyld_image_info> images;
+                images.resize(infos.infoArrayCount);
+                if (readTaskMemory(task, (mach_vm_address_t)infos.infoArray,
+                                   infos.infoArrayCount * sizeof(struct dyld_image_info), images.data())) {
+                    std::vector<uint32_t> libraryIds;
+                    readLibraryPaths(task, images.data(), infos.infoArrayCount, stringTable, &libraryIds);
+                    setId = haveKey ? librarySets.insert(key, infos.infoArrayCount, libraryIds)
+                                    : librarySets.intern(libraryIds);
                 }
             }
-            
-            vm_deallocate(mach_task_self(), data, size);
         }
     }
     
     mach_port_deallocate(mach_task_self(), task);
-    return libraries;
+    if (setId == 0) {
+        timer.failed();
+    }
+    return setId;
 }
 
 std::map<std::string, std::string> AudioVideoController::getProcessEnvironment(pid_t pid) {
+    MetricsCallTimer timer(metrics, METRIC_CALL_ENVIRONMENT);
     std::map<std::string, std::string> env;
     
     char *buffer = nullptr;
@@ -226,6 +312,8 @@ std::map<std::string, std::string> AudioVideoController::getProcessEnvironment(p
         }
         
         free(buffer);
+    } else {
+        timer.failed();
     }
     
     return env;
@@ -249,32 +337,14 @@ uint64_t AudioVideoController::getProcessCPUTime(pid_t pid) {
 
 bool AudioVideoController::isSystemCriticalProcess(pid_t pid) {
     char pathBuffer[PROC_PIDPATHINFO_MAXSIZE];
-    if (proc_pidpath(pid, pathBuffer, sizeof(pathBuffer)) > 0) {
-        std::string path(pathBuffer);
-        
-        // Check for system paths
-        if (path.find("/System/") == 0 || 
-            path.find("/usr/") == 0 ||
-            path.find("/sbin/") == 0 ||
-            path.find("/bin/") == 0) {
-            return true;
-        }
-        
-        // Check for known system processes
-        std::vector<std::string> systemProcesses = {
-            "kernel_task", "launchd", "kextd", "UserEventAgent",
-            "loginwindow", "WindowServer", "Dock", "Finder",
-            "SystemUIServer", "coreaudiod", "VDCAssistant"
-        };
-        
-        for (const auto& sysProc : systemProcesses) {
-            if (path.find(sysProc) != std::string::npos) {
-                return true;
-            }
-        }
-    }
-    
-    return false;
+    int length = proc_pidpath(pid, pathBuffer, sizeof(pathBuffer));
+    return length > 0 && isSystemPath(pathBuffer, (size_t)length);
+}
+
+// Path-only check, usable straight from an ES message
+bool AudioVideoController::isSystemPath(const char* path, size_t length) const {
+    // System prefixes and known system process names, all in one pass
+    return (pathClassifier.classify(path, length) & PATH_CLASS_SYSTEM) != 0;
 }
 
 bool AudioVideoController::hasElevatedPrivileges(pid_t pid) {
@@ -285,123 +355,357 @@ bool AudioVideoController::hasElevatedPrivileges(pid_t pid) {
     return false;
 }
 
-// Monitoring thread implementations
+// Periodic monitors run on dispatch timers; nothing sleeps in a loop
 void AudioVideoController::startProcessMonitoring() {
     monitoringEnabled = true;
-    pthread_create(&processMonitorThread, nullptr, processMonitoringThread, this);
+    monitorScheduler.addTask("com.example.AudioVideoMonitor.process-scan", QOS_CLASS_UTILITY,
+                             PROCESS_SCAN_INTERVAL_MS, processScanTask, this);
 }
 
 void AudioVideoController::startNetworkMonitoring() {
-    pthread_create(&networkMonitorThread, nullptr, networkMonitoringThread, this);
+    // The first sample records what's already open
+    monitorScheduler.addTask("com.example.AudioVideoMonitor.network-scan", QOS_CLASS_UTILITY, 0,
+                             networkScanTask, this);
 }
 
 void AudioVideoController::startFileSystemMonitoring() {
-    pthread_create(&fileSystemMonitorThread, nullptr, fileSystemMonitoringThread, this);
+    static const char* const watched[] = {FS_WATCH_PATHS};
+    std::string error;
+    if (!fileSystemWatcher.start(watched, sizeof(watched) / sizeof(watched[0]), fileSystemChanged, this,
+                                 &error)) {
+        syslog(LOG_ERR, "AudioVideoController: file system watcher not started: %s", error.c_str());
+    }
 }
 
-void* AudioVideoController::processMonitoringThread(void* arg) {
-    AudioVideoController* controller = (AudioVideoController*)arg;
-    
-    while (controller->monitoringEnabled) {
+// Catches processes ES never told us about; EXEC, FORK and EXIT do the rest.
+// While a backlog waits, runs come every PROCESS_DISCOVERY_INTERVAL_MS and
+// only work it off, so launch spreads the analysis over several seconds.
+uint32_t AudioVideoController::processScanTask(void* context) {
+    AudioVideoController* controller = (AudioVideoController*)context;
+    if (controller->discoveryBacklog.empty()) {
         controller->scanRunningProcesses();
-        sleep(5); // Scan every 5 seconds
     }
-    
-    return nullptr;
+    if (controller->discoverProcesses(PROCESS_DISCOVERY_BATCH)) {
+        return PROCESS_DISCOVERY_INTERVAL_MS;
+    }
+    return PROCESS_SCAN_INTERVAL_MS;
 }
 
-void* AudioVideoController::networkMonitoringThread(void* arg) {
-    AudioVideoController* controller = (AudioVideoController*)arg;
-    
-    while (controller->monitoringEnabled) {
-        controller->scanNetworkConnections();
-        sleep(10); // Scan every 10 seconds
-    }
-    
-    return nullptr;
+// The tracker picks the interval: seconds while connections churn, longer while idle
+uint32_t AudioVideoController::networkScanTask(void* context) {
+    AudioVideoController* controller = (AudioVideoController*)context;
+    controller->scanNetworkConnections();
+    return controller->networkTracker.intervalMs();
+}
+
+void AudioVideoController::fileSystemChanged(void* context, const char* path, size_t length,
+                                             FileSystemChange change) {
+    ((AudioVideoController*)context)->recordFileSystemChange(path, length, change);
 }
 
-void* AudioVideoController::fileSystemMonitoringThread(void* arg) {
-    AudioVideoController* controller = (AudioVideoController*)arg;
+void AudioVideoController::scanRunningProcesses() {
+    if (!processTracker.sample()) {
+        return;
+    }
+    
+    // Processes that died without us seeing an ES EXIT
+    for (const ProcessIdentity& gone : processTracker.vanished()) {
+        ProcessRecord record;
+        if (processTable.remove(gone.pid, 0, gone.startUsec, &record)) {
+            logProcessEvent(record, "VANISHED");
+        }
+    }
     
-    while (controller->monitoringEnabled) {
-        controller->monitorFileSystemEvents();
-        sleep(1); // Monitor frequently
+    // The lineage tree too, including processes that came and went between samples
+    std::vector<LineageRow> lineageRows;
+    lineage.reconcile(processTracker.processes(), processTracker.sampledUsec(), time(nullptr), &lineageRows);
+    if (!lineageRows.empty()) {
+        databaseWriter.appendLineage(lineageRows);
     }
     
-    return nullptr;
+    // Only the first sample can meet processes the last run saved
+    bool firstSample = processTracker.sampleCount() == 1;
+    for (const ProcessIdentity& found : processTracker.appeared()) {
+        // Skip if EXEC or FORK already told us about this process
+        if (processTable.contains(found.pid, 0, found.startUsec)) {
+            continue;
+        }
+        
+        // Still the process the last run saved: no analysis, and its DISCOVERED row is already logged
+        ProcessRecord record;
+        if (firstSample && warmStart.take(found.pid, found.startUsec, processTracker.name(found), &record)) {
+            bool displaced;
+            processTable.insert(record, &displaced);
+            continue;
+        }
+        discoveryBacklog.push_back(found);
+    }
+    if (firstSample) {
+        warmStart.discard();
+    }
+    discoveryPending.store(discoveryBacklog.size(), std::memory_order_relaxed);
 }
 
-void AudioVideoController::scanRunningProcesses() {
-    int mib[4] = {CTL_KERN, KERN_PROC, KERN_PROC_ALL, 0};
-    struct kinfo_proc *procs = nullptr;
-    size_t size;
-    
-    if (sysctl(mib, 4, nullptr, &size, nullptr, 0) == 0) {
-        procs = (struct kinfo_proc*)malloc(size);
+// Analyzes up to `limit` processes from the backlog; true if some are left
+bool AudioVideoController::discoverProcesses(size_t limit) {
+    for (size_t i = 0; i < limit && !discoveryBacklog.empty(); i++) {
+        ProcessIdentity found = discoveryBacklog.front();
+        discoveryBacklog.pop_front();
+        if (processTable.contains(found.pid, 0, found.startUsec)) {
+            continue;
+        }
         
-        if (sysctl(mib, 4, procs, &size, nullptr, 0) == 0) {
-            int numProcs = size / sizeof(struct kinfo_proc);
-            
-            for (int i = 0; i < numProcs; i++) {
-                pid_t pid = procs[i].kp_proc.p_pid;
-                
-                // Skip if we already know about this process
-                if (runningProcesses.find(pid) != runningProcesses.end()) {
-                    continue;
-                }
-                
-                // Analyze new process
-                ProcessInfo info = analyzeProcess(pid);
-                runningProcesses[pid] = info;
-                
-                logProcessEvent(info, "DISCOVERED");
-            }
+        // Analyze new process without holding anything; an EXEC racing with us wins
+        ProcessRecord record = internProcess(analyzeProcess(found.pid));
+        
+        // Exited while it waited, or the pid already belongs to someone else
+        if (record.startTime != found.startUsec / 1000000) {
+            continue;
         }
+        record.kernelStartUsec = found.startUsec;
+        logProcessEvent(record, "DISCOVERED");
+        logProcessDetails(record);
         
-        free(procs);
+        // Replaces an earlier process with this pid that we never saw exit
+        bool displaced;
+        processTable.insert(record, &displaced);
+        processesDiscovered.fetch_add(1, std::memory_order_relaxed);
     }
+    
+    discoveryPending.store(discoveryBacklog.size(), std::memory_order_relaxed);
+    return !discoveryBacklog.empty();
 }
 
-void AudioVideoController::scanNetworkConnections() {
-    // Implementation for network connection scanning
-    std::vector<NetworkConnection> connections = parseNetstat();
+void AudioVideoController::saveWarmStart() {
+    // Before the first scan the table is only what ES happened to report
+    if (processTracker.sampleCount() == 0) {
+        return;
+    }
     
-    for (const auto& conn : connections) {
-        logNetworkEvent(conn);
+    std::vector<ProcessRecord> records;
+    processTable.snapshot(&records);
+    std::string error;
+    if (!warmStart.save(WARM_START_PATH, records, &error)) {
+        syslog(LOG_ERR, "AudioVideoController: warm-start snapshot not saved: %s", error.c_str());
+        return;
     }
+    syslog(LOG_INFO, "AudioVideoController: saved %llu processes for the next launch",
+           (unsigned long long)warmStart.getStats().saved);
 }
 
-std::vector<NetworkConnection> AudioVideoController::parseNetstat() {
-    std::vector<NetworkConnection> connections;
-    
-    // Parse network connections using system calls
-    // This is a simplified implementation
+WarmStartStats AudioVideoController::getWarmStartStats() const {
+    WarmStartStats stats = warmStart.getStats();
+    stats.discovered = processesDiscovered.load(std::memory_order_relaxed);
+    stats.pending = discoveryPending.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void AudioVideoController::scanNetworkConnections() {
+    if (!networkTracker.sample()) {
+        return;
+    }
     
-    return connections;
+    // Only what changed since the last sample becomes a row
+    uint64_t now = mach_absolute_time();
+    char address[INET6_ADDRSTRLEN];
+    for (const ConnectionChange& change : networkTracker.changes()) {
+        const FdSocketEntry& socket = change.socket;
+        NetworkConnection conn;
+        conn.timestamp = now;
+        conn.pid = change.pid;
+        conn.protocol = socket.protocol == IPPROTO_TCP ? "TCP" :
+                        socket.protocol == IPPROTO_UDP ? "UDP" : "IP";
+        if (formatSocketAddress(socket.localAddress, address, sizeof(address))) {
+            conn.localAddress = address;
+        }
+        conn.localPort = socket.localPort;
+        if (formatSocketAddress(socket.remoteAddress, address, sizeof(address))) {
+            conn.remoteAddress = address;
+        }
+        conn.remotePort = socket.remotePort;
+        conn.state = change.kind == CONNECTION_CLOSED ? "CLOSED" : connectionStateName(socket.tcpState);
+        logNetworkEvent(conn);
+        
+        if (eventStream.active()) {
+            StreamEvent event = {now, change.pid, stringTable.intern(conn.remoteAddress),
+                                 stringTable.intern(conn.state), 1, STREAM_EVENT_NETWORK, false,
+                                 socket.protocol, socket.localPort, socket.remotePort,
+                                 stringTable.intern(conn.localAddress)};
+            eventStream.publish(event);
+        }
+    }
 }
 
-void AudioVideoController::monitorFileSystemEvents() {
-    // File system monitoring implementation
-    // This would integrate with FSEvents or similar
+// FSEvents has no pid and has already coalesced the batch, so rows skip the
+// per-worker aggregator and go straight to the log
+void AudioVideoController::recordFileSystemChange(const char* path, size_t length, FileSystemChange change) {
+    static const char* const changeNames[] = {"FS_CREATED", "FS_MODIFIED", "FS_RENAMED", "FS_REMOVED", "FS_RESCAN"};
+    
+    FileAccessRecord access;
+    access.pid = 0;
+    access.pathId = stringTable.intern(path, length);
+    access.accessTypeId = stringTable.intern(changeNames[change], strlen(changeNames[change]));
+    access.reasonId = 0;
+    access.timestamp = mach_absolute_time();
+    access.wasBlocked = false;
+    access.count = 1;
+    access.lastSeen = access.timestamp;
+    
+    logFileAccess(access);
+    rememberFileAccess(access);
 }
 
 std::vector<ProcessInfo> AudioVideoController::getAllProcesses() {
-    std::vector<ProcessInfo> processes;
+    // Expanding interns nothing, but it allocates; none of it holds up the event path
+    std::vector<ProcessRecord> records;
+    processTable.snapshot(&records);
     
-    for (const auto& pair : runningProcesses) {
-        processes.push_back(pair.second);
+    std::vector<ProcessInfo> processes;
+    processes.reserve(records.size());
+    for (const auto& record : records) {
+        processes.push_back(expandProcess(record));
     }
     
     return processes;
 }
 
+std::shared_ptr<const SharedSnapshot> AudioVideoController::getProcessSnapshot() {
+    // Read before the table is walked, so a change made during the walk forces a rebuild
+    uint64_t generation = processTable.generation();
+    
+    return snapshots.get(SNAPSHOT_PROCESSES, generation, [this, generation]() {
+        std::vector<ProcessRecord> records;
+        processTable.snapshot(&records);
+        
+        // Straight from the interned records; no ProcessInfo is expanded
+        SnapshotBuilder builder(SNAPSHOT_PROCESSES, sizeof(SnapshotProcess), &stringTable);
+        for (const auto& record : records) {
+            SnapshotProcess process;
+            memset(&process, 0, sizeof(process));
+            process.pid = record.pid;
+            process.ppid = record.ppid;
+            process.uid = record.uid;
+            process.gid = record.gid;
+            process.startTime = record.startTime;
+            process.cpuTime = record.cpuTime;
+            process.memoryUsage = record.memoryUsage;
+            process.executablePath = builder.addInterned(record.executablePathId);
+            process.commandLine = builder.addInterned(record.commandLineId);
+            process.bundleIdentifier = builder.addInterned(record.bundleIdentifierId);
+            process.enrichmentTier = record.enrichmentTier;
+            process.flags = (record.isSystemProcess ? SNAPSHOT_PROCESS_SYSTEM : 0) |
+                            (record.hasAudioAccess ? SNAPSHOT_PROCESS_AUDIO : 0) |
+                            (record.hasVideoAccess ? SNAPSHOT_PROCESS_VIDEO : 0) |
+                            (record.hasNetworkAccess ? SNAPSHOT_PROCESS_NETWORK : 0) |
+                            (record.hasFileSystemAccess ? SNAPSHOT_PROCESS_FILESYSTEM : 0);
+            builder.addRecord(&process);
+        }
+        return builder.finish(generation);
+    });
+}
+
+bool AudioVideoController::getProcessChanges(uint64_t since, std::vector<ProcessChange>* changes,
+                                             uint64_t* generation) {
+    return processTable.changesSince(since, changes, generation);
+}
+
 ProcessInfo AudioVideoController::getProcessInfo(pid_t pid) {
-    auto it = runningProcesses.find(pid);
-    if (it != runningProcesses.end()) {
-        return it->second;
+    ProcessRecord record;
+    bool known = processTable.lookup(pid, &record);
+    if (known && record.enrichmentTier < 2) {
+        // Asked for before tier 2 ran: do it now rather than return a partial record
+        EnrichmentTask task = {pid, record.kernelStartUsec, 0, 2};
+        enrichProcess(task);
+        known = processTable.lookup(pid, &record);
+    }
+    if (known) {
+        return expandProcess(record);
     }
     
     // If not in cache, analyze now
     return analyzeProcess(pid);
-}
\ No newline at end of file
+}
+ProcessRecord AudioVideoController::internProcess(const ProcessInfo& info) {
+    ProcessRecord record;
+    record.pid = info.pid;
+    record.ppid = info.ppid;
+    record.pidVersion = 0;
+    record.executablePathId = stringTable.intern(info.executablePath);
+    record.commandLineId = stringTable.intern(info.commandLine);
+    record.bundleIdentifierId = stringTable.intern(info.bundleIdentifier);
+    record.uid = info.uid;
+    record.gid = info.gid;
+    record.startTime = info.startTime;
+    record.kernelStartUsec = 0;
+    record.cpuTime = info.cpuTime;
+    record.memoryUsage = info.memoryUsage;
+    
+    record.librarySetId = info.librarySetId;
+    if (record.librarySetId == 0 && !info.loadedLibraries.empty()) {
+        std::vector<uint32_t> libraryIds;
+        libraryIds.reserve(info.loadedLibraries.size());
+        for (const auto& library : info.loadedLibraries) {
+            libraryIds.push_back(stringTable.intern(library));
+        }
+        record.librarySetId = librarySets.intern(libraryIds);
+    }
+    
+    if (!info.openFiles.empty() || !info.networkConnections.empty() || !info.environmentVariables.empty()) {
+        std::shared_ptr<ProcessDetails> details = std::make_shared<ProcessDetails>();
+        details->openFileIds.reserve(info.openFiles.size());
+        for (const auto& file : info.openFiles) {
+            details->openFileIds.push_back(stringTable.intern(file));
+        }
+        details->networkConnections = info.networkConnections;
+        details->environment.reserve(info.environmentVariables.size());
+        for (const auto& env : info.environmentVariables) {
+            details->environment.push_back(std::make_pair(stringTable.intern(env.first), env.second));
+        }
+        record.details = details;
+    }
+    
+    record.isSystemProcess = info.isSystemProcess;
+    record.hasAudioAccess = info.hasAudioAccess;
+    record.hasVideoAccess = info.hasVideoAccess;
+    record.hasNetworkAccess = info.hasNetworkAccess;
+    record.hasFileSystemAccess = info.hasFileSystemAccess;
+    record.enrichmentTier = info.enrichmentTier;
+    return record;
+}
+
+ProcessInfo AudioVideoController::expandProcess(const ProcessRecord& record) const {
+    ProcessInfo info;
+    info.pid = record.pid;
+    info.ppid = record.ppid;
+    info.executablePath = stringTable.str(record.executablePathId);
+    info.commandLine = stringTable.str(record.commandLineId);
+    info.bundleIdentifier = stringTable.str(record.bundleIdentifierId);
+    info.uid = record.uid;
+    info.gid = record.gid;
+    info.startTime = record.startTime;
+    info.cpuTime = record.cpuTime;
+    info.memoryUsage = record.memoryUsage;
+    
+    if (record.details) {
+        for (uint32_t id : record.details->openFileIds) {
+            info.openFiles.push_back(stringTable.str(id));
+        }
+        info.networkConnections = record.details->networkConnections;
+        for (const auto& env : record.details->environment) {
+            info.environmentVariables[stringTable.str(env.first)] = env.second;
+        }
+    }
+    info.librarySetId = record.librarySetId;
+    if (const LibrarySet* libraries = librarySets.get(record.librarySetId)) {
+        for (uint32_t id : libraries->libraryIds) {
+            info.loadedLibraries.push_back(stringTable.str(id));
+        }
+    }
+    info.isSystemProcess = record.isSystemProcess;
+    info.hasAudioAccess = record.hasAudioAccess;
+    info.hasVideoAccess = record.hasVideoAccess;
+    info.hasNetworkAccess = record.hasNetworkAccess;
+    info.hasFileSystemAccess = record.hasFileSystemAccess;
+    info.enrichmentTier = record.enrichmentTier;
+    return info;
+}
@@ -0,0 +1,229 @@
+// Tiered process enrichment: cheap fields inline, expensive ones later or on demand
+#include "AudioVideoController.h"
+#include <string.h>
+#include <time.h>
+
+bool AudioVideoController::startProcessEnricher() {
+    enrichmentRunning = true;
+    if (pthread_create(&enrichmentThread, nullptr, processEnrichmentThread, this) != 0) {
+        syslog(LOG_ERR, "Failed to start process enrichment thread");
+        enrichmentRunning = false;
+        return false;
+    }
+    return true;
+}
+
+void AudioVideoController::stopProcessEnricher() {
+    pthread_mutex_lock(&enrichmentMutex);
+    if (!enrichmentRunning) {
+        pthread_mutex_unlock(&enrichmentMutex);
+        return;
+    }
+    enrichmentRunning = false;
+    pthread_cond_signal(&enrichmentCond);
+    pthread_mutex_unlock(&enrichmentMutex);
+    
+    pthread_join(enrichmentThread, nullptr);
+    
+    for (int tier = 0; tier < ENRICH_TIER_COUNT; tier++) {
+        enrichmentQueues[tier].clear();
+    }
+}
+
+void AudioVideoController::scheduleEnrichment(pid_t pid, uint64_t kernelStartUsec, uint8_t tier,
+                                              uint64_t delayMs, const uint8_t* cdhash) {
+    EnrichmentTask task = EnrichmentTask();
+    task.pid = pid;
+    task.kernelStartUsec = kernelStartUsec;
+    task.notBefore = mach_absolute_time() + nanosecondsToMach(delayMs * 1000000ull);
+    task.tier = tier;
+    if (cdhash) {
+        memcpy(task.cdhash, cdhash, sizeof(task.cdhash));
+    }
+    
+    pthread_mutex_lock(&enrichmentMutex);
+    std::deque<EnrichmentTask>& queue = enrichmentQueues[tier];
+    if (!enrichmentRunning || queue.size() >= ENRICH_QUEUE_MAX) {
+        pthread_mutex_unlock(&enrichmentMutex);
+        enrichmentDropped[tier].fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    
+    // Each tier has a fixed delay, so appending keeps the queue ordered by notBefore
+    queue.push_back(task);
+    if (queue.size() == 1) {
+        pthread_cond_signal(&enrichmentCond);
+    }
+    pthread_mutex_unlock(&enrichmentMutex);
+    
+    enrichmentQueued[tier].fetch_add(1, std::memory_order_relaxed);
+}
+
+void* AudioVideoController::processEnrichmentThread(void* arg) {
+    AudioVideoController* controller = (AudioVideoController*)arg;
+    
+    pthread_mutex_lock(&controller->enrichmentMutex);
+    while (controller->enrichmentRunning) {
+        // Lower tiers first: they're cheap and unblock consumers of basic fields
+        EnrichmentTask task;
+        bool ready = false;
+        uint64_t nextDue = 0;
+        uint64_t now = mach_absolute_time();
+        
+        for (int tier = 1; tier < ENRICH_TIER_COUNT && !ready; tier++) {
+            std::deque<EnrichmentTask>& queue = controller->enrichmentQueues[tier];
+            if (queue.empty()) {
+                continue;
+            }
+            if (queue.front().notBefore <= now) {
+                task = queue.front();
+                queue.pop_front();
+                ready = true;
+            } else if (nextDue == 0 || queue.front().notBefore < nextDue) {
+                nextDue = queue.front().notBefore;
+            }
+        }
+        
+        if (ready) {
+            pthread_mutex_unlock(&controller->enrichmentMutex);
+            controller->enrichProcess(task);
+            pthread_mutex_lock(&controller->enrichmentMutex);
+            continue;
+        }
+        
+        if (nextDue == 0) {
+            pthread_cond_wait(&controller->enrichmentCond, &controller->enrichmentMutex);
+        } else {
+            uint64_t waitNs = machToNanoseconds(nextDue - now);
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += waitNs / 1000000000ull;
+            deadline.tv_nsec += waitNs % 1000000000ull;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&controller->enrichmentCond, &controller->enrichmentMutex, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&controller->enrichmentMutex);
+    
+    return nullptr;
+}
+
+bool AudioVideoController::enrichProcess(const EnrichmentTask& task) {
+    MetricsInterval interval(METRIC_INTERVAL_ENRICHMENT, task.tier);
+    uint64_t started = mach_absolute_time();
+    pid_t pid = task.pid;
+    
+    // Short-lived processes are usually gone by now; that's the point of waiting
+    ProcessRecord current;
+    bool alive = processTable.lookup(pid, &current) &&
+                 ProcessTable::matches(current, 0, task.kernelStartUsec);
+    uint8_t currentTier = alive ? current.enrichmentTier : 0;
+    
+    if (!alive) {
+        enrichmentSkipped[task.tier].fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (currentTier >= task.tier) {
+        return true;
+    }
+    
+    // Tier 1: a single proc_pidinfo call
+    struct proc_taskallinfo taskInfo;
+    bool haveTaskInfo = getProcessTaskInfo(pid, &taskInfo);
+    
+    // Tier 2: fds, dyld images and environment, built before anything is published
+    ProcessRecord details = ProcessRecord();
+    std::shared_ptr<ProcessDetails> extra;
+    uint32_t capabilities = 0;
+    if (task.tier >= 2) {
+        extra = std::make_shared<ProcessDetails>();
+        for (const auto& env : getProcessEnvironment(pid)) {
+            extra->environment.push_back(std::make_pair(stringTable.intern(env.first), env.second));
+        }
+        
+        // Usually a cache hit: one remote read to confirm the image count
+        details.librarySetId = getProcessLibrarySet(pid, task.cdhash);
+        capabilities = librarySets.capabilities(details.librarySetId);
+        
+        // Fds go straight from the snapshot into the string table, no per-fd std::string
+        static thread_local FdSnapshot snapshot;
+        bool captured;
+        {
+            MetricsCallTimer timer(metrics, METRIC_CALL_DESCRIPTORS);
+            captured = snapshot.capture(pid);
+            if (!captured) {
+                timer.failed();
+            }
+        }
+        if (captured) {
+            extra->openFileIds.reserve(snapshot.files().size());
+            for (const auto& file : snapshot.files()) {
+                extra->openFileIds.push_back(stringTable.intern(snapshot.path(file), file.pathLength));
+            }
+            
+            char connStr[256];
+            extra->networkConnections.reserve(snapshot.sockets().size());
+            for (const auto& socket : snapshot.sockets()) {
+                size_t length = formatSocketEntry(socket, connStr, sizeof(connStr));
+                extra->networkConnections.emplace_back(connStr, length);
+            }
+        }
+        details.details = extra;
+    }
+    
+    // Publishes a new record; readers keep whichever one they already copied
+    alive = processTable.update(pid, 0, task.kernelStartUsec, [&](ProcessRecord& record) {
+        if (haveTaskInfo) {
+            record.memoryUsage = taskInfo.ptinfo.pti_resident_size;
+            record.cpuTime = taskInfo.ptinfo.pti_total_user + taskInfo.ptinfo.pti_total_system;
+            if (record.kernelStartUsec == 0) {
+                record.kernelStartUsec = (uint64_t)taskInfo.pbsd.pbi_start_tvsec * 1000000ull +
+                                         taskInfo.pbsd.pbi_start_tvusec;
+            }
+        }
+        if (task.tier >= 2) {
+            record.details = extra;
+            record.librarySetId = details.librarySetId;
+            record.hasAudioAccess = (capabilities & LIBRARY_CAP_AUDIO) != 0;
+            record.hasVideoAccess = (capabilities & LIBRARY_CAP_VIDEO) != 0;
+            record.hasNetworkAccess = (capabilities & LIBRARY_CAP_NETWORK) != 0;
+            
+            // The details rows share the same immutable IDs
+            details.pid = record.pid;
+            details.startTime = record.startTime;
+        }
+        if (record.enrichmentTier < task.tier) {
+            record.enrichmentTier = task.tier;
+        }
+    });
+    
+    if (!alive) {
+        enrichmentSkipped[task.tier].fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    if (task.tier >= 2) {
+        logProcessDetails(details);
+    }
+    
+    enrichmentLatency[task.tier].record(machToNanoseconds(mach_absolute_time() - started));
+    enrichmentCompleted[task.tier].fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+std::vector<EnrichmentTierStats> AudioVideoController::getEnrichmentStats() const {
+    std::vector<EnrichmentTierStats> stats;
+    
+    for (int tier = 0; tier < ENRICH_TIER_COUNT; tier++) {
+        EnrichmentTierStats entry;
+        entry.latency = enrichmentLatency[tier].summarize();
+        entry.queued = enrichmentQueued[tier].load(std::memory_order_relaxed);
+        entry.completed = enrichmentCompleted[tier].load(std::memory_order_relaxed);
+        entry.skipped = enrichmentSkipped[tier].load(std::memory_order_relaxed);
+        entry.dropped = enrichmentDropped[tier].load(std::memory_order_relaxed);
+        stats.push_back(entry);
+    }
+    
+    return stats;
+}
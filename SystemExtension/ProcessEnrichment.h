@@ -0,0 +1,40 @@
+#ifndef ProcessEnrichment_h
+#define ProcessEnrichment_h
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "LatencyHistogram.h"
+
+// Only processes alive this long after EXEC get tier 2 enrichment automatically
+#ifndef ENRICH_TIER2_DELAY_MS
+#define ENRICH_TIER2_DELAY_MS 2000
+#endif
+
+// Pending tasks per tier beyond this are dropped; the process stays at its
+// current tier until someone asks for it
+#ifndef ENRICH_QUEUE_MAX
+#define ENRICH_QUEUE_MAX 8192
+#endif
+
+// Tier 0: fields carried by the ES message itself, no syscalls
+// Tier 1: proc_pidinfo task and BSD info, done asynchronously
+// Tier 2: fds, dyld image list and environment, delayed or on demand
+#define ENRICH_TIER_COUNT 3
+
+struct EnrichmentTask {
+    pid_t pid;
+    uint64_t kernelStartUsec;   // identity check; the pid may be reused before we run
+    uint64_t notBefore;         // mach time
+    uint8_t tier;
+    uint8_t cdhash[20];         // from the EXEC message; all zero if unknown
+};
+
+struct EnrichmentTierStats {
+    LatencySummary latency;
+    uint64_t queued;
+    uint64_t completed;
+    uint64_t skipped;           // process exited (or pid reused) before the task ran
+    uint64_t dropped;
+};
+
+#endif
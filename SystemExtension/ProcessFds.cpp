@@ -0,0 +1,156 @@
+// Single-pass file descriptor enumeration
+#include "ProcessFds.h"
+#include <libproc.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdio.h>
+
+// The raw fd list, reused by every snapshot taken on this thread
+static thread_local std::vector<struct proc_fdinfo> fdList;
+
+// One PROC_PIDLISTFDS in the common case; a completely full buffer may be truncated,
+// so only then ask the kernel for the size and read again
+static int listProcessFds(pid_t pid) {
+    if (fdList.empty()) {
+        fdList.resize(FD_SNAPSHOT_INITIAL_FDS);
+    }
+    
+    for (int attempt = 0; attempt < 4; attempt++) {
+        int capacity = (int)(fdList.size() * sizeof(struct proc_fdinfo));
+        int bytes = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, fdList.data(), capacity);
+        if (bytes <= 0) {
+            return -1;
+        }
+        if (bytes < capacity) {
+            return bytes / (int)sizeof(struct proc_fdinfo);
+        }
+        
+        int needed = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, nullptr, 0);
+        if (needed <= 0) {
+            return -1;
+        }
+        size_t entries = (size_t)needed / sizeof(struct proc_fdinfo) + 32;
+        fdList.resize(entries > fdList.size() * 2 ? entries : fdList.size() * 2);
+    }
+    
+    return (int)fdList.size();
+}
+
+static void copyAddress(const struct in_sockinfo& in, bool remote, uint8_t* address) {
+    if (in.insi_vflag & INI_IPV4) {
+        // Store as v4-mapped so both families share one layout
+        memset(address, 0, 10);
+        address[10] = 0xff;
+        address[11] = 0xff;
+        const struct in_addr& v4 = remote ? in.insi_faddr.ina_46.i46a_addr4
+                                          : in.insi_laddr.ina_46.i46a_addr4;
+        memcpy(address + 12, &v4, 4);
+    } else {
+        const struct in6_addr& v6 = remote ? in.insi_faddr.ina_6 : in.insi_laddr.ina_6;
+        memcpy(address, &v6, 16);
+    }
+}
+
+bool FdSnapshot::capture(pid_t pid, bool withFiles) {
+    fileEntries.clear();
+    socketEntries.clear();
+    paths.clear();
+    totalFds = 0;
+    
+    int count = listProcessFds(pid);
+    if (count < 0) {
+        return false;
+    }
+    totalFds = (size_t)count;
+    
+    // Both views in one walk; only vnodes and sockets cost a second syscall
+    for (int i = 0; i < count; i++) {
+        const struct proc_fdinfo& fd = fdList[i];
+        
+        if (fd.proc_fdtype == PROX_FDTYPE_VNODE && withFiles) {
+            struct vnode_fdinfowithpath vnodeInfo;
+            if (proc_pidfdinfo(pid, fd.proc_fd, PROC_PIDFDVNODEPATHINFO,
+                               &vnodeInfo, sizeof(vnodeInfo)) <= 0) {
+                continue;
+            }
+            
+            size_t length = strnlen(vnodeInfo.pvip.vip_path, sizeof(vnodeInfo.pvip.vip_path));
+            FdFileEntry entry;
+            entry.fd = fd.proc_fd;
+            entry.pathOffset = (uint32_t)paths.size();
+            entry.pathLength = (uint32_t)length;
+            entry.device = vnodeInfo.pvip.vip_vi.vi_stat.vst_dev;
+            entry.inode = vnodeInfo.pvip.vip_vi.vi_stat.vst_ino;
+            paths.insert(paths.end(), vnodeInfo.pvip.vip_path, vnodeInfo.pvip.vip_path + length);
+            paths.push_back('\0');
+            fileEntries.push_back(entry);
+        } else if (fd.proc_fdtype == PROX_FDTYPE_SOCKET) {
+            struct socket_fdinfo socketInfo;
+            if (proc_pidfdinfo(pid, fd.proc_fd, PROC_PIDFDSOCKETINFO,
+                               &socketInfo, sizeof(socketInfo)) <= 0) {
+                continue;
+            }
+            
+            const struct socket_info& psi = socketInfo.psi;
+            if (psi.soi_family != AF_INET && psi.soi_family != AF_INET6) {
+                continue;
+            }
+            if (psi.soi_kind != SOCKINFO_TCP && psi.soi_kind != SOCKINFO_IN) {
+                continue;
+            }
+            
+            // TCP sockets carry the same in_sockinfo wrapped with the connection state
+            const struct in_sockinfo& in = psi.soi_kind == SOCKINFO_TCP ? psi.soi_proto.pri_tcp.tcpsi_ini
+                                                                         : psi.soi_proto.pri_in;
+            FdSocketEntry entry;
+            entry.fd = fd.proc_fd;
+            entry.tcpState = psi.soi_kind == SOCKINFO_TCP ? psi.soi_proto.pri_tcp.tcpsi_state : -1;
+            entry.family = (uint8_t)psi.soi_family;
+            entry.protocol = (uint8_t)psi.soi_protocol;
+            entry.localPort = ntohs((uint16_t)in.insi_lport);
+            entry.remotePort = ntohs((uint16_t)in.insi_fport);
+            copyAddress(in, false, entry.localAddress);
+            copyAddress(in, true, entry.remoteAddress);
+            socketEntries.push_back(entry);
+        }
+    }
+    
+    return true;
+}
+
+static const uint8_t v4Mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+bool formatSocketAddress(const uint8_t* address, char* buffer, size_t size) {
+    if (memcmp(address, v4Mapped, sizeof(v4Mapped)) == 0) {
+        return inet_ntop(AF_INET, address + 12, buffer, (socklen_t)size) != nullptr;
+    }
+    return inet_ntop(AF_INET6, address, buffer, (socklen_t)size) != nullptr;
+}
+
+static void formatAddress(const uint8_t* address, uint16_t port, char* buffer, size_t size) {
+    char host[INET6_ADDRSTRLEN];
+    formatSocketAddress(address, host, sizeof(host));
+    
+    if (memcmp(address, v4Mapped, sizeof(v4Mapped)) == 0) {
+        snprintf(buffer, size, "%s:%u", host, port);
+    } else {
+        snprintf(buffer, size, "[%s]:%u", host, port);
+    }
+}
+
+size_t formatSocketEntry(const FdSocketEntry& entry, char* buffer, size_t size) {
+    char local[INET6_ADDRSTRLEN + 8];
+    char remote[INET6_ADDRSTRLEN + 8];
+    formatAddress(entry.localAddress, entry.localPort, local, sizeof(local));
+    formatAddress(entry.remoteAddress, entry.remotePort, remote, sizeof(remote));
+    
+    const char* protocol = entry.protocol == IPPROTO_TCP ? "TCP" :
+                           entry.protocol == IPPROTO_UDP ? "UDP" : "IP";
+    int length = snprintf(buffer, size, "%s %s -> %s", protocol, local, remote);
+    if (length < 0) {
+        return 0;
+    }
+    return (size_t)length < size ? (size_t)length : size - 1;
+}
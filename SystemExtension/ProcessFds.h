@@ -0,0 +1,64 @@
+#ifndef ProcessFds_h
+#define ProcessFds_h
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Initial fd list capacity; grown on demand and kept per thread
+#ifndef FD_SNAPSHOT_INITIAL_FDS
+#define FD_SNAPSHOT_INITIAL_FDS 256
+#endif
+
+// An open vnode; the path lives in the snapshot's arena
+struct FdFileEntry {
+    int32_t fd;
+    uint32_t pathOffset;
+    uint32_t pathLength;
+    uint64_t device;
+    uint64_t inode;
+};
+
+// An IPv4 or IPv6 socket; addresses are IPv6 or v4-mapped, ports in host order
+struct FdSocketEntry {
+    int32_t fd;
+    int32_t tcpState;           // -1 unless protocol is TCP
+    uint8_t family;
+    uint8_t protocol;
+    uint16_t localPort;
+    uint16_t remotePort;
+    uint8_t localAddress[16];
+    uint8_t remoteAddress[16];
+};
+
+// Everything interesting about a process's descriptors from one PROC_PIDLISTFDS
+// call. Keep one per thread and reuse it: capture() only reallocates when a
+// process has more fds or longer paths than any seen before.
+class FdSnapshot {
+public:
+    FdSnapshot() : totalFds(0) {}
+    
+    // False if the process is gone or its fd list couldn't be read; without
+    // files only sockets cost a second syscall
+    bool capture(pid_t pid, bool withFiles = true);
+    
+    const std::vector<FdFileEntry>& files() const { return fileEntries; }
+    const std::vector<FdSocketEntry>& sockets() const { return socketEntries; }
+    const char* path(const FdFileEntry& entry) const { return paths.data() + entry.pathOffset; }
+    size_t fdCount() const { return totalFds; }
+
+private:
+    std::vector<FdFileEntry> fileEntries;
+    std::vector<FdSocketEntry> socketEntries;
+    std::vector<char> paths;
+    size_t totalFds;
+};
+
+// Just the host part, v4-mapped addresses in dotted form; false if it doesn't fit
+bool formatSocketAddress(const uint8_t* address, char* buffer, size_t size);
+
+// "TCP 10.0.0.2:50123 -> 17.253.144.10:443"; returns the length written
+size_t formatSocketEntry(const FdSocketEntry& entry, char* buffer, size_t size);
+
+#endif
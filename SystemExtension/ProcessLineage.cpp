@@ -0,0 +1,448 @@
+// In-memory process tree and the process_lineage tables
+#include "ProcessLineage.h"
+#include <stdio.h>
+#include <syslog.h>
+#include <algorithm>
+
+ProcessLineage::ProcessLineage() : freeList(NONE), running(0), collected(0), untracked(0), reconciled(0) {
+    pthread_rwlock_init(&lock, nullptr);
+}
+
+ProcessLineage::~ProcessLineage() {
+    pthread_rwlock_destroy(&lock);
+}
+
+// Called with the lock held
+uint32_t ProcessLineage::find(pid_t pid, uint32_t pidVersion) const {
+    if (pidVersion == 0) {
+        auto current = byPid.find(pid);
+        return current != byPid.end() ? current->second : NONE;
+    }
+    auto found = byIdentity.find(identity(pid, pidVersion));
+    return found != byIdentity.end() ? found->second : NONE;
+}
+
+// Called with the write lock held; NONE if the tree is full
+uint32_t ProcessLineage::add(pid_t pid, uint32_t pidVersion, uint64_t startUsec, uint32_t parent,
+                             LineageRelation relation, uint32_t executablePathId, int64_t now,
+                             std::vector<LineageRow>* rows) {
+    uint32_t index;
+    if (freeList != NONE) {
+        index = freeList;
+        freeList = nodes[index].nextSibling;
+    } else if (nodes.size() < LINEAGE_MAX_NODES) {
+        index = (uint32_t)nodes.size();
+        nodes.push_back(Node());
+    } else {
+        untracked++;
+        return NONE;
+    }
+    
+    Node& node = nodes[index];
+    node.pid = pid;
+    node.pidVersion = pidVersion;
+    node.parent = parent;
+    node.firstChild = NONE;
+    node.prevSibling = NONE;
+    node.nextSibling = NONE;
+    node.executablePathId = executablePathId;
+    node.depth = 0;
+    node.relation = relation;
+    node.startUsec = startUsec;
+    node.started = now;
+    node.exited = 0;
+    
+    if (parent != NONE) {
+        Node& parentNode = nodes[parent];
+        node.depth = parentNode.depth + 1;
+        node.nextSibling = parentNode.firstChild;
+        if (parentNode.firstChild != NONE) {
+            nodes[parentNode.firstChild].prevSibling = index;
+        }
+        parentNode.firstChild = index;
+    }
+    
+    byIdentity[identity(pid, pidVersion)] = index;
+    byPid[pid] = index;
+    running++;
+    
+    LineageRow row;
+    row.kind = LINEAGE_ROW_START;
+    row.relation = relation;
+    row.pid = pid;
+    row.pidVersion = pidVersion;
+    row.parentPid = parent != NONE ? nodes[parent].pid : -1;
+    row.parentPidVersion = parent != NONE ? nodes[parent].pidVersion : 0;
+    row.executablePathId = executablePathId;
+    row.time = now;
+    rows->push_back(row);
+    return index;
+}
+
+uint32_t ProcessLineage::findOrAddRoot(pid_t pid, uint32_t pidVersion, uint64_t startUsec,
+                                       uint32_t executablePathId, int64_t now, std::vector<LineageRow>* rows) {
+    uint32_t index = find(pid, pidVersion);
+    if (index == NONE) {
+        index = add(pid, pidVersion, startUsec, NONE, LINEAGE_ROOT, executablePathId, now, rows);
+    } else if (nodes[index].startUsec == 0) {
+        nodes[index].startUsec = startUsec;
+    }
+    return index;
+}
+
+void ProcessLineage::markExited(uint32_t index, int64_t now, std::vector<LineageRow>* rows) {
+    Node& node = nodes[index];
+    if (node.exited != 0) {
+        return;
+    }
+    node.exited = now;
+    running--;
+    
+    LineageRow row = LineageRow();
+    row.kind = LINEAGE_ROW_EXIT;
+    row.pid = node.pid;
+    row.pidVersion = node.pidVersion;
+    row.time = now;
+    rows->push_back(row);
+}
+
+// Frees the node if it and all under it have exited, then tries its parent
+void ProcessLineage::collect(uint32_t index) {
+    while (index != NONE && nodes[index].exited != 0 && nodes[index].firstChild == NONE) {
+        Node& node = nodes[index];
+        uint32_t parent = node.parent;
+        if (node.prevSibling != NONE) {
+            nodes[node.prevSibling].nextSibling = node.nextSibling;
+        } else if (parent != NONE) {
+            nodes[parent].firstChild = node.nextSibling;
+        }
+        if (node.nextSibling != NONE) {
+            nodes[node.nextSibling].prevSibling = node.prevSibling;
+        }
+        
+        byIdentity.erase(identity(node.pid, node.pidVersion));
+        auto current = byPid.find(node.pid);
+        if (current != byPid.end() && current->second == index) {
+            byPid.erase(current);
+        }
+        node.nextSibling = freeList;
+        freeList = index;
+        collected++;
+        index = parent;
+    }
+}
+
+void ProcessLineage::fork(pid_t parentPid, uint32_t parentPidVersion, uint64_t parentStartUsec,
+                          uint32_t parentPathId, pid_t childPid, uint32_t childPidVersion, uint64_t childStartUsec,
+                          int64_t now, std::vector<LineageRow>* rows) {
+    pthread_rwlock_wrlock(&lock);
+    uint32_t parent = findOrAddRoot(parentPid, parentPidVersion, parentStartUsec, parentPathId, now, rows);
+    if (parent != NONE && find(childPid, childPidVersion) == NONE) {
+        // The child runs the parent's image until it execs
+        add(childPid, childPidVersion, childStartUsec, parent, LINEAGE_FORK, nodes[parent].executablePathId,
+            now, rows);
+    }
+    pthread_rwlock_unlock(&lock);
+}
+
+void ProcessLineage::exec(pid_t pid, uint32_t oldPidVersion, uint64_t startUsec, uint32_t oldPathId,
+                          uint32_t newPidVersion, uint32_t newPathId, int64_t now, std::vector<LineageRow>* rows) {
+    pthread_rwlock_wrlock(&lock);
+    uint32_t old = findOrAddRoot(pid, oldPidVersion, startUsec, oldPathId, now, rows);
+    if (old == NONE) {
+        pthread_rwlock_unlock(&lock);
+        return;
+    }
+    
+    if (newPidVersion == oldPidVersion) {
+        nodes[old].executablePathId = newPathId;
+        LineageRow row = LineageRow();
+        row.kind = LINEAGE_ROW_IMAGE;
+        row.pid = pid;
+        row.pidVersion = oldPidVersion;
+        row.executablePathId = newPathId;
+        row.time = now;
+        rows->push_back(row);
+    } else if (add(pid, newPidVersion, startUsec, old, LINEAGE_EXEC, newPathId, now, rows) != NONE) {
+        // The old image is gone; its node stays for as long as the new one does
+        markExited(old, now, rows);
+    }
+    pthread_rwlock_unlock(&lock);
+}
+
+void ProcessLineage::exit(pid_t pid, uint32_t pidVersion, int64_t now, std::vector<LineageRow>* rows) {
+    pthread_rwlock_wrlock(&lock);
+    uint32_t index = find(pid, pidVersion);
+    if (index != NONE) {
+        markExited(index, now, rows);
+        collect(index);
+    }
+    pthread_rwlock_unlock(&lock);
+}
+
+void ProcessLineage::reconcile(const std::vector<ProcessIdentity>& running, uint64_t sampledUsec, int64_t now,
+                               std::vector<LineageRow>* rows) {
+    pthread_rwlock_wrlock(&lock);
+    
+    // Every node, not just each pid's current one: a process whose EXIT was
+    // missed has usually lost its pid to the next process by now
+    std::vector<uint32_t> gone;
+    for (const auto& current : byIdentity) {
+        const Node& node = nodes[current.second];
+        if (node.exited != 0 || node.startUsec == 0 || node.startUsec >= sampledUsec) {
+            continue;
+        }
+        auto found = std::lower_bound(running.begin(), running.end(), node.pid,
+                                      [](const ProcessIdentity& process, pid_t pid) { return process.pid < pid; });
+        if (found == running.end() || found->pid != node.pid || found->startUsec != node.startUsec) {
+            gone.push_back(current.second);
+        }
+    }
+    
+    // Collecting edits byPid, so only once the walk is done. Freeing one node
+    // can free an exited parent that is also in the list; those are skipped.
+    for (uint32_t index : gone) {
+        markExited(index, now, rows);
+    }
+    for (uint32_t index : gone) {
+        if (find(nodes[index].pid, nodes[index].pidVersion) == index) {
+            collect(index);
+        }
+    }
+    reconciled += gone.size();
+    pthread_rwlock_unlock(&lock);
+}
+
+LineageEntry ProcessLineage::entry(uint32_t index, uint32_t depth) const {
+    const Node& node = nodes[index];
+    LineageEntry entry;
+    entry.pid = node.pid;
+    entry.pidVersion = node.pidVersion;
+    entry.parentPid = node.parent != NONE ? nodes[node.parent].pid : -1;
+    entry.parentPidVersion = node.parent != NONE ? nodes[node.parent].pidVersion : 0;
+    entry.relation = node.relation;
+    entry.executablePathId = node.executablePathId;
+    entry.depth = depth;
+    entry.started = node.started;
+    entry.exited = node.exited;
+    return entry;
+}
+
+bool ProcessLineage::ancestors(pid_t pid, uint32_t pidVersion, std::vector<LineageEntry>* entries) const {
+    pthread_rwlock_rdlock(&lock);
+    uint32_t index = find(pid, pidVersion);
+    bool found = index != NONE;
+    for (uint32_t distance = 0; index != NONE; distance++) {
+        entries->push_back(entry(index, distance));
+        index = nodes[index].parent;
+    }
+    pthread_rwlock_unlock(&lock);
+    return found;
+}
+
+bool ProcessLineage::descendants(pid_t pid, uint32_t pidVersion, size_t limit,
+                                 std::vector<LineageEntry>* entries) const {
+    pthread_rwlock_rdlock(&lock);
+    uint32_t top = find(pid, pidVersion);
+    if (top == NONE) {
+        pthread_rwlock_unlock(&lock);
+        return false;
+    }
+    
+    // Depth first, without recursion: down to the first child, else across, else back up
+    uint32_t baseDepth = nodes[top].depth;
+    uint32_t index = top;
+    while (index != NONE && entries->size() < limit) {
+        entries->push_back(entry(index, nodes[index].depth - baseDepth));
+        if (nodes[index].firstChild != NONE) {
+            index = nodes[index].firstChild;
+            continue;
+        }
+        while (index != top && nodes[index].nextSibling == NONE) {
+            index = nodes[index].parent;
+        }
+        index = index == top ? NONE : nodes[index].nextSibling;
+    }
+    pthread_rwlock_unlock(&lock);
+    return true;
+}
+
+void ProcessLineage::addStringRoots(std::vector<uint32_t>* roots) const {
+    pthread_rwlock_rdlock(&lock);
+    for (const auto& node : byIdentity) {
+        roots->push_back(nodes[node.second].executablePathId);
+    }
+    pthread_rwlock_unlock(&lock);
+}
+
+LineageStats ProcessLineage::getStats() const {
+    pthread_rwlock_rdlock(&lock);
+    LineageStats stats;
+    stats.nodes = byIdentity.size();
+    stats.running = running;
+    stats.collected = collected;
+    stats.untracked = untracked;
+    stats.reconciled = reconciled;
+    pthread_rwlock_unlock(&lock);
+    return stats;
+}
+
+const char* lineageRelationName(LineageRelation relation) {
+    switch (relation) {
+        case LINEAGE_FORK:
+            return "fork";
+        case LINEAGE_EXEC:
+            return "exec";
+        default:
+            return "root";
+    }
+}
+
+static bool exec(sqlite3* database, const char* sql) {
+    char* errMsg = nullptr;
+    if (sqlite3_exec(database, sql, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        syslog(LOG_ERR, "ProcessLineage: %s", errMsg ? errMsg : sqlite3_errmsg(database));
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
+
+bool createLineageTables(sqlite3* database, time_t now) {
+    char sql[2048];
+    snprintf(sql, sizeof(sql),
+             "BEGIN IMMEDIATE;"
+             "CREATE TABLE IF NOT EXISTS process_lineage ("
+             "pid INTEGER NOT NULL,"
+             "pid_version INTEGER NOT NULL,"
+             "parent_pid INTEGER NOT NULL,"         // -1 for roots
+             "parent_pid_version INTEGER NOT NULL,"
+             "relation INTEGER NOT NULL,"           // 0 root, 1 fork, 2 exec
+             "executable_path_id INTEGER NOT NULL,"
+             "started INTEGER NOT NULL,"
+             "exited INTEGER NOT NULL DEFAULT 0,"
+             "PRIMARY KEY (pid, pid_version)"
+             ") WITHOUT ROWID;"
+             "CREATE INDEX IF NOT EXISTS idx_lineage_exited ON process_lineage(exited);"
+             // Every ancestor of every node, itself included at distance 0:
+             // descendants are a range on the key, ancestors on the index
+             "CREATE TABLE IF NOT EXISTS process_lineage_closure ("
+             "ancestor_pid INTEGER NOT NULL,"
+             "ancestor_pid_version INTEGER NOT NULL,"
+             "distance INTEGER NOT NULL,"
+             "descendant_pid INTEGER NOT NULL,"
+             "descendant_pid_version INTEGER NOT NULL,"
+             "PRIMARY KEY (ancestor_pid, ancestor_pid_version, distance, descendant_pid, descendant_pid_version)"
+             ") WITHOUT ROWID;"
+             "CREATE INDEX IF NOT EXISTS idx_lineage_descendant "
+             "ON process_lineage_closure(descendant_pid, descendant_pid_version, distance);"
+             "UPDATE process_lineage SET exited = %lld WHERE exited = 0;"
+             "COMMIT;",
+             (long long)now);
+    
+    if (!exec(database, sql)) {
+        exec(database, "ROLLBACK;");
+        return false;
+    }
+    return true;
+}
+
+bool expireLineage(sqlite3* database, time_t now, uint64_t* removed) {
+    long long cutoff = (long long)now - (long long)LINEAGE_DAYS * 86400;
+    char sql[2048];
+    snprintf(sql, sizeof(sql),
+             "BEGIN IMMEDIATE;"
+             "CREATE TEMP TABLE lineage_expired AS SELECT pid, pid_version FROM process_lineage l "
+             "WHERE l.exited != 0 AND l.exited < %lld AND NOT EXISTS ("
+             "SELECT 1 FROM process_lineage_closure c JOIN process_lineage d "
+             "ON d.pid = c.descendant_pid AND d.pid_version = c.descendant_pid_version "
+             "WHERE c.ancestor_pid = l.pid AND c.ancestor_pid_version = l.pid_version AND c.distance > 0 "
+             "AND (d.exited = 0 OR d.exited >= %lld));"
+             // Every pair with an expired descendant; expired ancestors only have expired descendants
+             "DELETE FROM process_lineage_closure WHERE (descendant_pid, descendant_pid_version) IN "
+             "(SELECT pid, pid_version FROM temp.lineage_expired);"
+             "DELETE FROM process_lineage WHERE (pid, pid_version) IN "
+             "(SELECT pid, pid_version FROM temp.lineage_expired);"
+             "DROP TABLE temp.lineage_expired;"
+             "COMMIT;",
+             cutoff, cutoff);
+    
+    if (!exec(database, sql)) {
+        exec(database, "ROLLBACK;");
+        exec(database, "DROP TABLE IF EXISTS temp.lineage_expired;");
+        return false;
+    }
+    *removed = (uint64_t)sqlite3_changes(database);
+    return true;
+}
+
+// Joined with the node the closure row points at; column 8 is the distance
+static bool readLineage(sqlite3* database, const char* sql, pid_t pid, uint32_t pidVersion, size_t limit,
+                        std::vector<LineageEntry>* entries, std::string* error) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        *error = sqlite3_errmsg(database);
+        return false;
+    }
+    sqlite3_bind_int(stmt, 1, pid);
+    sqlite3_bind_int64(stmt, 2, pidVersion);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64)limit);
+    
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        LineageEntry entry;
+        entry.pid = sqlite3_column_int(stmt, 0);
+        entry.pidVersion = (uint32_t)sqlite3_column_int64(stmt, 1);
+        entry.parentPid = sqlite3_column_int(stmt, 2);
+        entry.parentPidVersion = (uint32_t)sqlite3_column_int64(stmt, 3);
+        entry.relation = (LineageRelation)sqlite3_column_int(stmt, 4);
+        entry.executablePathId = (uint32_t)sqlite3_column_int64(stmt, 5);
+        entry.started = sqlite3_column_int64(stmt, 6);
+        entry.exited = sqlite3_column_int64(stmt, 7);
+        entry.depth = (uint32_t)sqlite3_column_int(stmt, 8);
+        entries->push_back(entry);
+    }
+    if (result != SQLITE_DONE) {
+        *error = sqlite3_errmsg(database);
+    }
+    sqlite3_finalize(stmt);
+    return result == SQLITE_DONE;
+}
+
+bool queryLineage(sqlite3* database, pid_t pid, uint32_t pidVersion, size_t limit,
+                  std::vector<LineageEntry>* ancestors, std::vector<LineageEntry>* descendants,
+                  std::string* error) {
+    // Without a pidversion, the last process seen with the pid
+    if (pidVersion == 0) {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(database, "SELECT pid_version FROM process_lineage WHERE pid = ? "
+                               "ORDER BY started DESC, pid_version DESC LIMIT 1", -1, &stmt, nullptr) != SQLITE_OK) {
+            *error = sqlite3_errmsg(database);
+            return false;
+        }
+        sqlite3_bind_int(stmt, 1, pid);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            pidVersion = (uint32_t)sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+        if (pidVersion == 0) {
+            *error = "pid " + std::to_string(pid) + " is not in the lineage history";
+            return false;
+        }
+    }
+    
+    static const char* kColumns =
+        "SELECT l.pid, l.pid_version, l.parent_pid, l.parent_pid_version, l.relation, "
+        "l.executable_path_id, l.started, l.exited, c.distance FROM process_lineage_closure c "
+        "JOIN process_lineage l ON ";
+    std::string up = std::string(kColumns) +
+        "l.pid = c.ancestor_pid AND l.pid_version = c.ancestor_pid_version "
+        "WHERE c.descendant_pid = ?1 AND c.descendant_pid_version = ?2 ORDER BY c.distance LIMIT ?3";
+    std::string down = std::string(kColumns) +
+        "l.pid = c.descendant_pid AND l.pid_version = c.descendant_pid_version "
+        "WHERE c.ancestor_pid = ?1 AND c.ancestor_pid_version = ?2 ORDER BY c.distance LIMIT ?3";
+    
+    // Ancestry is bounded by depth, not by the limit
+    return readLineage(database, up.c_str(), pid, pidVersion, SIZE_MAX >> 1, ancestors, error) &&
+           readLineage(database, down.c_str(), pid, pidVersion, limit, descendants, error);
+}
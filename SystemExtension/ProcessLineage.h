@@ -0,0 +1,169 @@
+#ifndef ProcessLineage_h
+#define ProcessLineage_h
+
+#include <sqlite3.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <time.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "ProcessTracker.h"
+
+// Who started whom. Every process seen in a FORK, EXEC or EXIT is a node
+// keyed by (pid, pidversion), linked to its parent and its children. Exec
+// bumps the pidversion, so an exec is a child node of the image it replaced.
+// Ancestry is a walk up parent links, O(depth); descendants are a walk down
+// child lists. A node is freed once it and everything under it has exited.
+// Exits ES never delivered are caught by reconcile() against the kernel's
+// process list, matched on (pid, start time).
+//
+// The same tree is persisted as process_lineage, one row per node, and
+// process_lineage_closure, one row per (ancestor, descendant) pair with
+// their distance. Both directions are then an index range in SQL too, also
+// for processes long gone from memory.
+
+// Nodes kept in memory; past this, new processes aren't tracked until some exit
+#ifndef LINEAGE_MAX_NODES
+#define LINEAGE_MAX_NODES 65536
+#endif
+
+// How long a subtree stays in process_lineage once all of it has exited
+#ifndef LINEAGE_DAYS
+#define LINEAGE_DAYS 30
+#endif
+
+// How a node came from its parent
+enum LineageRelation : uint8_t {
+    LINEAGE_ROOT,                   // running before we saw it start; parent unknown
+    LINEAGE_FORK,
+    LINEAGE_EXEC                    // a new image of the same pid
+};
+
+struct LineageEntry {
+    pid_t pid;
+    uint32_t pidVersion;
+    pid_t parentPid;                // -1 for roots
+    uint32_t parentPidVersion;
+    LineageRelation relation;
+    uint32_t executablePathId;
+    uint32_t depth;                 // distance from the process asked about
+    int64_t started;                // epoch seconds
+    int64_t exited;                 // epoch seconds; 0 while running
+};
+
+// What the database writer applies to process_lineage
+enum LineageRowKind : uint8_t {
+    LINEAGE_ROW_START,              // a new node and its closure rows
+    LINEAGE_ROW_EXIT,
+    LINEAGE_ROW_IMAGE               // exec that kept its pidversion
+};
+
+struct LineageRow {
+    LineageRowKind kind;
+    LineageRelation relation;
+    pid_t pid;
+    uint32_t pidVersion;
+    pid_t parentPid;
+    uint32_t parentPidVersion;
+    uint32_t executablePathId;
+    int64_t time;
+};
+
+struct LineageStats {
+    uint64_t nodes;
+    uint64_t running;
+    uint64_t collected;             // nodes freed with their exited subtrees
+    uint64_t untracked;             // processes not tracked because the tree was full
+    uint64_t reconciled;            // exits found missing from the process list, not seen from ES
+};
+
+class ProcessLineage {
+public:
+    ProcessLineage();
+    ~ProcessLineage();
+    
+    // Each appends the rows to persist to *rows. Parents not seen before
+    // become roots; parentPathId names it if it has to be created. Start
+    // times are the kernel's in microseconds, 0 when ES didn't provide one.
+    void fork(pid_t parentPid, uint32_t parentPidVersion, uint64_t parentStartUsec, uint32_t parentPathId,
+              pid_t childPid, uint32_t childPidVersion, uint64_t childStartUsec, int64_t now,
+              std::vector<LineageRow>* rows);
+    void exec(pid_t pid, uint32_t oldPidVersion, uint64_t startUsec, uint32_t oldPathId, uint32_t newPidVersion,
+              uint32_t newPathId, int64_t now, std::vector<LineageRow>* rows);
+    void exit(pid_t pid, uint32_t pidVersion, int64_t now, std::vector<LineageRow>* rows);
+    
+    // Marks exited every running node that started before `sampledUsec` but
+    // isn't in `running` (sorted by pid), and frees what that leaves collectable.
+    // Nodes without a start time can only leave through exit().
+    void reconcile(const std::vector<ProcessIdentity>& running, uint64_t sampledUsec, int64_t now,
+                   std::vector<LineageRow>* rows);
+    
+    // pidVersion 0 means whichever process has the pid now. The process
+    // itself comes first in both: ancestors then run up to the root,
+    // descendants are in depth-first order. False if it isn't in the tree.
+    bool ancestors(pid_t pid, uint32_t pidVersion, std::vector<LineageEntry>* entries) const;
+    bool descendants(pid_t pid, uint32_t pidVersion, size_t limit, std::vector<LineageEntry>* entries) const;
+    
+    // Executable path IDs of the nodes in the tree, for string collection
+    void addStringRoots(std::vector<uint32_t>* roots) const;
+    
+    LineageStats getStats() const;
+
+private:
+    static const uint32_t NONE = UINT32_MAX;
+    
+    // Siblings are doubly linked so a child leaves its parent in O(1)
+    struct Node {
+        pid_t pid;
+        uint32_t pidVersion;
+        uint32_t parent;
+        uint32_t firstChild;
+        uint32_t nextSibling;       // also links the free list
+        uint32_t prevSibling;
+        uint32_t executablePathId;
+        uint32_t depth;             // from its root
+        LineageRelation relation;
+        uint64_t startUsec;         // kernel start time; 0 if unknown
+        int64_t started;
+        int64_t exited;
+    };
+    
+    std::vector<Node> nodes;
+    uint32_t freeList;
+    std::unordered_map<uint64_t, uint32_t> byIdentity;     // pid << 32 | pidversion
+    std::unordered_map<pid_t, uint32_t> byPid;              // the pid's current image
+    uint64_t running;
+    uint64_t collected;
+    uint64_t untracked;
+    uint64_t reconciled;
+    mutable pthread_rwlock_t lock;
+    
+    static uint64_t identity(pid_t pid, uint32_t pidVersion) {
+        return (uint64_t)(uint32_t)pid << 32 | pidVersion;
+    }
+    
+    uint32_t find(pid_t pid, uint32_t pidVersion) const;
+    uint32_t add(pid_t pid, uint32_t pidVersion, uint64_t startUsec, uint32_t parent, LineageRelation relation,
+                 uint32_t executablePathId, int64_t now, std::vector<LineageRow>* rows);
+    uint32_t findOrAddRoot(pid_t pid, uint32_t pidVersion, uint64_t startUsec, uint32_t executablePathId,
+                           int64_t now, std::vector<LineageRow>* rows);
+    void markExited(uint32_t index, int64_t now, std::vector<LineageRow>* rows);
+    void collect(uint32_t index);
+    LineageEntry entry(uint32_t index, uint32_t depth) const;
+};
+
+// Part of the schema. Nodes a previous run left running are closed at `now`,
+// since their exits were never seen.
+bool createLineageTables(sqlite3* database, time_t now);
+// Deletes subtrees whose every process exited more than LINEAGE_DAYS ago
+bool expireLineage(sqlite3* database, time_t now, uint64_t* removed);
+// The same lookups on the persisted tree; descendants come nearest first
+bool queryLineage(sqlite3* database, pid_t pid, uint32_t pidVersion, size_t limit,
+                  std::vector<LineageEntry>* ancestors, std::vector<LineageEntry>* descendants,
+                  std::string* error);
+
+const char* lineageRelationName(LineageRelation relation);
+
+#endif
@@ -1,219 +1,295 @@
 // Comprehensive process monitoring implementation
 #include "AudioVideoController.h"
 
-void AudioVideoController::handleESEvent(es_client_t* client, const es_message_t* message) {
+// Rows the lineage tree hands back for the writer; reused per worker
+static thread_local std::vector<LineageRow> lineageRows;
+
+void AudioVideoController::handleESEvent(es_client_t* client, const es_message_t* message, EsClientRole role) {
     AudioVideoController* controller = AudioVideoController::getInstance();
     
-    // Log all events for maximum visibility
-    uint64_t timestamp = mach_absolute_time();
+    // How long the message waited for this client's queue
+    EsClientState& state = controller->esClients[role];
+    uint64_t arrived = mach_absolute_time();
+    state.messages.fetch_add(1, std::memory_order_relaxed);
+    if (arrived >= message->mach_time) {
+        state.deliveryLatency.record(machToNanoseconds(arrived - message->mach_time));
+    }
+    controller->metrics.eventReceived(message);
+    
+    // AUTH events are answered first, from the policy snapshot alone, so the
+    // kernel is never waiting on enrichment or logging
+    AuthVerdict verdict = AUTH_VERDICT_NONE;
+    if (message->action_type == ES_ACTION_TYPE_AUTH) {
+        bool cacheable = false;
+        uint32_t generation;
+        verdict = controller->decideAuthVerdict(message, &cacheable, &generation);
+        controller->respondToAuthEvent(client, message, verdict, cacheable, generation, role);
+    }
+    
+    // Traced after the response so recording never adds to AUTH latency
+    if (controller->eventTrace.recording()) {
+        controller->eventTrace.record(message);
+    }
+    
+    // Hand the message to the worker pipeline; enrichment and persistence happen off the ES queue
+    controller->enqueueEvent(message, verdict);
+}
+
+void AudioVideoController::dispatchEvent(const QueuedEvent& event) {
+    const es_message_t* message = event.message;
     pid_t pid = audit_token_to_pid(message->process->audit_token);
     
     switch (message->event_type) {
         case ES_EVENT_TYPE_NOTIFY_EXEC:
-            controller->handleProcessExec(message);
+            handleProcessExec(message);
             break;
             
         case ES_EVENT_TYPE_NOTIFY_EXIT:
-            controller->handleProcessExit(message);
+            handleProcessExit(message);
             break;
             
         case ES_EVENT_TYPE_NOTIFY_FORK:
-            controller->handleFork(message);
+            handleFork(message);
             break;
             
         case ES_EVENT_TYPE_AUTH_OPEN:
         case ES_EVENT_TYPE_NOTIFY_OPEN:
-            controller->handleFileOpen(message);
+            handleFileOpen(message, event.verdict);
             break;
             
         case ES_EVENT_TYPE_NOTIFY_WRITE:
-            controller->handleFileWrite(message);
+            handleFileWrite(message);
             break;
             
         case ES_EVENT_TYPE_AUTH_UNLINK:
         case ES_EVENT_TYPE_NOTIFY_UNLINK:
-            controller->handleFileDelete(message);
+            handleFileDelete(message);
             break;
             
         case ES_EVENT_TYPE_NOTIFY_MMAP:
-            controller->handleMmap(message);
+            handleMmap(message);
             break;
             
         case ES_EVENT_TYPE_NOTIFY_SIGNAL:
-            controller->handleSignal(message);
+            handleSignal(message);
             break;
             
         case ES_EVENT_TYPE_NOTIFY_SETUID:
-            controller->handleSetuid(message);
+            handleSetuid(message);
             break;
             
         default:
-            // Log unknown events
-            syslog(LOG_DEBUG, "Unknown ES event type: %d from PID: %d", 
-                   message->event_type, pid);
+            EXT_LOG_DEBUG(LOG_CATEGORY_PROCESS, "Unhandled ES event type %d from pid %d", message->event_type, pid);
             break;
     }
-    
-    // Always allow events to proceed unless specifically blocking
-    if (message->action_type == ES_ACTION_TYPE_AUTH) {
-        es_respond_auth_result(client, message, ES_AUTH_RESULT_ALLOW, false);
-    }
 }
 
 void AudioVideoController::handleProcessExec(const es_message_t* message) {
-    pid_t pid = audit_token_to_pid(message->process->audit_token);
-    ProcessInfo processInfo = analyzeProcess(pid);
-    
-    // Comprehensive process analysis
-    processInfo.pid = pid;
-    processInfo.ppid = message->process->ppid;
-    processInfo.executablePath = std::string(message->process->executable->path.data, 
-                                           message->process->executable->path.length);
-    processInfo.uid = audit_token_to_euid(message->process->audit_token);
-    processInfo.gid = audit_token_to_rgid(message->process->audit_token);
-    processInfo.startTime = mach_absolute_time();
-    
-    // Get comprehensive process details
-    processInfo.commandLine = getProcessCommandLine(pid);
-    processInfo.openFiles = getProcessOpenFiles(pid);
-    processInfo.networkConnections = getProcessNetworkConnections(pid);
-    processInfo.loadedLibraries = getProcessLoadedLibraries(pid);
-    processInfo.environmentVariables = getProcessEnvironment(pid);
-    processInfo.memoryUsage = getProcessMemoryUsage(pid);
-    processInfo.cpuTime = getProcessCPUTime(pid);
-    processInfo.isSystemProcess = isSystemCriticalProcess(pid);
-    
-    // Check for audio/video access capabilities
-    processInfo.hasAudioAccess = false;
-    processInfo.hasVideoAccess = false;
-    processInfo.hasNetworkAccess = false;
-    processInfo.hasFileSystemAccess = true;
-    
-    // Analyze loaded libraries for capabilities
-    for (const auto& lib : processInfo.loadedLibraries) {
-        if (lib.find("AVFoundation") != std::string::npos ||
-            lib.find("CoreAudio") != std::string::npos ||
-            lib.find("AudioUnit") != std::string::npos) {
-            processInfo.hasAudioAccess = true;
-        }
-        if (lib.find("AVCapture") != std::string::npos ||
-            lib.find("CoreMediaIO") != std::string::npos) {
-            processInfo.hasVideoAccess = true;
-        }
-        if (lib.find("Network") != std::string::npos ||
-            lib.find("CFNetwork") != std::string::npos) {
-            processInfo.hasNetworkAccess = true;
+    uint64_t started = mach_absolute_time();
+    
+    // Tier 0: only what the message carries. The exec target is the new image;
+    // message->process is still the pre-exec one
+    const es_process_t* target = message->event.exec.target;
+    pid_t pid = audit_token_to_pid(target->audit_token);
+    const es_string_token_t& path = target->executable->path;
+    
+    // Reused per worker so known command lines intern without allocating
+    static thread_local std::string commandLine;
+    commandLine.clear();
+    uint32_t argCount = es_exec_arg_count(&message->event.exec);
+    for (uint32_t i = 0; i < argCount; i++) {
+        es_string_token_t arg = es_exec_arg(&message->event.exec, i);
+        if (i > 0) {
+            commandLine += ' ';
         }
+        commandLine.append(arg.data, arg.length);
     }
     
-    // Store process information
-    runningProcesses[pid] = processInfo;
+    ProcessRecord record = ProcessRecord();
+    record.pid = pid;
+    record.ppid = target->ppid;
+    record.executablePathId = stringTable.intern(path.data, path.length);
+    record.commandLineId = stringTable.intern(commandLine);
+    // Signing identifier: the bundle identifier for signed app bundles
+    record.bundleIdentifierId = stringTable.intern(target->signing_id.data, target->signing_id.length);
+    record.uid = audit_token_to_euid(target->audit_token);
+    record.gid = audit_token_to_rgid(target->audit_token);
+    record.pidVersion = audit_token_to_pidversion(target->audit_token);
+    record.startTime = mach_absolute_time();
+    if (message->version >= 3) {
+        record.kernelStartUsec = timevalToUsec(target->start_time);
+    }
+    record.isSystemProcess = target->is_platform_binary || isSystemPath(path.data, path.length);
+    record.hasFileSystemAccess = true;
+    record.enrichmentTier = 0;
     
     // Log to database
-    logProcessEvent(processInfo, "EXEC");
+    logProcessEvent(record, "EXEC");
+    uint64_t kernelStartUsec = record.kernelStartUsec;
+    
+    // Store process information; exec keeps the pid, so a known entry is an update
+    processTable.put(record);
+    
+    // The new image hangs off the one it replaced
+    const es_string_token_t& oldPath = message->process->executable->path;
+    lineageRows.clear();
+    lineage.exec(pid, audit_token_to_pidversion(message->process->audit_token), kernelStartUsec,
+                 stringTable.intern(oldPath.data, oldPath.length), record.pidVersion, record.executablePathId,
+                 time(nullptr), &lineageRows);
+    databaseWriter.appendLineage(lineageRows);
+    
+    // Cheap task info right away; the expensive tier only if the process sticks around
+    scheduleEnrichment(pid, kernelStartUsec, 1, 0, nullptr);
+    scheduleEnrichment(pid, kernelStartUsec, 2, ENRICH_TIER2_DELAY_MS, target->cdhash);
     
-    syslog(LOG_INFO, "Process EXEC: PID=%d, Path=%s, PPID=%d, UID=%d", 
-           pid, processInfo.executablePath.c_str(), processInfo.ppid, processInfo.uid);
+    enrichmentLatency[0].record(machToNanoseconds(mach_absolute_time() - started));
+    enrichmentCompleted[0].fetch_add(1, std::memory_order_relaxed);
+    
+    EXT_LOG_INFO(LOG_CATEGORY_PROCESS, "EXEC pid=%d ppid=%d uid=%d path=%{private}.*s",
+                 pid, target->ppid, audit_token_to_euid(target->audit_token), (int)path.length, path.data);
 }
 
 void AudioVideoController::handleProcessExit(const es_message_t* message) {
     pid_t pid = audit_token_to_pid(message->process->audit_token);
     
-    // Log exit event
-    if (runningProcesses.find(pid) != runningProcesses.end()) {
-        ProcessInfo& processInfo = runningProcesses[pid];
-        logProcessEvent(processInfo, "EXIT");
-        
-        syslog(LOG_INFO, "Process EXIT: PID=%d, Path=%s", 
-               pid, processInfo.executablePath.c_str());
-               
-        runningProcesses.erase(pid);
+    // Whatever was coalesced or rate limited for this process goes out with its EXIT
+    EventWorker& worker = workerFor(pid);
+    worker.aggregator.flushProcess(pid, &worker.aggregated);
+    writeAggregated(worker);
+    
+    uint32_t pidVersion = audit_token_to_pidversion(message->process->audit_token);
+    lineageRows.clear();
+    lineage.exit(pid, pidVersion, time(nullptr), &lineageRows);
+    databaseWriter.appendLineage(lineageRows);
+    
+    // Log exit event; the pidversion keeps a late EXIT from removing the pid's next owner
+    ProcessRecord record;
+    if (!processTable.remove(pid, pidVersion, 0, &record)) {
+        return;
     }
+    
+    logProcessEvent(record, "EXIT");
+    
+    if (!logEnabled(LOG_CATEGORY_PROCESS, LOG_LEVEL_INFO)) {
+        return;
+    }
+    size_t pathLength;
+    const char* path = stringTable.data(record.executablePathId, &pathLength);
+    EXT_LOG_INFO(LOG_CATEGORY_PROCESS, "EXIT pid=%d path=%{private}.*s", pid, (int)pathLength, path);
 }
 
-void AudioVideoController::handleFileOpen(const es_message_t* message) {
+void AudioVideoController::handleFileOpen(const es_message_t* message, AuthVerdict verdict) {
     pid_t pid = audit_token_to_pid(message->process->audit_token);
+    const es_string_token_t& path = message->event.open.file->path;
+    
+    // The allowed ones also come as NOTIFY_OPEN, which the kernel's AUTH cache doesn't hide
+    if (message->event_type == ES_EVENT_TYPE_AUTH_OPEN && verdict == AUTH_VERDICT_ALLOW &&
+        opensFromNotify.load(std::memory_order_relaxed)) {
+        return;
+    }
     
-    if (message->event.open.file->path.data) {
-        std::string filePath(message->event.open.file->path.data,
-                             message->event.open.file->path.length);        FileAccess access;
+    if (path.data) {
+        // Interned straight from the ES token: no allocation once the path is known
+        FileAccessRecord access;
         access.pid = pid;
-        access.filePath = filePath;
-        access.accessType = "OPEN";
+        access.pathId = stringTable.intern(path.data, path.length);
+        access.accessTypeId = stringTable.intern("OPEN", 4);
+        access.reasonId = 0;
         access.timestamp = mach_absolute_time();
         access.wasBlocked = false;
+        access.count = 1;
+        access.lastSeen = access.timestamp;
         
-        // Check for sensitive file access
-        bool isAudioDevice = (filePath.find("/dev/audio") != std::string::npos ||
-                             filePath.find("coreaudio") != std::string::npos);
-        bool isVideoDevice = (filePath.find("/dev/video") != std::string::npos ||
-                             filePath.find("AVCapture") != std::string::npos);
-        
-        if (isAudioDevice && !microphoneEnabled) {
+        // Record the verdict the AUTH fast path already sent to the kernel
+        if (verdict == AUTH_VERDICT_DENY_MICROPHONE) {
+            static const char reason[] = "Microphone disabled by system extension";
             access.wasBlocked = true;
-            access.reason = "Microphone disabled by system extension";
-        } else if (isVideoDevice && !cameraEnabled) {
+            access.reasonId = stringTable.intern(reason, sizeof(reason) - 1);
+        } else if (verdict == AUTH_VERDICT_DENY_CAMERA) {
+            static const char reason[] = "Camera disabled by system extension";
             access.wasBlocked = true;
-            access.reason = "Camera disabled by system extension";
+            access.reasonId = stringTable.intern(reason, sizeof(reason) - 1);
         }
         
-        logFileAccess(access);
-        recentFileAccess.push_back(access);
-        
-        // Keep only last 10000 file accesses in memory
-        if (recentFileAccess.size() > 10000) {
-            recentFileAccess.erase(recentFileAccess.begin(), 
-                                 recentFileAccess.begin() + 1000);
+        if (!recordFileAccess(access, EVENT_CLASS_FILE_OPEN)) {
+            return;
         }
         
-        syslog(LOG_DEBUG, "File OPEN: PID=%d, Path=%s, Blocked=%s", 
-               pid, filePath.c_str(), access.wasBlocked ? "YES" : "NO");
+        EXT_LOG_DEBUG(LOG_CATEGORY_FILE, "OPEN pid=%d blocked=%{public}s path=%{private}.*s",
+                      pid, access.wasBlocked ? "yes" : "no", (int)path.length, path.data);
+    }
+}
+
+void AudioVideoController::rememberFileAccess(const FileAccessRecord& access) {
+    // Fixed ring: the oldest entry is overwritten, nothing is shifted or freed
+    recentFileAccess.push(access);
+    
+    if (eventStream.active()) {
+        StreamEvent event = {access.timestamp, access.pid, access.pathId, access.accessTypeId, access.count,
+                             STREAM_EVENT_FILE, access.wasBlocked};
+        eventStream.publish(event);
     }
 }
 
 void AudioVideoController::handleFileWrite(const es_message_t* message) {
     pid_t pid = audit_token_to_pid(message->process->audit_token);
+    const es_string_token_t& path = message->event.write.target->path;
     
-    if (message->event.write.target->path.data) {
-        std::string filePath(message->event.write.target->path.data,
-                             message->event.write.target->path.length);        FileAccess access;
+    if (path.data) {
+        FileAccessRecord access;
         access.pid = pid;
-        access.filePath = filePath;
-        access.accessType = "WRITE";
+        access.pathId = stringTable.intern(path.data, path.length);
+        access.accessTypeId = stringTable.intern("WRITE", 5);
+        access.reasonId = 0;
         access.timestamp = mach_absolute_time();
         access.wasBlocked = false;
+        access.count = 1;
+        access.lastSeen = access.timestamp;
         
-        logFileAccess(access);
+        // Repeated writes to the same file become one record per window
+        if (!recordFileAccess(access, EVENT_CLASS_FILE_WRITE)) {
+            return;
+        }
         
-        syslog(LOG_DEBUG, "File WRITE: PID=%d, Path=%s", pid, filePath.c_str());
+        EXT_LOG_DEBUG(LOG_CATEGORY_FILE, "WRITE pid=%d path=%{private}.*s", pid, (int)path.length, path.data);
     }
 }
 
 void AudioVideoController::handleFileDelete(const es_message_t* message) {
     pid_t pid = audit_token_to_pid(message->process->audit_token);
+    const es_string_token_t& path = message->event.unlink.target->path;
     
-    if (message->event.unlink.target->path.data) {
-        std::string filePath(message->event.unlink.target->path.data,
-                             message->event.unlink.target->path.length);        FileAccess access;
+    if (path.data) {
+        FileAccessRecord access;
         access.pid = pid;
-        access.filePath = filePath;
-        access.accessType = "DELETE";
+        access.pathId = stringTable.intern(path.data, path.length);
+        access.accessTypeId = stringTable.intern("DELETE", 6);
+        access.reasonId = 0;
         access.timestamp = mach_absolute_time();
         access.wasBlocked = false;
+        access.count = 1;
+        access.lastSeen = access.timestamp;
         
-        logFileAccess(access);
+        if (!recordFileAccess(access, EVENT_CLASS_FILE_DELETE)) {
+            return;
+        }
         
-        syslog(LOG_INFO, "File DELETE: PID=%d, Path=%s", pid, filePath.c_str());
+        EXT_LOG_INFO(LOG_CATEGORY_FILE, "DELETE pid=%d path=%{private}.*s", pid, (int)path.length, path.data);
     }
 }
 
 void AudioVideoController::handleMmap(const es_message_t* message) {
     pid_t pid = audit_token_to_pid(message->process->audit_token);
     
+    // Every dylib load is a mapping; past the pid's budget they are only counted
+    if (!workerFor(pid).aggregator.admit(pid, EVENT_CLASS_MMAP, mach_absolute_time())) {
+        return;
+    }
+    
     // Log memory mapping for comprehensive analysis
     logSystemCall(pid, "mmap", "Memory mapping event");
     
-    syslog(LOG_DEBUG, "Memory MMAP: PID=%d", pid);
+    EXT_LOG_DEBUG(LOG_CATEGORY_FILE, "MMAP pid=%d", pid);
 }
 
 void AudioVideoController::handleSignal(const es_message_t* message) {
@@ -225,8 +301,7 @@ void AudioVideoController::handleSignal(const es_message_t* message) {
     snprintf(args, sizeof(args), "signal=%d target_pid=%d", sig, targetPid);
     logSystemCall(pid, "kill", args);
     
-    syslog(LOG_INFO, "Signal SEND: PID=%d sent signal %d to PID=%d", 
-           pid, sig, targetPid);
+    EXT_LOG_INFO(LOG_CATEGORY_PROCESS, "SIGNAL pid=%d sent %d to pid=%d", pid, sig, targetPid);
 }
 
 void AudioVideoController::handleFork(const es_message_t* message) {
@@ -235,8 +310,30 @@ void AudioVideoController::handleFork(const es_message_t* message) {
     
     logSystemCall(parentPid, "fork", "Process forked");
     
-    syslog(LOG_INFO, "Process FORK: Parent PID=%d, Child PID=%d", 
-           parentPid, childPid);
+    // The child runs the parent's image until it execs; track it without re-analysis,
+    // sharing the parent's details rather than copying them
+    const es_process_t* child = message->event.fork.child;
+    uint64_t childStartUsec = message->version >= 3 ? timevalToUsec(child->start_time) : 0;
+    ProcessRecord record;
+    if (processTable.lookup(parentPid, &record)) {
+        record.pid = childPid;
+        record.ppid = parentPid;
+        record.pidVersion = audit_token_to_pidversion(child->audit_token);
+        record.startTime = mach_absolute_time();
+        record.kernelStartUsec = childStartUsec;
+        bool displaced;
+        processTable.insert(record, &displaced);
+    }
+    
+    const es_string_token_t& parentPath = message->process->executable->path;
+    lineageRows.clear();
+    uint64_t parentStartUsec = message->version >= 3 ? timevalToUsec(message->process->start_time) : 0;
+    lineage.fork(parentPid, audit_token_to_pidversion(message->process->audit_token), parentStartUsec,
+                 stringTable.intern(parentPath.data, parentPath.length), childPid,
+                 audit_token_to_pidversion(child->audit_token), childStartUsec, time(nullptr), &lineageRows);
+    databaseWriter.appendLineage(lineageRows);
+    
+    EXT_LOG_INFO(LOG_CATEGORY_PROCESS, "FORK pid=%d child=%d", parentPid, childPid);
 }
 
 void AudioVideoController::handleSetuid(const es_message_t* message) {
@@ -247,5 +344,5 @@ void AudioVideoController::handleSetuid(const es_message_t* message) {
     snprintf(args, sizeof(args), "new_uid=%d", uid);
     logSystemCall(pid, "setuid", args);
     
-    syslog(LOG_WARNING, "SETUID: PID=%d changed to UID=%d", pid, uid);
+    EXT_LOG_DEFAULT(LOG_CATEGORY_PROCESS, "SETUID pid=%d uid=%d", pid, uid);
 }
\ No newline at end of file
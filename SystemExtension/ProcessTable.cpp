@@ -0,0 +1,309 @@
+// Sharded process table with lock-free readers
+#include "ProcessTable.h"
+
+ProcessTable::ProcessTable() {
+    for (Shard& shard : shards) {
+        pthread_mutex_init(&shard.writeMutex, nullptr);
+        shard.table.store(newTable(PROCESS_TABLE_INITIAL_SLOTS), std::memory_order_relaxed);
+        shard.epoch.store(0, std::memory_order_relaxed);
+        shard.readers[0].store(0, std::memory_order_relaxed);
+        shard.readers[1].store(0, std::memory_order_relaxed);
+        shard.live = 0;
+        shard.claimed = 0;
+        shard.resizes = 0;
+    }
+}
+
+ProcessTable::~ProcessTable() {
+    for (Shard& shard : shards) {
+        Table* table = shard.table.load(std::memory_order_relaxed);
+        for (size_t i = 0; i <= table->mask; i++) {
+            delete table->slots[i].record.load(std::memory_order_relaxed);
+        }
+        freeTable(table);
+        
+        for (int parity = 0; parity < 2; parity++) {
+            for (ProcessRecord* record : shard.retiredRecords[parity]) {
+                delete record;
+            }
+            for (Table* retired : shard.retiredTables[parity]) {
+                freeTable(retired);
+            }
+        }
+        pthread_mutex_destroy(&shard.writeMutex);
+    }
+}
+
+// Low bits pick the shard, the rest the home slot
+uint32_t ProcessTable::hashPid(pid_t pid) {
+    uint32_t h = (uint32_t)pid;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+ProcessTable::Table* ProcessTable::newTable(size_t slots) {
+    Table* table = new Table;
+    table->mask = slots - 1;
+    table->slots = new Slot[slots];
+    for (size_t i = 0; i < slots; i++) {
+        table->slots[i].pid.store(kEmpty, std::memory_order_relaxed);
+        table->slots[i].record.store(nullptr, std::memory_order_relaxed);
+    }
+    return table;
+}
+
+void ProcessTable::freeTable(Table* table) {
+    delete[] table->slots;
+    delete table;
+}
+
+// A claimed slot never changes its pid, so a probe racing a writer can only
+// miss a pid that is being added, never land on the wrong one
+ProcessTable::Slot* ProcessTable::probe(const Table* table, pid_t pid) {
+    size_t index = (hashPid(pid) / PROCESS_TABLE_SHARDS) & table->mask;
+    for (;;) {
+        Slot* slot = &table->slots[index];
+        int32_t slotPid = slot->pid.load(std::memory_order_acquire);
+        if (slotPid == pid) {
+            return slot;
+        }
+        if (slotPid == kEmpty) {
+            return nullptr;
+        }
+        index = (index + 1) & table->mask;
+    }
+}
+
+uint64_t ProcessTable::enter(const Shard& shard) const {
+    for (;;) {
+        uint64_t epoch = shard.epoch.load(std::memory_order_acquire);
+        shard.readers[epoch & 1].fetch_add(1, std::memory_order_seq_cst);
+        
+        // A writer may have moved on between the two; count under the epoch it really is
+        if (shard.epoch.load(std::memory_order_seq_cst) == epoch) {
+            return epoch;
+        }
+        shard.readers[epoch & 1].fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void ProcessTable::leave(const Shard& shard, uint64_t epoch) const {
+    shard.readers[epoch & 1].fetch_sub(1, std::memory_order_release);
+}
+
+bool ProcessTable::lookup(pid_t pid, ProcessRecord* record) const {
+    const Shard& shard = shardFor(pid);
+    uint64_t epoch = enter(shard);
+    
+    const Slot* slot = probe(shard.table.load(std::memory_order_acquire), pid);
+    const ProcessRecord* found = slot ? slot->record.load(std::memory_order_acquire) : nullptr;
+    if (found) {
+        *record = *found;
+    }
+    
+    leave(shard, epoch);
+    return found != nullptr;
+}
+
+bool ProcessTable::contains(pid_t pid, uint32_t pidVersion, uint64_t kernelStartUsec) const {
+    const Shard& shard = shardFor(pid);
+    uint64_t epoch = enter(shard);
+    
+    const Slot* slot = probe(shard.table.load(std::memory_order_acquire), pid);
+    const ProcessRecord* found = slot ? slot->record.load(std::memory_order_acquire) : nullptr;
+    bool known = found && matches(*found, pidVersion, kernelStartUsec);
+    
+    leave(shard, epoch);
+    return known;
+}
+
+void ProcessTable::snapshot(std::vector<ProcessRecord>* records) const {
+    for (const Shard& shard : shards) {
+        uint64_t epoch = enter(shard);
+        
+        const Table* table = shard.table.load(std::memory_order_acquire);
+        for (size_t i = 0; i <= table->mask; i++) {
+            const ProcessRecord* record = table->slots[i].record.load(std::memory_order_acquire);
+            if (record) {
+                records->push_back(*record);
+            }
+        }
+        
+        leave(shard, epoch);
+    }
+}
+
+ProcessTable::Slot* ProcessTable::findSlot(Shard& shard, pid_t pid) {
+    return probe(shard.table.load(std::memory_order_relaxed), pid);
+}
+
+ProcessTable::Slot* ProcessTable::claimSlot(Shard& shard, pid_t pid) {
+    Slot* slot = findSlot(shard, pid);
+    if (slot) {
+        return slot;
+    }
+    
+    Table* table = shard.table.load(std::memory_order_relaxed);
+    if ((shard.claimed + 1) * 4 > (table->mask + 1) * 3) {
+        rehash(shard);
+        table = shard.table.load(std::memory_order_relaxed);
+    }
+    
+    size_t index = (hashPid(pid) / PROCESS_TABLE_SHARDS) & table->mask;
+    while (table->slots[index].pid.load(std::memory_order_relaxed) != kEmpty) {
+        index = (index + 1) & table->mask;
+    }
+    
+    // Visible with a null record until publish() fills it in
+    slot = &table->slots[index];
+    slot->pid.store(pid, std::memory_order_release);
+    shard.claimed++;
+    return slot;
+}
+
+// Swaps the slot's record and retires the old one; null removes the process
+void ProcessTable::publish(Shard& shard, Slot* slot, ProcessRecord* record) {
+    ProcessRecord* old = slot->record.load(std::memory_order_relaxed);
+    slot->record.store(record, std::memory_order_release);
+    
+    if (old) {
+        shard.retiredRecords[shard.epoch.load(std::memory_order_relaxed) & 1].push_back(old);
+    }
+    if (record && !old) {
+        shard.live++;
+    } else if (!record && old) {
+        shard.live--;
+    }
+    
+    reclaim(shard);
+}
+
+// Frees what was retired two epochs ago once the readers of the previous epoch
+// are gone, then starts a new epoch. Cheap enough to try on every write.
+void ProcessTable::reclaim(Shard& shard) {
+    uint64_t epoch = shard.epoch.load(std::memory_order_relaxed);
+    int previous = (epoch + 1) & 1;
+    if (shard.readers[previous].load(std::memory_order_seq_cst) != 0) {
+        return;
+    }
+    
+    for (ProcessRecord* record : shard.retiredRecords[previous]) {
+        delete record;
+    }
+    shard.retiredRecords[previous].clear();
+    for (Table* table : shard.retiredTables[previous]) {
+        freeTable(table);
+    }
+    shard.retiredTables[previous].clear();
+    
+    shard.epoch.store(epoch + 1, std::memory_order_seq_cst);
+}
+
+// Rebuilds the shard's table sized for its live records, dropping tombstones;
+// the records themselves move over untouched
+void ProcessTable::rehash(Shard& shard) {
+    Table* old = shard.table.load(std::memory_order_relaxed);
+    
+    size_t slots = PROCESS_TABLE_INITIAL_SLOTS;
+    while ((shard.live + 1) * 2 > slots) {
+        slots *= 2;
+    }
+    
+    Table* table = newTable(slots);
+    for (size_t i = 0; i <= old->mask; i++) {
+        ProcessRecord* record = old->slots[i].record.load(std::memory_order_relaxed);
+        if (!record) {
+            continue;
+        }
+        pid_t pid = old->slots[i].pid.load(std::memory_order_relaxed);
+        size_t index = (hashPid(pid) / PROCESS_TABLE_SHARDS) & table->mask;
+        while (table->slots[index].pid.load(std::memory_order_relaxed) != kEmpty) {
+            index = (index + 1) & table->mask;
+        }
+        table->slots[index].pid.store(pid, std::memory_order_relaxed);
+        table->slots[index].record.store(record, std::memory_order_relaxed);
+    }
+    
+    shard.table.store(table, std::memory_order_release);
+    shard.retiredTables[shard.epoch.load(std::memory_order_relaxed) & 1].push_back(old);
+    shard.claimed = shard.live;
+    shard.resizes++;
+}
+
+bool ProcessTable::put(const ProcessRecord& record) {
+    Shard& shard = shardFor(record.pid);
+    pthread_mutex_lock(&shard.writeMutex);
+    
+    Slot* slot = claimSlot(shard, record.pid);
+    bool replaced = slot->record.load(std::memory_order_relaxed) != nullptr;
+    publish(shard, slot, new ProcessRecord(record));
+    changeLog.record(record.pid, replaced ? PROCESS_UPDATED : PROCESS_APPEARED);
+    
+    pthread_mutex_unlock(&shard.writeMutex);
+    return replaced;
+}
+
+bool ProcessTable::insert(const ProcessRecord& record, bool* displaced) {
+    Shard& shard = shardFor(record.pid);
+    pthread_mutex_lock(&shard.writeMutex);
+    
+    Slot* slot = claimSlot(shard, record.pid);
+    const ProcessRecord* current = slot->record.load(std::memory_order_relaxed);
+    *displaced = false;
+    if (current && matches(*current, record.pidVersion, record.kernelStartUsec)) {
+        pthread_mutex_unlock(&shard.writeMutex);
+        return false;
+    }
+    
+    // An earlier process with this pid that we never saw exit
+    if (current) {
+        *displaced = true;
+        changeLog.record(record.pid, PROCESS_EXITED);
+    }
+    publish(shard, slot, new ProcessRecord(record));
+    changeLog.record(record.pid, PROCESS_APPEARED);
+    
+    pthread_mutex_unlock(&shard.writeMutex);
+    return true;
+}
+
+bool ProcessTable::remove(pid_t pid, uint32_t pidVersion, uint64_t kernelStartUsec, ProcessRecord* removed) {
+    Shard& shard = shardFor(pid);
+    pthread_mutex_lock(&shard.writeMutex);
+    
+    Slot* slot = findSlot(shard, pid);
+    const ProcessRecord* current = slot ? slot->record.load(std::memory_order_relaxed) : nullptr;
+    if (!current || !matches(*current, pidVersion, kernelStartUsec)) {
+        pthread_mutex_unlock(&shard.writeMutex);
+        return false;
+    }
+    
+    if (removed) {
+        *removed = *current;
+    }
+    publish(shard, slot, nullptr);
+    changeLog.record(pid, PROCESS_EXITED);
+    
+    pthread_mutex_unlock(&shard.writeMutex);
+    return true;
+}
+
+ProcessTableStats ProcessTable::getStats() const {
+    ProcessTableStats stats = ProcessTableStats();
+    
+    for (const Shard& shard : shards) {
+        pthread_mutex_lock(&shard.writeMutex);
+        stats.processes += shard.live;
+        stats.slots += shard.table.load(std::memory_order_relaxed)->mask + 1;
+        stats.tombstones += shard.claimed - shard.live;
+        stats.resizes += shard.resizes;
+        stats.retired += shard.retiredRecords[0].size() + shard.retiredRecords[1].size();
+        pthread_mutex_unlock(&shard.writeMutex);
+    }
+    
+    return stats;
+}
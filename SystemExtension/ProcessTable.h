@@ -0,0 +1,155 @@
+#ifndef ProcessTable_h
+#define ProcessTable_h
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include "MonitoringTypes.h"
+#include "ProcessTracker.h"
+
+// Independent shards, each with its own writer lock (power of two)
+#ifndef PROCESS_TABLE_SHARDS
+#define PROCESS_TABLE_SHARDS 16
+#endif
+
+// Slots a shard starts with (power of two); tables double at 3/4 full
+#ifndef PROCESS_TABLE_INITIAL_SLOTS
+#define PROCESS_TABLE_INITIAL_SLOTS 64
+#endif
+
+struct ProcessTableStats {
+    uint64_t processes;
+    uint64_t slots;
+    uint64_t tombstones;        // slots of exited pids, dropped on the next resize
+    uint64_t resizes;
+    uint64_t retired;           // records waiting for readers to move on
+};
+
+// The running processes, as immutable ProcessRecords in per-shard
+// open-addressing tables. Readers never lock: they announce themselves in the
+// shard's current epoch, find the slot and copy the record. Writers take the
+// shard lock, publish a fresh record and retire the old one, which is freed
+// once every reader that could still see it has left (two epochs later).
+//
+// Slots are found by pid; the pidversion and kernel start time stored in the
+// record tell a reused pid from the process that had it before. Every change
+// is recorded in the change log while the shard is still locked.
+class ProcessTable {
+    static_assert((PROCESS_TABLE_SHARDS & (PROCESS_TABLE_SHARDS - 1)) == 0,
+                  "PROCESS_TABLE_SHARDS must be a power of two");
+    static_assert((PROCESS_TABLE_INITIAL_SLOTS & (PROCESS_TABLE_INITIAL_SLOTS - 1)) == 0,
+                  "PROCESS_TABLE_INITIAL_SLOTS must be a power of two");
+
+public:
+    ProcessTable();
+    ~ProcessTable();
+    
+    // Same process unless both sides know a pidversion or start time and they differ
+    static bool matches(const ProcessRecord& record, uint32_t pidVersion, uint64_t kernelStartUsec) {
+        return (pidVersion == 0 || record.pidVersion == 0 || record.pidVersion == pidVersion) &&
+               (kernelStartUsec == 0 || record.kernelStartUsec == 0 || record.kernelStartUsec == kernelStartUsec);
+    }
+    
+    bool lookup(pid_t pid, ProcessRecord* record) const;
+    bool contains(pid_t pid, uint32_t pidVersion, uint64_t kernelStartUsec) const;
+    
+    // Stores the record whatever was there; true if it replaced one (exec keeps the pid)
+    bool put(const ProcessRecord& record);
+    
+    // Stores the record unless this same process is already known; `displaced`
+    // says whether an earlier process with the pid had to make room
+    bool insert(const ProcessRecord& record, bool* displaced);
+    
+    bool remove(pid_t pid, uint32_t pidVersion, uint64_t kernelStartUsec, ProcessRecord* removed);
+    
+    // Publishes a modified copy of the matching record; false if it's gone
+    template <typename Mutate>
+    bool update(pid_t pid, uint32_t pidVersion, uint64_t kernelStartUsec, Mutate mutate);
+    
+    // Consistent per shard, not across shards
+    void snapshot(std::vector<ProcessRecord>* records) const;
+    
+    bool changesSince(uint64_t since, std::vector<ProcessChange>* changes, uint64_t* generation) const {
+        return changeLog.changesSince(since, changes, generation);
+    }
+    
+    // Moves with every put, insert, remove and update
+    uint64_t generation() const { return changeLog.current(); }
+    
+    ProcessTableStats getStats() const;
+
+private:
+    static const int32_t kEmpty = -1;
+    
+    struct Slot {
+        std::atomic<int32_t> pid;               // kEmpty until claimed; a claimed slot keeps its pid
+        std::atomic<ProcessRecord*> record;     // null once the process is gone
+    };
+    
+    struct Table {
+        size_t mask;
+        Slot* slots;
+    };
+    
+    struct alignas(64) Shard {
+        mutable pthread_mutex_t writeMutex;
+        std::atomic<Table*> table;
+        std::atomic<uint64_t> epoch;
+        mutable std::atomic<uint64_t> readers[2];   // by epoch parity
+        
+        // Under writeMutex
+        size_t live;
+        size_t claimed;                             // live records plus tombstones
+        uint64_t resizes;
+        std::vector<ProcessRecord*> retiredRecords[2];
+        std::vector<Table*> retiredTables[2];
+    };
+    
+    Shard shards[PROCESS_TABLE_SHARDS];
+    ProcessChangeLog changeLog;
+    
+    static uint32_t hashPid(pid_t pid);
+    Shard& shardFor(pid_t pid) { return shards[hashPid(pid) & (PROCESS_TABLE_SHARDS - 1)]; }
+    const Shard& shardFor(pid_t pid) const { return shards[hashPid(pid) & (PROCESS_TABLE_SHARDS - 1)]; }
+    
+    // Returns the epoch entered; pass it to leave()
+    uint64_t enter(const Shard& shard) const;
+    void leave(const Shard& shard, uint64_t epoch) const;
+    
+    static Slot* probe(const Table* table, pid_t pid);
+    
+    // Writer side, all with the shard lock held
+    Slot* findSlot(Shard& shard, pid_t pid);
+    Slot* claimSlot(Shard& shard, pid_t pid);
+    void publish(Shard& shard, Slot* slot, ProcessRecord* record);
+    void reclaim(Shard& shard);
+    void rehash(Shard& shard);
+    
+    static Table* newTable(size_t slots);
+    static void freeTable(Table* table);
+};
+
+template <typename Mutate>
+bool ProcessTable::update(pid_t pid, uint32_t pidVersion, uint64_t kernelStartUsec, Mutate mutate) {
+    Shard& shard = shardFor(pid);
+    pthread_mutex_lock(&shard.writeMutex);
+    
+    Slot* slot = findSlot(shard, pid);
+    ProcessRecord* current = slot ? slot->record.load(std::memory_order_relaxed) : nullptr;
+    if (!current || !matches(*current, pidVersion, kernelStartUsec)) {
+        pthread_mutex_unlock(&shard.writeMutex);
+        return false;
+    }
+    
+    ProcessRecord* next = new ProcessRecord(*current);
+    mutate(*next);
+    publish(shard, slot, next);
+    changeLog.record(pid, PROCESS_UPDATED);
+    
+    pthread_mutex_unlock(&shard.writeMutex);
+    return true;
+}
+
+#endif
@@ -0,0 +1,77 @@
+// Incremental process table sampling
+#include "ProcessTracker.h"
+#include <algorithm>
+#include <errno.h>
+#include <sys/time.h>
+#include <syslog.h>
+
+// Reads KERN_PROC_ALL into the reused buffer, growing it only when the kernel says it's too small
+bool ProcessTracker::readProcessList(size_t* count) {
+    int mib[4] = {CTL_KERN, KERN_PROC, KERN_PROC_ALL, 0};
+    
+    for (int attempt = 0; attempt < 4; attempt++) {
+        if (!buffer.empty()) {
+            size_t size = buffer.size() * sizeof(struct kinfo_proc);
+            if (sysctl(mib, 4, buffer.data(), &size, nullptr, 0) == 0) {
+                *count = size / sizeof(struct kinfo_proc);
+                return true;
+            }
+            if (errno != ENOMEM) {
+                break;
+            }
+        }
+        
+        // Processes can appear between sizing and reading; leave room for them
+        size_t size = 0;
+        if (sysctl(mib, 4, nullptr, &size, nullptr, 0) != 0) {
+            break;
+        }
+        buffer.resize(size / sizeof(struct kinfo_proc) + 64);
+    }
+    
+    syslog(LOG_ERR, "ProcessTracker: cannot read process list: %d", errno);
+    return false;
+}
+
+bool ProcessTracker::sample() {
+    struct timeval started;
+    gettimeofday(&started, nullptr);
+    size_t count = 0;
+    if (!readProcessList(&count)) {
+        return false;
+    }
+    sampled = timevalToUsec(started);
+    
+    current.clear();
+    for (size_t i = 0; i < count; i++) {
+        const struct extern_proc& proc = buffer[i].kp_proc;
+        current.push_back({proc.p_pid, (uint32_t)i, timevalToUsec(proc.p_starttime)});
+    }
+    std::sort(current.begin(), current.end(),
+              [](const ProcessIdentity& a, const ProcessIdentity& b) { return a.pid < b.pid; });
+    
+    // One merge pass over both sorted lists; a reused pid is both vanished and appeared
+    appearedSet.clear();
+    vanishedSet.clear();
+    size_t before = 0;
+    size_t now = 0;
+    while (before < previous.size() || now < current.size()) {
+        if (now == current.size() ||
+            (before < previous.size() && previous[before].pid < current[now].pid)) {
+            vanishedSet.push_back(previous[before++]);
+        } else if (before == previous.size() || current[now].pid < previous[before].pid) {
+            appearedSet.push_back(current[now++]);
+        } else {
+            if (previous[before].startUsec != current[now].startUsec) {
+                vanishedSet.push_back(previous[before]);
+                appearedSet.push_back(current[now]);
+            }
+            before++;
+            now++;
+        }
+    }
+    
+    previous.swap(current);
+    samples++;
+    return true;
+}
@@ -0,0 +1,123 @@
+#ifndef ProcessTracker_h
+#define ProcessTracker_h
+
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+// Changes remembered for generation queries; older callers must resync
+#ifndef PROCESS_CHANGE_LOG_SIZE
+#define PROCESS_CHANGE_LOG_SIZE 4096
+#endif
+
+// A process as the kernel names it: pids are reused, start times are not
+struct ProcessIdentity {
+    pid_t pid;
+    uint32_t slot;              // entry in the kernel list it was read from; see name()
+    uint64_t startUsec;
+};
+
+enum ProcessChangeKind : uint8_t {
+    PROCESS_APPEARED,
+    PROCESS_UPDATED,
+    PROCESS_EXITED
+};
+
+struct ProcessChange {
+    uint64_t generation;
+    pid_t pid;
+    ProcessChangeKind kind;
+};
+
+inline uint64_t timevalToUsec(const struct timeval& tv) {
+    return (uint64_t)tv.tv_sec * 1000000ull + (uint64_t)tv.tv_usec;
+}
+
+// Samples the kernel process list into a reused buffer and diffs it against the
+// previous sample in a single merge pass. Not thread-safe; one scanner owns it.
+class ProcessTracker {
+public:
+    ProcessTracker() : samples(0), sampled(0) {}
+    
+    // Refreshes appeared() and vanished(); false if the kernel list couldn't be read
+    bool sample();
+    
+    const std::vector<ProcessIdentity>& appeared() const { return appearedSet; }
+    const std::vector<ProcessIdentity>& vanished() const { return vanishedSet; }
+    // Every process in the last sample, sorted by pid
+    const std::vector<ProcessIdentity>& processes() const { return previous; }
+    size_t processCount() const { return previous.size(); }
+    // Wall clock just before the last sample was read; anything that started
+    // earlier and isn't in it has exited
+    uint64_t sampledUsec() const { return sampled; }
+    // Kernel entry and p_comm of a process in appeared(), until the next sample
+    const struct kinfo_proc& info(const ProcessIdentity& process) const { return buffer[process.slot]; }
+    const char* name(const ProcessIdentity& process) const { return info(process).kp_proc.p_comm; }
+    uint64_t sampleCount() const { return samples; }
+
+private:
+    std::vector<struct kinfo_proc> buffer;
+    std::vector<ProcessIdentity> previous;
+    std::vector<ProcessIdentity> current;
+    std::vector<ProcessIdentity> appearedSet;
+    std::vector<ProcessIdentity> vanishedSet;
+    uint64_t samples;
+    uint64_t sampled;
+    
+    bool readProcessList(size_t* count);
+};
+
+// Generation-stamped ring of process table changes. Its own lock keeps it
+// consistent; the process table records into it from inside a shard lock so
+// changes to one pid are logged in the order they were applied.
+class ProcessChangeLog {
+public:
+    ProcessChangeLog() : generation(0) {
+        pthread_mutex_init(&mutex, nullptr);
+    }
+    ~ProcessChangeLog() {
+        pthread_mutex_destroy(&mutex);
+    }
+    
+    uint64_t record(pid_t pid, ProcessChangeKind kind) {
+        pthread_mutex_lock(&mutex);
+        uint64_t gen = ++generation;
+        ProcessChange& change = ring[gen % PROCESS_CHANGE_LOG_SIZE];
+        change.generation = gen;
+        change.pid = pid;
+        change.kind = kind;
+        pthread_mutex_unlock(&mutex);
+        return gen;
+    }
+    
+    // Appends every change after `since` and reports the generation they run up
+    // to; false if some have already been overwritten
+    bool changesSince(uint64_t since, std::vector<ProcessChange>* changes, uint64_t* current) const {
+        pthread_mutex_lock(&mutex);
+        *current = generation;
+        bool complete = since <= generation && generation - since <= PROCESS_CHANGE_LOG_SIZE;
+        if (complete) {
+            for (uint64_t gen = since + 1; gen <= generation; gen++) {
+                changes->push_back(ring[gen % PROCESS_CHANGE_LOG_SIZE]);
+            }
+        }
+        pthread_mutex_unlock(&mutex);
+        return complete;
+    }
+    
+    uint64_t current() const {
+        pthread_mutex_lock(&mutex);
+        uint64_t gen = generation;
+        pthread_mutex_unlock(&mutex);
+        return gen;
+    }
+
+private:
+    mutable pthread_mutex_t mutex;
+    ProcessChange ring[PROCESS_CHANGE_LOG_SIZE];
+    uint64_t generation;
+};
+
+#endif
@@ -0,0 +1,259 @@
+// Trigram search index over interned paths and command lines
+#include "SearchIndex.h"
+#include "DatabaseRetention.h"
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+static bool exec(sqlite3* database, const std::string& sql) {
+    char* errMsg = nullptr;
+    if (sqlite3_exec(database, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK) {
+        syslog(LOG_ERR, "SearchIndex: %s", errMsg ? errMsg : sqlite3_errmsg(database));
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
+
+static bool tableExists(sqlite3* database, const char* name) {
+    sqlite3_stmt* stmt;
+    bool exists = false;
+    if (sqlite3_prepare_v2(database, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?",
+                           -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        exists = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+    }
+    return exists;
+}
+
+bool searchIndexAvailable(sqlite3* database) {
+    return tableExists(database, "search_index");
+}
+
+bool createSearchIndex(sqlite3* database) {
+    bool backfill = !tableExists(database, "search_usage");
+    bool indexed = searchIndexAvailable(database);
+    
+    std::string sql =
+        "BEGIN IMMEDIATE;"
+        "CREATE TABLE IF NOT EXISTS search_usage ("
+        "string_id INTEGER PRIMARY KEY,"
+        "kinds INTEGER NOT NULL,"
+        "last_seen INTEGER NOT NULL,"
+        "last_pid INTEGER NOT NULL,"
+        "uses INTEGER NOT NULL"
+        ");"
+        "CREATE TABLE IF NOT EXISTS search_backfill (table_name TEXT PRIMARY KEY);";
+    
+    // Partitions written before the index existed are indexed by the writer
+    // between batches, a day at a time
+    if (backfill) {
+        sql += "INSERT OR IGNORE INTO search_backfill SELECT name FROM sqlite_master "
+               "WHERE type = 'table' AND (name GLOB 'process_event_rows_d[0-9]*' "
+               "OR name GLOB 'file_access_rows_d[0-9]*');";
+    }
+    sql += "COMMIT;";
+    if (!exec(database, sql)) {
+        exec(database, "ROLLBACK;");
+        return false;
+    }
+    if (indexed) {
+        return true;
+    }
+    
+    // External content: the text stays in `strings` only
+    if (sqlite3_exec(database,
+                     "CREATE VIRTUAL TABLE search_index USING fts5("
+                     "value, content='strings', content_rowid='id', tokenize='trigram');",
+                     nullptr, nullptr, nullptr) != SQLITE_OK) {
+        syslog(LOG_NOTICE, "SearchIndex: FTS5 trigram index unavailable (%s); searches will scan",
+               sqlite3_errmsg(database));
+        return true;
+    }
+    
+    // Strings recorded while the index was unavailable
+    return exec(database,
+                "INSERT INTO search_index (rowid, value) "
+                "SELECT s.id, s.value FROM search_usage u JOIN strings s ON s.id = u.string_id;");
+}
+
+bool forgetSearchStrings(sqlite3* database, const std::vector<uint32_t>& ids) {
+    // Only strings with a search_usage row were ever indexed
+    const char* sql[] = {
+        "INSERT INTO search_index (search_index, rowid, value) "
+        "SELECT 'delete', s.id, s.value FROM search_usage u JOIN strings s ON s.id = u.string_id "
+        "WHERE u.string_id = ?",
+        "DELETE FROM search_usage WHERE string_id = ?"
+    };
+    int first = searchIndexAvailable(database) ? 0 : 1;
+    
+    bool forgotten = true;
+    for (int i = first; i < 2 && forgotten; i++) {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(database, sql[i], -1, &stmt, nullptr) != SQLITE_OK) {
+            syslog(LOG_ERR, "SearchIndex: %s", sqlite3_errmsg(database));
+            return false;
+        }
+        for (uint32_t id : ids) {
+            sqlite3_bind_int64(stmt, 1, id);
+            forgotten = sqlite3_step(stmt) == SQLITE_DONE;
+            sqlite3_reset(stmt);
+            if (!forgotten) {
+                syslog(LOG_ERR, "SearchIndex: cannot remove string %u: %s", id, sqlite3_errmsg(database));
+                break;
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+    return forgotten;
+}
+
+// The ID columns of one partition and what they are searched as
+static int partitionColumns(const char* partition, const char** columns, uint32_t* kinds) {
+    if (strncmp(partition, "process_event_rows_d", 20) == 0) {
+        columns[0] = "executable_path_id";
+        kinds[0] = SEARCH_EXECUTABLE;
+        columns[1] = "command_line_id";
+        kinds[1] = SEARCH_COMMAND_LINE;
+        return 2;
+    }
+    columns[0] = "path_id";
+    kinds[0] = SEARCH_FILE_PATH;
+    return 1;
+}
+
+static bool backfillPartition(sqlite3* database, const std::string& partition, bool indexed) {
+    size_t length = partition.size();
+    uint32_t day = length > 8 ? (uint32_t)strtoul(partition.c_str() + length - 8, nullptr, 10) : 0;
+    std::string seen = std::to_string((long long)partitionDayStart(day));
+    
+    const char* columns[2];
+    uint32_t kinds[2];
+    int count = partitionColumns(partition.c_str(), columns, kinds);
+    for (int i = 0; i < count; i++) {
+        std::string column = columns[i];
+        std::string sql;
+        // Unseen strings go into the index before search_usage learns about them
+        if (indexed) {
+            sql += "INSERT INTO search_index (rowid, value) "
+                   "SELECT s.id, s.value FROM strings s WHERE s.id IN "
+                   "(SELECT DISTINCT " + column + " FROM " + partition + " WHERE " + column + " != 0) "
+                   "AND s.id NOT IN (SELECT string_id FROM search_usage);";
+        }
+        sql += "INSERT INTO search_usage (string_id, kinds, last_seen, last_pid, uses) "
+               "SELECT " + column + ", " + std::to_string(kinds[i]) + ", " + seen + ", 0, count(*) "
+               "FROM " + partition + " WHERE " + column + " != 0 GROUP BY " + column + " "
+               "ON CONFLICT (string_id) DO UPDATE SET kinds = kinds | excluded.kinds, "
+               "last_seen = max(last_seen, excluded.last_seen), uses = uses + excluded.uses;";
+        if (!exec(database, sql)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool backfillSearchStep(sqlite3* database, bool indexed, int64_t* remaining) {
+    *remaining = 0;
+    std::string partition;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database, "SELECT table_name, (SELECT count(*) FROM search_backfill) "
+                           "FROM search_backfill ORDER BY table_name LIMIT 1", -1, &stmt, nullptr) != SQLITE_OK) {
+        return false;
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        partition = (const char*)sqlite3_column_text(stmt, 0);
+        *remaining = sqlite3_column_int64(stmt, 1);
+    }
+    sqlite3_finalize(stmt);
+    if (partition.empty()) {
+        return true;
+    }
+    
+    if (!exec(database, "BEGIN IMMEDIATE;")) {
+        return false;
+    }
+    // Retention may have dropped it since it was queued
+    bool done = !tableExists(database, partition.c_str()) || backfillPartition(database, partition, indexed);
+    if (done) {
+        sqlite3_prepare_v2(database, "DELETE FROM search_backfill WHERE table_name = ?", -1, &stmt, nullptr);
+        sqlite3_bind_text(stmt, 1, partition.c_str(), -1, SQLITE_STATIC);
+        done = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+    }
+    if (!done || !exec(database, "COMMIT;")) {
+        exec(database, "ROLLBACK;");
+        return false;
+    }
+    
+    (*remaining)--;
+    return true;
+}
+
+bool searchStrings(sqlite3* database, const char* term, uint32_t kinds, size_t limit,
+                   std::vector<SearchMatch>* matches, std::string* error) {
+    if (!term || !*term) {
+        *error = "missing search term";
+        return false;
+    }
+    if (kinds == 0) {
+        kinds = SEARCH_ALL;
+    }
+    if (limit == 0 || limit > SEARCH_MAX_RESULTS) {
+        limit = SEARCH_MAX_RESULTS;
+    }
+    
+    // Trigrams need at least three characters; shorter terms scan the distinct strings
+    size_t characters = 0;
+    for (const char* c = term; *c; c++) {
+        characters += ((unsigned char)*c & 0xc0) != 0x80;
+    }
+    bool indexed = characters >= 3 && searchIndexAvailable(database);
+    const char* sql = indexed ?
+        "SELECT u.string_id, s.value, u.kinds, u.last_seen, u.last_pid, u.uses "
+        "FROM search_index f JOIN search_usage u ON u.string_id = f.rowid "
+        "JOIN strings s ON s.id = f.rowid "
+        "WHERE search_index MATCH ?1 AND (u.kinds & ?2) != 0 "
+        "ORDER BY u.last_seen DESC, u.uses DESC LIMIT ?3" :
+        "SELECT u.string_id, s.value, u.kinds, u.last_seen, u.last_pid, u.uses "
+        "FROM search_usage u JOIN strings s ON s.id = u.string_id "
+        "WHERE instr(lower(s.value), lower(?1)) > 0 AND (u.kinds & ?2) != 0 "
+        "ORDER BY u.last_seen DESC, u.uses DESC LIMIT ?3";
+    
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(database, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        *error = sqlite3_errmsg(database);
+        return false;
+    }
+    
+    // One quoted phrase, so the term is matched as a substring and never parsed as a query
+    std::string query = term;
+    if (indexed) {
+        query.clear();
+        for (const char* c = term; *c; c++) {
+            query += *c == '"' ? "\"\"" : std::string(1, *c);
+        }
+        query = "\"" + query + "\"";
+    }
+    sqlite3_bind_text(stmt, 1, query.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, kinds);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64)limit);
+    
+    int result;
+    while ((result = sqlite3_step(stmt)) == SQLITE_ROW) {
+        SearchMatch match;
+        match.stringId = (uint32_t)sqlite3_column_int64(stmt, 0);
+        const char* value = (const char*)sqlite3_column_text(stmt, 1);
+        match.value = value ? value : "";
+        match.kinds = (uint32_t)sqlite3_column_int64(stmt, 2);
+        match.lastSeen = (uint64_t)sqlite3_column_int64(stmt, 3);
+        match.lastPid = (pid_t)sqlite3_column_int(stmt, 4);
+        match.uses = (uint64_t)sqlite3_column_int64(stmt, 5);
+        matches->push_back(match);
+    }
+    if (result != SQLITE_DONE) {
+        *error = sqlite3_errmsg(database);
+    }
+    sqlite3_finalize(stmt);
+    return result == SQLITE_DONE;
+}
@@ -0,0 +1,56 @@
+#ifndef SearchIndex_h
+#define SearchIndex_h
+
+#include <sqlite3.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Substring search over executable paths, command lines and file paths.
+// Each distinct string is indexed once, in an FTS5 trigram index over the
+// `strings` table, and search_usage records when it was last written and by
+// whom. A search looks at distinct strings rather than event rows, so it takes
+// about as long on a year of history as on a day. Without FTS5 trigram
+// support the same search scans search_usage instead. A string leaves the
+// index when string collection finds no row left that uses it.
+
+// What a string was used as; a path can be both an executable and a file
+#define SEARCH_EXECUTABLE   0x01
+#define SEARCH_COMMAND_LINE 0x02
+#define SEARCH_FILE_PATH    0x04
+#define SEARCH_ALL          (SEARCH_EXECUTABLE | SEARCH_COMMAND_LINE | SEARCH_FILE_PATH)
+
+// Most matches one search returns
+#ifndef SEARCH_MAX_RESULTS
+#define SEARCH_MAX_RESULTS 1000
+#endif
+
+struct SearchMatch {
+    uint32_t stringId;
+    std::string value;
+    uint32_t kinds;             // SEARCH_* it has been seen as
+    uint64_t lastSeen;          // epoch seconds of the batch that last wrote it
+    pid_t lastPid;              // 0 if only known from history before the index
+    uint64_t uses;              // rows written with it
+};
+
+// Part of the schema; history already in the database is queued for indexing
+bool createSearchIndex(sqlite3* database);
+// True if the FTS5 index exists; search_usage is kept either way
+bool searchIndexAvailable(sqlite3* database);
+
+// Indexes one queued partition from before the index existed, in its own
+// transaction. Returns false on error; *remaining is the partitions left.
+bool backfillSearchStep(sqlite3* database, bool indexed, int64_t* remaining);
+
+// Takes released strings out of search_usage and the index. Inside the
+// caller's transaction, before their `strings` rows are deleted, since the
+// index needs the old text to remove an entry.
+bool forgetSearchStrings(sqlite3* database, const std::vector<uint32_t>& ids);
+
+// Newest first. `term` matches anywhere in the string, ignoring ASCII case.
+bool searchStrings(sqlite3* database, const char* term, uint32_t kinds, size_t limit,
+                   std::vector<SearchMatch>* matches, std::string* error);
+
+#endif
@@ -0,0 +1,138 @@
+// Flat snapshots for zero-copy bulk queries
+#include "SharedSnapshot.h"
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+SharedSnapshot::~SharedSnapshot() {
+    munmap(region, mappedSize);
+}
+
+SnapshotBuilder::SnapshotBuilder(SnapshotKind kind, uint32_t recordSize, const StringTable* strings)
+    : kind(kind), recordSize(recordSize), strings(strings) {
+    // Offset 0 is the empty string
+    pool.push_back('\0');
+}
+
+uint32_t SnapshotBuilder::appendToPool(const char* data, size_t length) {
+    uint32_t offset = (uint32_t)pool.size();
+    pool.insert(pool.end(), data, data + length);
+    pool.push_back('\0');
+    return offset;
+}
+
+uint32_t SnapshotBuilder::addInterned(uint32_t id) {
+    if (id == 0) {
+        return 0;
+    }
+    auto known = internedOffsets.find(id);
+    if (known != internedOffsets.end()) {
+        return known->second;
+    }
+    
+    size_t length;
+    const char* data = strings->data(id, &length);
+    uint32_t offset = length ? appendToPool(data, length) : 0;
+    internedOffsets.emplace(id, offset);
+    return offset;
+}
+
+// For rows that never went through the string table (the SQLite fallback)
+uint32_t SnapshotBuilder::addString(const std::string& value) {
+    if (value.empty()) {
+        return 0;
+    }
+    auto known = stringOffsets.find(value);
+    if (known != stringOffsets.end()) {
+        return known->second;
+    }
+    
+    uint32_t offset = appendToPool(value.data(), value.size());
+    stringOffsets.emplace(value, offset);
+    return offset;
+}
+
+void SnapshotBuilder::addRecord(const void* record) {
+    const uint8_t* bytes = (const uint8_t*)record;
+    records.insert(records.end(), bytes, bytes + recordSize);
+}
+
+std::shared_ptr<const SharedSnapshot> SnapshotBuilder::finish(uint64_t generation) {
+    // Pad the pool so the total, like every record, stays 8-byte aligned
+    while (pool.size() % 8 != 0) {
+        pool.push_back('\0');
+    }
+    
+    uint64_t total = sizeof(SnapshotHeader) + records.size() + pool.size();
+    if (total > UINT32_MAX) {
+        syslog(LOG_ERR, "SharedSnapshot: %llu bytes is too large", (unsigned long long)total);
+        return nullptr;
+    }
+    
+    size_t page = (size_t)getpagesize();
+    size_t mapped = ((size_t)total + page - 1) / page * page;
+    void* region = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0);
+    if (region == MAP_FAILED) {
+        syslog(LOG_ERR, "SharedSnapshot: cannot map %zu bytes", mapped);
+        return nullptr;
+    }
+    
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.kind = kind;
+    header.count = recordSize ? (uint32_t)(records.size() / recordSize) : 0;
+    header.recordSize = recordSize;
+    header.recordsOffset = sizeof(SnapshotHeader);
+    header.stringsOffset = (uint32_t)(sizeof(SnapshotHeader) + records.size());
+    header.stringsSize = (uint32_t)pool.size();
+    header.totalSize = (uint32_t)total;
+    header.generation = generation;
+    header.createdUsec = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+    
+    uint8_t* out = (uint8_t*)region;
+    memcpy(out, &header, sizeof(header));
+    if (!records.empty()) {
+        memcpy(out + header.recordsOffset, records.data(), records.size());
+    }
+    memcpy(out + header.stringsOffset, pool.data(), pool.size());
+    
+    // Read-only before anyone sees it: the memory entry XPC makes for a client
+    // takes the region's protection, so a client can't write into pages the
+    // extension and every other client share
+    if (mprotect(region, mapped, PROT_READ) != 0) {
+        syslog(LOG_ERR, "SharedSnapshot: cannot make %zu bytes read-only", mapped);
+        munmap(region, mapped);
+        return nullptr;
+    }
+    
+    return std::make_shared<const SharedSnapshot>(region, mapped);
+}
+
+SnapshotCache::SnapshotCache() : builds(0), hits(0) {
+    pthread_mutex_init(&mutex, nullptr);
+}
+
+SnapshotCache::~SnapshotCache() {
+    pthread_mutex_destroy(&mutex);
+}
+
+SnapshotCacheStats SnapshotCache::getStats() const {
+    SnapshotCacheStats stats = SnapshotCacheStats();
+    pthread_mutex_lock(&mutex);
+    stats.builds = builds;
+    stats.hits = hits;
+    for (const auto& snapshot : cached) {
+        if (snapshot) {
+            stats.bytes += snapshot->size();
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    return stats;
+}
@@ -0,0 +1,176 @@
+#ifndef SharedSnapshot_h
+#define SharedSnapshot_h
+
+#include <pthread.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include "StringTable.h"
+
+// Flat, versioned bulk-query results handed to clients as one shared mapping
+// (get_snapshot over XPC). Layout: a SnapshotHeader, `count` records of
+// `recordSize` bytes, then the string pool. String fields are pool offsets of
+// NUL-terminated UTF-8; offset 0 is the empty string and the pool always ends
+// in a NUL. Everything is little-endian and 8-byte aligned. Clients parse it
+// in place (CLI/systemmonitor.swift and ControlApp mirror these offsets), so
+// fields are only ever appended and any other change bumps the version.
+
+#define SNAPSHOT_MAGIC   0x4e535641      // "AVSN"
+#define SNAPSHOT_VERSION 1
+
+enum SnapshotKind : uint16_t {
+    SNAPSHOT_PROCESSES = 1,
+    SNAPSHOT_FILE_ACCESS = 2
+};
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t kind;
+    uint32_t count;
+    uint32_t recordSize;
+    uint32_t recordsOffset;
+    uint32_t stringsOffset;
+    uint32_t stringsSize;
+    uint32_t totalSize;
+    uint64_t generation;        // what the source was at when this was built
+    uint64_t createdUsec;       // wall clock
+};
+
+#define SNAPSHOT_PROCESS_SYSTEM     0x01
+#define SNAPSHOT_PROCESS_AUDIO      0x02
+#define SNAPSHOT_PROCESS_VIDEO      0x04
+#define SNAPSHOT_PROCESS_NETWORK    0x08
+#define SNAPSHOT_PROCESS_FILESYSTEM 0x10
+
+struct SnapshotProcess {
+    int32_t pid;
+    int32_t ppid;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t startTime;
+    uint64_t cpuTime;
+    uint64_t memoryUsage;
+    uint32_t executablePath;
+    uint32_t commandLine;
+    uint32_t bundleIdentifier;
+    uint8_t enrichmentTier;
+    uint8_t flags;              // SNAPSHOT_PROCESS_*
+    uint16_t reserved;
+};
+
+struct SnapshotFileAccess {
+    uint64_t timestamp;
+    uint64_t lastSeen;
+    int32_t pid;
+    uint32_t count;
+    uint32_t path;
+    uint32_t accessType;
+    uint32_t reason;
+    uint8_t blocked;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(SnapshotHeader) == 48, "SnapshotHeader layout is shared with clients");
+static_assert(sizeof(SnapshotProcess) == 56, "SnapshotProcess layout is shared with clients");
+static_assert(sizeof(SnapshotFileAccess) == 40, "SnapshotFileAccess layout is shared with clients");
+
+// A finished snapshot in its own anonymous shared mapping, which
+// xpc_shmem_create can hand out as-is. finish() makes it read-only, so any
+// number of clients can map it while it is alive here and none can change it.
+class SharedSnapshot {
+public:
+    SharedSnapshot(void* region, size_t size) : region(region), mappedSize(size) {}
+    ~SharedSnapshot();
+    
+    SharedSnapshot(const SharedSnapshot&) = delete;
+    SharedSnapshot& operator=(const SharedSnapshot&) = delete;
+    
+    // Page-rounded; the header's totalSize is the used part
+    void* data() const { return region; }
+    size_t size() const { return mappedSize; }
+    const SnapshotHeader& header() const { return *(const SnapshotHeader*)region; }
+
+private:
+    void* region;
+    size_t mappedSize;
+};
+
+// Collects records and their strings, deduplicating by StringTable ID
+class SnapshotBuilder {
+public:
+    SnapshotBuilder(SnapshotKind kind, uint32_t recordSize, const StringTable* strings);
+    
+    uint32_t addInterned(uint32_t id);
+    uint32_t addString(const std::string& value);
+    void addRecord(const void* record);
+    
+    // Null if the mapping can't be made or the result would not fit 32-bit offsets
+    std::shared_ptr<const SharedSnapshot> finish(uint64_t generation);
+
+private:
+    SnapshotKind kind;
+    uint32_t recordSize;
+    const StringTable* strings;
+    std::vector<uint8_t> records;
+    std::vector<char> pool;
+    std::unordered_map<uint32_t, uint32_t> internedOffsets;
+    std::unordered_map<std::string, uint32_t> stringOffsets;
+    
+    uint32_t appendToPool(const char* data, size_t length);
+};
+
+struct SnapshotCacheStats {
+    uint64_t builds;
+    uint64_t hits;
+    uint64_t bytes;             // mapped by the snapshots currently cached
+};
+
+// The newest snapshot of each kind, reused while its source generation hasn't
+// moved. However many clients ask, the extension holds one mapping per kind;
+// a replaced one is unmapped once no request holds it, while the memory entry
+// XPC made for it keeps the pages alive in the clients that mapped them.
+class SnapshotCache {
+public:
+    SnapshotCache();
+    ~SnapshotCache();
+    
+    // Builds under the lock, so clients asking at once share one build
+    template <typename Build>
+    std::shared_ptr<const SharedSnapshot> get(SnapshotKind kind, uint64_t generation, Build build);
+    
+    SnapshotCacheStats getStats() const;
+
+private:
+    static const int kKinds = 3;
+    
+    mutable pthread_mutex_t mutex;
+    std::shared_ptr<const SharedSnapshot> cached[kKinds];
+    uint64_t builds;
+    uint64_t hits;
+};
+
+template <typename Build>
+std::shared_ptr<const SharedSnapshot> SnapshotCache::get(SnapshotKind kind, uint64_t generation, Build build) {
+    pthread_mutex_lock(&mutex);
+    std::shared_ptr<const SharedSnapshot>& slot = cached[kind];
+    if (slot && slot->header().generation == generation) {
+        hits++;
+        std::shared_ptr<const SharedSnapshot> snapshot = slot;
+        pthread_mutex_unlock(&mutex);
+        return snapshot;
+    }
+    
+    std::shared_ptr<const SharedSnapshot> snapshot = build();
+    if (snapshot) {
+        slot = snapshot;
+        builds++;
+    }
+    pthread_mutex_unlock(&mutex);
+    return snapshot;
+}
+
+#endif
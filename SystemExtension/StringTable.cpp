@@ -0,0 +1,384 @@
+// Interned string arena shared by the hot in-memory structures and the event store
+#include "StringTable.h"
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+StringTable::StringTable()
+    : entryCount(0), buckets(nullptr), bucketMask(0), arenaBlock(nullptr),
+      arenaUsed(STRING_TABLE_ARENA_BLOCK), epoch(0), overflowed(false), bytes(0), freeCount(0),
+      released(0), overflows(0), hits(0), misses(0) {
+    for (uint32_t i = 0; i < kChunkCount; i++) {
+        chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+    pthread_rwlock_init(&lock, nullptr);
+    
+    bucketMask = 4096 - 1;
+    buckets = (uint32_t*)calloc(bucketMask + 1, sizeof(uint32_t));
+    
+    // ID 0 is the empty string and is never indexed
+    appendLocked("", 0, hashBytes("", 0));
+}
+
+StringTable::~StringTable() {
+    for (uint32_t i = 0; i < kChunkCount; i++) {
+        delete[] chunks[i].load(std::memory_order_relaxed);
+    }
+    for (char* block : arenaBlocks) {
+        free(block);
+    }
+    free(buckets);
+    pthread_rwlock_destroy(&lock);
+}
+
+uint32_t StringTable::hashBytes(const char* data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)data[i]) * 0x100000001b3ull;
+    }
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+const StringTable::Entry* StringTable::entry(uint32_t id) const {
+    if (id >= entryCount.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    Entry* chunk = chunks[id >> kChunkBits].load(std::memory_order_acquire);
+    return chunk ? &chunk[id & (kChunkSize - 1)] : nullptr;
+}
+
+uint32_t StringTable::findLocked(const char* data, size_t length, uint32_t hash) const {
+    for (uint32_t slot = hash & bucketMask;; slot = (slot + 1) & bucketMask) {
+        uint32_t id = buckets[slot];
+        if (id == 0) {
+            return 0;
+        }
+        const Entry* candidate = entry(id);
+        if (candidate->hash == hash && candidate->length == length &&
+            memcmp(candidate->data, data, length) == 0) {
+            return id;
+        }
+    }
+}
+
+char* StringTable::allocateLocked(size_t length) {
+    // Oversized strings get a block of their own
+    if (length > STRING_TABLE_ARENA_BLOCK / 4) {
+        char* block = (char*)malloc(length);
+        if (block) {
+            arenaBlocks.push_back(block);
+        }
+        return block;
+    }
+    
+    // Rounded so released strings of about the same length can share their bytes
+    length = (length + 7) & ~(size_t)7;
+    auto reusable = freeBytes.find(length);
+    if (reusable != freeBytes.end() && !reusable->second.empty()) {
+        char* result = reusable->second.back();
+        reusable->second.pop_back();
+        return result;
+    }
+    
+    if (arenaUsed + length > STRING_TABLE_ARENA_BLOCK) {
+        arenaBlock = (char*)malloc(STRING_TABLE_ARENA_BLOCK);
+        if (!arenaBlock) {
+            arenaUsed = STRING_TABLE_ARENA_BLOCK;
+            return nullptr;
+        }
+        arenaBlocks.push_back(arenaBlock);
+        arenaUsed = 0;
+    }
+    
+    char* result = arenaBlock + arenaUsed;
+    arenaUsed += length;
+    return result;
+}
+
+void StringTable::freeLocked(char* data, size_t length) {
+    if (length > STRING_TABLE_ARENA_BLOCK / 4) {
+        for (size_t i = 0; i < arenaBlocks.size(); i++) {
+            if (arenaBlocks[i] == data) {
+                arenaBlocks[i] = arenaBlocks.back();
+                arenaBlocks.pop_back();
+                free(data);
+                break;
+            }
+        }
+        return;
+    }
+    freeBytes[(length + 7) & ~(size_t)7].push_back(data);
+}
+
+// The entry for a new ID at the end of the table; published by the caller
+StringTable::Entry* StringTable::claimLocked(uint32_t id) {
+    Entry* chunk = chunks[id >> kChunkBits].load(std::memory_order_relaxed);
+    if (!chunk) {
+        chunk = new Entry[kChunkSize];
+        chunks[id >> kChunkBits].store(chunk, std::memory_order_release);
+    }
+    return &chunk[id & (kChunkSize - 1)];
+}
+
+// Takes a released ID if there is one, otherwise the next new one
+uint32_t StringTable::appendLocked(const char* data, size_t length, uint32_t hash) {
+    bool reuse = !freeIds.empty();
+    uint32_t id = reuse ? freeIds.back() : entryCount.load(std::memory_order_relaxed);
+    if ((!reuse && id >= STRING_TABLE_MAX_ENTRIES) || length > UINT32_MAX) {
+        return 0;
+    }
+    
+    // Strings are stored unterminated; length is authoritative
+    char* copy = nullptr;
+    if (length > 0) {
+        copy = allocateLocked(length);
+        if (!copy) {
+            return 0;
+        }
+        memcpy(copy, data, length);
+    }
+    
+    Entry* slot = reuse ? entry(id) : claimLocked(id);
+    slot->data = copy ? copy : "";
+    slot->length = (uint32_t)length;
+    slot->hash = hash;
+    slot->epoch.store(epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    slot->state.store(reuse ? ENTRY_REUSED : ENTRY_LIVE, std::memory_order_relaxed);
+    bytes.fetch_add(length, std::memory_order_relaxed);
+    
+    if (reuse) {
+        // The ID is only handed out once the lock is dropped, which publishes the entry
+        freeIds.pop_back();
+        freeCount.fetch_sub(1, std::memory_order_relaxed);
+        reusedIds.push_back(id);
+    } else {
+        // Publish the entry before anyone can hold its ID
+        entryCount.store(id + 1, std::memory_order_release);
+    }
+    return id;
+}
+
+void StringTable::growIndexLocked() {
+    uint32_t newMask = bucketMask * 2 + 1;
+    uint32_t* newBuckets = (uint32_t*)calloc(newMask + 1, sizeof(uint32_t));
+    if (!newBuckets) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i <= bucketMask; i++) {
+        uint32_t id = buckets[i];
+        if (id == 0) {
+            continue;
+        }
+        uint32_t slot = entry(id)->hash & newMask;
+        while (newBuckets[slot] != 0) {
+            slot = (slot + 1) & newMask;
+        }
+        newBuckets[slot] = id;
+    }
+    
+    free(buckets);
+    buckets = newBuckets;
+    bucketMask = newMask;
+}
+
+// Backward-shift deletion keeps every probe run unbroken without tombstones
+void StringTable::unindexLocked(uint32_t id, uint32_t hash) {
+    uint32_t hole = hash & bucketMask;
+    while (buckets[hole] != id) {
+        // Duplicates restored from disk were never indexed
+        if (buckets[hole] == 0) {
+            return;
+        }
+        hole = (hole + 1) & bucketMask;
+    }
+    
+    for (uint32_t next = (hole + 1) & bucketMask; buckets[next] != 0; next = (next + 1) & bucketMask) {
+        uint32_t home = entry(buckets[next])->hash & bucketMask;
+        // Move it back unless its home lies after the hole, in which case it isn't displaced past it
+        if (((next - home) & bucketMask) >= ((next - hole) & bucketMask)) {
+            buckets[hole] = buckets[next];
+            hole = next;
+        }
+    }
+    buckets[hole] = 0;
+}
+
+void StringTable::indexLocked(uint32_t id, uint32_t hash) {
+    // Keep the load factor at or below one half
+    if ((uint64_t)count() * 2 > (uint64_t)bucketMask + 1) {
+        growIndexLocked();
+    }
+    
+    uint32_t slot = hash & bucketMask;
+    while (buckets[slot] != 0) {
+        slot = (slot + 1) & bucketMask;
+    }
+    buckets[slot] = id;
+}
+
+uint32_t StringTable::intern(const char* data, size_t length) {
+    if (!data || length == 0) {
+        return 0;
+    }
+    
+    uint32_t hash = hashBytes(data, length);
+    
+    // Stamped under the lock so a collection can't release it in between
+    uint32_t now = epoch.load(std::memory_order_relaxed);
+    pthread_rwlock_rdlock(&lock);
+    uint32_t id = findLocked(data, length, hash);
+    if (id != 0) {
+        Entry* found = entry(id);
+        if (found->epoch.load(std::memory_order_relaxed) != now) {
+            found->epoch.store(now, std::memory_order_relaxed);
+        }
+    }
+    pthread_rwlock_unlock(&lock);
+    if (id != 0) {
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+    
+    pthread_rwlock_wrlock(&lock);
+    // Someone may have added it between the two locks
+    id = findLocked(data, length, hash);
+    if (id != 0) {
+        entry(id)->epoch.store(epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    } else {
+        id = appendLocked(data, length, hash);
+        if (id != 0) {
+            indexLocked(id, hash);
+        }
+    }
+    pthread_rwlock_unlock(&lock);
+    
+    if (id == 0) {
+        // Every such string reads back empty, so this is never quiet: logged at
+        // the first refusal and every 10000th after, counted, and the database
+        // writer is asked to collect without waiting for retention
+        overflowed.store(true, std::memory_order_relaxed);
+        uint64_t refused = overflows.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (refused == 1 || refused % 10000 == 0) {
+            syslog(LOG_ERR, "StringTable full at %u live strings; %llu strings stored as empty so far",
+                   (unsigned)STRING_TABLE_MAX_ENTRIES, (unsigned long long)refused);
+        }
+    }
+    
+    misses.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+bool StringTable::restore(uint32_t id, const char* data, size_t length) {
+    if (id == 0) {
+        return true;
+    }
+    
+    pthread_rwlock_wrlock(&lock);
+    
+    // Gaps are IDs collected earlier; they keep in-memory IDs aligned with
+    // the rows on disk and are handed out again like any released ID
+    while (count() < id && count() < STRING_TABLE_MAX_ENTRIES) {
+        uint32_t gap = count();
+        Entry* slot = claimLocked(gap);
+        slot->data = "";
+        slot->length = 0;
+        slot->hash = 0;
+        slot->epoch.store(0, std::memory_order_relaxed);
+        slot->state.store(ENTRY_FREE, std::memory_order_relaxed);
+        entryCount.store(gap + 1, std::memory_order_release);
+        freeIds.push_back(gap);
+        freeCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    // Restored at the end of the table, never into one of the gaps
+    std::vector<uint32_t> gaps;
+    gaps.swap(freeIds);
+    bool restored = false;
+    if (count() == id) {
+        uint32_t hash = hashBytes(data, length);
+        if (appendLocked(data, length, hash) == id) {
+            if (length > 0 && findLocked(data, length, hash) == 0) {
+                indexLocked(id, hash);
+            }
+            restored = true;
+        }
+    }
+    freeIds.swap(gaps);
+    
+    pthread_rwlock_unlock(&lock);
+    return restored;
+}
+
+uint32_t StringTable::beginCollection() {
+    overflowed.store(false, std::memory_order_relaxed);
+    return epoch.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void StringTable::release(const std::vector<uint32_t>& ids, uint32_t collectionEpoch,
+                          std::vector<uint32_t>* releasedIds) {
+    pthread_rwlock_wrlock(&lock);
+    for (uint32_t id : ids) {
+        Entry* found = id != 0 ? entry(id) : nullptr;
+        if (!found || found->state.load(std::memory_order_relaxed) == ENTRY_FREE ||
+            found->epoch.load(std::memory_order_relaxed) + STRING_TABLE_GRACE_EPOCHS > collectionEpoch) {
+            continue;
+        }
+        
+        if (found->length > 0) {
+            unindexLocked(id, found->hash);
+            freeLocked((char*)found->data, found->length);
+        }
+        bytes.fetch_sub(found->length, std::memory_order_relaxed);
+        found->data = "";
+        found->length = 0;
+        found->state.store(ENTRY_FREE, std::memory_order_relaxed);
+        freeIds.push_back(id);
+        releasedIds->push_back(id);
+    }
+    freeCount.store(freeIds.size(), std::memory_order_relaxed);
+    pthread_rwlock_unlock(&lock);
+    released.fetch_add(releasedIds->size(), std::memory_order_relaxed);
+}
+
+void StringTable::takeReused(std::vector<uint32_t>* ids) {
+    pthread_rwlock_wrlock(&lock);
+    ids->insert(ids->end(), reusedIds.begin(), reusedIds.end());
+    reusedIds.clear();
+    pthread_rwlock_unlock(&lock);
+}
+
+bool StringTable::takeUnjournaled(uint32_t id) {
+    Entry* found = entry(id);
+    uint8_t reused = ENTRY_REUSED;
+    return found && found->state.load(std::memory_order_relaxed) == ENTRY_REUSED &&
+           found->state.compare_exchange_strong(reused, ENTRY_LIVE, std::memory_order_relaxed);
+}
+
+const char* StringTable::data(uint32_t id, size_t* length) const {
+    const Entry* found = entry(id);
+    if (!found) {
+        *length = 0;
+        return "";
+    }
+    *length = found->length;
+    return found->data;
+}
+
+std::string StringTable::str(uint32_t id) const {
+    size_t length;
+    const char* value = data(id, &length);
+    return std::string(value, length);
+}
+
+StringTableStats StringTable::getStats() const {
+    StringTableStats stats;
+    stats.freeIds = freeCount.load(std::memory_order_relaxed);
+    stats.strings = count() - stats.freeIds;
+    stats.bytes = bytes.load(std::memory_order_relaxed);
+    stats.hits = hits.load(std::memory_order_relaxed);
+    stats.misses = misses.load(std::memory_order_relaxed);
+    stats.released = released.load(std::memory_order_relaxed);
+    stats.overflows = overflows.load(std::memory_order_relaxed);
+    return stats;
+}
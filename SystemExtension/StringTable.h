@@ -0,0 +1,144 @@
+#ifndef StringTable_h
+#define StringTable_h
+
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+// Upper bound on live strings. Past it interning fails (returns 0); every
+// failure is counted and logged, and asks the writer to collect early.
+#ifndef STRING_TABLE_MAX_ENTRIES
+#define STRING_TABLE_MAX_ENTRIES (1u << 22)
+#endif
+
+// Collections an ID has to go without being interned before it can be released
+#ifndef STRING_TABLE_GRACE_EPOCHS
+#define STRING_TABLE_GRACE_EPOCHS 2
+#endif
+
+// Size of each block string bytes are carved from
+#ifndef STRING_TABLE_ARENA_BLOCK
+#define STRING_TABLE_ARENA_BLOCK (256 * 1024)
+#endif
+
+struct StringTableStats {
+    uint64_t strings;           // live IDs
+    uint64_t bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t freeIds;           // released, waiting to be handed out again
+    uint64_t released;
+    uint64_t overflows;         // interns refused because the table was full
+};
+
+// Hash-consed string arena. Every distinct string is stored once and named by a
+// dense 32-bit ID, which is also its row id in the on-disk `strings` table.
+// ID 0 is the empty string. Interning a known string takes a shared lock and
+// never allocates; resolving an ID is lock-free.
+//
+// The database writer collects strings nothing refers to any more and releases
+// their IDs, which are then handed out again. Interning stamps a string with
+// the current collection epoch, and only strings that have gone
+// STRING_TABLE_GRACE_EPOCHS collections unstamped can be released, so an ID
+// obtained recently always resolves. Anything that keeps an ID longer than
+// that without interning it again must report it as a root at collection.
+class StringTable {
+public:
+    StringTable();
+    ~StringTable();
+    
+    uint32_t intern(const char* data, size_t length);
+    uint32_t intern(const std::string& value) { return intern(value.data(), value.size()); }
+    
+    // Re-registers a string read back from disk under its stored ID. IDs must
+    // arrive in ascending order; gaps are filled with empty placeholders.
+    bool restore(uint32_t id, const char* data, size_t length);
+    
+    // Valid until the ID is released; unknown and released IDs resolve to ""
+    const char* data(uint32_t id, size_t* length) const;
+    std::string str(uint32_t id) const;
+    
+    // One past the highest ID handed out
+    uint32_t count() const { return entryCount.load(std::memory_order_acquire); }
+    
+    // Collection, driven by the database writer. beginCollection starts a new
+    // epoch and returns it; release frees those of `ids` that are unstamped
+    // for long enough and appends them to *released.
+    uint32_t beginCollection();
+    void release(const std::vector<uint32_t>& ids, uint32_t epoch, std::vector<uint32_t>* released);
+    // Set once an intern has been refused for lack of room
+    bool collectionWanted() const { return overflowed.load(std::memory_order_relaxed); }
+    
+    // Released IDs handed out again since the last call. They sit below
+    // count(), so the writer, which persists by ID range, asks for them here.
+    void takeReused(std::vector<uint32_t>* ids);
+    // True once for each reuse of `id`, for the journal
+    bool takeUnjournaled(uint32_t id);
+    
+    StringTableStats getStats() const;
+
+private:
+    enum EntryState : uint8_t {
+        ENTRY_LIVE,
+        ENTRY_REUSED,       // live; the journal hasn't seen this string yet
+        ENTRY_FREE
+    };
+    
+    struct Entry {
+        const char* data;
+        uint32_t length;
+        uint32_t hash;
+        std::atomic<uint32_t> epoch;    // collection epoch it was last interned in
+        std::atomic<uint8_t> state;
+    };
+    
+    static const uint32_t kChunkBits = 12;
+    static const uint32_t kChunkSize = 1u << kChunkBits;
+    static const uint32_t kChunkCount = (STRING_TABLE_MAX_ENTRIES + kChunkSize - 1) / kChunkSize;
+    
+    // Entries live in fixed chunks so their addresses never move
+    std::atomic<Entry*> chunks[kChunkCount];
+    std::atomic<uint32_t> entryCount;
+    
+    // Open-addressed ID index keyed by hash; 0 marks an empty bucket
+    uint32_t* buckets;
+    uint32_t bucketMask;
+    
+    char* arenaBlock;
+    size_t arenaUsed;
+    std::vector<char*> arenaBlocks;
+    // Bytes of released strings by rounded length, for the next string that size
+    std::unordered_map<size_t, std::vector<char*>> freeBytes;
+    
+    // Under the write lock
+    std::vector<uint32_t> freeIds;
+    std::vector<uint32_t> reusedIds;
+    
+    mutable pthread_rwlock_t lock;
+    std::atomic<uint32_t> epoch;
+    std::atomic<bool> overflowed;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> freeCount;
+    std::atomic<uint64_t> released;
+    std::atomic<uint64_t> overflows;
+    mutable std::atomic<uint64_t> hits;
+    mutable std::atomic<uint64_t> misses;
+    
+    static uint32_t hashBytes(const char* data, size_t length);
+    const Entry* entry(uint32_t id) const;
+    Entry* entry(uint32_t id) { return const_cast<Entry*>(static_cast<const StringTable*>(this)->entry(id)); }
+    uint32_t findLocked(const char* data, size_t length, uint32_t hash) const;
+    uint32_t appendLocked(const char* data, size_t length, uint32_t hash);
+    Entry* claimLocked(uint32_t id);
+    void indexLocked(uint32_t id, uint32_t hash);
+    void unindexLocked(uint32_t id, uint32_t hash);
+    void growIndexLocked();
+    char* allocateLocked(size_t length);
+    void freeLocked(char* data, size_t length);
+};
+
+#endif
@@ -0,0 +1,348 @@
+// ES subscription profiles and kernel-side muting
+#include "AudioVideoController.h"
+#include <string.h>
+
+// Process lifecycle and the AUTH_OPEN device check, shared by every profile
+#define SUBSCRIPTION_BASE_EVENTS \
+    ES_EVENT_TYPE_NOTIFY_EXEC, \
+    ES_EVENT_TYPE_NOTIFY_EXIT, \
+    ES_EVENT_TYPE_NOTIFY_FORK, \
+    ES_EVENT_TYPE_AUTH_OPEN
+
+static const es_event_type_t minimalEvents[] = {
+    SUBSCRIPTION_BASE_EVENTS
+};
+
+// The kernel caches allowed AUTH_OPENs (see respondToAuthEvent), so after a
+// process's first open of a file only NOTIFY_OPEN still reports it. Opens are
+// logged from NOTIFY_OPEN wherever it's subscribed; AUTH_OPEN then logs only
+// denials, which NOTIFY_OPEN never sees. Minimal logs what AUTH_OPEN reaches.
+static const es_event_type_t devicesOnlyEvents[] = {
+    SUBSCRIPTION_BASE_EVENTS,
+    ES_EVENT_TYPE_NOTIFY_OPEN,
+    ES_EVENT_TYPE_NOTIFY_WRITE,
+    ES_EVENT_TYPE_NOTIFY_UNLINK,
+    ES_EVENT_TYPE_NOTIFY_IOKIT_OPEN,
+    ES_EVENT_TYPE_NOTIFY_MMAP,
+    ES_EVENT_TYPE_NOTIFY_SIGNAL,
+    ES_EVENT_TYPE_NOTIFY_SETUID
+};
+
+// No STAT, READDIR, ACCESS, CLOSE, DUP or CHDIR: one per syscall and nothing
+// reads them. No AUTH_UNLINK either, which reaches the same handler as
+// NOTIFY_UNLINK and would log each delete twice.
+static const es_event_type_t forensicEvents[] = {
+    SUBSCRIPTION_BASE_EVENTS,
+    ES_EVENT_TYPE_NOTIFY_OPEN,
+    ES_EVENT_TYPE_NOTIFY_SIGNAL,
+    ES_EVENT_TYPE_NOTIFY_SETUID,
+    ES_EVENT_TYPE_NOTIFY_SETGID,
+    ES_EVENT_TYPE_NOTIFY_CREATE,
+    ES_EVENT_TYPE_NOTIFY_UNLINK,
+    ES_EVENT_TYPE_NOTIFY_RENAME,
+    ES_EVENT_TYPE_NOTIFY_WRITE,
+    ES_EVENT_TYPE_NOTIFY_TRUNCATE,
+    ES_EVENT_TYPE_NOTIFY_COPYFILE,
+    ES_EVENT_TYPE_NOTIFY_MMAP,
+    ES_EVENT_TYPE_NOTIFY_MPROTECT,
+    ES_EVENT_TYPE_NOTIFY_KEXTLOAD,
+    ES_EVENT_TYPE_NOTIFY_IOKIT_OPEN
+};
+
+// Files every process opens constantly and no device rule is about
+static const MutedPath noisyTargets[] = {
+    {"/dev/null", ES_MUTE_PATH_TYPE_TARGET_LITERAL},
+    {"/dev/random", ES_MUTE_PATH_TYPE_TARGET_LITERAL},
+    {"/dev/urandom", ES_MUTE_PATH_TYPE_TARGET_LITERAL},
+    {"/dev/dtracehelper", ES_MUTE_PATH_TYPE_TARGET_LITERAL},
+    {"/private/var/folders/", ES_MUTE_PATH_TYPE_TARGET_PREFIX},
+    {"/private/var/db/uuidtext/", ES_MUTE_PATH_TYPE_TARGET_PREFIX},
+    {"/private/var/db/diagnostics/", ES_MUTE_PATH_TYPE_TARGET_PREFIX},
+    {"/Library/Caches/", ES_MUTE_PATH_TYPE_TARGET_PREFIX},
+    {"/System/Library/Caches/", ES_MUTE_PATH_TYPE_TARGET_PREFIX}
+};
+
+// SIP-protected daemons that touch files all day long
+static const char* trustedBinaries[] = {
+    "/System/Library/Frameworks/CoreServices.framework/Versions/A/Frameworks/Metadata.framework/Versions/A/Support/mds",
+    "/System/Library/Frameworks/CoreServices.framework/Versions/A/Frameworks/Metadata.framework/Versions/A/Support/mds_stores",
+    "/System/Library/Frameworks/CoreServices.framework/Versions/A/Frameworks/Metadata.framework/Versions/A/Support/mdworker_shared",
+    "/System/Library/Frameworks/CoreServices.framework/Versions/A/Frameworks/FSEvents.framework/Versions/A/Support/fseventsd",
+    "/System/Library/CoreServices/backupd.bundle/Contents/Resources/backupd",
+    "/usr/libexec/logd",
+    "/usr/sbin/syslogd"
+};
+
+// Only their file events are muted; EXEC, FORK and EXIT still keep the process table right
+static const es_event_type_t trustedMutedEvents[] = {
+    ES_EVENT_TYPE_AUTH_OPEN,
+    ES_EVENT_TYPE_NOTIFY_OPEN,
+    ES_EVENT_TYPE_NOTIFY_CLOSE,
+    ES_EVENT_TYPE_NOTIFY_CREATE,
+    ES_EVENT_TYPE_NOTIFY_WRITE,
+    ES_EVENT_TYPE_NOTIFY_UNLINK,
+    ES_EVENT_TYPE_NOTIFY_RENAME,
+    ES_EVENT_TYPE_NOTIFY_TRUNCATE,
+    ES_EVENT_TYPE_NOTIFY_COPYFILE,
+    ES_EVENT_TYPE_NOTIFY_MMAP
+};
+
+static const SubscriptionProfileSpec profileSpecs[SUBSCRIPTION_PROFILE_COUNT] = {
+    {"minimal", minimalEvents, sizeof(minimalEvents) / sizeof(minimalEvents[0]),
+     noisyTargets, sizeof(noisyTargets) / sizeof(noisyTargets[0]), true},
+    {"devices-only", devicesOnlyEvents, sizeof(devicesOnlyEvents) / sizeof(devicesOnlyEvents[0]),
+     noisyTargets, sizeof(noisyTargets) / sizeof(noisyTargets[0]), true},
+    {"forensic", forensicEvents, sizeof(forensicEvents) / sizeof(forensicEvents[0]),
+     nullptr, 0, false}
+};
+
+const SubscriptionProfileSpec& subscriptionProfileSpec(SubscriptionProfile profile) {
+    return profileSpecs[profile < SUBSCRIPTION_PROFILE_COUNT ? profile : SUBSCRIPTION_PROFILE_DEFAULT];
+}
+
+bool parseSubscriptionProfile(const char* name, SubscriptionProfile* profile) {
+    if (!name) {
+        return false;
+    }
+    for (int i = 0; i < SUBSCRIPTION_PROFILE_COUNT; i++) {
+        if (strcmp(name, profileSpecs[i].name) == 0) {
+            *profile = (SubscriptionProfile)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+EsClientRole esClientForEvent(es_event_type_t type) {
+    switch (type) {
+        case ES_EVENT_TYPE_AUTH_EXEC:
+        case ES_EVENT_TYPE_AUTH_OPEN:
+        case ES_EVENT_TYPE_AUTH_UNLINK:
+        case ES_EVENT_TYPE_AUTH_RENAME:
+        case ES_EVENT_TYPE_AUTH_TRUNCATE:
+        case ES_EVENT_TYPE_AUTH_COPYFILE:
+            return ES_CLIENT_AUTH;
+        default:
+            return ES_CLIENT_NOTIFY;
+    }
+}
+
+const char* esClientName(EsClientRole role) {
+    return role == ES_CLIENT_AUTH ? "auth" : "notify";
+}
+
+bool AudioVideoController::applySubscriptionProfile(SubscriptionProfile profile, std::string* error) {
+    const SubscriptionProfileSpec& spec = subscriptionProfileSpec(profile);
+    
+    pthread_mutex_lock(&subscriptionMutex);
+    
+    for (int role = 0; role < ES_CLIENT_COUNT; role++) {
+        if (!esClients[role].client) {
+            pthread_mutex_unlock(&subscriptionMutex);
+            *error = std::string(esClientName((EsClientRole)role)) + " ES client is not running";
+            return false;
+        }
+    }
+    
+    bool wanted[ES_EVENT_TYPE_LAST] = {};
+    for (size_t i = 0; i < spec.eventCount; i++) {
+        wanted[spec.events[i]] = true;
+    }
+    
+    // Each client subscribes and unsubscribes only its own event types
+    std::vector<es_event_type_t> added[ES_CLIENT_COUNT];
+    std::vector<es_event_type_t> removed[ES_CLIENT_COUNT];
+    for (int type = 0; type < ES_EVENT_TYPE_LAST; type++) {
+        EsClientRole role = esClientForEvent((es_event_type_t)type);
+        if (wanted[type] && !subscribedEvents[type]) {
+            added[role].push_back((es_event_type_t)type);
+        } else if (!wanted[type] && subscribedEvents[type]) {
+            removed[role].push_back((es_event_type_t)type);
+        }
+    }
+    
+    // Subscribe before anything else so a failure leaves the old profile fully in place
+    for (int role = 0; role < ES_CLIENT_COUNT; role++) {
+        if (added[role].empty()) {
+            continue;
+        }
+        es_return_t result = es_subscribe(esClients[role].client, added[role].data(), (uint32_t)added[role].size());
+        if (result != ES_RETURN_SUCCESS) {
+            // Take back what the other client already subscribed to
+            for (int undo = 0; undo < role; undo++) {
+                if (!added[undo].empty() &&
+                    es_unsubscribe(esClients[undo].client, added[undo].data(), (uint32_t)added[undo].size()) == ES_RETURN_SUCCESS) {
+                    for (es_event_type_t type : added[undo]) {
+                        subscribedEvents[type] = false;
+                    }
+                }
+            }
+            pthread_mutex_unlock(&subscriptionMutex);
+            *error = std::string("es_subscribe failed on the ") + esClientName((EsClientRole)role) +
+                     " client: " + std::to_string(result);
+            return false;
+        }
+        for (es_event_type_t type : added[role]) {
+            subscribedEvents[type] = true;
+        }
+    }
+    
+    // Our own database and log writes would otherwise come straight back as events
+    audit_token_t token;
+    mach_msg_type_number_t count = TASK_AUDIT_TOKEN_COUNT;
+    bool haveToken = false;
+    for (int role = 0; role < ES_CLIENT_COUNT; role++) {
+        if (esClients[role].selfMuted) {
+            continue;
+        }
+        if (!haveToken) {
+            haveToken = task_info(mach_task_self(), TASK_AUDIT_TOKEN, (task_info_t)&token, &count) == KERN_SUCCESS;
+        }
+        if (haveToken && es_mute_process(esClients[role].client, &token) == ES_RETURN_SUCCESS) {
+            esClients[role].selfMuted = true;
+        } else {
+            muteFailures.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    
+    const SubscriptionProfileSpec& previous = subscriptionProfileSpec(
+        (SubscriptionProfile)subscriptionProfile.load(std::memory_order_relaxed));
+    if (pathMutesApplied) {
+        updatePathMutes(previous, false);
+    }
+    updatePathMutes(spec, true);
+    pathMutesApplied = true;
+    
+    for (int role = 0; role < ES_CLIENT_COUNT; role++) {
+        if (removed[role].empty()) {
+            continue;
+        }
+        es_return_t result = es_unsubscribe(esClients[role].client, removed[role].data(), (uint32_t)removed[role].size());
+        if (result == ES_RETURN_SUCCESS) {
+            for (es_event_type_t type : removed[role]) {
+                subscribedEvents[type] = false;
+            }
+        } else {
+            // Stray events still get dispatched correctly; they just cost what they did before
+            syslog(LOG_WARNING, "AudioVideoController: es_unsubscribe failed on the %s client: %d",
+                   esClientName((EsClientRole)role), result);
+        }
+    }
+    
+    opensFromNotify.store(subscribedEvents[ES_EVENT_TYPE_NOTIFY_OPEN], std::memory_order_relaxed);
+    subscriptionProfile.store(profile, std::memory_order_release);
+    pthread_mutex_unlock(&subscriptionMutex);
+    return true;
+}
+
+// Target and per-event path muting need macOS 13; before that profiles only
+// change the subscription. Mutes are per client, so both get the same targets
+// and each its own share of the trusted binaries' events. Called with
+// subscriptionMutex held.
+void AudioVideoController::updatePathMutes(const SubscriptionProfileSpec& spec, bool mute) {
+    if (__builtin_available(macOS 13.0, *)) {
+        uint64_t muted = 0;
+        
+        for (int role = 0; role < ES_CLIENT_COUNT; role++) {
+            es_client_t* client = esClients[role].client;
+            
+            for (size_t i = 0; i < spec.mutedTargetCount; i++) {
+                const MutedPath& target = spec.mutedTargets[i];
+                es_return_t result = mute ? es_mute_path(client, target.path, target.type)
+                                          : es_unmute_path(client, target.path, target.type);
+                if (result == ES_RETURN_SUCCESS) {
+                    muted++;
+                } else if (mute) {
+                    muteFailures.fetch_add(1, std::memory_order_relaxed);
+                    syslog(LOG_WARNING, "AudioVideoController: Failed to mute target %s", target.path);
+                }
+            }
+            
+            if (!spec.muteTrustedBinaries) {
+                continue;
+            }
+            
+            es_event_type_t events[sizeof(trustedMutedEvents) / sizeof(trustedMutedEvents[0])];
+            size_t eventCount = 0;
+            for (es_event_type_t type : trustedMutedEvents) {
+                if (esClientForEvent(type) == role) {
+                    events[eventCount++] = type;
+                }
+            }
+            if (eventCount == 0) {
+                continue;
+            }
+            
+            for (const char* binary : trustedBinaries) {
+                es_return_t result = mute
+                    ? es_mute_path_events(client, binary, ES_MUTE_PATH_TYPE_LITERAL, events, eventCount)
+                    : es_unmute_path_events(client, binary, ES_MUTE_PATH_TYPE_LITERAL, events, eventCount);
+                if (result == ES_RETURN_SUCCESS) {
+                    muted++;
+                } else if (mute) {
+                    muteFailures.fetch_add(1, std::memory_order_relaxed);
+                    syslog(LOG_WARNING, "AudioVideoController: Failed to mute %s", binary);
+                }
+            }
+        }
+        
+        mutedPaths.store(mute ? muted : 0, std::memory_order_relaxed);
+    }
+}
+
+bool AudioVideoController::setSubscriptionProfile(const char* name, std::string* error) {
+    SubscriptionProfile profile;
+    if (!parseSubscriptionProfile(name, &profile)) {
+        *error = std::string("unknown profile: ") + (name ? name : "(none)");
+        return false;
+    }
+    
+    if (!applySubscriptionProfile(profile, error)) {
+        syslog(LOG_ERR, "AudioVideoController: Failed to switch to profile %s: %s", name, error->c_str());
+        return false;
+    }
+    
+    subscriptionSwitches.fetch_add(1, std::memory_order_relaxed);
+    syslog(LOG_INFO, "AudioVideoController: Subscription profile is now %s", name);
+    return true;
+}
+
+SubscriptionStats AudioVideoController::getSubscriptionStats() const {
+    const SubscriptionProfileSpec& spec = subscriptionProfileSpec(
+        (SubscriptionProfile)subscriptionProfile.load(std::memory_order_acquire));
+    
+    SubscriptionStats stats;
+    stats.profile = spec.name;
+    stats.eventTypes = spec.eventCount;
+    stats.mutedPaths = mutedPaths.load(std::memory_order_relaxed);
+    stats.muteFailures = muteFailures.load(std::memory_order_relaxed);
+    stats.switches = subscriptionSwitches.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::vector<EsClientStats> AudioVideoController::getEsClientStats() {
+    uint64_t eventTypes[ES_CLIENT_COUNT] = {};
+    pthread_mutex_lock(&subscriptionMutex);
+    for (int type = 0; type < ES_EVENT_TYPE_LAST; type++) {
+        if (subscribedEvents[type]) {
+            eventTypes[esClientForEvent((es_event_type_t)type)]++;
+        }
+    }
+    pthread_mutex_unlock(&subscriptionMutex);
+    
+    std::vector<EsClientStats> stats;
+    for (int role = 0; role < ES_CLIENT_COUNT; role++) {
+        const EsClientState& state = esClients[role];
+        EsClientStats entry;
+        entry.name = esClientName((EsClientRole)role);
+        entry.eventTypes = eventTypes[role];
+        entry.messages = state.messages.load(std::memory_order_relaxed);
+        entry.missedDeadlines = state.missedDeadlines.load(std::memory_order_relaxed);
+        entry.delivery = state.deliveryLatency.summarize();
+        entry.deadlineMargin = state.deadlineMargin.summarize();
+        entry.minDeadlineMarginNs = entry.deadlineMargin.count > 0
+            ? state.minDeadlineMarginNs.load(std::memory_order_relaxed) : 0;
+        stats.push_back(entry);
+    }
+    return stats;
+}
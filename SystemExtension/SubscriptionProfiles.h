@@ -0,0 +1,72 @@
+#ifndef SubscriptionProfiles_h
+#define SubscriptionProfiles_h
+
+#include <EndpointSecurity/EndpointSecurity.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "LatencyHistogram.h"
+
+// Which ES events the client asks the kernel for, and which it mutes.
+// Every profile keeps process lifecycle and AUTH_OPEN, so the process table
+// and device blocking work the same under all of them.
+enum SubscriptionProfile : uint8_t {
+    SUBSCRIPTION_PROFILE_MINIMAL,       // lifecycle and device enforcement only
+    SUBSCRIPTION_PROFILE_DEVICES_ONLY,  // plus file opens, writes and deletes, IOKit opens,
+                                        // mappings, signals and setuid
+    SUBSCRIPTION_PROFILE_FORENSIC,      // every event with a handler, nothing muted
+    SUBSCRIPTION_PROFILE_COUNT
+};
+
+// Profile the ES client starts with
+#ifndef SUBSCRIPTION_PROFILE_DEFAULT
+#define SUBSCRIPTION_PROFILE_DEFAULT SUBSCRIPTION_PROFILE_DEVICES_ONLY
+#endif
+
+// AUTH events get an ES client of their own, so the callback queue that
+// answers the kernel never sits behind a burst of NOTIFY traffic
+enum EsClientRole : uint8_t {
+    ES_CLIENT_AUTH,
+    ES_CLIENT_NOTIFY,
+    ES_CLIENT_COUNT
+};
+
+struct MutedPath {
+    const char* path;
+    es_mute_path_type_t type;
+};
+
+struct SubscriptionProfileSpec {
+    const char* name;
+    const es_event_type_t* events;
+    size_t eventCount;
+    const MutedPath* mutedTargets;      // events on these files never leave the kernel
+    size_t mutedTargetCount;
+    bool muteTrustedBinaries;           // drop file events from known-noisy system daemons
+};
+
+struct SubscriptionStats {
+    const char* profile;
+    uint64_t eventTypes;
+    uint64_t mutedPaths;
+    uint64_t muteFailures;
+    uint64_t switches;
+};
+
+struct EsClientStats {
+    const char* name;
+    uint64_t eventTypes;            // subscribed on this client
+    uint64_t messages;
+    uint64_t missedDeadlines;       // answered after message->deadline
+    uint64_t minDeadlineMarginNs;   // closest an answer came to the deadline
+    LatencySummary delivery;        // event creation to our callback
+    LatencySummary deadlineMargin;  // time left before the deadline when answered
+};
+
+const SubscriptionProfileSpec& subscriptionProfileSpec(SubscriptionProfile profile);
+bool parseSubscriptionProfile(const char* name, SubscriptionProfile* profile);
+
+// Which client an event type is subscribed on
+EsClientRole esClientForEvent(es_event_type_t type);
+const char* esClientName(EsClientRole role);
+
+#endif
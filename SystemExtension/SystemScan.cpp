@@ -0,0 +1,119 @@
+// C interface to the directory scanner and process list for the Swift tools
+#include "SystemScan.h"
+#include "DirectoryScanner.h"
+#include "LatencyHistogram.h"
+#include "ProcessTracker.h"
+#include <libproc.h>
+#include <syslog.h>
+#include <deque>
+#include <new>
+#include <string>
+#include <vector>
+
+struct SystemDirectoryScanner {
+    DirectoryScanner scanner;
+    std::string cachePath;
+    
+    SystemDirectoryScanner(unsigned threads) : scanner(threads) {}
+};
+
+SystemDirectoryScanner* systemDirectoryScannerCreate(const char* cachePath, unsigned threads) {
+    SystemDirectoryScanner* scanner = new (std::nothrow) SystemDirectoryScanner(threads);
+    if (!scanner || !cachePath) {
+        return scanner;
+    }
+    
+    scanner->cachePath = cachePath;
+    std::string error;
+    if (!scanner->scanner.load(cachePath, &error)) {
+        syslog(LOG_WARNING, "SystemScan: starting a new size cache: %s", error.c_str());
+    }
+    return scanner;
+}
+
+bool systemDirectoryScannerScan(SystemDirectoryScanner* scanner, const char* path, SystemDirectoryTotals* totals) {
+    DirectoryTotals found;
+    std::string error;
+    if (!scanner->scanner.scan(path, &found, &error)) {
+        return false;
+    }
+    totals->bytes = found.bytes;
+    totals->files = found.files;
+    totals->directories = found.directories;
+    totals->directoriesRead = found.directoriesRead;
+    totals->errors = found.errors;
+    return true;
+}
+
+void systemDirectoryScannerInvalidate(SystemDirectoryScanner* scanner, const char* path) {
+    scanner->scanner.invalidate(path);
+}
+
+void systemDirectoryScannerDestroy(SystemDirectoryScanner* scanner) {
+    if (!scanner) {
+        return;
+    }
+    std::string error;
+    if (!scanner->cachePath.empty() && !scanner->scanner.save(scanner->cachePath.c_str(), &error)) {
+        syslog(LOG_WARNING, "SystemScan: size cache not saved: %s", error.c_str());
+    }
+    delete scanner;
+}
+
+// Strings sit in a deque so the entries' pointers survive it growing
+struct SystemProcessList {
+    std::vector<SystemProcessEntry> entries;
+    std::deque<std::string> strings;
+};
+
+SystemProcessList* systemProcessListCopy(void) {
+    ProcessTracker tracker;
+    if (!tracker.sample()) {
+        return nullptr;
+    }
+    SystemProcessList* list = new (std::nothrow) SystemProcessList;
+    if (!list) {
+        return nullptr;
+    }
+    
+    // The first sample has every process in appeared()
+    list->entries.reserve(tracker.appeared().size());
+    for (const ProcessIdentity& process : tracker.appeared()) {
+        const struct kinfo_proc& info = tracker.info(process);
+        SystemProcessEntry entry = {};
+        entry.pid = process.pid;
+        entry.ppid = info.kp_eproc.e_ppid;
+        entry.uid = info.kp_eproc.e_ucred.cr_uid;
+        list->strings.push_back(tracker.name(process));
+        entry.name = list->strings.back().c_str();
+        
+        char path[PROC_PIDPATHINFO_MAXSIZE];
+        if (proc_pidpath(process.pid, path, sizeof(path)) > 0) {
+            list->strings.push_back(path);
+            entry.path = list->strings.back().c_str();
+        } else {
+            entry.path = entry.name;
+        }
+        
+        // Other users' processes need root; task times are in mach time units
+        struct proc_taskinfo task;
+        if (proc_pidinfo(process.pid, PROC_PIDTASKINFO, 0, &task, sizeof(task)) > 0) {
+            entry.residentBytes = task.pti_resident_size;
+            entry.cpuTimeNs = machToNanoseconds(task.pti_total_user + task.pti_total_system);
+        }
+        list->entries.push_back(entry);
+    }
+    return list;
+}
+
+size_t systemProcessListCount(const SystemProcessList* list) {
+    return list->entries.size();
+}
+
+const SystemProcessEntry* systemProcessListEntries(const SystemProcessList* list) {
+    return list->entries.data();
+}
+
+void systemProcessListFree(SystemProcessList* list) {
+    delete list;
+}
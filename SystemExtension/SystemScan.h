@@ -0,0 +1,61 @@
+#ifndef SystemScan_h
+#define SystemScan_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// C entry points for the Swift tools. systemcleanup imports this header and
+// links SystemScan.cpp, DirectoryScanner.cpp and ProcessTracker.cpp, so it
+// sizes directories and lists processes with the extension's own code
+// instead of walking FileManager or parsing ps.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct SystemDirectoryScanner SystemDirectoryScanner;
+
+typedef struct {
+    uint64_t bytes;
+    uint64_t files;
+    uint64_t directories;
+    uint64_t directoriesRead;       // the rest came from the size cache
+    uint64_t errors;                // directories that couldn't be read in full
+} SystemDirectoryTotals;
+
+// cachePath may be null for no cache; a damaged cache is started over.
+// threads 0 is one per active CPU.
+SystemDirectoryScanner* systemDirectoryScannerCreate(const char* cachePath, unsigned threads);
+// False if path isn't a readable directory
+bool systemDirectoryScannerScan(SystemDirectoryScanner* scanner, const char* path, SystemDirectoryTotals* totals);
+// After the caller has changed something under path
+void systemDirectoryScannerInvalidate(SystemDirectoryScanner* scanner, const char* path);
+// Saves the cache and frees the scanner
+void systemDirectoryScannerDestroy(SystemDirectoryScanner* scanner);
+
+typedef struct {
+    pid_t pid;
+    pid_t ppid;
+    uid_t uid;
+    const char* name;               // p_comm
+    const char* path;               // executable; p_comm when it can't be read
+    uint64_t residentBytes;         // 0 when task info can't be read
+    uint64_t cpuTimeNs;             // user and system time so far
+} SystemProcessEntry;
+
+typedef struct SystemProcessList SystemProcessList;
+
+// Every process from one KERN_PROC_ALL read, with libproc's path and task
+// info; entries and their strings live as long as the list. Null on failure.
+SystemProcessList* systemProcessListCopy(void);
+size_t systemProcessListCount(const SystemProcessList* list);
+const SystemProcessEntry* systemProcessListEntries(const SystemProcessList* list);
+void systemProcessListFree(SystemProcessList* list);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
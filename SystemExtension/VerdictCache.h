@@ -0,0 +1,110 @@
+#ifndef VerdictCache_h
+#define VerdictCache_h
+
+#include <EndpointSecurity/EndpointSecurity.h>
+#include <atomic>
+#include <stdint.h>
+#include "EventPipeline.h"
+
+// Number of slots in the verdict cache (power of two)
+#ifndef VERDICT_CACHE_SLOTS
+#define VERDICT_CACHE_SLOTS 65536
+#endif
+
+// Direct-mapped cache of AUTH verdicts keyed on (executable, target, event type).
+// Each slot packs tag | generation | verdict into one 64-bit word so lookups and
+// stores are single relaxed atomics safe to use from any ES callback queue.
+// Bumping the generation invalidates every entry at once.
+class VerdictCache {
+    static_assert((VERDICT_CACHE_SLOTS & (VERDICT_CACHE_SLOTS - 1)) == 0,
+                  "VERDICT_CACHE_SLOTS must be a power of two");
+
+public:
+    VerdictCache() : generation(1), hits(0), misses(0) {
+        for (size_t i = 0; i < VERDICT_CACHE_SLOTS; i++) {
+            slots[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    
+    // Generation to tag a decision with; read it before reading the policy
+    uint32_t currentGeneration() const {
+        return generation.load(std::memory_order_acquire) & kGenerationMask;
+    }
+    
+    bool lookup(uint64_t key, uint32_t gen, AuthVerdict* verdict) {
+        uint64_t slot = slots[key & (VERDICT_CACHE_SLOTS - 1)].load(std::memory_order_relaxed);
+        if (slot != 0 && (slot >> kTagShift) == (key >> kTagShift) &&
+            ((slot >> kVerdictBits) & kGenerationMask) == gen) {
+            *verdict = (AuthVerdict)(slot & kVerdictMask);
+            hits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    void store(uint64_t key, uint32_t gen, AuthVerdict verdict) {
+        uint64_t slot = (key & ~((1ull << kTagShift) - 1)) |
+                        ((uint64_t)(gen & kGenerationMask) << kVerdictBits) |
+                        ((uint64_t)verdict & kVerdictMask);
+        slots[key & (VERDICT_CACHE_SLOTS - 1)].store(slot, std::memory_order_relaxed);
+    }
+    
+    // Must be called after the policy it guards has been updated
+    void invalidate() {
+        uint32_t next = (generation.load(std::memory_order_relaxed) + 1) & kGenerationMask;
+        if (next == 0) {
+            // Generation wrapped: wipe the table so old entries can't alias
+            for (size_t i = 0; i < VERDICT_CACHE_SLOTS; i++) {
+                slots[i].store(0, std::memory_order_relaxed);
+            }
+            next = 1;
+        }
+        generation.store(next, std::memory_order_release);
+    }
+    
+    uint64_t hitCount() const { return hits.load(std::memory_order_relaxed); }
+    uint64_t missCount() const { return misses.load(std::memory_order_relaxed); }
+    
+    static uint64_t mix(uint64_t value) {
+        value ^= value >> 30;
+        value *= 0xbf58476d1ce4e5b9ull;
+        value ^= value >> 27;
+        value *= 0x94d049bb133111ebull;
+        value ^= value >> 31;
+        return value;
+    }
+    
+    // File identity: vnode (dev, inode) when known, otherwise a hash of the path
+    static uint64_t fileIdentity(const es_file_t* file) {
+        if (!file) {
+            return 0;
+        }
+        if (file->stat.st_ino != 0) {
+            return mix(((uint64_t)file->stat.st_dev << 32) ^ (uint64_t)file->stat.st_ino);
+        }
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < file->path.length; i++) {
+            hash = (hash ^ (uint8_t)file->path.data[i]) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+    
+    static uint64_t makeKey(const es_file_t* executable, const es_file_t* target, es_event_type_t type) {
+        return mix(fileIdentity(executable) * 31 + fileIdentity(target) + ((uint64_t)type << 56));
+    }
+
+private:
+    static const int kVerdictBits = 2;
+    static const int kGenerationBits = 20;
+    static const int kTagShift = kVerdictBits + kGenerationBits;
+    static const uint64_t kVerdictMask = (1ull << kVerdictBits) - 1;
+    static const uint32_t kGenerationMask = (1u << kGenerationBits) - 1;
+    
+    std::atomic<uint64_t> slots[VERDICT_CACHE_SLOTS];
+    std::atomic<uint32_t> generation;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+};
+
+#endif
@@ -0,0 +1,422 @@
+// Warm-start snapshot of the process table and library-set cache
+#include "WarmStart.h"
+#include "ProcessTracker.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/sysctl.h>
+#include <time.h>
+#include <unistd.h>
+
+// Record flag bits
+#define WARM_SYSTEM_PROCESS     0x01
+#define WARM_AUDIO_ACCESS       0x02
+#define WARM_VIDEO_ACCESS       0x04
+#define WARM_NETWORK_ACCESS     0x08
+#define WARM_FILE_SYSTEM_ACCESS 0x10
+
+// Pids and start times only mean something within the boot that made them
+static uint64_t bootTimeUsec() {
+    int mib[2] = {CTL_KERN, KERN_BOOTTIME};
+    struct timeval boot;
+    size_t size = sizeof(boot);
+    if (sysctl(mib, 2, &boot, &size, nullptr, 0) != 0) {
+        return 0;
+    }
+    return timevalToUsec(boot);
+}
+
+static uint64_t checksum(const uint8_t* data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Strings and sets get the file's own dense numbering. The next unused index
+// announces a new one, which follows inline, the way traces write strings.
+struct SnapshotEncoder {
+    const StringTable* strings;
+    const LibrarySetCache* librarySets;
+    std::vector<uint8_t> buffer;
+    std::unordered_map<uint32_t, uint32_t> stringIndex;     // this run's ID -> file index
+    std::unordered_map<uint32_t, uint32_t> setIndex;
+    
+    void putVarint(uint64_t value) {
+        while (value >= 0x80) {
+            buffer.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        buffer.push_back((uint8_t)value);
+    }
+    
+    void putString(uint32_t id) {
+        size_t length = 0;
+        const char* value = strings->data(id, &length);
+        if (length == 0) {
+            putVarint(0);
+            return;
+        }
+        auto found = stringIndex.find(id);
+        if (found != stringIndex.end()) {
+            putVarint(found->second);
+            return;
+        }
+        uint32_t index = (uint32_t)stringIndex.size() + 1;
+        stringIndex[id] = index;
+        putVarint(index);
+        putVarint(length);
+        buffer.insert(buffer.end(), (const uint8_t*)value, (const uint8_t*)value + length);
+    }
+    
+    void putSet(uint32_t id) {
+        const LibrarySet* set = librarySets->get(id);
+        if (!set) {
+            putVarint(0);
+            return;
+        }
+        auto found = setIndex.find(id);
+        if (found != setIndex.end()) {
+            putVarint(found->second);
+            return;
+        }
+        uint32_t index = (uint32_t)setIndex.size() + 1;
+        setIndex[id] = index;
+        putVarint(index);
+        putVarint(set->libraryIds.size());
+        for (uint32_t library : set->libraryIds) {
+            putString(library);
+        }
+    }
+};
+
+// Reads back what the encoder wrote, mapping file indices to this run's IDs
+struct SnapshotDecoder {
+    StringTable* strings;
+    LibrarySetCache* librarySets;
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+    std::vector<uint32_t> stringIds;        // by file index; slot 0 is the empty string
+    std::vector<uint32_t> setIds;
+    
+    bool getVarint(uint64_t* value) {
+        *value = 0;
+        for (int shift = 0; shift < 64 && offset < size; shift += 7) {
+            uint8_t byte = data[offset++];
+            *value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    bool getString(uint32_t* id) {
+        uint64_t index;
+        if (!getVarint(&index) || index > stringIds.size()) {
+            return false;
+        }
+        if (index < stringIds.size()) {
+            *id = stringIds[index];
+            return true;
+        }
+        
+        uint64_t length;
+        if (!getVarint(&length) || length > size - offset) {
+            return false;
+        }
+        *id = strings->intern((const char*)data + offset, (size_t)length);
+        offset += (size_t)length;
+        stringIds.push_back(*id);
+        return true;
+    }
+    
+    bool getSet(uint32_t* id) {
+        uint64_t index;
+        if (!getVarint(&index) || index > setIds.size()) {
+            return false;
+        }
+        if (index < setIds.size()) {
+            *id = setIds[index];
+            return true;
+        }
+        
+        uint64_t count;
+        if (!getVarint(&count) || count > size - offset) {
+            return false;
+        }
+        std::vector<uint32_t> libraryIds((size_t)count);
+        for (uint32_t& library : libraryIds) {
+            if (!getString(&library)) {
+                return false;
+            }
+        }
+        // Capabilities are worked out again under this run's path rules
+        *id = librarySets->intern(libraryIds);
+        setIds.push_back(*id);
+        return true;
+    }
+};
+
+WarmStartSnapshot::WarmStartSnapshot(StringTable* strings, LibrarySetCache* librarySets)
+    : strings(strings), librarySets(librarySets), loaded(0), restored(0), stale(0), saved(0) {
+}
+
+bool WarmStartSnapshot::save(const char* path, const std::vector<ProcessRecord>& processes, std::string* error) {
+    SnapshotEncoder encoder;
+    encoder.strings = strings;
+    encoder.librarySets = librarySets;
+    encoder.buffer.insert(encoder.buffer.end(), WARM_START_MAGIC, WARM_START_MAGIC + 8);
+    encoder.putVarint(bootTimeUsec());
+    encoder.putVarint((uint64_t)time(nullptr));
+    
+    // Keys first, so new execs of a known image hit the cache on the next run too
+    std::vector<LibrarySetKeyEntry> keys;
+    librarySets->exportKeys(&keys);
+    encoder.putVarint(keys.size());
+    for (const auto& entry : keys) {
+        encoder.buffer.push_back(entry.key.kind);
+        encoder.buffer.insert(encoder.buffer.end(), entry.key.digest, entry.key.digest + sizeof(entry.key.digest));
+        encoder.putString(LibrarySetCache::keyPathId(entry.key));
+        encoder.putSet(entry.setId);
+        encoder.putVarint(entry.imageCount);
+    }
+    
+    uint64_t count = 0;
+    for (const auto& record : processes) {
+        count += record.kernelStartUsec != 0;
+    }
+    encoder.putVarint(count);
+    for (const auto& record : processes) {
+        if (record.kernelStartUsec == 0) {
+            continue;
+        }
+        encoder.putVarint((uint32_t)record.pid);
+        encoder.putVarint((uint32_t)record.ppid);
+        encoder.putVarint(record.pidVersion);
+        encoder.putString(record.executablePathId);
+        encoder.putString(record.commandLineId);
+        encoder.putString(record.bundleIdentifierId);
+        encoder.putVarint(record.uid);
+        encoder.putVarint(record.gid);
+        encoder.putVarint(record.startTime);
+        encoder.putVarint(record.kernelStartUsec);
+        encoder.putVarint(record.cpuTime);
+        encoder.putVarint(record.memoryUsage);
+        encoder.putSet(record.librarySetId);
+        encoder.buffer.push_back((record.isSystemProcess ? WARM_SYSTEM_PROCESS : 0) |
+                                 (record.hasAudioAccess ? WARM_AUDIO_ACCESS : 0) |
+                                 (record.hasVideoAccess ? WARM_VIDEO_ACCESS : 0) |
+                                 (record.hasNetworkAccess ? WARM_NETWORK_ACCESS : 0) |
+                                 (record.hasFileSystemAccess ? WARM_FILE_SYSTEM_ACCESS : 0));
+        encoder.buffer.push_back(record.enrichmentTier);
+    }
+    
+    // A file cut short anywhere fails the check and is ignored
+    uint64_t sum = checksum(encoder.buffer.data(), encoder.buffer.size());
+    const uint8_t* sumBytes = (const uint8_t*)&sum;
+    encoder.buffer.insert(encoder.buffer.end(), sumBytes, sumBytes + sizeof(sum));
+    
+    std::string temporary = std::string(path) + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        *error = "cannot create " + temporary + ": " + strerror(errno);
+        return false;
+    }
+    size_t written = 0;
+    while (written < encoder.buffer.size()) {
+        ssize_t result = write(fd, encoder.buffer.data() + written, encoder.buffer.size() - written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            *error = "cannot write " + temporary + ": " + strerror(errno);
+            close(fd);
+            unlink(temporary.c_str());
+            return false;
+        }
+        written += (size_t)result;
+    }
+    close(fd);
+    if (rename(temporary.c_str(), path) != 0) {
+        *error = std::string("cannot replace ") + path + ": " + strerror(errno);
+        unlink(temporary.c_str());
+        return false;
+    }
+    
+    saved.store(count, std::memory_order_relaxed);
+    return true;
+}
+
+bool WarmStartSnapshot::load(const char* path, std::string* error) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *error = errno == ENOENT ? "no snapshot" : std::string("cannot open ") + path + ": " + strerror(errno);
+        return false;
+    }
+    
+    // Used once either way: a later crash must not bring back an older table
+    std::vector<uint8_t> contents;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 16) {
+        contents.resize((size_t)info.st_size);
+        size_t done = 0;
+        while (done < contents.size()) {
+            ssize_t result = read(fd, contents.data() + done, contents.size() - done);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                break;
+            }
+            done += (size_t)result;
+        }
+        contents.resize(done);
+    }
+    close(fd);
+    unlink(path);
+    
+    uint64_t sum = 0;
+    if (contents.size() > 16) {
+        memcpy(&sum, contents.data() + contents.size() - sizeof(sum), sizeof(sum));
+    }
+    if (contents.size() <= 16 || memcmp(contents.data(), WARM_START_MAGIC, 8) != 0 ||
+        checksum(contents.data(), contents.size() - sizeof(sum)) != sum) {
+        *error = std::string(path) + " is damaged";
+        return false;
+    }
+    
+    SnapshotDecoder decoder;
+    decoder.strings = strings;
+    decoder.librarySets = librarySets;
+    decoder.data = contents.data();
+    decoder.size = contents.size() - sizeof(sum);
+    decoder.offset = 8;
+    decoder.stringIds.push_back(0);
+    decoder.setIds.push_back(0);
+    
+    uint64_t bootTime, savedAt;
+    if (!decoder.getVarint(&bootTime) || !decoder.getVarint(&savedAt)) {
+        *error = std::string(path) + " is damaged";
+        return false;
+    }
+    if (bootTime != bootTimeUsec()) {
+        *error = "snapshot is from an earlier boot";
+        return false;
+    }
+    
+    uint64_t keyCount;
+    bool intact = decoder.getVarint(&keyCount);
+    for (uint64_t i = 0; intact && i < keyCount; i++) {
+        LibrarySetKey key;
+        uint32_t pathId, setId;
+        uint64_t imageCount;
+        intact = decoder.size - decoder.offset > sizeof(key.digest);
+        if (!intact) {
+            break;
+        }
+        key.kind = decoder.data[decoder.offset++];
+        memcpy(key.digest, decoder.data + decoder.offset, sizeof(key.digest));
+        decoder.offset += sizeof(key.digest);
+        intact = decoder.getString(&pathId) && decoder.getSet(&setId) && decoder.getVarint(&imageCount);
+        const LibrarySet* set = intact ? librarySets->get(setId) : nullptr;
+        if (set) {
+            librarySets->insert(LibrarySetCache::withPathId(key, pathId), (uint32_t)imageCount, set->libraryIds);
+        }
+    }
+    
+    uint64_t processCount = 0;
+    intact = intact && decoder.getVarint(&processCount);
+    records.clear();
+    for (uint64_t i = 0; intact && i < processCount; i++) {
+        ProcessRecord record = ProcessRecord();
+        uint64_t pid, ppid, pidVersion, uid, gid;
+        intact = decoder.getVarint(&pid) && decoder.getVarint(&ppid) && decoder.getVarint(&pidVersion) &&
+                 decoder.getString(&record.executablePathId) && decoder.getString(&record.commandLineId) &&
+                 decoder.getString(&record.bundleIdentifierId) && decoder.getVarint(&uid) &&
+                 decoder.getVarint(&gid) && decoder.getVarint(&record.startTime) &&
+                 decoder.getVarint(&record.kernelStartUsec) && decoder.getVarint(&record.cpuTime) &&
+                 decoder.getVarint(&record.memoryUsage) && decoder.getSet(&record.librarySetId) &&
+                 decoder.size - decoder.offset >= 2;
+        if (!intact) {
+            break;
+        }
+        uint8_t flags = decoder.data[decoder.offset++];
+        record.pid = (pid_t)pid;
+        record.ppid = (pid_t)ppid;
+        record.pidVersion = (uint32_t)pidVersion;
+        record.uid = (uid_t)uid;
+        record.gid = (gid_t)gid;
+        record.isSystemProcess = (flags & WARM_SYSTEM_PROCESS) != 0;
+        record.hasAudioAccess = (flags & WARM_AUDIO_ACCESS) != 0;
+        record.hasVideoAccess = (flags & WARM_VIDEO_ACCESS) != 0;
+        record.hasNetworkAccess = (flags & WARM_NETWORK_ACCESS) != 0;
+        record.hasFileSystemAccess = (flags & WARM_FILE_SYSTEM_ACCESS) != 0;
+        
+        // Fds and environment were never saved; tier 2 runs again if anyone asks
+        uint8_t tier = decoder.data[decoder.offset++];
+        record.enrichmentTier = tier < 1 ? tier : 1;
+        if (record.librarySetId) {
+            uint32_t capabilities = librarySets->capabilities(record.librarySetId);
+            record.hasAudioAccess = (capabilities & LIBRARY_CAP_AUDIO) != 0;
+            record.hasVideoAccess = (capabilities & LIBRARY_CAP_VIDEO) != 0;
+            record.hasNetworkAccess = (capabilities & LIBRARY_CAP_NETWORK) != 0;
+        }
+        records[record.pid] = record;
+    }
+    
+    if (!intact) {
+        records.clear();
+        *error = std::string(path) + " is damaged";
+        return false;
+    }
+    loaded.store(records.size(), std::memory_order_relaxed);
+    return true;
+}
+
+bool WarmStartSnapshot::take(pid_t pid, uint64_t kernelStartUsec, const char* name, ProcessRecord* record) {
+    auto found = records.find(pid);
+    if (found == records.end()) {
+        return false;
+    }
+    
+    // p_comm is the first MAXCOMLEN bytes of the name the image was exec'd as
+    size_t length = 0;
+    const char* path = strings->data(found->second.executablePathId, &length);
+    size_t baseLength = 0;
+    while (baseLength < length && path[length - baseLength - 1] != '/') {
+        baseLength++;
+    }
+    size_t nameLength = strnlen(name, MAXCOMLEN);
+    bool sameImage = nameLength > 0 &&
+                     (nameLength == baseLength || (nameLength == MAXCOMLEN && baseLength > MAXCOMLEN)) &&
+                     memcmp(path + length - baseLength, name, nameLength) == 0;
+    
+    bool same = found->second.kernelStartUsec == kernelStartUsec && sameImage;
+    if (same) {
+        *record = found->second;
+        restored.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        stale.fetch_add(1, std::memory_order_relaxed);
+    }
+    records.erase(found);
+    return same;
+}
+
+void WarmStartSnapshot::discard() {
+    stale.fetch_add(records.size(), std::memory_order_relaxed);
+    records.clear();
+}
+
+WarmStartStats WarmStartSnapshot::getStats() const {
+    WarmStartStats stats = WarmStartStats();
+    stats.loaded = loaded.load(std::memory_order_relaxed);
+    stats.restored = restored.load(std::memory_order_relaxed);
+    stats.stale = stale.load(std::memory_order_relaxed);
+    stats.saved = saved.load(std::memory_order_relaxed);
+    return stats;
+}
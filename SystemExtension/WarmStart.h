@@ -0,0 +1,71 @@
+#ifndef WarmStart_h
+#define WarmStart_h
+
+#include <sys/types.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include "MonitoringTypes.h"
+#include "StringTable.h"
+#include "LibrarySetCache.h"
+
+// The process table and library-set cache as they were at shutdown, so the
+// next launch doesn't analyze every running process again. A saved record is
+// taken over only if the kernel's process list still shows the same pid with
+// the same start time and command name; the list carries no pidversion, and
+// the name is what changes when a process execs while we're down. Anything
+// else is left to the process scan. A snapshot is read once and only within
+// the boot that wrote it.
+
+#define WARM_START_MAGIC "AVWARM01"
+
+// Where the snapshot lives; replay builds point it at a scratch directory
+#ifndef WARM_START_PATH
+#define WARM_START_PATH "/var/log/AudioVideoMonitor.warm"
+#endif
+
+struct WarmStartStats {
+    uint64_t loaded;                // records read at launch
+    uint64_t restored;              // still running and taken over without analysis
+    uint64_t stale;                 // exited, exec'd or lost their pid while we were down
+    uint64_t saved;                 // records written by the last save
+    uint64_t discovered;            // analyzed by the process scan, a batch at a time
+    uint64_t pending;               // still waiting for it
+};
+
+// Not thread-safe: load before the process scan starts, take and discard
+// from the scan, save once it has stopped
+class WarmStartSnapshot {
+public:
+    WarmStartSnapshot(StringTable* strings, LibrarySetCache* librarySets);
+    
+    // Records without a kernel start time can't be checked later and are left out.
+    // The file is replaced in one rename.
+    bool save(const char* path, const std::vector<ProcessRecord>& records, std::string* error);
+    
+    // Interns the snapshot's strings and library sets into this run's tables
+    // and deletes the file; false if there is none or it's from another boot
+    bool load(const char* path, std::string* error);
+    
+    // The saved record for a running process, with this run's IDs; each is
+    // handed out at most once. name is the kernel's p_comm for the process.
+    bool take(pid_t pid, uint64_t kernelStartUsec, const char* name, ProcessRecord* record);
+    
+    // Forgets records nobody took
+    void discard();
+    
+    WarmStartStats getStats() const;
+
+private:
+    StringTable* strings;
+    LibrarySetCache* librarySets;
+    std::unordered_map<pid_t, ProcessRecord> records;
+    std::atomic<uint64_t> loaded;
+    std::atomic<uint64_t> restored;
+    std::atomic<uint64_t> stale;
+    std::atomic<uint64_t> saved;
+};
+
+#endif
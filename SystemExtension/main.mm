@@ -3,6 +3,75 @@
 #include <xpc/xpc.h>
 #include <dispatch/dispatch.h>
 #include <syslog.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <memory>
+
+// Interned strings are unterminated; XPC wants C strings
+static void set_interned_string(xpc_object_t dictionary, const char* key, uint32_t id) {
+    static thread_local std::string scratch;
+    size_t length;
+    const char* data = AudioVideoController::getInstance()->resolveString(id, &length);
+    scratch.assign(data, length);
+    xpc_dictionary_set_string(dictionary, key, scratch.c_str());
+}
+
+static void set_event_subject(xpc_object_t dictionary, const StreamEvent& event) {
+    static thread_local std::string scratch;
+    char buffer[128];
+    size_t length;
+    const char* data = AudioVideoController::getInstance()->streamSubject(event, buffer, sizeof(buffer), &length);
+    scratch.assign(data, length);
+    xpc_dictionary_set_string(dictionary, "subject", scratch.c_str());
+}
+
+// Builds one "events" message for a subscriber. Runs on the stream's flusher
+// thread; the barrier tells the stream when XPC has sent it, which is what
+// bounds how much a slow client can have queued.
+static void send_event_batch(xpc_connection_t connection, uint64_t client,
+                             const StreamEvent* events, size_t count, uint64_t dropped) {
+    // Mach times become wall-clock microseconds once per batch
+    uint64_t nowMach = mach_absolute_time();
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    uint64_t nowUsec = timevalToUsec(now);
+    
+    xpc_object_t batch = xpc_dictionary_create(nullptr, nullptr, 0);
+    xpc_dictionary_set_string(batch, "stream", "events");
+    xpc_dictionary_set_uint64(batch, "dropped", dropped);
+    
+    xpc_object_t entries = xpc_array_create(nullptr, 0);
+    for (size_t i = 0; i < count; i++) {
+        const StreamEvent& event = events[i];
+        uint64_t ageUsec = nowMach > event.timestamp ? machToNanoseconds(nowMach - event.timestamp) / 1000 : 0;
+        
+        xpc_object_t entry = xpc_dictionary_create(nullptr, nullptr, 0);
+        xpc_dictionary_set_string(entry, "type", streamEventTypeName(event.type));
+        xpc_dictionary_set_int64(entry, "pid", event.pid);
+        xpc_dictionary_set_uint64(entry, "timestamp", event.timestamp);
+        xpc_dictionary_set_uint64(entry, "time_us", nowUsec > ageUsec ? nowUsec - ageUsec : 0);
+        set_event_subject(entry, event);
+        set_interned_string(entry, "action", event.actionId);
+        xpc_dictionary_set_uint64(entry, "count", event.count);
+        xpc_dictionary_set_bool(entry, "blocked", event.blocked);
+        xpc_array_append_value(entries, entry);
+        xpc_release(entry);
+    }
+    xpc_dictionary_set_value(batch, "events", entries);
+    xpc_release(entries);
+    
+    xpc_connection_send_message(connection, batch);
+    xpc_release(batch);
+    xpc_connection_send_barrier(connection, ^{
+        AudioVideoController::getInstance()->eventBatchDelivered(client);
+    });
+}
+
+// Commands that change what gets denied, or that see every process's
+// activity, are only for root peers
+static bool peer_is_privileged(xpc_connection_t connection) {
+    return xpc_connection_get_euid(connection) == 0;
+}
 
 // XPC service for communication with main app
 static xpc_connection_t create_listener() {
@@ -15,39 +84,55 @@ static xpc_connection_t create_listener() {
         if (xpc_get_type(event) == XPC_TYPE_CONNECTION) {
             xpc_connection_t connection = (xpc_connection_t)event;
             
+            // At most one event stream per connection
+            __block uint64_t subscription = 0;
+            
             xpc_connection_set_event_handler(connection, ^(xpc_object_t message) {
+                if (xpc_get_type(message) == XPC_TYPE_ERROR) {
+                    // The client went away; stop queueing for it
+                    if (subscription) {
+                        AudioVideoController::getInstance()->unsubscribeEvents(subscription);
+                        subscription = 0;
+                    }
+                    return;
+                }
+                
                 if (xpc_get_type(message) == XPC_TYPE_DICTIONARY) {
                     const char* command = xpc_dictionary_get_string(message, "command");
                     
                     if (!command) {
-                        syslog(LOG_ERR, "Received XPC message without command");
+                        EXT_LOG_ERROR(LOG_CATEGORY_XPC, "Message without a command");
                         return;
                     }
                     
                     AudioVideoController* controller = AudioVideoController::getInstance();
                     xpc_object_t reply = xpc_dictionary_create_reply(message);
                     
-                    syslog(LOG_INFO, "Processing XPC command: %s", command);
+                    EXT_LOG_INFO(LOG_CATEGORY_XPC, "Command %{public}s", command);
                     
                     if (strcmp(command, "disable_microphone") == 0) {
                         bool success = controller->disableMicrophone();
                         xpc_dictionary_set_bool(reply, "success", success);
-                        syslog(LOG_INFO, "Disable microphone result: %s", success ? "success" : "failed");
+                        EXT_LOG_DEFAULT(LOG_CATEGORY_DEVICE, "Disable microphone: %{public}s",
+                                        success ? "success" : "failed");
                     }
                     else if (strcmp(command, "enable_microphone") == 0) {
                         bool success = controller->enableMicrophone();
                         xpc_dictionary_set_bool(reply, "success", success);
-                        syslog(LOG_INFO, "Enable microphone result: %s", success ? "success" : "failed");
+                        EXT_LOG_DEFAULT(LOG_CATEGORY_DEVICE, "Enable microphone: %{public}s",
+                                        success ? "success" : "failed");
                     }
                     else if (strcmp(command, "disable_camera") == 0) {
                         bool success = controller->disableCamera();
                         xpc_dictionary_set_bool(reply, "success", success);
-                        syslog(LOG_INFO, "Disable camera result: %s", success ? "success" : "failed");
+                        EXT_LOG_DEFAULT(LOG_CATEGORY_DEVICE, "Disable camera: %{public}s",
+                                        success ? "success" : "failed");
                     }
                     else if (strcmp(command, "enable_camera") == 0) {
                         bool success = controller->enableCamera();
                         xpc_dictionary_set_bool(reply, "success", success);
-                        syslog(LOG_INFO, "Enable camera result: %s", success ? "success" : "failed");
+                        EXT_LOG_DEFAULT(LOG_CATEGORY_DEVICE, "Enable camera: %{public}s",
+                                        success ? "success" : "failed");
                     }
                     else if (strcmp(command, "get_status") == 0) {
                         xpc_dictionary_set_bool(reply, "microphone_enabled", 
@@ -55,12 +140,669 @@ static xpc_connection_t create_listener() {
                         xpc_dictionary_set_bool(reply, "camera_enabled", 
                                               controller->isCameraEnabled());
                         xpc_dictionary_set_bool(reply, "success", true);
-                        syslog(LOG_INFO, "Status requested - Mic: %s, Camera: %s", 
-                               controller->isMicrophoneEnabled() ? "enabled" : "disabled",
-                               controller->isCameraEnabled() ? "enabled" : "disabled");
+                        EXT_LOG_INFO(LOG_CATEGORY_XPC, "Status: microphone %{public}s, camera %{public}s",
+                                     controller->isMicrophoneEnabled() ? "enabled" : "disabled",
+                                     controller->isCameraEnabled() ? "enabled" : "disabled");
+                    }
+                    else if (strcmp(command, "get_pipeline_stats") == 0) {
+                        EventPipelineStats stats = controller->getEventPipelineStats();
+                        xpc_dictionary_set_uint64(reply, "events_enqueued", stats.enqueued);
+                        xpc_dictionary_set_uint64(reply, "events_processed", stats.processed);
+                        xpc_dictionary_set_uint64(reply, "events_dropped", stats.dropped);
+                        xpc_dictionary_set_uint64(reply, "backpressure_events", stats.backpressure);
+                        xpc_dictionary_set_uint64(reply, "lifecycle_waits", stats.lifecycleWaits);
+                        xpc_dictionary_set_uint64(reply, "queue_depth", stats.queueDepth);
+                        xpc_dictionary_set_uint64(reply, "max_queue_depth", stats.maxQueueDepth);
+                        xpc_dictionary_set_uint64(reply, "worker_count", stats.workerCount);
+                        xpc_dictionary_set_uint64(reply, "queue_latency_p50_ns", stats.queueLatency.p50Ns);
+                        xpc_dictionary_set_uint64(reply, "queue_latency_p99_ns", stats.queueLatency.p99Ns);
+                        xpc_dictionary_set_uint64(reply, "handler_latency_p50_ns", stats.handlerLatency.p50Ns);
+                        xpc_dictionary_set_uint64(reply, "handler_latency_p99_ns", stats.handlerLatency.p99Ns);
+                        xpc_dictionary_set_uint64(reply, "handler_latency_p999_ns", stats.handlerLatency.p999Ns);
+                        
+                        AggregationStats aggregationStats = controller->getAggregationStats();
+                        xpc_dictionary_set_uint64(reply, "aggregation_window_ms", aggregationStats.windowMs);
+                        xpc_dictionary_set_uint64(reply, "aggregation_absorbed", aggregationStats.absorbed);
+                        xpc_dictionary_set_uint64(reply, "aggregation_summaries", aggregationStats.summaries);
+                        xpc_dictionary_set_uint64(reply, "aggregation_pending", aggregationStats.pending);
+                        xpc_dictionary_set_uint64(reply, "rate_limited_events", aggregationStats.rateLimited);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "get_database_stats") == 0) {
+                        // The writer, the strings it persists and collects, and the journal in front of it
+                        DatabaseWriterStats writerStats = controller->getDatabaseWriterStats();
+                        xpc_dictionary_set_uint64(reply, "db_rows_queued", writerStats.rowsQueued);
+                        xpc_dictionary_set_uint64(reply, "db_rows_written", writerStats.rowsWritten);
+                        xpc_dictionary_set_uint64(reply, "db_rows_dropped", writerStats.rowsDropped);
+                        xpc_dictionary_set_uint64(reply, "db_rows_failed", writerStats.rowsFailed);
+                        xpc_dictionary_set_uint64(reply, "db_rows_pending", writerStats.pendingRows);
+                        xpc_dictionary_set_uint64(reply, "db_batches_committed", writerStats.batchesCommitted);
+                        xpc_dictionary_set_uint64(reply, "db_commit_failures", writerStats.commitFailures);
+                        xpc_dictionary_set_uint64(reply, "db_last_commit_ns", writerStats.lastCommitNs);
+                        xpc_dictionary_set_uint64(reply, "db_wal_pages", writerStats.walPages);
+                        xpc_dictionary_set_uint64(reply, "db_checkpoints", writerStats.checkpoints);
+                        xpc_dictionary_set_uint64(reply, "db_checkpointed_pages", writerStats.checkpointedPages);
+                        xpc_dictionary_set_uint64(reply, "db_last_checkpoint_ns", writerStats.lastCheckpointNs);
+                        xpc_dictionary_set_uint64(reply, "db_strings_persisted", writerStats.stringsPersisted);
+                        xpc_dictionary_set_uint64(reply, "db_partition_day", writerStats.partitionDay);
+                        xpc_dictionary_set_uint64(reply, "db_partitions_dropped", writerStats.partitionsDropped);
+                        xpc_dictionary_set_uint64(reply, "db_aggregate_rows", writerStats.aggregateRows);
+                        xpc_dictionary_set_uint64(reply, "db_vacuumed_pages", writerStats.vacuumedPages);
+                        xpc_dictionary_set_uint64(reply, "db_last_maintenance_ns", writerStats.lastMaintenanceNs);
+                        xpc_dictionary_set_uint64(reply, "db_search_strings_indexed", writerStats.searchStringsIndexed);
+                        xpc_dictionary_set_uint64(reply, "db_search_backfill_pending", writerStats.searchBackfillPending);
+                        xpc_dictionary_set_uint64(reply, "db_rollup_rows_updated", writerStats.rollupRowsUpdated);
+                        xpc_dictionary_set_uint64(reply, "db_rollup_backfill_pending", writerStats.rollupBackfillPending);
+                        xpc_dictionary_set_uint64(reply, "db_string_collections", writerStats.stringCollections);
+                        xpc_dictionary_set_uint64(reply, "db_strings_collected", writerStats.stringsCollected);
+                        xpc_dictionary_set_uint64(reply, "db_last_collection_ns", writerStats.lastCollectionNs);
+                        
+                        StringTableStats stringStats = controller->getStringTableStats();
+                        xpc_dictionary_set_uint64(reply, "strings_interned", stringStats.strings);
+                        xpc_dictionary_set_uint64(reply, "strings_bytes", stringStats.bytes);
+                        xpc_dictionary_set_uint64(reply, "strings_hits", stringStats.hits);
+                        xpc_dictionary_set_uint64(reply, "strings_misses", stringStats.misses);
+                        xpc_dictionary_set_uint64(reply, "strings_free_ids", stringStats.freeIds);
+                        xpc_dictionary_set_uint64(reply, "strings_released", stringStats.released);
+                        xpc_dictionary_set_uint64(reply, "strings_overflows", stringStats.overflows);
+                        
+                        EventJournalStats journalStats = controller->getEventJournalStats();
+                        xpc_dictionary_set_uint64(reply, "journal_segments", journalStats.segments);
+                        xpc_dictionary_set_uint64(reply, "journal_appended", journalStats.appended);
+                        xpc_dictionary_set_uint64(reply, "journal_fallbacks", journalStats.fallbacks);
+                        xpc_dictionary_set_uint64(reply, "journal_rotations", journalStats.rotations);
+                        xpc_dictionary_set_uint64(reply, "journal_compacted", journalStats.compacted);
+                        xpc_dictionary_set_uint64(reply, "journal_recovered", journalStats.recovered);
+                        xpc_dictionary_set_uint64(reply, "journal_last_compact_ns", journalStats.lastCompactNs);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "get_stream_stats") == 0) {
+                        EventStreamStats streamStats = controller->getEventStreamStats();
+                        xpc_dictionary_set_uint64(reply, "stream_clients", streamStats.clients);
+                        xpc_dictionary_set_uint64(reply, "stream_published", streamStats.published);
+                        xpc_dictionary_set_uint64(reply, "stream_delivered", streamStats.delivered);
+                        xpc_dictionary_set_uint64(reply, "stream_dropped", streamStats.dropped);
+                        xpc_dictionary_set_uint64(reply, "stream_batches", streamStats.batches);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "get_snapshot_stats") == 0) {
+                        SnapshotCacheStats snapshotStats = controller->getSnapshotStats();
+                        xpc_dictionary_set_uint64(reply, "snapshot_builds", snapshotStats.builds);
+                        xpc_dictionary_set_uint64(reply, "snapshot_hits", snapshotStats.hits);
+                        xpc_dictionary_set_uint64(reply, "snapshot_bytes", snapshotStats.bytes);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "get_lineage") == 0) {
+                        pid_t pid = (pid_t)xpc_dictionary_get_int64(message, "pid");
+                        uint32_t pidVersion = (uint32_t)xpc_dictionary_get_uint64(message, "pid_version");
+                        uint64_t limit = xpc_dictionary_get_uint64(message, "limit");
+                        std::vector<LineageEntry> ancestors;
+                        std::vector<LineageEntry> descendants;
+                        bool live = false;
+                        std::string error;
+                        bool success = controller->getLineage(pid, pidVersion, limit ? limit : 1000, &ancestors,
+                                                              &descendants, &live, &error);
+                        
+                        const std::vector<LineageEntry>* lists[] = {&ancestors, &descendants};
+                        const char* keys[] = {"ancestors", "descendants"};
+                        for (int list = 0; list < 2; list++) {
+                            xpc_object_t entries = xpc_array_create(nullptr, 0);
+                            for (const auto& node : *lists[list]) {
+                                xpc_object_t entry = xpc_dictionary_create(nullptr, nullptr, 0);
+                                xpc_dictionary_set_int64(entry, "pid", node.pid);
+                                xpc_dictionary_set_uint64(entry, "pid_version", node.pidVersion);
+                                xpc_dictionary_set_int64(entry, "parent_pid", node.parentPid);
+                                xpc_dictionary_set_uint64(entry, "parent_pid_version", node.parentPidVersion);
+                                xpc_dictionary_set_string(entry, "relation", lineageRelationName(node.relation));
+                                set_interned_string(entry, "path", node.executablePathId);
+                                xpc_dictionary_set_uint64(entry, "depth", node.depth);
+                                xpc_dictionary_set_int64(entry, "started", node.started);
+                                xpc_dictionary_set_int64(entry, "exited", node.exited);
+                                xpc_array_append_value(entries, entry);
+                                xpc_release(entry);
+                            }
+                            xpc_dictionary_set_value(reply, keys[list], entries);
+                            xpc_release(entries);
+                        }
+                        
+                        LineageStats stats = controller->getLineageStats();
+                        xpc_dictionary_set_bool(reply, "live", live);
+                        xpc_dictionary_set_uint64(reply, "tree_nodes", stats.nodes);
+                        xpc_dictionary_set_uint64(reply, "tree_running", stats.running);
+                        xpc_dictionary_set_uint64(reply, "tree_reconciled", stats.reconciled);
+                        xpc_dictionary_set_bool(reply, "success", success);
+                        if (!success) {
+                            xpc_dictionary_set_string(reply, "error", error.c_str());
+                        }
+                    }
+                    else if (strcmp(command, "get_log_levels") == 0) {
+                        xpc_object_t categories = xpc_array_create(nullptr, 0);
+                        for (const auto& category : getLogStats()) {
+                            xpc_object_t entry = xpc_dictionary_create(nullptr, nullptr, 0);
+                            xpc_dictionary_set_string(entry, "name", category.name);
+                            xpc_dictionary_set_string(entry, "level", logLevelName(category.level));
+                            xpc_dictionary_set_uint64(entry, "suppressed", category.suppressed);
+                            xpc_array_append_value(categories, entry);
+                            xpc_release(entry);
+                        }
+                        xpc_dictionary_set_value(reply, "categories", categories);
+                        xpc_release(categories);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "set_log_level") == 0) {
+                        const char* category = xpc_dictionary_get_string(message, "category");
+                        const char* level = xpc_dictionary_get_string(message, "level");
+                        std::string error = "category and level are required";
+                        bool success = category && level && setLogLevel(category, level, &error);
+                        xpc_dictionary_set_bool(reply, "success", success);
+                        if (!success) {
+                            xpc_dictionary_set_string(reply, "error", error.c_str());
+                        }
+                        // Logged whatever the XPC category's own level is
+                        syslog(LOG_NOTICE, "Log level of %s set to %s: %s", category ? category : "?",
+                               level ? level : "?", success ? "success" : error.c_str());
+                    }
+                    else if (strcmp(command, "get_metrics") == 0) {
+                        MetricsSnapshot metrics = controller->getMetrics();
+                        xpc_object_t events = xpc_array_create(nullptr, 0);
+                        for (const auto& type : metrics.events) {
+                            xpc_object_t entry = xpc_dictionary_create(nullptr, nullptr, 0);
+                            xpc_dictionary_set_int64(entry, "event_type", type.eventType);
+                            if (type.name) {
+                                xpc_dictionary_set_string(entry, "name", type.name);
+                            }
+                            xpc_dictionary_set_uint64(entry, "received", type.received);
+                            xpc_dictionary_set_uint64(entry, "kernel_dropped", type.kernelDropped);
+                            xpc_dictionary_set_uint64(entry, "handled", type.handler.count);
+                            xpc_dictionary_set_uint64(entry, "mean_ns", type.handler.meanNs);
+                            xpc_dictionary_set_uint64(entry, "p50_ns", type.handler.p50Ns);
+                            xpc_dictionary_set_uint64(entry, "p99_ns", type.handler.p99Ns);
+                            xpc_dictionary_set_uint64(entry, "p999_ns", type.handler.p999Ns);
+                            xpc_dictionary_set_uint64(entry, "max_ns", type.handler.maxNs);
+                            xpc_array_append_value(events, entry);
+                            xpc_release(entry);
+                        }
+                        xpc_dictionary_set_value(reply, "events", events);
+                        xpc_release(events);
+                        
+                        xpc_object_t calls = xpc_array_create(nullptr, 0);
+                        for (const auto& call : metrics.calls) {
+                            xpc_object_t entry = xpc_dictionary_create(nullptr, nullptr, 0);
+                            xpc_dictionary_set_string(entry, "name", call.name);
+                            xpc_dictionary_set_uint64(entry, "count", call.latency.count);
+                            xpc_dictionary_set_uint64(entry, "failures", call.failures);
+                            xpc_dictionary_set_uint64(entry, "mean_ns", call.latency.meanNs);
+                            xpc_dictionary_set_uint64(entry, "p50_ns", call.latency.p50Ns);
+                            xpc_dictionary_set_uint64(entry, "p99_ns", call.latency.p99Ns);
+                            xpc_dictionary_set_uint64(entry, "p999_ns", call.latency.p999Ns);
+                            xpc_dictionary_set_uint64(entry, "max_ns", call.latency.maxNs);
+                            xpc_array_append_value(calls, entry);
+                            xpc_release(entry);
+                        }
+                        xpc_dictionary_set_value(reply, "calls", calls);
+                        xpc_release(calls);
+                        
+                        xpc_object_t clients = xpc_array_create(nullptr, 0);
+                        for (const auto& client : controller->getEsClientStats()) {
+                            xpc_object_t entry = xpc_dictionary_create(nullptr, nullptr, 0);
+                            xpc_dictionary_set_string(entry, "name", client.name);
+                            xpc_dictionary_set_uint64(entry, "event_types", client.eventTypes);
+                            xpc_dictionary_set_uint64(entry, "messages", client.messages);
+                            xpc_dictionary_set_uint64(entry, "delivery_p50_ns", client.delivery.p50Ns);
+                            xpc_dictionary_set_uint64(entry, "delivery_p99_ns", client.delivery.p99Ns);
+                            xpc_dictionary_set_uint64(entry, "delivery_max_ns", client.delivery.maxNs);
+                            xpc_dictionary_set_uint64(entry, "responses", client.deadlineMargin.count + client.missedDeadlines);
+                            xpc_dictionary_set_uint64(entry, "missed_deadlines", client.missedDeadlines);
+                            xpc_dictionary_set_uint64(entry, "min_deadline_margin_ns", client.minDeadlineMarginNs);
+                            xpc_dictionary_set_uint64(entry, "deadline_margin_p50_ns", client.deadlineMargin.p50Ns);
+                            xpc_array_append_value(clients, entry);
+                            xpc_release(entry);
+                        }
+                        xpc_dictionary_set_value(reply, "es_clients", clients);
+                        xpc_release(clients);
+                        
+                        xpc_dictionary_set_uint64(reply, "events_received", metrics.received);
+                        xpc_dictionary_set_uint64(reply, "kernel_dropped", metrics.kernelDropped);
+                        xpc_dictionary_set_uint64(reply, "metric_shards", metrics.shardsInUse);
+                        
+                        EventPipelineStats pipeline = controller->getEventPipelineStats();
+                        xpc_dictionary_set_uint64(reply, "queue_depth", pipeline.queueDepth);
+                        xpc_dictionary_set_uint64(reply, "max_queue_depth", pipeline.maxQueueDepth);
+                        xpc_dictionary_set_uint64(reply, "pipeline_dropped", pipeline.dropped);
+                        xpc_dictionary_set_uint64(reply, "queue_latency_p50_ns", pipeline.queueLatency.p50Ns);
+                        xpc_dictionary_set_uint64(reply, "queue_latency_p99_ns", pipeline.queueLatency.p99Ns);
+                        
+                        DatabaseWriterStats writerStats = controller->getDatabaseWriterStats();
+                        xpc_dictionary_set_uint64(reply, "db_commits", writerStats.commitLatency.count);
+                        xpc_dictionary_set_uint64(reply, "db_commit_failures", writerStats.commitFailures);
+                        xpc_dictionary_set_uint64(reply, "db_commit_p50_ns", writerStats.commitLatency.p50Ns);
+                        xpc_dictionary_set_uint64(reply, "db_commit_p99_ns", writerStats.commitLatency.p99Ns);
+                        xpc_dictionary_set_uint64(reply, "db_commit_max_ns", writerStats.commitLatency.maxNs);
+                        xpc_dictionary_set_uint64(reply, "db_rows_pending", writerStats.pendingRows);
+                        
+                        xpc_object_t monitors = xpc_array_create(nullptr, 0);
+                        for (const auto& task : controller->getMonitorStats()) {
+                            xpc_object_t entry = xpc_dictionary_create(nullptr, nullptr, 0);
+                            xpc_dictionary_set_string(entry, "name", task.name);
+                            xpc_dictionary_set_uint64(entry, "runs", task.runs);
+                            xpc_dictionary_set_uint64(entry, "total_run_ns", task.totalRunNs);
+                            xpc_dictionary_set_uint64(entry, "last_run_ns", task.lastRunNs);
+                            xpc_dictionary_set_uint64(entry, "interval_ms", task.intervalMs);
+                            xpc_array_append_value(monitors, entry);
+                            xpc_release(entry);
+                        }
+                        xpc_dictionary_set_value(reply, "monitors", monitors);
+                        xpc_release(monitors);
+                        
+                        FileSystemWatcherStats watcher = controller->getFileSystemWatcherStats();
+                        xpc_dictionary_set_bool(reply, "fs_watch_running", watcher.running);
+                        xpc_dictionary_set_uint64(reply, "fs_watch_batches", watcher.batches);
+                        xpc_dictionary_set_uint64(reply, "fs_watch_changes", watcher.changes);
+                        xpc_dictionary_set_uint64(reply, "fs_watch_rescans", watcher.rescans);
+                        
+                        WarmStartStats warm = controller->getWarmStartStats();
+                        xpc_dictionary_set_uint64(reply, "warm_start_loaded", warm.loaded);
+                        xpc_dictionary_set_uint64(reply, "warm_start_restored", warm.restored);
+                        xpc_dictionary_set_uint64(reply, "warm_start_stale", warm.stale);
+                        xpc_dictionary_set_uint64(reply, "processes_discovered", warm.discovered);
+                        xpc_dictionary_set_uint64(reply, "discovery_pending", warm.pending);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "get_auth_latency") == 0) {
+                        xpc_object_t entries = xpc_array_create(nullptr, 0);
+                        for (const auto& stats : controller->getAuthLatencyStats()) {
+                            xpc_object_t entry = xpc_dictionary_create(nullptr, nullptr, 0);
+                            xpc_dictionary_set_int64(entry, "event_type", stats.eventType);
+                            xpc_dictionary_set_uint64(entry, "count", stats.latency.count);
+                            xpc_dictionary_set_uint64(entry, "mean_ns", stats.latency.meanNs);
+                            xpc_dictionary_set_uint64(entry, "p50_ns", stats.latency.p50Ns);
+                            xpc_dictionary_set_uint64(entry, "p99_ns", stats.latency.p99Ns);
+                            xpc_dictionary_set_uint64(entry, "p999_ns", stats.latency.p999Ns);
+                            xpc_dictionary_set_uint64(entry, "max_ns", stats.latency.maxNs);
+                            xpc_array_append_value(entries, entry);
+                            xpc_release(entry);
+                        }
+                        xpc_dictionary_set_value(reply, "auth_latency", entries);
+                        xpc_release(entries);
+                        
+                        AuthCacheStats cacheStats = controller->getAuthCacheStats();
+                        xpc_dictionary_set_uint64(reply, "verdict_cache_hits", cacheStats.hits);
+                        xpc_dictionary_set_uint64(reply, "verdict_cache_misses", cacheStats.misses);
+                        xpc_dictionary_set_uint64(reply, "cacheable_responses", cacheStats.cacheableResponses);
+                        xpc_dictionary_set_uint64(reply, "kernel_cache_clears", cacheStats.kernelCacheClears);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "get_process_changes") == 0) {
+                        // Poll with the returned generation; resync means fetch everything again
+                        uint64_t since = xpc_dictionary_get_uint64(message, "since");
+                        uint64_t generation = 0;
+                        std::vector<ProcessChange> changes;
+                        bool complete = controller->getProcessChanges(since, &changes, &generation);
+                        
+                        xpc_object_t entries = xpc_array_create(nullptr, 0);
+                        for (const auto& change : changes) {
+                            xpc_object_t entry = xpc_dictionary_create(nullptr, nullptr, 0);
+                            xpc_dictionary_set_uint64(entry, "generation", change.generation);
+                            xpc_dictionary_set_int64(entry, "pid", change.pid);
+                            xpc_dictionary_set_string(entry, "change",
+                                                      change.kind == PROCESS_APPEARED ? "appeared" :
+                                                      change.kind == PROCESS_EXITED ? "exited" : "updated");
+                            xpc_array_append_value(entries, entry);
+                            xpc_release(entry);
+                        }
+                        xpc_dictionary_set_value(reply, "changes", entries);
+                        xpc_release(entries);
+                        
+                        xpc_dictionary_set_uint64(reply, "generation", generation);
+                        xpc_dictionary_set_bool(reply, "resync", !complete);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "get_enrichment_stats") == 0) {
+                        std::vector<EnrichmentTierStats> tiers = controller->getEnrichmentStats();
+                        xpc_object_t entries = xpc_array_create(nullptr, 0);
+                        for (size_t tier = 0; tier < tiers.size(); tier++) {
+                            const EnrichmentTierStats& stats = tiers[tier];
+                            xpc_object_t entry = xpc_dictionary_create(nullptr, nullptr, 0);
+                            xpc_dictionary_set_uint64(entry, "tier", tier);
+                            xpc_dictionary_set_uint64(entry, "count", stats.latency.count);
+                            xpc_dictionary_set_uint64(entry, "mean_ns", stats.latency.meanNs);
+                            xpc_dictionary_set_uint64(entry, "p50_ns", stats.latency.p50Ns);
+                            xpc_dictionary_set_uint64(entry, "p99_ns", stats.latency.p99Ns);
+                            xpc_dictionary_set_uint64(entry, "max_ns", stats.latency.maxNs);
+                            xpc_dictionary_set_uint64(entry, "queued", stats.queued);
+                            xpc_dictionary_set_uint64(entry, "completed", stats.completed);
+                            xpc_dictionary_set_uint64(entry, "skipped", stats.skipped);
+                            xpc_dictionary_set_uint64(entry, "dropped", stats.dropped);
+                            xpc_array_append_value(entries, entry);
+                            xpc_release(entry);
+                        }
+                        xpc_dictionary_set_value(reply, "tiers", entries);
+                        xpc_release(entries);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "get_library_set_stats") == 0) {
+                        LibrarySetCacheStats libraryStats = controller->getLibrarySetStats();
+                        xpc_dictionary_set_uint64(reply, "library_sets", libraryStats.sets);
+                        xpc_dictionary_set_uint64(reply, "library_set_keys", libraryStats.keys);
+                        xpc_dictionary_set_uint64(reply, "library_set_hits", libraryStats.hits);
+                        xpc_dictionary_set_uint64(reply, "library_set_misses", libraryStats.misses);
+                        xpc_dictionary_set_uint64(reply, "library_set_uncached", libraryStats.uncached);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "get_process_table_stats") == 0) {
+                        ProcessTableStats tableStats = controller->getProcessTableStats();
+                        xpc_dictionary_set_uint64(reply, "process_table_processes", tableStats.processes);
+                        xpc_dictionary_set_uint64(reply, "process_table_slots", tableStats.slots);
+                        xpc_dictionary_set_uint64(reply, "process_table_tombstones", tableStats.tombstones);
+                        xpc_dictionary_set_uint64(reply, "process_table_resizes", tableStats.resizes);
+                        xpc_dictionary_set_uint64(reply, "process_table_retired", tableStats.retired);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "set_path_rules") == 0) {
+                        // Missing or empty rules restore the built-in set
+                        std::string error;
+                        bool success = false;
+                        if (!peer_is_privileged(connection)) {
+                            error = "not permitted";
+                        } else {
+                            success = controller->setPathRules(xpc_dictionary_get_string(message, "rules"), &error);
+                        }
+                        xpc_dictionary_set_bool(reply, "success", success);
+                        xpc_dictionary_set_uint64(reply, "generation", controller->getPathRulesGeneration());
+                        if (!success) {
+                            xpc_dictionary_set_string(reply, "error", error.c_str());
+                        }
+                        EXT_LOG_DEFAULT(LOG_CATEGORY_XPC, "Set path rules: %{public}s",
+                                        success ? "success" : error.c_str());
+                    }
+                    else if (strcmp(command, "get_recent_file_access") == 0) {
+                        // Served from memory; poll with the returned "next" to get only new entries
+                        uint64_t since = xpc_dictionary_get_uint64(message, "since");
+                        uint64_t limit = xpc_dictionary_get_uint64(message, "limit");
+                        if (limit == 0 || limit > FILE_ACCESS_RING_SLOTS) {
+                            limit = FILE_ACCESS_RING_SLOTS;
+                        }
+                        std::vector<FileAccess> accesses;
+                        uint64_t next = controller->getRecentFileAccess(since, limit, &accesses);
+                        
+                        xpc_object_t entries = xpc_array_create(nullptr, 0);
+                        for (const auto& access : accesses) {
+                            xpc_object_t entry = xpc_dictionary_create(nullptr, nullptr, 0);
+                            xpc_dictionary_set_uint64(entry, "timestamp", access.timestamp);
+                            xpc_dictionary_set_int64(entry, "pid", access.pid);
+                            xpc_dictionary_set_string(entry, "path", access.filePath.c_str());
+                            xpc_dictionary_set_string(entry, "access_type", access.accessType.c_str());
+                            xpc_dictionary_set_bool(entry, "blocked", access.wasBlocked);
+                            xpc_dictionary_set_uint64(entry, "count", access.count);
+                            xpc_dictionary_set_uint64(entry, "last_seen", access.lastSeen);
+                            xpc_dictionary_set_string(entry, "reason", access.reason.c_str());
+                            xpc_array_append_value(entries, entry);
+                            xpc_release(entry);
+                        }
+                        xpc_dictionary_set_value(reply, "accesses", entries);
+                        xpc_release(entries);
+                        xpc_dictionary_set_uint64(reply, "next", next);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "get_snapshot") == 0) {
+                        // Bulk results as one shared mapping instead of an XPC array per row;
+                        // the region is read-only and clients parse it in place (SharedSnapshot.h)
+                        const char* kind = xpc_dictionary_get_string(message, "kind");
+                        std::shared_ptr<const SharedSnapshot> snapshot;
+                        if (kind && strcmp(kind, "processes") == 0) {
+                            snapshot = controller->getProcessSnapshot();
+                        } else if (kind && strcmp(kind, "file_access") == 0) {
+                            snapshot = controller->getFileAccessSnapshot();
+                        }
+                        
+                        xpc_object_t shmem = snapshot ? xpc_shmem_create(snapshot->data(), snapshot->size()) : nullptr;
+                        if (shmem) {
+                            const SnapshotHeader& header = snapshot->header();
+                            xpc_dictionary_set_value(reply, "snapshot", shmem);
+                            xpc_release(shmem);
+                            xpc_dictionary_set_uint64(reply, "version", header.version);
+                            xpc_dictionary_set_uint64(reply, "count", header.count);
+                            xpc_dictionary_set_uint64(reply, "size", header.totalSize);
+                            xpc_dictionary_set_uint64(reply, "generation", header.generation);
+                            xpc_dictionary_set_bool(reply, "success", true);
+                        } else {
+                            xpc_dictionary_set_bool(reply, "success", false);
+                            xpc_dictionary_set_string(reply, "error", snapshot ? "cannot share snapshot" :
+                                                      kind ? "unknown snapshot kind" : "missing snapshot kind");
+                        }
+                    }
+                    else if (strcmp(command, "set_aggregation_window") == 0) {
+                        // 0 logs every file access on its own again
+                        controller->setAggregationWindow(xpc_dictionary_get_uint64(message, "window_ms"));
+                        xpc_dictionary_set_uint64(reply, "window_ms", controller->getAggregationStats().windowMs);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "set_subscription_profile") == 0) {
+                        // minimal, devices-only or forensic
+                        std::string error;
+                        bool success = controller->setSubscriptionProfile(xpc_dictionary_get_string(message, "profile"), &error);
+                        xpc_dictionary_set_bool(reply, "success", success);
+                        xpc_dictionary_set_string(reply, "profile", controller->getSubscriptionStats().profile);
+                        if (!success) {
+                            xpc_dictionary_set_string(reply, "error", error.c_str());
+                        }
+                    }
+                    else if (strcmp(command, "set_retention") == 0) {
+                        // Days to keep for one table; 0 keeps everything
+                        std::string error;
+                        bool success = controller->setRetention(xpc_dictionary_get_string(message, "table"),
+                                                                (int)xpc_dictionary_get_int64(message, "days"), &error);
+                        xpc_dictionary_set_bool(reply, "success", success);
+                        if (!success) {
+                            xpc_dictionary_set_string(reply, "error", error.c_str());
+                        }
+                        EXT_LOG_DEFAULT(LOG_CATEGORY_XPC, "Set retention: %{public}s",
+                                        success ? "success" : error.c_str());
+                    }
+                    else if (strcmp(command, "get_retention") == 0) {
+                        xpc_object_t entries = xpc_array_create(nullptr, 0);
+                        for (const auto& setting : controller->getRetention()) {
+                            xpc_object_t entry = xpc_dictionary_create(nullptr, nullptr, 0);
+                            xpc_dictionary_set_string(entry, "table", setting.table.c_str());
+                            xpc_dictionary_set_int64(entry, "days", setting.days);
+                            xpc_dictionary_set_uint64(entry, "partitions", setting.partitions);
+                            xpc_dictionary_set_uint64(entry, "oldest_day", setting.oldestDay);
+                            xpc_array_append_value(entries, entry);
+                            xpc_release(entry);
+                        }
+                        xpc_dictionary_set_value(reply, "retention", entries);
+                        xpc_release(entries);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "search") == 0) {
+                        // kinds is a SEARCH_* mask, 0 for all; limit defaults to 50
+                        uint64_t limit = xpc_dictionary_get_uint64(message, "limit");
+                        std::vector<SearchMatch> matches;
+                        std::string error;
+                        bool success = controller->searchHistory(xpc_dictionary_get_string(message, "term"),
+                                                                 (uint32_t)xpc_dictionary_get_uint64(message, "kinds"),
+                                                                 limit ? (size_t)limit : 50, &matches, &error);
+                        
+                        xpc_object_t entries = xpc_array_create(nullptr, 0);
+                        for (const auto& match : matches) {
+                            xpc_object_t entry = xpc_dictionary_create(nullptr, nullptr, 0);
+                            xpc_dictionary_set_string(entry, "value", match.value.c_str());
+                            xpc_dictionary_set_uint64(entry, "kinds", match.kinds);
+                            xpc_dictionary_set_uint64(entry, "last_seen", match.lastSeen);
+                            xpc_dictionary_set_int64(entry, "last_pid", match.lastPid);
+                            xpc_dictionary_set_uint64(entry, "uses", match.uses);
+                            xpc_array_append_value(entries, entry);
+                            xpc_release(entry);
+                        }
+                        xpc_dictionary_set_value(reply, "matches", entries);
+                        xpc_release(entries);
+                        xpc_dictionary_set_bool(reply, "success", success);
+                        if (!success) {
+                            xpc_dictionary_set_string(reply, "error", error.c_str());
+                        }
+                    }
+                    else if (strcmp(command, "get_rollups") == 0) {
+                        // resolution: minute, hour or total (default); dimension: table (default),
+                        // event_type, executable or pid; since: epoch seconds; series: one entry per bucket
+                        int resolution;
+                        RollupDimension dimension = ROLLUP_BY_TABLE;
+                        const char* dimensionName = xpc_dictionary_get_string(message, "dimension");
+                        std::vector<RollupEntry> entries;
+                        std::string error;
+                        bool success = false;
+                        if (!parseRollupResolution(xpc_dictionary_get_string(message, "resolution"), &resolution)) {
+                            error = "unknown resolution";
+                        } else if (dimensionName && !parseRollupDimension(dimensionName, &dimension)) {
+                            error = "unknown dimension";
+                        } else {
+                            success = controller->getRollups(resolution, dimension,
+                                                             xpc_dictionary_get_int64(message, "since"),
+                                                             xpc_dictionary_get_bool(message, "series"),
+                                                             (size_t)xpc_dictionary_get_uint64(message, "limit"),
+                                                             &entries, &error);
+                        }
+                        
+                        xpc_object_t rollups = xpc_array_create(nullptr, 0);
+                        for (const auto& entry : entries) {
+                            xpc_object_t item = xpc_dictionary_create(nullptr, nullptr, 0);
+                            xpc_dictionary_set_int64(item, "bucket", entry.bucket);
+                            xpc_dictionary_set_int64(item, "key", entry.key);
+                            xpc_dictionary_set_string(item, "name", entry.name.c_str());
+                            xpc_dictionary_set_uint64(item, "events", entry.events);
+                            xpc_dictionary_set_uint64(item, "blocked", entry.blocked);
+                            xpc_array_append_value(rollups, item);
+                            xpc_release(item);
+                        }
+                        xpc_dictionary_set_value(reply, "rollups", rollups);
+                        xpc_release(rollups);
+                        xpc_dictionary_set_bool(reply, "success", success);
+                        if (!success) {
+                            xpc_dictionary_set_string(reply, "error", error.c_str());
+                        }
+                    }
+                    else if (strcmp(command, "start_trace") == 0 || strcmp(command, "stop_trace") == 0 ||
+                             strcmp(command, "get_trace_stats") == 0) {
+                        // Traces go to EVENT_TRACE_DIR under a name we pick; a client can't
+                        // choose what the extension creates as root. They replay with avbench
+                        std::string error;
+                        bool success = true;
+                        EventTraceStats stats;
+                        if (strcmp(command, "start_trace") == 0) {
+                            success = controller->startEventTrace(&error);
+                            stats = controller->getEventTraceStats();
+                        } else if (strcmp(command, "stop_trace") == 0) {
+                            stats = controller->stopEventTrace();
+                        } else {
+                            stats = controller->getEventTraceStats();
+                        }
+                        xpc_dictionary_set_bool(reply, "recording", stats.recording);
+                        xpc_dictionary_set_string(reply, "path", stats.path.c_str());
+                        xpc_dictionary_set_uint64(reply, "events", stats.events);
+                        xpc_dictionary_set_uint64(reply, "bytes", stats.bytes);
+                        xpc_dictionary_set_uint64(reply, "strings", stats.strings);
+                        xpc_dictionary_set_uint64(reply, "dropped", stats.dropped);
+                        xpc_dictionary_set_bool(reply, "success", success);
+                        if (!success) {
+                            xpc_dictionary_set_string(reply, "error", error.c_str());
+                        }
+                        EXT_LOG_DEFAULT(LOG_CATEGORY_XPC, "%{public}s: %{public}s",
+                                        command, success ? "success" : error.c_str());
+                    }
+                    else if (strcmp(command, "get_network_stats") == 0) {
+                        NetworkSamplerStats stats = controller->getNetworkSamplerStats();
+                        xpc_dictionary_set_uint64(reply, "samples", stats.samples);
+                        xpc_dictionary_set_uint64(reply, "connections", stats.connections);
+                        xpc_dictionary_set_uint64(reply, "opened", stats.opened);
+                        xpc_dictionary_set_uint64(reply, "closed", stats.closed);
+                        xpc_dictionary_set_uint64(reply, "state_changes", stats.stateChanges);
+                        xpc_dictionary_set_uint64(reply, "interval_ms", stats.intervalMs);
+                        xpc_dictionary_set_uint64(reply, "last_sample_ns", stats.lastSampleNs);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "get_subscription_profile") == 0) {
+                        SubscriptionStats stats = controller->getSubscriptionStats();
+                        xpc_dictionary_set_string(reply, "profile", stats.profile);
+                        xpc_dictionary_set_uint64(reply, "event_types", stats.eventTypes);
+                        xpc_dictionary_set_uint64(reply, "muted_paths", stats.mutedPaths);
+                        xpc_dictionary_set_uint64(reply, "mute_failures", stats.muteFailures);
+                        xpc_dictionary_set_uint64(reply, "switches", stats.switches);
+                        
+                        xpc_object_t profiles = xpc_array_create(nullptr, 0);
+                        for (int i = 0; i < SUBSCRIPTION_PROFILE_COUNT; i++) {
+                            xpc_array_set_string(profiles, XPC_ARRAY_APPEND, subscriptionProfileSpec((SubscriptionProfile)i).name);
+                        }
+                        xpc_dictionary_set_value(reply, "profiles", profiles);
+                        xpc_release(profiles);
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "get_path_rules") == 0) {
+                        xpc_dictionary_set_string(reply, "rules", controller->getPathRules().c_str());
+                        xpc_dictionary_set_uint64(reply, "generation", controller->getPathRulesGeneration());
+                        xpc_dictionary_set_bool(reply, "success", true);
+                    }
+                    else if (strcmp(command, "subscribe_events") == 0) {
+                        // Filtered before anything is queued; subscribing again replaces the filter
+                        EventFilter filter;
+                        filter.types = 0;
+                        filter.pid = (pid_t)xpc_dictionary_get_int64(message, "pid");
+                        const char* prefix = xpc_dictionary_get_string(message, "path_prefix");
+                        if (prefix) {
+                            filter.pathPrefix = prefix;
+                        }
+                        
+                        const char* badType = nullptr;
+                        xpc_object_t types = xpc_dictionary_get_value(message, "types");
+                        if (types && xpc_get_type(types) == XPC_TYPE_ARRAY) {
+                            for (size_t i = 0; i < xpc_array_get_count(types) && !badType; i++) {
+                                const char* name = xpc_array_get_string(types, i);
+                                StreamEventType type;
+                                if (parseStreamEventType(name, &type)) {
+                                    filter.types |= 1u << type;
+                                } else {
+                                    badType = name ? name : "(none)";
+                                }
+                            }
+                        }
+                        
+                        if (subscription) {
+                            controller->unsubscribeEvents(subscription);
+                            subscription = 0;
+                        }
+                        
+                        if (!peer_is_privileged(connection)) {
+                            xpc_dictionary_set_bool(reply, "success", false);
+                            xpc_dictionary_set_string(reply, "error", "not permitted");
+                        } else if (badType) {
+                            std::string error = std::string("unknown event type: ") + badType;
+                            xpc_dictionary_set_bool(reply, "success", false);
+                            xpc_dictionary_set_string(reply, "error", error.c_str());
+                        } else {
+                            // The sink owns a reference; the stream drops it when the client is gone
+                            xpc_retain(connection);
+                            std::shared_ptr<void> peer((void*)connection, [](void* held) {
+                                xpc_release((xpc_connection_t)held);
+                            });
+                            subscription = controller->subscribeEvents(filter,
+                                [peer](uint64_t client, const StreamEvent* events, size_t count, uint64_t dropped) {
+                                    send_event_batch((xpc_connection_t)peer.get(), client, events, count, dropped);
+                                });
+                            
+                            xpc_dictionary_set_bool(reply, "success", subscription != 0);
+                            if (subscription) {
+                                xpc_dictionary_set_uint64(reply, "subscription", subscription);
+                                xpc_dictionary_set_uint64(reply, "queue_capacity", EVENT_STREAM_CLIENT_QUEUE);
+                            } else {
+                                xpc_dictionary_set_string(reply, "error", "too many subscribers");
+                            }
+                        }
+                    }
+                    else if (strcmp(command, "unsubscribe_events") == 0) {
+                        bool success = subscription && controller->unsubscribeEvents(subscription);
+                        subscription = 0;
+                        xpc_dictionary_set_bool(reply, "success", success);
                     }
                     else {
-                        syslog(LOG_ERR, "Unknown command received: %s", command);
+                        EXT_LOG_ERROR(LOG_CATEGORY_XPC, "Unknown command %{public}s", command);
                         xpc_dictionary_set_bool(reply, "success", false);
                         xpc_dictionary_set_string(reply, "error", "Unknown command");
                     }
@@ -103,6 +845,18 @@ int main(int argc, const char * argv[]) {
         
         xpc_connection_resume(listener);
         
+        // launchd stops the extension with SIGTERM; shutting down properly commits
+        // the last rows and saves the process table for the next launch
+        signal(SIGTERM, SIG_IGN);
+        dispatch_source_t terminate = dispatch_source_create(DISPATCH_SOURCE_TYPE_SIGNAL, SIGTERM, 0,
+                                                             dispatch_get_main_queue());
+        dispatch_source_set_event_handler(terminate, ^{
+            syslog(LOG_INFO, "AudioVideoMonitor System Extension stopping");
+            controller->cleanup();
+            exit(0);
+        });
+        dispatch_resume(terminate);
+        
         syslog(LOG_INFO, "AudioVideoMonitor System Extension ready and listening");
         NSLog(@"AudioVideoMonitor System Extension ready and listening");
         
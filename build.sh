@@ -72,6 +72,7 @@ clang++ -o "$SYSEXT_BUNDLE/Contents/MacOS/AudioVideoMonitor" \
     -lEndpointSecurity \
     -framework IOKit \
     -framework CoreFoundation \
+    -framework CoreServices \
     -framework Security \
     -lbsm \
     -lsqlite3 \
@@ -139,17 +140,63 @@ swiftc -o "$BUILD_DIR/systemmonitor" \
     -target arm64-apple-macos10.15 \
     -target x86_64-apple-macos10.15
 
-# Compile system cleanup CLI
+# Compile system cleanup CLI with the extension's directory scanner and
+# process list; the C++ is compiled per architecture and linked in
+SCAN_OBJECTS="$BUILD_DIR/systemscan"
+mkdir -p "$SCAN_OBJECTS"
+for source in SystemScan DirectoryScanner ProcessTracker; do
+    clang++ -c "$PROJECT_ROOT/SystemExtension/$source.cpp" \
+        -o "$SCAN_OBJECTS/$source.o" \
+        -std=c++17 \
+        -arch arm64 \
+        -arch x86_64 \
+        -mmacosx-version-min=10.15 \
+        -O2
+done
+
 swiftc -o "$BUILD_DIR/systemcleanup" \
     systemcleanup.swift \
+    "$SCAN_OBJECTS"/*.o \
+    -import-objc-header "$PROJECT_ROOT/SystemExtension/SystemScan.h" \
     -framework Foundation \
     -framework OSLog \
+    -framework CoreServices \
     -lsqlite3 \
+    -lc++ \
+    -lproc \
     -target arm64-apple-macos10.15 \
     -target x86_64-apple-macos10.15
 
 echo -e "${GREEN}✅ Enhanced CLI Tools built successfully${NC}"
 
+# Build the replay benchmark
+echo -e "${YELLOW}🔧 Building avbench...${NC}"
+cd "$PROJECT_ROOT/Benchmarks"
+
+# The extension's sources without main.mm or libEndpointSecurity: the ES,
+# libproc and sysctl calls are answered by ReplayHarness.cpp, and the
+# database and warm-start snapshot go to the scratch directory avbench runs in
+clang++ -o "$BUILD_DIR/avbench" \
+    *.cpp ../SystemExtension/*.cpp \
+    -I../SystemExtension \
+    -framework IOKit \
+    -framework CoreFoundation \
+    -framework CoreServices \
+    -framework Security \
+    -lbsm \
+    -lsqlite3 \
+    -lpthread \
+    -std=c++17 \
+    -arch arm64 \
+    -arch x86_64 \
+    -mmacosx-version-min=10.15 \
+    -O2 \
+    -DDATABASE_PATH='"replay.db"' \
+    -DEVENT_JOURNAL_DIR='"replay.journal"' \
+    -DWARM_START_PATH='"replay.warm"'
+
+echo -e "${GREEN}✅ avbench built successfully${NC}"
+
 # Code Signing (if team ID is set)
 if [ "$TEAM_ID" != "YOURTEAMID" ]; then
     echo -e "${YELLOW}🔐 Code signing applications...${NC}"
@@ -310,6 +357,7 @@ echo -e "${NC}"
 echo "📁 Built files:"
 echo "  • App Bundle:    $APP_BUNDLE"
 echo "  • CLI Tool:      $BUILD_DIR/avcontrol"
+echo "  • Benchmark:     $BUILD_DIR/avbench"
 echo "  • Distribution:  $DIST_DIR/"
 echo "  • ZIP Package:   $DIST_DIR/AudioVideoMonitor-v1.0.zip"
 echo ""